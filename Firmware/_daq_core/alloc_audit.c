@@ -0,0 +1,190 @@
+/*
+ *
+ * Description :
+ * Heap allocation audit of the steady state processing loops
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+#include "log.h"
+#include "alloc_audit.h"
+
+#define MAX_CALL_SITES 16
+#define TRACE_DEPTH    8
+
+static struct
+{
+    int warmup_frames; // 0: audit disabled
+    const char* stage;
+    size_t alloc_cnt;
+    void* call_sites[MAX_CALL_SITES];
+    size_t call_site_cnt[MAX_CALL_SITES];
+    void* traces[MAX_CALL_SITES][TRACE_DEPTH]; // Stack of the first allocation of the call site
+    int trace_depth[MAX_CALL_SITES];
+} audit;
+
+static __thread int thr_frames;
+static __thread int thr_steady;
+static __thread int thr_in_audit;
+
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+/* Without the audit the wrappers forward directly to the glibc allocator */
+#define AUDIT_ENABLED __builtin_expect(audit.warmup_frames != 0, 0)
+
+static void count_alloc(void* call_site)
+/*
+ * Called by the allocations of the process when the audit is enabled, it must
+ * not allocate itself
+ */
+{
+    if (!thr_steady || thr_in_audit) {return;}
+    thr_in_audit = 1;
+    __atomic_add_fetch(&audit.alloc_cnt, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < MAX_CALL_SITES; i++)
+    {
+        void* expected = NULL;
+        if (__atomic_compare_exchange_n(&audit.call_sites[i], &expected, call_site, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            audit.trace_depth[i] = backtrace(audit.traces[i], TRACE_DEPTH);
+            __atomic_add_fetch(&audit.call_site_cnt[i], 1, __ATOMIC_RELAXED);
+            break;
+        }
+        if (expected == call_site)
+        {
+            __atomic_add_fetch(&audit.call_site_cnt[i], 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    thr_in_audit = 0;
+}
+
+void* malloc(size_t size)
+{
+    if (AUDIT_ENABLED) {count_alloc(__builtin_return_address(0));}
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    if (AUDIT_ENABLED) {count_alloc(__builtin_return_address(0));}
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (AUDIT_ENABLED) {count_alloc(__builtin_return_address(0));}
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    if (AUDIT_ENABLED) {count_alloc(__builtin_return_address(0));}
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (AUDIT_ENABLED) {count_alloc(__builtin_return_address(0));}
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (AUDIT_ENABLED) {count_alloc(__builtin_return_address(0));}
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment-1)) != 0) {return EINVAL;}
+    void* ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) {return ENOMEM;}
+    *memptr = ptr;
+    return 0;
+}
+#endif
+
+void alloc_audit_init(const char* stage)
+/*
+ * Enables the audit when it is requested in the environment
+ */
+{
+    const char* requested = getenv(ALLOC_AUDIT_ENV);
+    if (requested == NULL || atoi(requested) <= 0) {return;}
+#ifdef __GLIBC__
+    /* The first backtrace call loads the unwinder, it must not happen in the steady state */
+    void* trace[TRACE_DEPTH];
+    backtrace(trace, TRACE_DEPTH);
+    audit.warmup_frames = atoi(requested);
+    audit.stage = stage;
+    log_info("Allocation audit enabled, warm-up frames: %d", audit.warmup_frames);
+#else
+    log_warn("Allocation audit is only available with glibc");
+#endif
+}
+
+void alloc_audit_frame_end(void)
+/*
+ * Counts the frames of the calling thread, its allocations are audited after
+ * the warm-up frames
+ */
+{
+    if (audit.warmup_frames == 0 || thr_steady) {return;}
+    if (++thr_frames >= audit.warmup_frames) {thr_steady = 1;}
+}
+
+int alloc_audit_report(void)
+/*
+ * Logs the allocations of the steady state, called at the exit of the stage
+ *
+ * Return values:
+ * --------------
+ *       0: No allocation in the steady state or the audit is disabled
+ *      -1: The steady state allocated
+ */
+{
+    if (audit.warmup_frames == 0) {return 0;}
+    thr_steady = 0;
+    size_t alloc_cnt = __atomic_load_n(&audit.alloc_cnt, __ATOMIC_RELAXED);
+    if (thr_frames < audit.warmup_frames)
+        {log_warn("Allocation audit [%s]: the stage exited in the warm-up, %d frames", audit.stage, thr_frames);}
+    if (alloc_cnt == 0)
+    {
+        log_info("Allocation audit [%s]: no allocation in the steady state", audit.stage);
+        return 0;
+    }
+    log_error("Allocation audit [%s]: %zu allocations in the steady state", audit.stage, alloc_cnt);
+#ifdef __GLIBC__
+    for (int i = 0; i < MAX_CALL_SITES && audit.call_sites[i] != NULL; i++)
+    {
+        log_error("Allocation audit [%s]: %zu allocations from:", audit.stage, audit.call_site_cnt[i]);
+        backtrace_symbols_fd(audit.traces[i], audit.trace_depth[i], STDERR_FILENO);
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,49 @@
+/*
+ *
+ * Description :
+ * Heap allocation audit of the steady state processing loops
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ALLOC_AUDIT_H
+#define ALLOC_AUDIT_H
+
+#define ALLOC_AUDIT_ENV "HDAQ_ALLOC_AUDIT"
+
+/*
+ * The processing loops of the stages do not allocate after their first frames,
+ * every buffer is allocated during the initialization. The audit checks this:
+ * when HDAQ_ALLOC_AUDIT=<n> is set, the heap allocations (malloc, calloc,
+ * realloc and the aligned variants, including the ones made by libc and the
+ * linked libraries) of a processing thread are counted after its first n
+ * frames. At exit the number of the allocations and the call stacks of their
+ * call sites are logged, and the stage exits with an error when the steady
+ * state allocated.
+ *
+ * The allocator functions are interposed with glibc's __libc_* entry points,
+ * on other C libraries the audit is not available. When HDAQ_ALLOC_AUDIT is
+ * not set, the interposed functions forward directly to glibc.
+ */
+void alloc_audit_init(const char* stage);
+void alloc_audit_frame_end(void);
+int  alloc_audit_report(void);
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ *
+ * Description :
+ * Offline batch processor of recorded raw IQ captures
+ *
+ * Re-processes raw (cu8) IQ frame captures with the decimation, filter and IQ
+ * correction settings given on the command line, without replaying them through
+ * the live chain. A capture file is a sequence of IQ frames (1024 byte header,
+ * per-channel metadata of large arrays and the payload) as written by the IQ
+ * recorders, the output files use
+ * the same format with the frames converted the way the decimator stage does.
+ *
+ * The frames of all the input files are split into chunks that are processed in
+ * parallel by a pool of worker threads. The filter state at the start of every
+ * chunk is restored from the preceding data frame of the capture, so the output
+ * does not depend on the chunking or on the number of threads.
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "iq_header.h"
+#include "daq_config.h"
+#include "hdaq_simd.h"
+
+#define INI_FNAME "daq_chain_config.ini"
+#define FIR_COEFF "_data_control/fir_coeffs.txt"
+#define CHUNK_SIZE (8*1024*1024) // Input bytes processed by a worker at once
+#define PROGRESS_INTERVAL_MS 1000
+
+struct frame_info
+{
+    off_t in_offset;
+    off_t out_offset;
+    uint32_t frame_type;
+    uint32_t ch_no;
+    uint32_t meta_length; // Per-channel metadata following the header
+    struct iq_ch_mask ch_mask; // Receiver channels of the payload slots
+    uint32_t cpi_length; // Input samples per channel
+    size_t in_payload;
+    size_t out_payload;
+};
+
+struct capture
+{
+    const char* in_fname;
+    char out_fname[PATH_MAX];
+    int in_fd;
+    int out_fd;
+    struct frame_info* frames;
+    size_t frame_cnt;
+    size_t first; // Processed frame range
+    size_t count;
+};
+
+struct chunk
+{
+    int capture;
+    size_t first;
+    size_t count;
+};
+
+struct batch
+{
+    /* Processing parameters */
+    int dec;
+    bool filter_reset;
+    float* coeffs;
+    size_t tap_size;
+    float* corrections; // Complex IQ correction coefficients of the channels, NULL if disabled
+    size_t corr_cnt;
+
+    struct capture* captures;
+    int capture_cnt;
+    struct chunk* chunks;
+    size_t chunk_cnt;
+
+    /* Buffer sizes required by the largest frame */
+    size_t max_ch;
+    size_t max_meta_length;
+    size_t max_cpi_length;
+    size_t max_in_payload;
+    size_t max_out_payload;
+
+    /* Shared between the worker threads, accessed atomically */
+    size_t next_chunk;
+    size_t frames_done;
+    uint64_t bytes_done;
+    uint64_t samples_done;
+    int error;
+};
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] capture_file [capture_file ..]\n"
+        "  -c <file>   DAQ chain configuration file (default: %s)\n"
+        "  -d <ratio>  Decimation ratio (default: decimation_ratio of the configuration)\n"
+        "  -f <file>   FIR filter coefficient file (default: %s)\n"
+        "  -q <file>   IQ correction file, one \"real imag\" coefficient line per channel\n"
+        "  -s <frame>  Index of the first frame to process in every capture (default: 0)\n"
+        "  -n <count>  Number of frames to process in every capture (default: all)\n"
+        "  -j <count>  Number of worker threads (default: number of CPU cores)\n"
+        "  -o <dir>    Output directory (default: .)\n"
+        "  -v          Print progress and throughput reports\n",
+        name, INI_FNAME, FIR_COEFF);
+}
+
+static double elapsed_s(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static float* read_values(const char* fname, size_t* cnt)
+/*
+ * Reads the whitespace separated float values of a text file
+ */
+{
+    FILE* fd = fopen(fname, "r");
+    if (fd == NULL) {return NULL;}
+    size_t size = 256;
+    float* values = malloc(size * sizeof(float));
+    *cnt = 0;
+    while (values != NULL && fscanf(fd, "%f", &values[*cnt]) == 1)
+    {
+        if (++(*cnt) == size)
+        {
+            size *= 2;
+            float* tmp = realloc(values, size * sizeof(float));
+            if (tmp == NULL) {free(values);}
+            values = tmp;
+        }
+    }
+    fclose(fd);
+    return values;
+}
+
+static size_t out_cpi_length(const struct batch* b, const struct frame_info* f)
+{
+    if (f->frame_type == FRAME_TYPE_DATA && b->dec > 1)
+        return f->cpi_length / b->dec;
+    return f->cpi_length;
+}
+
+static int index_capture(struct batch* b, struct capture* cap)
+/*
+ * Builds the frame table of the capture file and the layout of the output file
+ *
+ * Returns 0 on success, -1 on failure
+ */
+{
+    /* Header and per-channel metadata */
+    union {struct iq_header_struct hdr; uint8_t bytes[IQ_HEADER_LENGTH + IQ_CH_META_MAX_LENGTH];} frame_head;
+    struct iq_header_struct* hdr = &frame_head.hdr;
+    struct iq_ch_mask ch_mask;
+    char mask_str[IQ_MAX_CH/4+3];
+    struct stat st;
+    size_t size = 1024;
+    off_t offset = 0;
+
+    if (fstat(cap->in_fd, &st) != 0) {return -1;}
+    cap->frames = malloc(size * sizeof(struct frame_info));
+    cap->frame_cnt = 0;
+    while (cap->frames != NULL && offset + IQ_HEADER_LENGTH <= st.st_size)
+    {
+        if (pread(cap->in_fd, hdr, sizeof(*hdr), offset) != sizeof(*hdr)) {return -1;}
+        if (check_sync_word(hdr) != 0 || iq_header_check_ch_meta(hdr) != 0)
+        {
+            log_error("Invalid IQ header in %s at byte %lld", cap->in_fname, (long long) offset);
+            return -1;
+        }
+        size_t meta_length = hdr->ch_meta_length;
+        if (meta_length > 0 && pread(cap->in_fd, frame_head.bytes + IQ_HEADER_LENGTH, meta_length,
+                                     offset + IQ_HEADER_LENGTH) != (ssize_t) meta_length) {return -1;}
+        iq_header_get_ch_mask(hdr, &ch_mask);
+        if (iq_ch_mask_cnt(&ch_mask) != (int) hdr->active_ant_chs)
+        {
+            log_error("Channel mask %s does not match the channel number %u in %s at byte %lld",
+                      iq_ch_mask_str(&ch_mask, mask_str, sizeof(mask_str)), hdr->active_ant_chs, cap->in_fname, (long long) offset);
+            return -1;
+        }
+        size_t payload = (size_t) hdr->cpi_length * hdr->active_ant_chs * 2 * (hdr->sample_bit_depth / 8);
+        if (payload > 0 && hdr->sample_bit_depth != 8)
+        {
+            log_error("%s is not a raw capture, sample bit depth: %u", cap->in_fname, hdr->sample_bit_depth);
+            return -1;
+        }
+        if (offset + IQ_HEADER_LENGTH + (off_t) (meta_length + payload) > st.st_size)
+        {
+            log_warn("Truncated frame at the end of %s is skipped", cap->in_fname);
+            break;
+        }
+        if (cap->frame_cnt == size)
+        {
+            size *= 2;
+            struct frame_info* tmp = realloc(cap->frames, size * sizeof(struct frame_info));
+            if (tmp == NULL) {return -1;}
+            cap->frames = tmp;
+        }
+        struct frame_info* f = &cap->frames[cap->frame_cnt++];
+        f->in_offset = offset;
+        f->frame_type = hdr->frame_type;
+        f->ch_no = hdr->active_ant_chs;
+        f->meta_length = meta_length;
+        f->ch_mask = ch_mask;
+        f->cpi_length = hdr->cpi_length;
+        f->in_payload = payload;
+        f->out_payload = payload ? out_cpi_length(b, f) * f->ch_no * 2 * sizeof(float) : 0;
+        offset += IQ_HEADER_LENGTH + meta_length + payload;
+    }
+    if (cap->frames == NULL) {return -1;}
+
+    if (cap->first > cap->frame_cnt) {cap->first = cap->frame_cnt;}
+    if (cap->count > cap->frame_cnt - cap->first) {cap->count = cap->frame_cnt - cap->first;}
+
+    off_t out_offset = 0;
+    for (size_t i = cap->first; i < cap->first + cap->count; i++)
+    {
+        struct frame_info* f = &cap->frames[i];
+        f->out_offset = out_offset;
+        out_offset += IQ_HEADER_LENGTH + f->meta_length + f->out_payload;
+        size_t ch_end = iq_ch_mask_end(&f->ch_mask); // States and corrections are kept per receiver channel
+        if (ch_end > b->max_ch) {b->max_ch = ch_end;}
+        if (f->meta_length > b->max_meta_length) {b->max_meta_length = f->meta_length;}
+        if (f->cpi_length > b->max_cpi_length) {b->max_cpi_length = f->cpi_length;}
+        if (f->in_payload > b->max_in_payload) {b->max_in_payload = f->in_payload;}
+        if (f->out_payload > b->max_out_payload) {b->max_out_payload = f->out_payload;}
+    }
+    /* Sizing the output file up front lets the workers write their frames in any order */
+    if (ftruncate(cap->out_fd, out_offset) != 0) {return -1;}
+    return 0;
+}
+
+/*
+ *-------------------------------------
+ *  Worker threads
+ *-------------------------------------
+ */
+struct worker_buffers
+{
+    uint8_t* in;    // Header and raw payload of the input frame
+    float* out;     // Header and converted payload of the output frame
+    float* conv;    // Converted samples of one channel
+    float* states;  // Filter states of the channels
+    struct iq_ch_mask last_ch_mask; // Channel mask of the last filtered frame
+};
+
+static void prime_states(struct batch* b, struct capture* cap, size_t first, struct worker_buffers* w)
+/*
+ * Restores the filter states at the given frame from the end of the preceding
+ * data frame, the decimator stage keeps the states over the calibration frames.
+ */
+{
+    size_t hist = b->tap_size - 1;
+    memset(w->states, 0, b->max_ch * hist * 2 * sizeof(float));
+    iq_ch_mask_all(&w->last_ch_mask, 0);
+    if (b->filter_reset || b->dec == 1 || hist == 0) {return;}
+
+    for (size_t i = first; i-- > 0;)
+    {
+        struct frame_info* f = &cap->frames[i];
+        if (f->frame_type != FRAME_TYPE_DATA || f->in_payload == 0) {continue;}
+
+        size_t end = (f->cpi_length / b->dec) * b->dec; // Processed input samples of the frame
+        size_t tail = end < hist ? end : hist;
+        w->last_ch_mask = f->ch_mask;
+        int ch = -1;
+        for (size_t slot = 0; slot < f->ch_no; slot++)
+        {
+            ch = iq_ch_mask_next(&f->ch_mask, ch);
+            if (ch >= (int) b->max_ch) {break;}
+            off_t offset = f->in_offset + IQ_HEADER_LENGTH + f->meta_length + 2 * ((off_t) slot * f->cpi_length + end - tail);
+            if (pread(cap->in_fd, w->in, 2 * tail, offset) != (ssize_t) (2 * tail))
+            {
+                log_error("Failed to read %s", cap->in_fname);
+                __atomic_store_n(&b->error, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            hdaq_cu8_to_cf32(w->in, w->states + 2 * (ch * hist + hist - tail), 2 * tail);
+        }
+        return;
+    }
+}
+
+static int process_frame(struct batch* b, struct capture* cap, size_t index, struct worker_buffers* w)
+{
+    struct frame_info* f = &cap->frames[index];
+    size_t head_size = IQ_HEADER_LENGTH + f->meta_length;
+    size_t in_size = head_size + f->in_payload;
+    if (pread(cap->in_fd, w->in, in_size, f->in_offset) != (ssize_t) in_size)
+    {
+        log_error("Failed to read %s", cap->in_fname);
+        return -1;
+    }
+
+    /* Header fields are updated as in the decimator stage */
+    struct iq_header_struct* iq_header = (struct iq_header_struct*) w->out;
+    memcpy(iq_header, w->in, head_size);
+    iq_header->data_type = 3; // Data type is decimated IQ
+    iq_header->sample_bit_depth = 32; // Complex float 32
+    iq_header->cpi_index = index - cap->first;
+
+    const uint8_t* in = w->in + head_size;
+    float* out = w->out + head_size / sizeof(float);
+    size_t n_out = out_cpi_length(b, f);
+    size_t hist = b->tap_size - 1;
+    if (f->frame_type == FRAME_TYPE_DATA && b->dec > 1)
+    {
+        iq_header->sampling_freq = iq_header->adc_sampling_freq / (uint64_t) b->dec;
+        iq_header->cpi_length = (uint32_t) n_out;
+        iq_header->first_sample_index += (uint64_t) (b->dec - 1) * iq_header->sample_index_step;
+        iq_header->sample_index_step *= (uint32_t) b->dec;
+
+        /* Re-enabled channels do not continue from their samples before the mask change, as in the decimator */
+        if (b->filter_reset || !iq_ch_mask_equal(&f->ch_mask, &w->last_ch_mask)) {memset(w->states, 0, b->max_ch * hist * 2 * sizeof(float));}
+        w->last_ch_mask = f->ch_mask;
+        int ch = -1;
+        for (size_t slot = 0; slot < f->ch_no && n_out > 0; slot++)
+        {
+            ch = iq_ch_mask_next(&f->ch_mask, ch);
+            hdaq_cu8_to_cf32(in + 2 * slot * f->cpi_length, w->conv, 2 * n_out * b->dec);
+            hdaq_cf32_fir_decimate(w->conv, out + 2 * slot * n_out, n_out * b->dec, b->coeffs, b->tap_size, b->dec,
+                                   w->states + 2 * ch * hist);
+        }
+    }
+    else
+    {
+        iq_header->sampling_freq = iq_header->adc_sampling_freq;
+        hdaq_cu8_to_cf32(in, out, f->in_payload);
+    }
+
+    /* DC removal and IQ correction as in the delay synchronizer */
+    if (b->corrections != NULL)
+    {
+        int ch = -1;
+        for (size_t slot = 0; slot < f->ch_no && n_out > 0; slot++)
+        {
+            float mean[2];
+            ch = iq_ch_mask_next(&f->ch_mask, ch);
+            hdaq_cf32_mean(out + 2 * slot * n_out, n_out, mean);
+            hdaq_cf32_scale(out + 2 * slot * n_out, out + 2 * slot * n_out, n_out, mean, b->corrections + 2 * ch);
+        }
+    }
+
+    size_t out_size = head_size + f->out_payload;
+    if (pwrite(cap->out_fd, w->out, out_size, f->out_offset) != (ssize_t) out_size)
+    {
+        log_error("Failed to write %s", cap->out_fname);
+        return -1;
+    }
+    __atomic_add_fetch(&b->frames_done, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&b->bytes_done, in_size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&b->samples_done, (uint64_t) f->cpi_length * f->ch_no, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void* worker(void* arg)
+{
+    struct batch* b = arg;
+    struct worker_buffers w;
+    size_t hist = b->tap_size - 1;
+    w.in = malloc(IQ_HEADER_LENGTH + b->max_meta_length + b->max_in_payload);
+    w.out = malloc(IQ_HEADER_LENGTH + b->max_meta_length + b->max_out_payload);
+    w.conv = malloc((b->max_cpi_length + 1) * 2 * sizeof(float));
+    w.states = malloc((b->max_ch * hist + 1) * 2 * sizeof(float));
+    if (w.in == NULL || w.out == NULL || w.conv == NULL || w.states == NULL)
+    {
+        log_error("Malloc failed");
+        __atomic_store_n(&b->error, 1, __ATOMIC_RELAXED);
+    }
+
+    while (!__atomic_load_n(&b->error, __ATOMIC_RELAXED))
+    {
+        size_t c = __atomic_fetch_add(&b->next_chunk, 1, __ATOMIC_RELAXED);
+        if (c >= b->chunk_cnt) {break;}
+        struct chunk* chunk = &b->chunks[c];
+        struct capture* cap = &b->captures[chunk->capture];
+
+        prime_states(b, cap, chunk->first, &w);
+        for (size_t i = chunk->first; i < chunk->first + chunk->count; i++)
+        {
+            if (process_frame(b, cap, i, &w) != 0)
+            {
+                __atomic_store_n(&b->error, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+    free(w.in);
+    free(w.out);
+    free(w.conv);
+    free(w.states);
+    return NULL;
+}
+
+static void report(struct batch* b, size_t total_frames, const struct timespec* start, bool final)
+{
+    double t = elapsed_s(start);
+    size_t frames = __atomic_load_n(&b->frames_done, __ATOMIC_RELAXED);
+    double mbytes = __atomic_load_n(&b->bytes_done, __ATOMIC_RELAXED) / 1e6;
+    double msamples = __atomic_load_n(&b->samples_done, __ATOMIC_RELAXED) / 1e6;
+    if (t <= 0) {t = 1e-9;}
+    fprintf(final ? stdout : stderr, "%s%5.1f%% %zu/%zu frames, %.1f s, %.1f MB/s, %.1f MS/s%s",
+            final ? "" : "\r", total_frames ? 100.0 * frames / total_frames : 100.0, frames, total_frames,
+            t, mbytes / t, msamples / t, final ? "\n" : "");
+    fflush(final ? stdout : stderr);
+}
+
+int main(int argc, char** argv)
+{
+    const char* ini_fname = INI_FNAME;
+    const char* fir_fname = FIR_COEFF;
+    const char* corr_fname = NULL;
+    const char* out_dir = ".";
+    size_t first = 0, count = SIZE_MAX;
+    long thread_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    int dec = 0;
+    bool verbose = false;
+    struct batch b;
+    memset(&b, 0, sizeof(b));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:f:q:s:n:j:o:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': ini_fname = optarg; break;
+            case 'd': dec = atoi(optarg); break;
+            case 'f': fir_fname = optarg; break;
+            case 'q': corr_fname = optarg; break;
+            case 's': first = strtoull(optarg, NULL, 10); break;
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'j': thread_cnt = atol(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind >= argc) {usage(argv[0]); return 2;}
+    if (thread_cnt < 1) {thread_cnt = 1;}
+    log_set_level(LOG_INFO);
+
+    /* Processing parameters */
+    struct daq_config config;
+    if (load_daq_config(ini_fname, &config) == 0)
+    {
+        if (dec == 0) {dec = config.decimation_ratio;}
+        b.filter_reset = (bool) config.en_filter_reset;
+    }
+    else if (dec == 0)
+    {
+        log_fatal("Configuration could not be loaded from %s, exiting ..", ini_fname);
+        return 1;
+    }
+    if (dec < 1) {log_fatal("Invalid decimation ratio: %d", dec); return 1;}
+    b.dec = dec;
+    b.tap_size = 1;
+    if (dec > 1)
+    {
+        b.coeffs = read_values(fir_fname, &b.tap_size);
+        if (b.coeffs == NULL || b.tap_size == 0)
+        {
+            log_fatal("Failed to load the FIR filter coefficients from %s", fir_fname);
+            return 1;
+        }
+    }
+    if (corr_fname != NULL)
+    {
+        size_t cnt;
+        b.corrections = read_values(corr_fname, &cnt);
+        if (b.corrections == NULL || cnt == 0 || cnt % 2)
+        {
+            log_fatal("Failed to load the IQ corrections from %s", corr_fname);
+            return 1;
+        }
+        b.corr_cnt = cnt / 2;
+    }
+
+    /* Index the captures */
+    b.capture_cnt = argc - optind;
+    b.captures = calloc(b.capture_cnt, sizeof(struct capture));
+    size_t total_frames = 0;
+    for (int i = 0; i < b.capture_cnt; i++)
+    {
+        struct capture* cap = &b.captures[i];
+        cap->in_fname = argv[optind + i];
+        cap->first = first;
+        cap->count = count;
+        char name[PATH_MAX];
+        strncpy(name, cap->in_fname, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+        char* base = basename(name);
+        char* ext = strrchr(base, '.');
+        if (ext != NULL && ext != base) {*ext = '\0';}
+        snprintf(cap->out_fname, sizeof(cap->out_fname), "%s/%s_dec%d.iqf", out_dir, base, dec);
+
+        cap->in_fd = open(cap->in_fname, O_RDONLY);
+        if (cap->in_fd < 0) {log_fatal("Failed to open %s", cap->in_fname); return 1;}
+        cap->out_fd = open(cap->out_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (cap->out_fd < 0) {log_fatal("Failed to create %s", cap->out_fname); return 1;}
+        if (index_capture(&b, cap) != 0) {log_fatal("Failed to index %s", cap->in_fname); return 1;}
+        total_frames += cap->count;
+        if (verbose) {log_info("%s: %zu frames, processing %zu -> %s", cap->in_fname, cap->frame_cnt, cap->count, cap->out_fname);}
+    }
+    if (b.corrections != NULL && b.corr_cnt < b.max_ch)
+    {
+        log_fatal("IQ corrections are given for %zu channels, the captures have %zu", b.corr_cnt, b.max_ch);
+        return 1;
+    }
+
+    /* Split the captures into chunks, every chunk has at least one frame */
+    size_t chunk_size = 0;
+    for (int i = 0; i < b.capture_cnt; i++)
+    {
+        struct capture* cap = &b.captures[i];
+        for (size_t f = cap->first; f < cap->first + cap->count; f++)
+        {
+            if (b.chunk_cnt == 0 || b.chunks[b.chunk_cnt-1].capture != i || chunk_size >= CHUNK_SIZE)
+            {
+                struct chunk* tmp = realloc(b.chunks, (b.chunk_cnt + 1) * sizeof(struct chunk));
+                if (tmp == NULL) {log_fatal("Malloc failed"); return 1;}
+                b.chunks = tmp;
+                b.chunks[b.chunk_cnt].capture = i;
+                b.chunks[b.chunk_cnt].first = f;
+                b.chunks[b.chunk_cnt].count = 0;
+                b.chunk_cnt++;
+                chunk_size = 0;
+            }
+            b.chunks[b.chunk_cnt-1].count++;
+            chunk_size += IQ_HEADER_LENGTH + cap->frames[f].meta_length + cap->frames[f].in_payload;
+        }
+    }
+    if ((size_t) thread_cnt > b.chunk_cnt) {thread_cnt = b.chunk_cnt ? b.chunk_cnt : 1;}
+    if (verbose)
+    {
+        log_info("Decimation ratio: %d, FIR tap size: %zu, IQ correction: %s", dec, dec > 1 ? b.tap_size : 0,
+                 b.corrections != NULL ? "enabled" : "disabled");
+        log_info("Worker threads: %ld, SIMD kernel variant: %s", thread_cnt, hdaq_simd_level_name(hdaq_simd_init()));
+    }
+
+    /* Process */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t* threads = malloc(thread_cnt * sizeof(pthread_t));
+    for (long t = 0; t < thread_cnt; t++)
+    {
+        if (pthread_create(&threads[t], NULL, worker, &b) != 0)
+        {
+            log_fatal("Failed to start worker thread");
+            __atomic_store_n(&b.error, 1, __ATOMIC_RELAXED);
+            thread_cnt = t;
+            break;
+        }
+    }
+    while (verbose && __atomic_load_n(&b.frames_done, __ATOMIC_RELAXED) < total_frames &&
+           !__atomic_load_n(&b.error, __ATOMIC_RELAXED))
+    {
+        struct timespec ts = {PROGRESS_INTERVAL_MS / 1000, (PROGRESS_INTERVAL_MS % 1000) * 1000000L};
+        nanosleep(&ts, NULL);
+        report(&b, total_frames, &start, false);
+    }
+    for (long t = 0; t < thread_cnt; t++)
+        pthread_join(threads[t], NULL);
+    if (verbose) {fprintf(stderr, "\n");}
+    report(&b, total_frames, &start, true);
+
+    for (int i = 0; i < b.capture_cnt; i++)
+    {
+        close(b.captures[i].in_fd);
+        close(b.captures[i].out_fd);
+        free(b.captures[i].frames);
+    }
+    free(threads);
+    free(b.chunks);
+    free(b.captures);
+    free(b.coeffs);
+    free(b.corrections);
+    return b.error ? 1 : 0;
+}
@@ -0,0 +1,691 @@
+/*
+ *
+ * Description :
+ * Shared loader and validator of the DAQ chain configuration file
+ *
+ * The configuration file is parsed once into a typed structure, which is then
+ * checked against the single field and the cross-field constraints of the
+ * processing chain. Every C module and the Python binding (daq_config.py) use
+ * this implementation, so the constraints are defined only once.
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "ini.h"
+#include "iq_header.h"
+#include "daq_config.h"
+
+#if DAQ_CFG_MAX_CH > IQ_MAX_CH
+#error "The channel number is limited by the channel masks of the IQ header"
+#endif
+
+#define FRAC_DELAY_BLOCK_SIZE 1024 // Block size of the fractional delay estimation in the delay synchronizer
+#define CORR_PEAK_OFFSET       100 // Correlation side-lobe offset used by the delay synchronizer
+
+static const int valid_gains[] = {0, 9, 14, 27, 37, 77, 87, 125, 144, 157, 166, 197, 207, 229, 254,
+                                  280, 297, 328, 338, 364, 372, 386, 402, 421, 434, 439, 445, 480, 496};
+static const char* valid_fir_windows[] = {"boxcar", "triang", "blackman", "hamming", "hann", "bartlett",
+                                          "flattop", "parzen", "bohman", "blackmanharris", "nuttall", "barthann", NULL};
+static const char* valid_amplitude_cal_modes[] = {"default", "disabled", "channel_power", NULL};
+static const char* valid_iq_adjust_sources[] = {"explicit-time-delay", "touchstone", NULL};
+static const char* valid_out_data_iface_types[] = {"eth", "shmem", NULL};
+static const char* valid_numa_policies[] = {"first_touch", "consumer", "interleave", "pinning", NULL};
+/* Indexed by enum iq_fft_window */
+static const char* valid_spectrum_windows[] = {"rectangular", "hann", "hamming", "blackman", NULL};
+_Static_assert(sizeof(valid_spectrum_windows)/sizeof(valid_spectrum_windows[0]) == IQ_FFT_WINDOW_CNT+1,
+               "The spectrum windows must match the fft_window codes of the IQ header");
+
+/* Indexed by enum daq_graph_stage */
+static const char* graph_stage_names[] = {"rtl_daq", "rebuffer", "decimator", "delay_sync"};
+/* Shared memory links written by the stages, rtl_daq streams to the rebuffer on a pipe */
+static const char* graph_out_links[] = {NULL, "decimator_in", "decimator_out", "delay_sync_iq"};
+#define GRAPH_REQUIRED_STAGES (DAQ_GRAPH_BIT(DAQ_GRAPH_RTL_DAQ) | DAQ_GRAPH_BIT(DAQ_GRAPH_REBUFFER) | \
+                               DAQ_GRAPH_BIT(DAQ_GRAPH_DELAY_SYNC))
+
+/*
+ *-------------------------------------
+ *       Value conversion helpers
+ *-------------------------------------
+ */
+static int parse_int(const char* value, int* out)
+{
+    char* end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno != 0 || v != (int) v) {return -1;}
+    *out = (int) v;
+    return 0;
+}
+static int parse_uint32(const char* value, uint32_t* out)
+{
+    char* end;
+    errno = 0;
+    long long v = strtoll(value, &end, 10);
+    if (end == value || *end != '\0' || errno != 0 || v < 0 || v > UINT32_MAX) {return -1;}
+    *out = (uint32_t) v;
+    return 0;
+}
+static int parse_float(const char* value, float* out)
+{
+    char* end;
+    errno = 0;
+    float v = strtof(value, &end);
+    if (end == value || *end != '\0' || errno != 0) {return -1;}
+    *out = v;
+    return 0;
+}
+static int parse_str(const char* value, char* out)
+{
+    if (strlen(value) >= DAQ_CFG_STR_LEN) {return -1;}
+    strcpy(out, value);
+    return 0;
+}
+/*
+ * Parses a comma separated list, e.g.: "0, 1,0,1".
+ * The number of converted items is stored in *cnt
+ */
+static int parse_list(const char* value, void* out, int* cnt, int is_float)
+{
+    char item[DAQ_CFG_STR_LEN];
+    const char* p = value;
+    *cnt = 0;
+    while (*p != '\0')
+    {
+        const char* sep = strchr(p, ',');
+        size_t len = sep ? (size_t)(sep - p) : strlen(p);
+        while (len > 0 && (*p == ' ' || *p == '\t')) {p++; len--;}
+        while (len > 0 && (p[len-1] == ' ' || p[len-1] == '\t')) {len--;}
+        if (len == 0 || len >= sizeof(item) || *cnt >= DAQ_CFG_MAX_CH) {return -1;}
+        memcpy(item, p, len);
+        item[len] = '\0';
+        int ret = is_float ? parse_float(item, (float*) out + *cnt) : parse_int(item, (int*) out + *cnt);
+        if (ret != 0) {return -1;}
+        (*cnt)++;
+        if (!sep) {break;}
+        p = sep + 1;
+    }
+    return 0;
+}
+
+/*
+ * Ini configuration parser callback function
+ */
+static int handler(void* conf_struct, const char* section, const char* name,
+                   const char* value)
+{
+    struct daq_config* pconfig = (struct daq_config*) conf_struct;
+    int ret = 0;
+
+    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+    /* [meta] */
+    if (MATCH("meta", "ini_version"))
+        {ret = parse_int(value, &pconfig->ini_version);}
+    else if (MATCH("meta", "config_name"))
+        {ret = parse_str(value, pconfig->config_name);}
+    /* [hw] */
+    else if (MATCH("hw", "name"))
+        {ret = parse_str(value, pconfig->hw_name);}
+    else if (MATCH("hw", "unit_id"))
+        {ret = parse_int(value, &pconfig->unit_id);}
+    else if (MATCH("hw", "ioo_type"))
+        {ret = parse_int(value, &pconfig->ioo_type);}
+    else if (MATCH("hw", "num_ch"))
+        {ret = parse_int(value, &pconfig->num_ch);}
+    else if (MATCH("hw", "en_bias_tee"))
+        {ret = parse_list(value, pconfig->en_bias_tee, &pconfig->en_bias_tee_cnt, 0);}
+    /* [daq] */
+    else if (MATCH("daq", "log_level"))
+        {ret = parse_int(value, &pconfig->log_level);}
+    else if (MATCH("daq", "daq_buffer_size"))
+        {ret = parse_int(value, &pconfig->daq_buffer_size);}
+    else if (MATCH("daq", "center_freq"))
+        {ret = parse_uint32(value, &pconfig->center_freq);}
+    else if (MATCH("daq", "sample_rate"))
+        {ret = parse_uint32(value, &pconfig->sample_rate);}
+    else if (MATCH("daq", "gain"))
+        {ret = parse_int(value, &pconfig->gain);}
+    else if (MATCH("daq", "en_noise_source_ctr"))
+        {ret = parse_int(value, &pconfig->en_noise_source_ctr);}
+    else if (MATCH("daq", "ctr_channel_serial_no"))
+        {ret = parse_int(value, &pconfig->ctr_channel_serial_no);}
+    /* [pre_processing] */
+    else if (MATCH("pre_processing", "cpi_size"))
+        {ret = parse_int(value, &pconfig->cpi_size);}
+    else if (MATCH("pre_processing", "decimation_ratio"))
+        {ret = parse_int(value, &pconfig->decimation_ratio);}
+    else if (MATCH("pre_processing", "fir_relative_bandwidth"))
+        {ret = parse_float(value, &pconfig->fir_relative_bandwidth);}
+    else if (MATCH("pre_processing", "fir_tap_size"))
+        {ret = parse_int(value, &pconfig->fir_tap_size);}
+    else if (MATCH("pre_processing", "fir_window"))
+        {ret = parse_str(value, pconfig->fir_window);}
+    else if (MATCH("pre_processing", "en_filter_reset"))
+        {ret = parse_int(value, &pconfig->en_filter_reset);}
+    /* [calibration] */
+    else if (MATCH("calibration", "corr_size"))
+        {ret = parse_int(value, &pconfig->corr_size);}
+    else if (MATCH("calibration", "std_ch_ind"))
+        {ret = parse_int(value, &pconfig->std_ch_ind);}
+    else if (MATCH("calibration", "en_iq_cal"))
+        {ret = parse_int(value, &pconfig->en_iq_cal);}
+    else if (MATCH("calibration", "amplitude_cal_mode"))
+        {ret = parse_str(value, pconfig->amplitude_cal_mode);}
+    else if (MATCH("calibration", "en_gain_tune_init"))
+        {ret = parse_int(value, &pconfig->en_gain_tune_init);}
+    else if (MATCH("calibration", "gain_lock_interval"))
+        {ret = parse_int(value, &pconfig->gain_lock_interval);}
+    else if (MATCH("calibration", "unified_gain_control"))
+        {ret = parse_int(value, &pconfig->unified_gain_control);}
+    else if (MATCH("calibration", "require_track_lock_intervention"))
+        {ret = parse_int(value, &pconfig->require_track_lock_intervention);}
+    else if (MATCH("calibration", "cal_track_mode"))
+        {ret = parse_int(value, &pconfig->cal_track_mode);}
+    else if (MATCH("calibration", "cal_frame_interval"))
+        {ret = parse_int(value, &pconfig->cal_frame_interval);}
+    else if (MATCH("calibration", "cal_frame_burst_size"))
+        {ret = parse_int(value, &pconfig->cal_frame_burst_size);}
+    else if (MATCH("calibration", "noise_switch_guard"))
+        {ret = parse_int(value, &pconfig->noise_switch_guard);}
+    else if (MATCH("calibration", "amplitude_tolerance"))
+        {ret = parse_int(value, &pconfig->amplitude_tolerance);}
+    else if (MATCH("calibration", "phase_tolerance"))
+        {ret = parse_int(value, &pconfig->phase_tolerance);}
+    else if (MATCH("calibration", "maximum_sync_fails"))
+        {ret = parse_int(value, &pconfig->maximum_sync_fails);}
+    else if (MATCH("calibration", "iq_adjust_source"))
+        {ret = parse_str(value, pconfig->iq_adjust_source);}
+    else if (MATCH("calibration", "iq_adjust_amplitude"))
+        {ret = parse_list(value, pconfig->iq_adjust_amplitude, &pconfig->iq_adjust_amplitude_cnt, 1);}
+    else if (MATCH("calibration", "iq_adjust_time_delay_ns"))
+        {ret = parse_list(value, pconfig->iq_adjust_time_delay_ns, &pconfig->iq_adjust_time_delay_ns_cnt, 1);}
+    /* [adpis] */
+    else if (MATCH("adpis", "en_adpis"))
+        {ret = parse_int(value, &pconfig->en_adpis);}
+    else if (MATCH("adpis", "adpis_proc_size"))
+        {ret = parse_int(value, &pconfig->adpis_proc_size);}
+    else if (MATCH("adpis", "adpis_gains_init"))
+        {ret = parse_list(value, pconfig->adpis_gains_init, &pconfig->adpis_gains_init_cnt, 0);}
+    /* [data_interface] */
+    else if (MATCH("data_interface", "out_data_iface_type"))
+        {ret = parse_str(value, pconfig->out_data_iface_type);}
+    /* [launcher] */
+    else if (MATCH("launcher", "rt_priority"))
+        {ret = parse_int(value, &pconfig->rt_priority);}
+    else if (MATCH("launcher", "max_restarts"))
+        {ret = parse_int(value, &pconfig->max_restarts);}
+    else if (MATCH("launcher", "cpu_rtl_daq"))
+        {ret = parse_int(value, &pconfig->cpu_rtl_daq);}
+    else if (MATCH("launcher", "cpu_rebuffer"))
+        {ret = parse_int(value, &pconfig->cpu_rebuffer);}
+    else if (MATCH("launcher", "cpu_decimator"))
+        {ret = parse_int(value, &pconfig->cpu_decimator);}
+    else if (MATCH("launcher", "cpu_delay_sync"))
+        {ret = parse_int(value, &pconfig->cpu_delay_sync);}
+    else if (MATCH("launcher", "cpu_hw_controller"))
+        {ret = parse_int(value, &pconfig->cpu_hw_controller);}
+    else if (MATCH("launcher", "cpu_iq_server"))
+        {ret = parse_int(value, &pconfig->cpu_iq_server);}
+    /* [graph] */
+    else if (MATCH("graph", "chain"))
+        {ret = parse_str(value, pconfig->graph_chain);}
+    else if (MATCH("graph", "en_bypass"))
+        {ret = parse_int(value, &pconfig->en_stage_bypass);}
+    /* [numa] */
+    else if (MATCH("numa", "decimator_in"))
+        {ret = parse_str(value, pconfig->numa_decimator_in);}
+    else if (MATCH("numa", "decimator_out"))
+        {ret = parse_str(value, pconfig->numa_decimator_out);}
+    else if (MATCH("numa", "delay_sync_iq"))
+        {ret = parse_str(value, pconfig->numa_delay_sync_iq);}
+    /* [perf] */
+    else if (MATCH("perf", "en_counters"))
+        {ret = parse_int(value, &pconfig->en_perf_counters);}
+    else if (MATCH("perf", "report_interval"))
+        {ret = parse_int(value, &pconfig->perf_report_interval);}
+    else if (MATCH("perf", "en_frame_log"))
+        {ret = parse_int(value, &pconfig->en_perf_frame_log);}
+    /* [spectrum] */
+    else if (MATCH("spectrum", "en_spectrum"))
+        {ret = parse_int(value, &pconfig->en_spectrum);}
+    else if (MATCH("spectrum", "fft_size"))
+        {ret = parse_int(value, &pconfig->spectrum_fft_size);}
+    else if (MATCH("spectrum", "overlap"))
+        {ret = parse_int(value, &pconfig->spectrum_overlap);}
+    else if (MATCH("spectrum", "window"))
+        {ret = parse_str(value, pconfig->spectrum_window);}
+    else
+        {return 1;} /* unknown section/name, ignored */
+
+    if (ret != 0)
+    {
+        size_t len = strlen(pconfig->invalid_fields);
+        snprintf(pconfig->invalid_fields + len, sizeof(pconfig->invalid_fields) - len,
+                 "%s%s.%s", len ? ", " : "", section, name);
+        pconfig->invalid_field_cnt++;
+        return 0;
+    }
+    return 1;
+}
+
+void set_default_daq_config(struct daq_config* cfg)
+/*
+ * Default values are identical to the shipped "kraken_default" configuration
+ */
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->ini_version = 7;
+    strcpy(cfg->config_name, "default");
+    strcpy(cfg->hw_name, "kraken5");
+    cfg->num_ch = 5;
+    cfg->en_bias_tee_cnt = 5;
+    cfg->log_level = 5;
+    cfg->daq_buffer_size = 262144;
+    cfg->center_freq = 700000000;
+    cfg->sample_rate = 2400000;
+    cfg->en_noise_source_ctr = 1;
+    cfg->ctr_channel_serial_no = 1000;
+    cfg->cpi_size = 1048576;
+    cfg->decimation_ratio = 1;
+    cfg->fir_relative_bandwidth = 1.0;
+    cfg->fir_tap_size = 1;
+    strcpy(cfg->fir_window, "hann");
+    cfg->corr_size = 65536;
+    cfg->en_iq_cal = 1;
+    strcpy(cfg->amplitude_cal_mode, "channel_power");
+    cfg->cal_track_mode = 2;
+    cfg->cal_frame_interval = 687;
+    cfg->cal_frame_burst_size = 10;
+    cfg->noise_switch_guard = 8192; // ~3.4 ms at 2.4 MS/s, settling and latency not covered by the measured jitter
+    cfg->amplitude_tolerance = 2;
+    cfg->phase_tolerance = 1;
+    cfg->maximum_sync_fails = 10;
+    strcpy(cfg->iq_adjust_source, "explicit-time-delay");
+    cfg->iq_adjust_amplitude_cnt = 4;
+    cfg->iq_adjust_time_delay_ns_cnt = 4;
+    cfg->adpis_proc_size = 8192;
+    cfg->adpis_gains_init_cnt = 5;
+    strcpy(cfg->out_data_iface_type, "shmem");
+    cfg->rt_priority = 99; // Same as "chrt -f 99" in the start scripts
+    cfg->max_restarts = 3;
+    cfg->cpu_rtl_daq = -1; // -1: No CPU pinning
+    cfg->cpu_rebuffer = -1;
+    cfg->cpu_decimator = -1;
+    cfg->cpu_delay_sync = -1;
+    cfg->cpu_hw_controller = -1;
+    cfg->cpu_iq_server = -1;
+    strcpy(cfg->graph_chain, "rtl_daq > rebuffer > decimator > delay_sync");
+    cfg->en_stage_bypass = 1;
+    strcpy(cfg->numa_decimator_in, "first_touch"); // Placed by the producer, as without NUMA policies
+    strcpy(cfg->numa_decimator_out, "first_touch");
+    strcpy(cfg->numa_delay_sync_iq, "first_touch");
+    cfg->en_perf_counters = 0;
+    cfg->perf_report_interval = 100;
+    cfg->en_perf_frame_log = 0;
+    cfg->en_spectrum = 0;
+    cfg->spectrum_fft_size = 1024;
+    cfg->spectrum_overlap = 0;
+    strcpy(cfg->spectrum_window, "hann");
+}
+
+int load_daq_config(const char* fname, struct daq_config* cfg)
+/*
+ *  Loads the configuration file into the typed configuration structure.
+ *  Fields missing from the file keep their default values.
+ *
+ *  Return values:
+ *  --------------
+ *       0: Configuration loaded
+ *      -1: Configuration file could not be opened
+ *      -2: One or more fields could not be converted, see cfg->invalid_fields
+ */
+{
+    set_default_daq_config(cfg);
+    int ret = ini_parse(fname, handler, cfg);
+    if (ret == -1) {return -1;}
+    if (cfg->invalid_field_cnt) {return -2;}
+    return 0;
+}
+
+/*
+ *-------------------------------------
+ *          Validation helpers
+ *-------------------------------------
+ */
+struct err_list {
+    char* buf;
+    size_t size;
+    size_t len;
+    int cnt;
+};
+
+static void add_error(struct err_list* errs, const char* fmt, ...)
+{
+    errs->cnt++;
+    if (errs->buf == NULL || errs->len + 1 >= errs->size) {return;}
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(errs->buf + errs->len, errs->size - errs->len, fmt, args);
+    va_end(args);
+    if (n < 0) {return;}
+    errs->len += (size_t) n;
+    if (errs->len + 1 < errs->size)
+    {
+        errs->buf[errs->len++] = '\n';
+        errs->buf[errs->len] = '\0';
+    }
+    else {errs->len = errs->size - 1;}
+}
+static int is_in_str_list(const char* value, const char** list)
+{
+    for (int i = 0; list[i] != NULL; i++)
+        if (strcmp(value, list[i]) == 0) {return 1;}
+    return 0;
+}
+static int is_valid_gain(int gain)
+{
+    for (size_t i = 0; i < sizeof(valid_gains)/sizeof(valid_gains[0]); i++)
+        if (valid_gains[i] == gain) {return 1;}
+    return 0;
+}
+/*
+ * Parses the stage chain, e.g.: "rtl_daq > rebuffer > delay_sync".
+ * Returns the bit mask of the listed stages, -1 if a stage is unknown or the
+ * stages are not listed in data flow order.
+ */
+static int parse_graph_chain(const char* chain)
+{
+    int mask = 0;
+    int last = -1;
+    const char* p = chain;
+    while (*p != '\0')
+    {
+        const char* sep = strchr(p, '>');
+        size_t len = sep ? (size_t)(sep - p) : strlen(p);
+        while (len > 0 && (*p == ' ' || *p == '\t')) {p++; len--;}
+        while (len > 0 && (p[len-1] == ' ' || p[len-1] == '\t')) {len--;}
+        int stage = -1;
+        for (int i = 0; i < DAQ_GRAPH_STAGE_NUM; i++)
+            if (strlen(graph_stage_names[i]) == len && strncmp(p, graph_stage_names[i], len) == 0) {stage = i;}
+        if (stage <= last) {return -1;}
+        mask |= DAQ_GRAPH_BIT(stage);
+        last = stage;
+        if (!sep) {break;}
+        p = sep + 1;
+    }
+    return mask;
+}
+#define CHK_FLAG(v, name) if ((v) != 0 && (v) != 1) {add_error(&errs, "%s must be 0 or 1. Currently it is: '%d'", name, v);}
+#define CHK_MIN(v, min, name) if ((v) < (min)) {add_error(&errs, "%s must be at least %d. Currently it is: '%d'", name, min, v);}
+
+int check_daq_config(const struct daq_config* cfg, char* err_buf, size_t err_buf_size)
+/*
+ *  Checks the loaded configuration against the constraints of the processing chain.
+ *  The description of the violated constraints are written into err_buf, one per line.
+ *
+ *  Return values:
+ *  --------------
+ *      Number of violated constraints (0: configuration is valid)
+ */
+{
+    struct err_list errs = {err_buf, err_buf_size, 0, 0};
+    if (err_buf != NULL && err_buf_size > 0) {err_buf[0] = '\0';}
+
+    if (cfg->invalid_field_cnt)
+        {add_error(&errs, "Could not convert the value of the following fields: %s", cfg->invalid_fields);}
+
+    /* [hw] */
+    if (strlen(cfg->hw_name) >= sizeof(((struct iq_header_struct*)0)->hardware_id))
+        {add_error(&errs, "Hardware name has to be less than 16 character, currently it is: %zu", strlen(cfg->hw_name));}
+    if (cfg->num_ch < 1 || cfg->num_ch > DAQ_CFG_MAX_CH)
+        {add_error(&errs, "Number of channels must be in the range of 1-%d. Currently it is: '%d'", DAQ_CFG_MAX_CH, cfg->num_ch);}
+    for (int i = 0; i < cfg->en_bias_tee_cnt; i++)
+        CHK_FLAG(cfg->en_bias_tee[i], "Bias tee init value")
+    if (cfg->en_bias_tee_cnt < cfg->num_ch) // Values above the channel number are ignored
+        {add_error(&errs, "Bias tee init values are missing for some channels. Set:%d, channels:%d", cfg->en_bias_tee_cnt, cfg->num_ch);}
+
+    /* [daq] */
+    if (cfg->log_level < 0 || cfg->log_level > 5)
+        {add_error(&errs, "Valid log level range is: 0-5. Currently it is: '%d'", cfg->log_level);}
+    if (cfg->daq_buffer_size <= 0 || (cfg->daq_buffer_size & (cfg->daq_buffer_size-1)) != 0)
+        {add_error(&errs, "DAQ buffer size must be a positive power of 2. Currently it is: '%d'", cfg->daq_buffer_size);}
+    if (cfg->center_freq == 0)
+        {add_error(&errs, "DAQ center frequency must be a non-zero integer");}
+    if (cfg->sample_rate == 0)
+        {add_error(&errs, "Sample rate must be a non-zero integer");}
+    if (!is_valid_gain(cfg->gain))
+        {add_error(&errs, "Invalid gain value: '%d', check the valid gain list of the R820T tuner", cfg->gain);}
+    CHK_FLAG(cfg->en_noise_source_ctr, "Noise source control enable")
+
+    /* [pre_processing] */
+    CHK_MIN(cfg->cpi_size, 1, "CPI size")
+    CHK_MIN(cfg->decimation_ratio, 1, "Decimation ratio")
+    if (cfg->fir_relative_bandwidth <= 0 || cfg->fir_relative_bandwidth > 1)
+        {add_error(&errs, "FIR filter relative bandwidth must be in the range of ]0-1]. Currently it is: '%f'", cfg->fir_relative_bandwidth);}
+    CHK_MIN(cfg->fir_tap_size, 1, "FIR filter tap size")
+    if (!is_in_str_list(cfg->fir_window, valid_fir_windows))
+        {add_error(&errs, "Invalid FIR window type: '%s'", cfg->fir_window);}
+    CHK_FLAG(cfg->en_filter_reset, "Filter reset enable")
+    if (cfg->decimation_ratio != 1 && cfg->fir_tap_size <= cfg->decimation_ratio)
+        {add_error(&errs, "FIR tap size must be higher than the decimation ratio. Please consider increasing the tap size");}
+    if ((long long) cfg->cpi_size * cfg->decimation_ratio < cfg->daq_buffer_size)
+        {add_error(&errs, "The duration of the CPI size (including decimation) must be larger than the duration of the DAQ buffer size");}
+    if ((long long) cfg->cpi_size * cfg->decimation_ratio > MAX_IQFRAME_PAYLOAD_SIZE)
+        {add_error(&errs, "CPI size x decimation ratio exceeds the maximum frame size of %d samples", MAX_IQFRAME_PAYLOAD_SIZE);}
+
+    /* [calibration] */
+    CHK_MIN(cfg->corr_size, 1, "Calibration correlation size")
+    if (cfg->corr_size > MAX_IQFRAME_PAYLOAD_SIZE)
+        {add_error(&errs, "Calibration correlation size exceeds the maximum frame size of %d samples", MAX_IQFRAME_PAYLOAD_SIZE);}
+    if (cfg->corr_size % FRAC_DELAY_BLOCK_SIZE != 0 || cfg->corr_size <= CORR_PEAK_OFFSET)
+        {add_error(&errs, "Calibration correlation size must be a multiple of %d. Currently it is: '%d'", FRAC_DELAY_BLOCK_SIZE, cfg->corr_size);}
+    if (cfg->std_ch_ind < 0 || cfg->std_ch_ind >= cfg->num_ch)
+        {add_error(&errs, "Standard channel index must be in the range of 0-%d. Currently it is: '%d'", cfg->num_ch-1, cfg->std_ch_ind);}
+    CHK_FLAG(cfg->en_iq_cal, "IQ calibration enable")
+    if (!is_in_str_list(cfg->amplitude_cal_mode, valid_amplitude_cal_modes))
+        {add_error(&errs, "Invalid amplitude calibration mode: '%s'", cfg->amplitude_cal_mode);}
+    CHK_FLAG(cfg->en_gain_tune_init, "Initial gain tune enable")
+    CHK_MIN(cfg->gain_lock_interval, 0, "Gain lock interval")
+    CHK_FLAG(cfg->unified_gain_control, "Unified gain control enable")
+    CHK_FLAG(cfg->require_track_lock_intervention, "Track lock intervention enable")
+    if (cfg->cal_track_mode < 0 || cfg->cal_track_mode > 3)
+        {add_error(&errs, "Calibration track mode should be one of the followings: 0/1/2/3. Currently it is: '%d'", cfg->cal_track_mode);}
+    CHK_MIN(cfg->cal_frame_interval, 1, "Calibration frame interval")
+    CHK_MIN(cfg->cal_frame_burst_size, 1, "Calibration frame burst size")
+    CHK_MIN(cfg->noise_switch_guard, 0, "Noise source switch guard")
+    CHK_MIN(cfg->amplitude_tolerance, 1, "Calibration amplitude tolerance")
+    CHK_MIN(cfg->phase_tolerance, 1, "Calibration phase tolerance")
+    CHK_MIN(cfg->maximum_sync_fails, 1, "Maximum allowed sync check fails")
+    if (!is_in_str_list(cfg->iq_adjust_source, valid_iq_adjust_sources))
+        {add_error(&errs, "Invalid IQ adjustment source: '%s'", cfg->iq_adjust_source);}
+    else if (strcmp(cfg->iq_adjust_source, "explicit-time-delay") == 0)
+    {
+        // The delay synchronizer uses the first num_ch-1 values, the rest is ignored
+        if (cfg->iq_adjust_amplitude_cnt < cfg->num_ch-1)
+            {add_error(&errs, "IQ amplitude adjustment requires channel count-1 values. Set:%d, required:%d", cfg->iq_adjust_amplitude_cnt, cfg->num_ch-1);}
+        if (cfg->iq_adjust_time_delay_ns_cnt < cfg->num_ch-1)
+            {add_error(&errs, "IQ time delay adjustment requires channel count-1 values. Set:%d, required:%d", cfg->iq_adjust_time_delay_ns_cnt, cfg->num_ch-1);}
+    }
+
+    /* [adpis] */
+    CHK_FLAG(cfg->en_adpis, "ADPIS enable")
+    CHK_MIN(cfg->adpis_proc_size, 1, "ADPIS processing size")
+    for (int i = 0; i < cfg->adpis_gains_init_cnt; i++)
+        if (!is_valid_gain(cfg->adpis_gains_init[i]))
+            {add_error(&errs, "Invalid ADPIS gain init value: '%d'", cfg->adpis_gains_init[i]);}
+    if (cfg->adpis_gains_init_cnt != cfg->num_ch)
+        {add_error(&errs, "The number of ADPIS gain init values does not match the channel number. Set:%d, channels:%d", cfg->adpis_gains_init_cnt, cfg->num_ch);}
+
+    /* [data_interface] */
+    if (!is_in_str_list(cfg->out_data_iface_type, valid_out_data_iface_types))
+        {add_error(&errs, "Output data interface type should be 'eth' or 'shmem'. Currently it is: '%s'", cfg->out_data_iface_type);}
+
+    /* [launcher] */
+    if (cfg->rt_priority < 0 || cfg->rt_priority > 99)
+        {add_error(&errs, "Real-time priority must be in the range of 0-99 (0: disabled). Currently it is: '%d'", cfg->rt_priority);}
+    CHK_MIN(cfg->max_restarts, 0, "Maximum number of stage restarts")
+    CHK_MIN(cfg->cpu_rtl_daq, -1, "CPU index of rtl_daq")
+    CHK_MIN(cfg->cpu_rebuffer, -1, "CPU index of rebuffer")
+    CHK_MIN(cfg->cpu_decimator, -1, "CPU index of the decimator")
+    CHK_MIN(cfg->cpu_delay_sync, -1, "CPU index of delay_sync")
+    CHK_MIN(cfg->cpu_hw_controller, -1, "CPU index of hw_controller")
+    CHK_MIN(cfg->cpu_iq_server, -1, "CPU index of iq_server")
+
+    /* [graph] */
+    int graph_mask = parse_graph_chain(cfg->graph_chain);
+    if (graph_mask < 0)
+        {add_error(&errs, "Invalid stage graph: '%s', the stages must be listed in data flow order: rtl_daq > rebuffer > decimator > delay_sync", cfg->graph_chain);}
+    else
+    {
+        if ((graph_mask & GRAPH_REQUIRED_STAGES) != GRAPH_REQUIRED_STAGES)
+            {add_error(&errs, "The stage graph must contain the rtl_daq, rebuffer and delay_sync stages. Currently it is: '%s'", cfg->graph_chain);}
+        if (!(graph_mask & DAQ_GRAPH_BIT(DAQ_GRAPH_DECIMATOR)) && cfg->decimation_ratio != 1)
+            {add_error(&errs, "The decimator can not be removed from the stage graph when the decimation ratio is higher than 1");}
+    }
+    CHK_FLAG(cfg->en_stage_bypass, "Stage bypass enable")
+
+    /* [numa] */
+    if (!is_in_str_list(cfg->numa_decimator_in, valid_numa_policies))
+        {add_error(&errs, "Invalid NUMA policy of the decimator_in link: '%s'", cfg->numa_decimator_in);}
+    if (!is_in_str_list(cfg->numa_decimator_out, valid_numa_policies))
+        {add_error(&errs, "Invalid NUMA policy of the decimator_out link: '%s'", cfg->numa_decimator_out);}
+    if (!is_in_str_list(cfg->numa_delay_sync_iq, valid_numa_policies))
+        {add_error(&errs, "Invalid NUMA policy of the delay_sync_iq link: '%s'", cfg->numa_delay_sync_iq);}
+
+    /* [perf] */
+    CHK_FLAG(cfg->en_perf_counters, "Performance counter enable")
+    CHK_MIN(cfg->perf_report_interval, 1, "Performance counter report interval")
+    CHK_FLAG(cfg->en_perf_frame_log, "Performance counter frame log enable")
+
+    /* [spectrum] */
+    CHK_FLAG(cfg->en_spectrum, "Spectrum output enable")
+    CHK_MIN(cfg->spectrum_fft_size, 2, "Spectrum FFT size")
+    if (cfg->spectrum_fft_size > cfg->cpi_size || cfg->spectrum_fft_size > cfg->corr_size)
+        {add_error(&errs, "Spectrum FFT size can not be larger than the CPI size and the calibration correlation size. Currently it is: '%d'", cfg->spectrum_fft_size);}
+    if (cfg->spectrum_overlap < 0 || cfg->spectrum_overlap >= cfg->spectrum_fft_size)
+        {add_error(&errs, "Spectrum overlap must be in the range of 0-%d. Currently it is: '%d'", cfg->spectrum_fft_size-1, cfg->spectrum_overlap);}
+    if (!is_in_str_list(cfg->spectrum_window, valid_spectrum_windows))
+        {add_error(&errs, "Invalid spectrum window type: '%s'", cfg->spectrum_window);}
+    else if (cfg->en_spectrum && daq_iq_frame_length(cfg) > MAX_IQFRAME_PAYLOAD_SIZE)
+        {add_error(&errs, "The spectral frames exceed the maximum frame size of %d samples, consider decreasing the overlap", MAX_IQFRAME_PAYLOAD_SIZE);}
+
+    return errs.cnt;
+}
+
+int daq_graph_stages(const struct daq_config* cfg)
+/*
+ * Resolves the stages to be started. With the bypass enabled, stages that would
+ * only copy the frames are removed and their neighbours are linked directly:
+ * without decimation the delay synchronizer converts the raw samples itself.
+ *
+ * Return values:
+ * --------------
+ *      Bit mask of the active stages (DAQ_GRAPH_BIT), -1 if the graph is invalid
+ */
+{
+    int mask = parse_graph_chain(cfg->graph_chain);
+    if (mask < 0 || (mask & GRAPH_REQUIRED_STAGES) != GRAPH_REQUIRED_STAGES) {return -1;}
+    if (cfg->en_stage_bypass && cfg->decimation_ratio == 1) {mask &= ~DAQ_GRAPH_BIT(DAQ_GRAPH_DECIMATOR);}
+    return mask;
+}
+
+const char* daq_graph_stage_name(int stage)
+{
+    if (stage < 0 || stage >= DAQ_GRAPH_STAGE_NUM) {return NULL;}
+    return graph_stage_names[stage];
+}
+
+const char* daq_graph_input_link(const struct daq_config* cfg, int stage)
+/*
+ * Returns the name of the shared memory link the stage reads, that is the output
+ * link of the closest active upstream stage. NULL is returned for inactive stages,
+ * for rtl_daq and for the rebuffer (fed on a pipe).
+ */
+{
+    int mask = daq_graph_stages(cfg);
+    if (mask < 0 || stage <= DAQ_GRAPH_REBUFFER || stage >= DAQ_GRAPH_STAGE_NUM ||
+        !(mask & DAQ_GRAPH_BIT(stage))) {return NULL;}
+    int producer = stage - 1;
+    while (!(mask & DAQ_GRAPH_BIT(producer))) {producer--;}
+    return graph_out_links[producer];
+}
+
+static int stage_cpu(const struct daq_config* cfg, int stage)
+{
+    switch (stage)
+    {
+        case DAQ_GRAPH_RTL_DAQ:    return cfg->cpu_rtl_daq;
+        case DAQ_GRAPH_REBUFFER:   return cfg->cpu_rebuffer;
+        case DAQ_GRAPH_DECIMATOR:  return cfg->cpu_decimator;
+        case DAQ_GRAPH_DELAY_SYNC: return cfg->cpu_delay_sync;
+        default: return -1;
+    }
+}
+
+const char* daq_link_numa_policy(const struct daq_config* cfg, int stage, int* producer_cpu, int* consumer_cpu)
+/*
+ * Returns the NUMA policy of the shared memory link written by the stage, the
+ * pinned CPUs of its producer and consumer stages are stored in *producer_cpu and
+ * *consumer_cpu (-1: not pinned). The consumer is the closest active downstream
+ * stage, the delay synchronizer output is read by the IQ server with the
+ * Ethernet interface and by the (unpinned) DSP otherwise. NULL is returned for
+ * inactive stages and for rtl_daq.
+ */
+{
+    int mask = daq_graph_stages(cfg);
+    if (mask < 0 || stage <= DAQ_GRAPH_RTL_DAQ || stage >= DAQ_GRAPH_STAGE_NUM ||
+        !(mask & DAQ_GRAPH_BIT(stage))) {return NULL;}
+    *producer_cpu = stage_cpu(cfg, stage);
+    if (stage == DAQ_GRAPH_DELAY_SYNC)
+    {
+        *consumer_cpu = strcmp(cfg->out_data_iface_type, "eth") == 0 ? cfg->cpu_iq_server : -1;
+        return cfg->numa_delay_sync_iq;
+    }
+    int consumer = stage + 1;
+    while (!(mask & DAQ_GRAPH_BIT(consumer))) {consumer++;} // delay_sync is always active
+    *consumer_cpu = stage_cpu(cfg, consumer);
+    return stage == DAQ_GRAPH_REBUFFER ? cfg->numa_decimator_in : cfg->numa_decimator_out;
+}
+
+size_t daq_iq_frame_length(const struct daq_config* cfg)
+/*
+ * Returns the maximum number of complex samples per channel in the frames of the
+ * delay_sync_iq link: the CPI or the calibration correlation size, or the bins of
+ * all the FFT segments of the longer one when the spectrum output is enabled.
+ */
+{
+    size_t length = cfg->cpi_size >= cfg->corr_size ? cfg->cpi_size : cfg->corr_size;
+    if (!cfg->en_spectrum || cfg->spectrum_fft_size < 2 || cfg->spectrum_overlap < 0 ||
+        cfg->spectrum_overlap >= cfg->spectrum_fft_size || length < (size_t) cfg->spectrum_fft_size) {return length;}
+    size_t hop = cfg->spectrum_fft_size - cfg->spectrum_overlap;
+    return ((length - cfg->spectrum_fft_size) / hop + 1) * cfg->spectrum_fft_size;
+}
+
+size_t daq_config_struct_size(void)
+/*
+ * Used by the Python binding to verify its mirrored structure layout
+ */
+{
+    return sizeof(struct daq_config);
+}
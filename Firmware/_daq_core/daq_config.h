@@ -0,0 +1,148 @@
+/*
+ *
+ * Description :
+ * Shared loader and validator of the DAQ chain configuration file
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DAQ_CONFIG_H
+#define DAQ_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DAQ_CFG_MAX_CH   256 // Limited by the channel masks of the IQ header (IQ_MAX_CH)
+#define DAQ_CFG_STR_LEN  64
+
+/*
+ * Typed content of the "daq_chain_config.ini" file.
+ *
+ * The layout of this structure is mirrored by the ctypes binding in
+ * daq_config.py, keep the two in sync when adding new fields.
+ */
+struct daq_config {
+    /* [meta] */
+    int ini_version;
+    char config_name[DAQ_CFG_STR_LEN];
+    /* [hw] */
+    char hw_name[DAQ_CFG_STR_LEN];
+    int unit_id;
+    int ioo_type;
+    int num_ch;
+    int en_bias_tee[DAQ_CFG_MAX_CH];
+    int en_bias_tee_cnt;
+    /* [daq] */
+    int log_level;
+    int daq_buffer_size;
+    uint32_t center_freq;
+    uint32_t sample_rate;
+    int gain;
+    int en_noise_source_ctr;
+    int ctr_channel_serial_no;
+    /* [pre_processing] */
+    int cpi_size;
+    int decimation_ratio;
+    float fir_relative_bandwidth;
+    int fir_tap_size;
+    char fir_window[DAQ_CFG_STR_LEN];
+    int en_filter_reset;
+    /* [calibration] */
+    int corr_size;
+    int std_ch_ind;
+    int en_iq_cal;
+    char amplitude_cal_mode[DAQ_CFG_STR_LEN];
+    int en_gain_tune_init;
+    int gain_lock_interval;
+    int unified_gain_control;
+    int require_track_lock_intervention;
+    int cal_track_mode;
+    int cal_frame_interval;
+    int cal_frame_burst_size;
+    int noise_switch_guard;
+    int amplitude_tolerance;
+    int phase_tolerance;
+    int maximum_sync_fails;
+    char iq_adjust_source[DAQ_CFG_STR_LEN];
+    float iq_adjust_amplitude[DAQ_CFG_MAX_CH];
+    int iq_adjust_amplitude_cnt;
+    float iq_adjust_time_delay_ns[DAQ_CFG_MAX_CH];
+    int iq_adjust_time_delay_ns_cnt;
+    /* [adpis] */
+    int en_adpis;
+    int adpis_proc_size;
+    int adpis_gains_init[DAQ_CFG_MAX_CH];
+    int adpis_gains_init_cnt;
+    /* [data_interface] */
+    char out_data_iface_type[DAQ_CFG_STR_LEN];
+    /* [launcher] (optional) */
+    int rt_priority;
+    int max_restarts;
+    int cpu_rtl_daq;
+    int cpu_rebuffer;
+    int cpu_decimator;
+    int cpu_delay_sync;
+    int cpu_hw_controller;
+    int cpu_iq_server;
+    /* [graph] (optional) */
+    char graph_chain[DAQ_CFG_STR_LEN];
+    int en_stage_bypass;
+    /* [numa] (optional) */
+    char numa_decimator_in[DAQ_CFG_STR_LEN];
+    char numa_decimator_out[DAQ_CFG_STR_LEN];
+    char numa_delay_sync_iq[DAQ_CFG_STR_LEN];
+    /* [perf] (optional) */
+    int en_perf_counters;
+    int perf_report_interval;
+    int en_perf_frame_log;
+    /* [spectrum] (optional) */
+    int en_spectrum;
+    int spectrum_fft_size;
+    int spectrum_overlap;
+    char spectrum_window[DAQ_CFG_STR_LEN];
+    /* Fields that could not be converted to the expected type */
+    int invalid_field_cnt;
+    char invalid_fields[512];
+};
+
+/*
+ * Stages of the processing graph in data flow order, the "chain" field of the
+ * [graph] section lists them separated by '>'
+ */
+enum daq_graph_stage {
+    DAQ_GRAPH_RTL_DAQ,
+    DAQ_GRAPH_REBUFFER,
+    DAQ_GRAPH_DECIMATOR,
+    DAQ_GRAPH_DELAY_SYNC,
+    DAQ_GRAPH_STAGE_NUM
+};
+#define DAQ_GRAPH_BIT(stage) (1 << (stage))
+
+void set_default_daq_config(struct daq_config* cfg);
+int load_daq_config(const char* fname, struct daq_config* cfg);
+int check_daq_config(const struct daq_config* cfg, char* err_buf, size_t err_buf_size);
+int daq_graph_stages(const struct daq_config* cfg);
+const char* daq_graph_stage_name(int stage);
+const char* daq_graph_input_link(const struct daq_config* cfg, int stage);
+const char* daq_link_numa_policy(const struct daq_config* cfg, int stage, int* producer_cpu, int* consumer_cpu);
+size_t daq_iq_frame_length(const struct daq_config* cfg);
+size_t daq_config_struct_size(void);
+
+#endif
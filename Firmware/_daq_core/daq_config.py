@@ -0,0 +1,240 @@
+"""
+    HeIMDALL DAQ Firmware
+    Python binding of the shared configuration loader and validator (daq_config.c)
+
+    Author: Tamás Pető
+    License: GNU GPL V3
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+"""
+import ctypes
+from os.path import join, dirname, realpath
+
+DAQ_CFG_MAX_CH = 256
+DAQ_CFG_STR_LEN = 64
+
+# Stages of the processing graph in data flow order (enum daq_graph_stage)
+GRAPH_STAGES = ["rtl_daq", "rebuffer", "decimator", "delay_sync"]
+
+class DaqConfig(ctypes.Structure):
+    """
+        Mirror of the "struct daq_config" type defined in daq_config.h
+    """
+    _fields_ = [
+        # [meta]
+        ("ini_version", ctypes.c_int),
+        ("config_name", ctypes.c_char * DAQ_CFG_STR_LEN),
+        # [hw]
+        ("hw_name", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("unit_id", ctypes.c_int),
+        ("ioo_type", ctypes.c_int),
+        ("num_ch", ctypes.c_int),
+        ("en_bias_tee", ctypes.c_int * DAQ_CFG_MAX_CH),
+        ("en_bias_tee_cnt", ctypes.c_int),
+        # [daq]
+        ("log_level", ctypes.c_int),
+        ("daq_buffer_size", ctypes.c_int),
+        ("center_freq", ctypes.c_uint32),
+        ("sample_rate", ctypes.c_uint32),
+        ("gain", ctypes.c_int),
+        ("en_noise_source_ctr", ctypes.c_int),
+        ("ctr_channel_serial_no", ctypes.c_int),
+        # [pre_processing]
+        ("cpi_size", ctypes.c_int),
+        ("decimation_ratio", ctypes.c_int),
+        ("fir_relative_bandwidth", ctypes.c_float),
+        ("fir_tap_size", ctypes.c_int),
+        ("fir_window", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("en_filter_reset", ctypes.c_int),
+        # [calibration]
+        ("corr_size", ctypes.c_int),
+        ("std_ch_ind", ctypes.c_int),
+        ("en_iq_cal", ctypes.c_int),
+        ("amplitude_cal_mode", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("en_gain_tune_init", ctypes.c_int),
+        ("gain_lock_interval", ctypes.c_int),
+        ("unified_gain_control", ctypes.c_int),
+        ("require_track_lock_intervention", ctypes.c_int),
+        ("cal_track_mode", ctypes.c_int),
+        ("cal_frame_interval", ctypes.c_int),
+        ("cal_frame_burst_size", ctypes.c_int),
+        ("noise_switch_guard", ctypes.c_int),
+        ("amplitude_tolerance", ctypes.c_int),
+        ("phase_tolerance", ctypes.c_int),
+        ("maximum_sync_fails", ctypes.c_int),
+        ("iq_adjust_source", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("iq_adjust_amplitude", ctypes.c_float * DAQ_CFG_MAX_CH),
+        ("iq_adjust_amplitude_cnt", ctypes.c_int),
+        ("iq_adjust_time_delay_ns", ctypes.c_float * DAQ_CFG_MAX_CH),
+        ("iq_adjust_time_delay_ns_cnt", ctypes.c_int),
+        # [adpis]
+        ("en_adpis", ctypes.c_int),
+        ("adpis_proc_size", ctypes.c_int),
+        ("adpis_gains_init", ctypes.c_int * DAQ_CFG_MAX_CH),
+        ("adpis_gains_init_cnt", ctypes.c_int),
+        # [data_interface]
+        ("out_data_iface_type", ctypes.c_char * DAQ_CFG_STR_LEN),
+        # [launcher]
+        ("rt_priority", ctypes.c_int),
+        ("max_restarts", ctypes.c_int),
+        ("cpu_rtl_daq", ctypes.c_int),
+        ("cpu_rebuffer", ctypes.c_int),
+        ("cpu_decimator", ctypes.c_int),
+        ("cpu_delay_sync", ctypes.c_int),
+        ("cpu_hw_controller", ctypes.c_int),
+        ("cpu_iq_server", ctypes.c_int),
+        # [graph]
+        ("graph_chain", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("en_stage_bypass", ctypes.c_int),
+        # [numa]
+        ("numa_decimator_in", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("numa_decimator_out", ctypes.c_char * DAQ_CFG_STR_LEN),
+        ("numa_delay_sync_iq", ctypes.c_char * DAQ_CFG_STR_LEN),
+        # [perf]
+        ("en_perf_counters", ctypes.c_int),
+        ("perf_report_interval", ctypes.c_int),
+        ("en_perf_frame_log", ctypes.c_int),
+        # [spectrum]
+        ("en_spectrum", ctypes.c_int),
+        ("spectrum_fft_size", ctypes.c_int),
+        ("spectrum_overlap", ctypes.c_int),
+        ("spectrum_window", ctypes.c_char * DAQ_CFG_STR_LEN),
+        # Fields that could not be converted
+        ("invalid_field_cnt", ctypes.c_int),
+        ("invalid_fields", ctypes.c_char * 512),
+    ]
+
+    def get_list(self, name):
+        """
+            Returns the valid part of a list type field as a Python list
+
+            :param name: Name of the list field, e.g.: "en_bias_tee"
+        """
+        return list(getattr(self, name)[:getattr(self, name+"_cnt")])
+
+def _load_library(lib_path=None):
+    if lib_path is None:
+        lib_path = join(dirname(realpath(__file__)), "libhdaq.so")
+    lib = ctypes.CDLL(lib_path)
+    lib.load_daq_config.argtypes = [ctypes.c_char_p, ctypes.POINTER(DaqConfig)]
+    lib.load_daq_config.restype = ctypes.c_int
+    lib.check_daq_config.argtypes = [ctypes.POINTER(DaqConfig), ctypes.c_char_p, ctypes.c_size_t]
+    lib.check_daq_config.restype = ctypes.c_int
+    lib.daq_graph_stages.argtypes = [ctypes.POINTER(DaqConfig)]
+    lib.daq_graph_stages.restype = ctypes.c_int
+    lib.daq_graph_input_link.argtypes = [ctypes.POINTER(DaqConfig), ctypes.c_int]
+    lib.daq_graph_input_link.restype = ctypes.c_char_p
+    lib.daq_link_numa_policy.argtypes = [ctypes.POINTER(DaqConfig), ctypes.c_int,
+                                         ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int)]
+    lib.daq_link_numa_policy.restype = ctypes.c_char_p
+    lib.daq_iq_frame_length.argtypes = [ctypes.POINTER(DaqConfig)]
+    lib.daq_iq_frame_length.restype = ctypes.c_size_t
+    lib.daq_config_struct_size.argtypes = []
+    lib.daq_config_struct_size.restype = ctypes.c_size_t
+    if lib.daq_config_struct_size() != ctypes.sizeof(DaqConfig):
+        raise ImportError("DaqConfig layout does not match the native library ({:d} != {:d})".format(
+                          ctypes.sizeof(DaqConfig), lib.daq_config_struct_size()))
+    return lib
+
+_lib = None
+def _get_lib():
+    global _lib
+    if _lib is None:
+        _lib = _load_library()
+    return _lib
+
+def load_daq_config(fname):
+    """
+        Loads the configuration file with the native loader
+
+        :param fname: Name of the configuration file
+
+        :return: Tuple of the loaded configuration and the return code of the loader
+                 (0: OK, -1: file could not be opened, -2: invalid field values)
+    """
+    config = DaqConfig()
+    ret = _get_lib().load_daq_config(fname.encode(), ctypes.byref(config))
+    return config, ret
+
+def check_daq_config(config):
+    """
+        Validates the loaded configuration
+
+        :param config: Configuration loaded with load_daq_config
+
+        :return: List of the violated constraints, empty when the configuration is valid
+    """
+    err_buf = ctypes.create_string_buffer(4096)
+    err_cnt = _get_lib().check_daq_config(ctypes.byref(config), err_buf, len(err_buf))
+    if not err_cnt:
+        return []
+    return err_buf.value.decode().splitlines()
+
+def check_config_file(fname):
+    """
+        Loads and validates the configuration file in one step
+
+        :param fname: Name of the configuration file
+
+        :return: List of the violated constraints, empty when the configuration is valid
+    """
+    config, ret = load_daq_config(fname)
+    if ret == -1:
+        return ["Configuration file could not be opened: {0}".format(fname)]
+    return check_daq_config(config)
+
+def graph_stages(config):
+    """
+        Returns the names of the active stages of the processing graph, the
+        bypassed stages are not listed. Empty when the graph is invalid.
+    """
+    mask = _get_lib().daq_graph_stages(ctypes.byref(config))
+    if mask < 0:
+        return []
+    return [name for index, name in enumerate(GRAPH_STAGES) if mask & (1 << index)]
+
+def graph_input_link(config, stage):
+    """
+        Returns the name of the shared memory link read by the stage, e.g.:
+        "decimator_in" for the delay synchronizer when the decimator is bypassed
+
+        :param stage: Name of the stage, see GRAPH_STAGES
+
+        :return: Link name, None for inactive stages and for stages fed on a pipe
+    """
+    link = _get_lib().daq_graph_input_link(ctypes.byref(config), GRAPH_STAGES.index(stage))
+    return None if link is None else link.decode()
+
+def iq_frame_length(config):
+    """
+        Returns the maximum number of complex samples per channel in the frames of
+        the delay_sync_iq link, the IQ server sizes its input with the same value
+
+        :param config: Configuration loaded with load_daq_config
+    """
+    return _get_lib().daq_iq_frame_length(ctypes.byref(config))
+
+def link_numa_policy(config, stage):
+    """
+        Returns the NUMA placement of the shared memory link written by the stage
+
+        :param stage: Name of the stage, see GRAPH_STAGES
+
+        :return: Tuple of the policy name and the pinned CPUs of the producer and
+                 the consumer (-1: not pinned), None for inactive stages
+    """
+    producer_cpu, consumer_cpu = ctypes.c_int(-1), ctypes.c_int(-1)
+    policy = _get_lib().daq_link_numa_policy(ctypes.byref(config), GRAPH_STAGES.index(stage),
+                                             ctypes.byref(producer_cpu), ctypes.byref(consumer_cpu))
+    return None if policy is None else (policy.decode(), producer_cpu.value, consumer_cpu.value)
@@ -0,0 +1,79 @@
+/*
+ *
+ * Description :
+ * Command line checker of the DAQ chain configuration file
+ *
+ * Prints nothing and returns 0 when the configuration is valid, otherwise the
+ * violated constraints are printed to the standard error, one per line.
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "daq_config.h"
+
+#define INI_FNAME "daq_chain_config.ini"
+
+int main(int argc, char* argv[])
+/*
+ * Usage: daq_config_check.out [-g] [config file]
+ *
+ * The configuration file name is optional, default: daq_chain_config.ini
+ * -g: Prints the active stages of the processing graph (bypassed stages
+ *     removed) separated by spaces, used by the start scripts
+ */
+{
+    const char* fname = INI_FNAME;
+    int print_graph = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-g") == 0) {print_graph = 1;}
+        else {fname = argv[i];}
+    }
+
+    struct daq_config config;
+    if (load_daq_config(fname, &config) == -1)
+    {
+        fprintf(stderr, "Configuration file could not be opened: %s\n", fname);
+        return 2;
+    }
+    char err_buf[4096];
+    int err_cnt = check_daq_config(&config, err_buf, sizeof(err_buf));
+    if (err_cnt)
+    {
+        fputs(err_buf, stderr);
+        return 1;
+    }
+    if (print_graph)
+    {
+        int mask = daq_graph_stages(&config);
+        const char* sep = "";
+        for (int stage = 0; stage < DAQ_GRAPH_STAGE_NUM; stage++)
+        {
+            if (!(mask & DAQ_GRAPH_BIT(stage))) {continue;}
+            printf("%s%s", sep, daq_graph_stage_name(stage));
+            sep = " ";
+        }
+        printf("\n");
+    }
+    return 0;
+}
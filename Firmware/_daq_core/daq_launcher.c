@@ -0,0 +1,564 @@
+/*
+ *
+ * Description :
+ * DAQ chain launcher and supervisor
+ *
+ * Prepares the environment of the DAQ chain (control FIFOs, kernel settings,
+ * port check), starts the processing stages in parallel, pins them according
+ * to the [launcher] section of the configuration file, restarts crashed stages
+ * and reports the time to the first valid and to the first synchronized frame.
+ *
+ * The start order is not gated by the launcher: a producer reports ready only
+ * after its consumer has opened the control FIFOs of the link, so the stages
+ * are synchronized by the shared memory link handshake itself. The ready
+ * events are used for the startup report and for the ready timeout warning.
+ *
+ * Only the stages of the [graph] section are started, stages bypassed by the
+ * configuration (see daq_graph_stages) are left out together with their links.
+ *
+ * Stages report their milestones through the status pipe (see stage_ctrl.h).
+ * Must be started from the Firmware directory, root privileges are required
+ * for the real-time scheduling and for the kernel settings:
+ *      sudo env "PATH=$PATH" ./_daq_core/daq_launcher.out
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <glob.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "log.h"
+#include "daq_config.h"
+#include "sh_mem_util.h"
+#include "stage_ctrl.h"
+
+#define INI_FNAME "daq_chain_config.ini"
+#define LOG_DIR "_logs"
+#define IQ_SERVER_PORT 5000
+#define HWC_SERVER_PORT 5001
+#define PORT_CHECK_RETRIES 5
+#define READY_TIMEOUT_MS 30000 // Warn if a stage does not get ready within this time
+#define POLL_PERIOD_MS 100
+
+#define FATAL_ERR(l) log_fatal(l); return -1;
+
+enum stage_id {
+    STAGE_FIR_DESIGNER, // Runs to completion, the decimator waits for it
+    STAGE_RTL_DAQ,      // rtl_daq | rebuffer pipe, started and restarted together
+    STAGE_REBUFFER,
+    STAGE_DECIMATOR,
+    STAGE_DELAY_SYNC,
+    STAGE_HWC,
+    STAGE_IQ_SERVER,
+    STAGE_NUM
+};
+
+struct stage {
+    const char* name;
+    const char* log_fname;
+    char* const* argv;
+    int enabled;
+    int cpu;
+    pid_t pid;
+    int status_fd;      // Read end of the status pipe, -1 if closed
+    int restarts;
+    int ready;          // The current instance has reported READY
+    int ready_warned;
+    double t_spawn;     // Start of the current instance, the READY timeout is measured from here
+    double t_start;     // Timestamps are measured from the launcher start in [ms], first start for the report
+    double t_ready;
+    double t_first_frame;
+    double t_first_sync;
+};
+
+static char* const argv_fir[]        = {"python3", "fir_filter_designer.py", NULL};
+static char* const argv_rtl_daq[]    = {"_daq_core/rtl_daq.out", NULL};
+static char* const argv_rebuffer[]   = {"_daq_core/rebuffer.out", "0", NULL};
+static char* const argv_decimator[]  = {"_daq_core/decimate.out", NULL};
+static char* const argv_delay_sync[] = {"python3", "_daq_core/delay_sync.py", NULL};
+static char* const argv_hwc[]        = {"python3", "_daq_core/hw_controller.py", NULL};
+static char* const argv_iq_server[]  = {"_daq_core/iq_server.out", NULL};
+
+static struct stage stages[STAGE_NUM] = {
+    [STAGE_FIR_DESIGNER] = {"fir_designer", "fir_filter_designer.log", argv_fir},
+    [STAGE_RTL_DAQ]      = {"rtl_daq",      "rtl_daq.log",             argv_rtl_daq},
+    [STAGE_REBUFFER]     = {"rebuffer",     "rebuffer.log",            argv_rebuffer},
+    [STAGE_DECIMATOR]    = {"decimator",    "decimator.log",           argv_decimator},
+    [STAGE_DELAY_SYNC]   = {"delay_sync",   "delay_sync.log",          argv_delay_sync},
+    [STAGE_HWC]          = {"hwc",          "hwc.log",                 argv_hwc},
+    [STAGE_IQ_SERVER]    = {"iq_server",    "iq_server.log",           argv_iq_server},
+};
+
+static volatile sig_atomic_t exit_request = 0;
+static double t_launch;
+static double t_env_ready;
+static int rt_priority;
+static int report_printed = 0;
+
+static void sig_handler(int signo) {exit_request = 1;}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6 - t_launch;
+}
+
+static int write_sys_file(const char* fname, const char* value)
+{
+    int fd = open(fname, O_WRONLY);
+    if (fd < 0) {return -1;}
+    int ret = write(fd, value, strlen(value)) == (ssize_t) strlen(value) ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+static void prepare_system(void)
+/*
+ * Kernel settings applied by the former start script. Failures are not fatal,
+ * the chain runs without them with degraded performance.
+ */
+{
+    if (write_sys_file("/proc/sys/kernel/sched_rt_runtime_us", "-1") != 0)
+        log_warn("Failed to disable the real-time throttling (%s)", strerror(errno));
+    // Disable the 16 MB limit of the libusb buffers
+    if (write_sys_file("/sys/module/usbcore/parameters/usbfs_memory_mb", "0") != 0)
+        log_warn("Failed to disable the usbfs memory limit (%s)", strerror(errno));
+    sync();
+    if (write_sys_file("/proc/sys/vm/drop_caches", "3") != 0)
+        log_warn("Failed to drop the caches (%s)", strerror(errno));
+}
+
+static int create_fifos(void)
+/*
+ * Stale FIFOs are removed, new ones are created only for the links in use
+ */
+{
+    const char* fifo_names[] = {DECIMATOR_IN_FW_FIFO, DECIMATOR_IN_BW_FIFO,
+                                DECIMATOR_OUT_FW_FIFO, DECIMATOR_OUT_BW_FIFO,
+                                DELAY_SYNC_IQ_FW_FIFO, DELAY_SYNC_IQ_BW_FIFO,
+                                DELAY_SYNC_HWC_FW_FIFO, DELAY_SYNC_HWC_BW_FIFO};
+    const struct stage* producers[] = {&stages[STAGE_REBUFFER], &stages[STAGE_REBUFFER],
+                                       &stages[STAGE_DECIMATOR], &stages[STAGE_DECIMATOR],
+                                       &stages[STAGE_DELAY_SYNC], &stages[STAGE_DELAY_SYNC],
+                                       &stages[STAGE_DELAY_SYNC], &stages[STAGE_DELAY_SYNC]};
+    for (size_t i = 0; i < sizeof(fifo_names)/sizeof(fifo_names[0]); i++)
+    {
+        unlink(fifo_names[i]);
+        if (!producers[i]->enabled) {continue;}
+        if (mkfifo(fifo_names[i], 0666) != 0)
+        {
+            log_fatal("Failed to create control FIFO: %s (%s)", fifo_names[i], strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void remove_old_logs(void)
+{
+    glob_t g;
+    if (glob(LOG_DIR "/*.log", 0, NULL, &g) == 0)
+    {
+        for (size_t i = 0; i < g.gl_pathc; i++) {unlink(g.gl_pathv[i]);}
+        globfree(&g);
+    }
+}
+
+static int is_port_free(int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {return 0;}
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    int ret = bind(sock, (struct sockaddr*) &addr, sizeof(addr));
+    close(sock);
+    return ret == 0;
+}
+
+static void exec_stage(struct stage* st, int status_wr_fd, int stdin_fd, int stdout_fd)
+/*
+ * Runs in the forked child, does not return
+ */
+{
+    char log_path[256];
+    snprintf(log_path, sizeof(log_path), "%s/%s", LOG_DIR, st->log_fname);
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log_fd >= 0) {dup2(log_fd, STDERR_FILENO); close(log_fd);}
+    if (stdin_fd >= 0)  {dup2(stdin_fd, STDIN_FILENO);}
+    if (stdout_fd >= 0) {dup2(stdout_fd, STDOUT_FILENO);}
+    else if (st == &stages[STAGE_FIR_DESIGNER]) {dup2(STDERR_FILENO, STDOUT_FILENO);}
+
+    // The status pipe is the only descriptor inherited through exec
+    fcntl(status_wr_fd, F_SETFD, 0);
+    char fd_str[16];
+    snprintf(fd_str, sizeof(fd_str), "%d", status_wr_fd);
+    setenv(STAGE_STATUS_FD_ENV, fd_str, 1);
+
+    if (rt_priority > 0)
+    {
+        struct sched_param param = {.sched_priority = rt_priority};
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+            fprintf(stderr, "Launcher: failed to set SCHED_FIFO priority %d (%s)\n", rt_priority, strerror(errno));
+    }
+    if (st->cpu >= 0)
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(st->cpu, &cpu_set);
+        if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
+            fprintf(stderr, "Launcher: failed to pin the stage to CPU %d (%s)\n", st->cpu, strerror(errno));
+    }
+    setpgid(0, 0); // Own process group, helpers of the stage are stopped together with it
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGRTMAX, SIG_DFL);
+    execvp(st->argv[0], st->argv);
+    fprintf(stderr, "Launcher: failed to start %s (%s)\n", st->argv[0], strerror(errno));
+    _exit(127);
+}
+
+static int spawn_stage(struct stage* st, int stdin_fd, int stdout_fd)
+{
+    int status_pipe[2];
+    if (pipe2(status_pipe, O_CLOEXEC) != 0) {FATAL_ERR("Failed to create status pipe")}
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(status_pipe[0]);
+        close(status_pipe[1]);
+        FATAL_ERR("Failed to fork stage")
+    }
+    if (pid == 0) {exec_stage(st, status_pipe[1], stdin_fd, stdout_fd);}
+    setpgid(pid, pid); // Also set here to avoid racing with the child
+
+    close(status_pipe[1]);
+    fcntl(status_pipe[0], F_SETFL, O_NONBLOCK);
+    if (st->status_fd >= 0) {close(st->status_fd);}
+    st->status_fd = status_pipe[0];
+    st->pid = pid;
+    st->ready = 0;
+    st->ready_warned = 0;
+    st->t_spawn = now_ms();
+    if (st->t_start < 0) {st->t_start = st->t_spawn;}
+    log_info("Stage started: %s, pid: %d", st->name, pid);
+    return 0;
+}
+
+static int spawn_acquisition(void)
+/*
+ * rtl_daq streams its frames to the rebuffer on a pipe, they are spawned together
+ */
+{
+    int data_pipe[2];
+    if (pipe2(data_pipe, O_CLOEXEC) != 0) {FATAL_ERR("Failed to create data pipe")}
+    int ret = spawn_stage(&stages[STAGE_RTL_DAQ], -1, data_pipe[1]);
+    if (ret == 0) {ret = spawn_stage(&stages[STAGE_REBUFFER], data_pipe[0], -1);}
+    close(data_pipe[0]);
+    close(data_pipe[1]);
+    return ret;
+}
+
+static void read_status(struct stage* st)
+{
+    char events[16];
+    ssize_t n;
+    while ((n = read(st->status_fd, events, sizeof(events))) > 0)
+    {
+        double t = now_ms();
+        for (ssize_t i = 0; i < n; i++)
+        {
+            switch (events[i])
+            {
+                case STAGE_EV_READY:
+                    st->ready = 1;
+                    if (st->t_ready < 0) {st->t_ready = t;}
+                    log_info("Stage ready: %s (%.1f ms)", st->name, t);
+                    break;
+                case STAGE_EV_FIRST_FRAME:
+                    if (st->t_first_frame < 0) {st->t_first_frame = t;}
+                    break;
+                case STAGE_EV_FIRST_SYNC:
+                    if (st->t_first_sync < 0) {st->t_first_sync = t;}
+                    break;
+                default:
+                    log_warn("Unknown status event from %s: 0x%02X", st->name, events[i]);
+            }
+        }
+    }
+    if (n == 0) // Stage closed its end (exited)
+    {
+        close(st->status_fd);
+        st->status_fd = -1;
+    }
+}
+
+static void print_ms(double t)
+{
+    if (t < 0) {printf("%12s", "-");}
+    else {printf("%12.1f", t);}
+}
+
+static void print_report(void)
+{
+    report_printed = 1;
+    printf("\n---- DAQ chain startup breakdown [ms, from launcher start] ----\n");
+    printf("Environment prepared (FIFOs, kernel settings, ports): %.1f\n", t_env_ready);
+    printf("%-14s%12s%12s%12s%12s\n", "stage", "started", "ready", "1st frame", "restarts");
+    for (int i = 0; i < STAGE_NUM; i++)
+    {
+        struct stage* st = &stages[i];
+        if (!st->enabled) {continue;}
+        printf("%-14s", st->name);
+        print_ms(st->t_start);
+        print_ms(st->t_ready);
+        print_ms(st->t_first_frame);
+        printf("%12d\n", st->restarts);
+    }
+    printf("Time to first valid frame       : ");
+    print_ms(stages[STAGE_DELAY_SYNC].t_first_frame);
+    printf("\nTime to first synchronized frame: ");
+    print_ms(stages[STAGE_DELAY_SYNC].t_first_sync);
+    printf("\n---------------------------------------------------------------\n");
+    fflush(stdout);
+}
+
+static void stop_stages(void)
+{
+    for (int i = 0; i < STAGE_NUM; i++)
+        if (stages[i].pid > 0) {kill(-stages[i].pid, SIGRTMAX);}
+    // Give the stages time to exit gracefully
+    for (int t = 0; t < 20; t++)
+    {
+        int running = 0;
+        for (int i = 0; i < STAGE_NUM; i++)
+        {
+            if (stages[i].pid > 0 && waitpid(stages[i].pid, NULL, WNOHANG) == 0) {running = 1;}
+            else {stages[i].pid = 0;}
+        }
+        if (!running) {return;}
+        usleep(100000);
+    }
+    for (int i = 0; i < STAGE_NUM; i++)
+    {
+        if (stages[i].pid > 0)
+        {
+            kill(-stages[i].pid, SIGKILL);
+            waitpid(stages[i].pid, NULL, 0);
+            stages[i].pid = 0;
+        }
+    }
+}
+
+static struct stage* find_stage(pid_t pid)
+{
+    for (int i = 0; i < STAGE_NUM; i++)
+        if (stages[i].pid == pid) {return &stages[i];}
+    return NULL;
+}
+
+static int handle_exit(struct stage* st, int status, int max_restarts)
+/*
+ * Return values:
+ * --------------
+ *      0: Handled, the chain keeps running
+ *     -1: The chain has to be stopped
+ */
+{
+    st->pid = 0;
+    if (st == &stages[STAGE_FIR_DESIGNER])
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {FATAL_ERR("FIR filter design failed, DAQ chain not started!")}
+        log_info("FIR filter coefficients are ready (%.1f ms)", now_ms());
+        return spawn_stage(&stages[STAGE_DECIMATOR], -1, -1);
+    }
+    if (WIFSIGNALED(status))
+        {log_error("Stage %s terminated by signal %d", st->name, WTERMSIG(status));}
+    else
+        {log_error("Stage %s exited with code %d", st->name, WEXITSTATUS(status));}
+
+    if (st->restarts >= max_restarts)
+    {
+        log_fatal("Stage %s reached the restart limit (%d)", st->name, max_restarts);
+        return -1;
+    }
+    st->restarts++;
+    if (st == &stages[STAGE_RTL_DAQ] || st == &stages[STAGE_REBUFFER])
+    {
+        struct stage* peer = (st == &stages[STAGE_RTL_DAQ]) ? &stages[STAGE_REBUFFER] : &stages[STAGE_RTL_DAQ];
+        if (peer->pid > 0)
+        {
+            kill(-peer->pid, SIGRTMAX);
+            waitpid(peer->pid, NULL, 0);
+            peer->pid = 0;
+        }
+        log_warn("Restarting the acquisition stages (%d/%d)", st->restarts, max_restarts);
+        return spawn_acquisition();
+    }
+    log_warn("Restarting stage %s (%d/%d)", st->name, st->restarts, max_restarts);
+    return spawn_stage(st, -1, -1);
+}
+
+int main(int argc, char* argv[])
+{
+    log_set_level(LOG_INFO);
+    t_launch = 0;
+    t_launch = now_ms();
+
+    struct daq_config config;
+    char err_buf[4096];
+    if (load_daq_config(INI_FNAME, &config) == -1) {FATAL_ERR("Configuration could not be loaded, exiting ..")}
+    if (check_daq_config(&config, err_buf, sizeof(err_buf)))
+    {
+        log_fatal("Config file check [ FAIL ]\n%s", err_buf);
+        return -1;
+    }
+    rt_priority = config.rt_priority;
+    stages[STAGE_RTL_DAQ].cpu     = config.cpu_rtl_daq;
+    stages[STAGE_REBUFFER].cpu    = config.cpu_rebuffer;
+    stages[STAGE_DECIMATOR].cpu   = config.cpu_decimator;
+    stages[STAGE_DELAY_SYNC].cpu  = config.cpu_delay_sync;
+    stages[STAGE_HWC].cpu         = config.cpu_hw_controller;
+    stages[STAGE_IQ_SERVER].cpu   = config.cpu_iq_server;
+    stages[STAGE_FIR_DESIGNER].cpu = -1;
+    for (int i = 0; i < STAGE_NUM; i++)
+    {
+        stages[i].enabled = 1;
+        stages[i].status_fd = -1;
+        stages[i].t_start = stages[i].t_ready = stages[i].t_first_frame = stages[i].t_first_sync = -1;
+    }
+    stages[STAGE_IQ_SERVER].enabled = strcmp(config.out_data_iface_type, "eth") == 0;
+
+    /* The FIR designer is only needed by the decimator */
+    int graph_mask = daq_graph_stages(&config);
+    stages[STAGE_DECIMATOR].enabled = (graph_mask & DAQ_GRAPH_BIT(DAQ_GRAPH_DECIMATOR)) != 0;
+    stages[STAGE_FIR_DESIGNER].enabled = stages[STAGE_DECIMATOR].enabled;
+    char graph_str[128] = "";
+    for (int stage = 0; stage < DAQ_GRAPH_STAGE_NUM; stage++)
+    {
+        if (!(graph_mask & DAQ_GRAPH_BIT(stage))) {continue;}
+        if (graph_str[0] != '\0') {strcat(graph_str, " > ");}
+        strcat(graph_str, daq_graph_stage_name(stage));
+    }
+    log_info("Stage graph: %s", graph_str);
+
+    /* Prepare environment */
+    if (create_fifos() != 0) {return -1;}
+    remove_old_logs();
+    prepare_system();
+    int retries = 0;
+    while (!is_port_free(IQ_SERVER_PORT) || !is_port_free(HWC_SERVER_PORT))
+    {
+        if (++retries > PORT_CHECK_RETRIES)
+            {FATAL_ERR("Ports used by the DAQ chain are not free! (5000 & 5001), run daq_stop.sh")}
+        log_warn("Ports used by the DAQ chain are not free! (5000 & 5001), retrying..");
+        sleep(1);
+    }
+    t_env_ready = now_ms();
+
+    struct sigaction sa = {0};
+    sa.sa_handler = sig_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGRTMAX, &sa, NULL);
+
+    /* Start stages, only the decimator waits for the filter design, the others wait on the link handshake */
+    int exit_code = 0;
+    if ((stages[STAGE_FIR_DESIGNER].enabled && spawn_stage(&stages[STAGE_FIR_DESIGNER], -1, -1) != 0) ||
+        spawn_acquisition() != 0 ||
+        spawn_stage(&stages[STAGE_DELAY_SYNC], -1, -1) != 0 ||
+        spawn_stage(&stages[STAGE_HWC], -1, -1) != 0 ||
+        (stages[STAGE_IQ_SERVER].enabled && spawn_stage(&stages[STAGE_IQ_SERVER], -1, -1) != 0))
+    {
+        exit_request = 1;
+        exit_code = -1;
+    }
+
+    /* Supervise */
+    struct pollfd pfds[STAGE_NUM];
+    struct stage* pfd_stages[STAGE_NUM];
+    while (!exit_request)
+    {
+        int nfds = 0;
+        for (int i = 0; i < STAGE_NUM; i++)
+        {
+            if (stages[i].status_fd < 0) {continue;}
+            pfds[nfds].fd = stages[i].status_fd;
+            pfds[nfds].events = POLLIN;
+            pfd_stages[nfds++] = &stages[i];
+        }
+        if (poll(pfds, nfds, POLL_PERIOD_MS) > 0)
+        {
+            for (int i = 0; i < nfds; i++)
+                if (pfds[i].revents) {read_status(pfd_stages[i]);}
+        }
+        if (!report_printed && stages[STAGE_DELAY_SYNC].t_first_sync >= 0) {print_report();}
+
+        double t = now_ms();
+        for (int i = 0; i < STAGE_NUM; i++)
+        {
+            struct stage* st = &stages[i];
+            if (i != STAGE_FIR_DESIGNER && st->pid > 0 && !st->ready && !st->ready_warned &&
+                t - st->t_spawn > READY_TIMEOUT_MS)
+            {
+                log_warn("Stage %s is not ready after %d ms", st->name, READY_TIMEOUT_MS);
+                st->ready_warned = 1;
+            }
+        }
+
+        int status;
+        pid_t pid;
+        while (!exit_request && (pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            struct stage* st = find_stage(pid);
+            if (st == NULL) {continue;}
+            if (handle_exit(st, status, config.max_restarts) != 0)
+            {
+                exit_request = 1;
+                exit_code = -1;
+            }
+        }
+    }
+
+    log_info("Shut down DAQ chain ..");
+    stop_stages();
+    if (!report_printed) {print_report();}
+    return exit_code;
+}
@@ -27,6 +27,8 @@
 import logging
 from ntpath import join
 import sys
+import threading
+import queue
 from struct import pack
 from time import sleep
 from os.path import join
@@ -35,22 +37,92 @@ from os.path import join
 import numpy as np
 import numpy.linalg as lin
 from scipy import fft
-from scipy.optimize import curve_fit
-from configparser import ConfigParser
+from scipy.signal import get_window
 import zmq
 import skrf as rf
 
-import numba as nb
-from numba import jit, njit
-
 # Import HeIMDALL modules
-from iq_header import IQHeader
-from shmemIface import outShmemIface, inShmemIface
+from iq_header import IQHeader, IQHeaderView, IQ_HEADER_SIZE, IQ_DATA_TYPE_SPECTRUM, IQ_FFT_WINDOWS, iq_ch_meta_length
+from shmemIface import outShmemIface, inShmemIface, outSnapshotIface
+from daq_config import load_daq_config, graph_input_link, link_numa_policy, iq_frame_length
+import hdaq_kernels
+from stage_ctrl import stage_notify, STAGE_EV_READY, STAGE_EV_FIRST_FRAME, STAGE_EV_FIRST_SYNC
 import inter_module_messages
 
-# Linear curve definition for curve fitting
-def linear_func(x, a, b):
-    return a*x+b
+def dominant_eigvecs(iq_samples, k, v0, iters=4, oversampling=1):
+    """
+        Estimates the k dominant eigenvalues and eigenvectors of the spatial correlation
+        matrix of the samples, without computing the matrix.
+
+        Implementation notes:
+        ---------------------
+        Subspace iteration on the sample matrix: every step costs two products of the M x N
+        sample matrix with an M x (k+oversampling) block, O(M) per sample instead of the O(M^2)
+        of the correlation matrix, the final Rayleigh-Ritz step extracts the eigenpairs.
+        Started from the correlations of the channels with a reference channel (a column of
+        the correlation matrix) a dominant coherent signal converges in a few steps.
+
+        Parameters:
+        -----------
+            :param: iq_samples  : IQ samples of the channels, M x N
+            :param: k           : Number of the eigenpairs to estimate
+            :param: v0          : Starting vector of M elements
+            :param: iters       : Number of iterations
+            :param: oversampling: Number of the additional vectors iterated along
+
+        Return values:
+        --------------
+            :return: eigenvalues : Estimated eigenvalues in descending order
+            :return: eigenvectors: Estimated eigenvectors in the columns, M x k
+    """
+    M = iq_samples.shape[0]
+    b = min(M, k+oversampling)
+    rng = np.random.default_rng(0) # The additional starting vectors are fixed, results are repeatable
+    Q = np.empty((M, b), dtype=np.complex128)
+    Q[:, 0] = v0
+    Q[:, 1:] = rng.standard_normal((M, b-1)) + 1j*rng.standard_normal((M, b-1))
+    for it in range(iters):
+        Q, _ = lin.qr(Q)
+        Yh = Q.conj().T.astype(iq_samples.dtype) @ iq_samples # b x N, (X^H Q)^H
+        if it == iters-1:
+            break
+        Q = iq_samples @ Yh.conj().T
+    # Rayleigh-Ritz: eigendecomposition of Q^H X X^H Q
+    eigenvalues, U = lin.eigh((Yh @ Yh.conj().T).astype(np.complex128))
+    eigenvectors = Q @ U
+    return eigenvalues[::-1][0:k], eigenvectors[:, ::-1][:, 0:k]
+
+def calc_spectra(iq_samples, window, hop, out):
+    """
+        Computes the windowed spectra of the overlapping segments of every channel.
+
+        Implementation notes:
+        ---------------------
+        The segments are strided views of the samples, they are windowed straight into
+        the output and transformed there with a single batched FFT over all the channels
+        and segments. The bins are left in natural order (DC first) and unnormalized.
+
+        Parameters:
+        -----------
+            :param: iq_samples: IQ samples of the channels, M x N
+            :param: window    : Window coefficients, its length is the FFT size
+            :param: hop       : Distance of the segment starts in samples
+            :param: out       : Flat complex64 buffer of at least M x segments x FFT size elements
+
+        Return values:
+        --------------
+            :return: spectra: View of out, M x segments x FFT size
+    """
+    M, N = iq_samples.shape
+    fft_size = window.size
+    segments = (N-fft_size)//hop + 1
+    frames = np.lib.stride_tricks.sliding_window_view(iq_samples, fft_size, axis=1)[:, ::hop]
+    spectra = out[0:M*segments*fft_size].reshape(M, segments, fft_size)
+    np.multiply(frames, window, out=spectra)
+    result = fft.fft(spectra, axis=2, workers=4, overwrite_x=True)
+    if result.ctypes.data != spectra.ctypes.data: # The transform is not guaranteed to be in place
+        np.copyto(spectra, result)
+    return spectra
 
 class delaySynchronizer():
     
@@ -61,8 +133,11 @@ class delaySynchronizer():
 
         self.module_identifier = 5 # Inter-module message module identifier        
         self.in_shmem_iface = None
-        self.in_shmem_iface_name = ""
+        self.in_shmem_iface_name = "decimator_out"
+        self.out_numa = None # NUMA placement of the IQ output link, None: first touch
+        self.cpi_index = -1 # Counts the input frames when the decimator is bypassed, the first one gets 0 as in the decimator
         self.out_shmem_iface_iq = None
+        self.out_snapshot_iface_iq = None
         self.out_shmem_iface_hwc = None
         
         self.log_level = 0
@@ -71,16 +146,32 @@ class delaySynchronizer():
         self.sync_delay_byte = 'd'.encode('ascii')
         self.sync_reset_byte = 'r'.encode('ascii')
         
-        self.M = 8 # Number of receiver channels 
+        self.M = 8 # Number of active receiver channels 
+        self.M_total = 8 # Number of receiver channels in the system
+        self.ch_mask = (1<<self.M_total)-1 # Active channels of the acquisition, bit m stands for the mth receiver channel
+        self.active_chs = [] # Receiver channel indexes of the active channels
         self.N = 2**18 # Number of samples per channel
         self.R = 12 # Decimation ratio
+        self.iq_frame_length = self.N # Maximum number of samples (or bins) per channel in the output frames
+
+        # Frequency domain output
+        self.en_spectrum = False # Replaces the IQ samples of the output frames with their spectra
+        self.fft_size = 1024
+        self.fft_hop = 1024 # FFT size minus the overlap
+        self.fft_window_code = IQ_FFT_WINDOWS.index("hann")
+        self.fft_window = None
+        self.spectrum_samples = None # Corrected IQ samples of the current frame
+        self.spectrum_bins = None # Spectra of the frame when the IQ server buffer is dropped
+        self.spectrum_header = None # Header of the spectral frames
         
         # Calibration control parameters
         self.N_proc = 2**18        
-        self.std_ch_ind = 0 # Index of standard channel. All channels are matched in delay to this one        
+        self.std_ch_ind = 0 # Index of standard channel among the active channels. All channels are matched in delay to this one        
+        self.std_ch_ind_cfg = 0 # Receiver channel index of the standard channel
         self.en_iq_cal = False # Enables amlitude and phase calibration        
         # IQ calibration adjustment
         self.iq_adjust = np.zeros(self.M, dtype=np.complex64)
+        self.iq_adjust_full = np.ones(self.M_total, dtype=np.complex64) # Adjustment of all the receiver channels
         self.iq_adjust_source = "explicit-time-delay" # "explicit-time-delay" / "touchstone"
         self.iq_adjust_amplitude = None
         self.iq_adjust_time = None
@@ -89,6 +180,13 @@ class delaySynchronizer():
         self.min_corr_peak_dyn_range = 20 # [dB]
         self.corr_peak_offset = 100 # [sample]
         self.cal_track_mode = 0        
+        self.cal_frame_interval = 687 # Maximum number of data frames between two calibration bursts in cal_track_mode=3
+        self.min_blind_dominance = 10 # [dB], minimum ratio of the two largest eigenvalues for the blind estimation
+        self.coh_sample_cnt = 4096 # Number of samples per channel used by the coherence monitor
+        self.min_coh = 0.5 # Minimum coherence magnitude of a channel pair to be monitored
+        self.coh_step_tolerance = 10 # deg, maximum allowable phase step of the coherence between two data frames
+        self.max_eig_ch = 16 # Larger arrays estimate the dominant eigenvectors without the spatial correlation matrix
+        self.corr_block_ch = 8 # Number of channels whose correlation functions are calculated at once
         self.amplitude_cal_mode = "channel_power" # "default" / "disabled" / "channel_power"  -> Updated from .ini
 
         self.phase_diff_tolerance = 3 # deg, maximum allowable phase difference
@@ -108,6 +206,14 @@ class delaySynchronizer():
         self.iq_compensation_cntr = 0 # Count the number of issued iq compensations 
         self.last_update_ind=-3 # Hold the last index when the compensation has sent
         self.last_rf = 0 # Tracks the RF center frequency, recalibration is initiated when changed 
+        self.keep_sample_sync = False # Set on retune, the sample delays do not depend on the RF center frequency
+        self.track_sample_sync = True # Result of the last tracking check, carried by the frames until the next one
+        self.track_iq_sync = True
+        self.iq_corr_cpi_index = 0 # CPI index from which the current IQ corrections are applied
+        self.blind_ref = None # Dominant eigenvector taken on the first confident data frame after a calibration burst
+        self.blind_frame_cntr = 0 # Counts the data frames since the last confident blind estimation
+        self.cal_burst_request = False # Set when calibration frames are requested from the HW controller
+        self.last_coh = None # Coherences measured on the last data frame by the coherence monitor
                 
         # Overwrite default configuration
         self._read_config_file("daq_chain_config.ini")
@@ -128,15 +234,9 @@ class delaySynchronizer():
         self.logger.info("IQ samples per channel {:d}".format(self.N))  
         self.current_state = "STATE_INIT" 
         
-        # List of the channels to be mathced 
-        self.channel_list=(np.arange(self.M).tolist())
-        self.channel_list.remove(self.std_ch_ind)        
-        
-        # Allocations
-        self.corr_functions = np.zeros((self.M, self.N_proc*2))
-        self.delays = np.zeros(self.M, dtype=int) # Holds the calculated samples delay
-        self.iq_corrections = np.ones(self.M, dtype=np.complex64) # This vector holds the IQ compensation values
-        self.iq_diff_ref = np.ones(self.M, dtype=np.complex64) # Reference IQ difference vector used in the tracking mode
+        self.cal_worker = CalibrationWorker(self._calc_calibration)
+        # Channel list and allocations, all the channels are active until the frames tell otherwise
+        self._set_channel_mask(self.ch_mask)
         
         self.logger.info("Delay synchronizer initialized")
     
@@ -156,75 +256,151 @@ class delaySynchronizer():
                 :return: 0: Confiugrations fields succesfully applied
                         -1: Configuration file not found
         """
-        parser = ConfigParser()
-        found = parser.read([config_filename])
-        if not found:
+        config, ret = load_daq_config(config_filename)
+        if ret == -1:
             self.logger.error("DAQ core configuration file not found. Default parameters will be used!")
             return -1
-        self.N = parser.getint('pre_processing', 'cpi_size')
-        self.M = parser.getint('hw', 'num_ch')
-        self.R = parser.getint('pre_processing', 'decimation_ratio')
-        self.N_proc = parser.getint('calibration', 'corr_size')
-        self.std_ch_ind = parser.getint('calibration','std_ch_ind')
-        self.amp_diff_tolerance = parser.getint('calibration', 'amplitude_tolerance')
-        self.phase_diff_tolerance = parser.getint('calibration', 'phase_tolerance')
-        self.cal_track_mode = parser.getint('calibration','cal_track_mode')
-        self.max_sync_fails = parser.getint('calibration','maximum_sync_fails')
-        self.amplitude_cal_mode = parser.get('calibration','amplitude_cal_mode')
+        elif ret == -2:
+            self.logger.error("Invalid configuration fields: {0}".format(config.invalid_fields.decode()))
+        self.N = config.cpi_size
+        self.M = config.num_ch
+        self.M_total = config.num_ch
+        self.ch_mask = (1<<self.M_total)-1
+        self.R = config.decimation_ratio
+        self.N_proc = config.corr_size
+        self.std_ch_ind = config.std_ch_ind
+        self.std_ch_ind_cfg = config.std_ch_ind
+        self.amp_diff_tolerance = config.amplitude_tolerance
+        self.phase_diff_tolerance = config.phase_tolerance
+        self.cal_track_mode = config.cal_track_mode
+        self.cal_frame_interval = config.cal_frame_interval
+        self.max_sync_fails = config.maximum_sync_fails
+        self.amplitude_cal_mode = config.amplitude_cal_mode.decode()
+        self.iq_frame_length = iq_frame_length(config)
+        self.en_spectrum = bool(config.en_spectrum)
+        if self.en_spectrum:
+            self.fft_size = config.spectrum_fft_size
+            self.fft_hop = config.spectrum_fft_size - config.spectrum_overlap
+            self.fft_window_code = IQ_FFT_WINDOWS.index(config.spectrum_window.decode())
+            window_name = config.spectrum_window.decode().replace("rectangular", "boxcar")
+            self.fft_window = get_window(window_name, self.fft_size).astype(np.float32)
+            self.logger.info("Spectrum output: FFT size {:d}, hop {:d}, {:s} window".format(
+                             self.fft_size, self.fft_hop, config.spectrum_window.decode()))
+        # The input is the raw rebuffer output when the decimator is bypassed
+        in_link = graph_input_link(config, "delay_sync")
+        if in_link is not None:
+            self.in_shmem_iface_name = in_link
+        self.out_numa = link_numa_policy(config, "delay_sync")
         
-        if parser.getint('calibration', 'en_iq_cal'):
+        if config.en_iq_cal:
             self.en_iq_cal = True
         else:
             self.en_iq_cal = False
         
-        self.log_level=(parser.getint('daq', 'log_level')*10)
+        self.log_level=(config.log_level*10)
 
         # Convert to voltage ratio
         self.amp_diff_tolerance = 10**(self.amp_diff_tolerance/20)
         
         # External IQ calibration adjustment
-        self.iq_adjust_source = parser.get('calibration','iq_adjust_source')
+        self.iq_adjust_source = config.iq_adjust_source.decode()
 
-        daq_rf  = parser.getint('daq', 'center_freq') # Read RF center frequency for phase offset calculation
+        daq_rf  = config.center_freq # Read RF center frequency for phase offset calculation
 
         if self.iq_adjust_source == "explicit-time-delay":
-            iq_adjust_amplitude_str = parser.get('calibration','iq_adjust_amplitude')
-            iq_adjust_amplitude_str = iq_adjust_amplitude_str.split(',')[0:self.M-1]
-            iq_adjust_amplitude     = list(map(float, iq_adjust_amplitude_str))
+            iq_adjust_amplitude     = config.get_list('iq_adjust_amplitude')[0:self.M_total-1]
             self.iq_adjust_amplitude     = 10**(np.array(iq_adjust_amplitude)/20) # Convert to voltage relations
             
-            iq_adjust_time_str  = parser.get('calibration','iq_adjust_time_delay_ns')
-            iq_adjust_time_str  = iq_adjust_time_str.split(',')[0:self.M-1]
-            self.iq_adjust_time = np.array(list(map(float, iq_adjust_time_str)))*10**-9
-
-            iq_adjust_phase     = self.iq_adjust_time*daq_rf*2*np.pi  # Convert time delay to phase         
-
-            self.iq_adjust = self.iq_adjust_amplitude * np.exp(1j*iq_adjust_phase) # Assemble IQ adjustment vector
-            self.iq_adjust = np.insert(self.iq_adjust, self.std_ch_ind, 1+0j)
+            iq_adjust_time      = config.get_list('iq_adjust_time_delay_ns')[0:self.M_total-1]
+            self.iq_adjust_time = np.array(iq_adjust_time)*10**-9
         elif self.iq_adjust_source == "touchstone":
-            for m in range(self.M):
+            for m in range(self.M_total):
                 fname = join("_calibration", f"cable_ch{m}.s1p")
                 self.logger.info(f"Loading: {fname}")
                 net = rf.Network(fname)
                 if self.iq_adjust_table is None:
-                    self.iq_adjust_table = np.zeros((len(net.f),self.M+1), dtype=complex)
+                    self.iq_adjust_table = np.zeros((len(net.f),self.M_total+1), dtype=complex)
                     self.iq_adjust_table[:,0] = net.f[:]
                 self.iq_adjust_table[:,m+1] = net.s[:,0,0]
             self.logger.info(f"{self.iq_adjust_table.shape}")
-            self.iq_adjust = self.iq_adjust_table[np.argmin(abs(self.iq_adjust_table[:,0]-daq_rf)), 1::]
         
-        self.iq_adjust /= self.iq_adjust[self.std_ch_ind]
+        self.iq_adjust_full = self._calc_iq_adjust(daq_rf)
+        self.iq_adjust = self.iq_adjust_full
         self.logger.info(f"IQ adjustment vector: abs:{abs(self.iq_adjust)}")
         self.logger.info(f"IQ adjustment vector: phase:{np.rad2deg(np.angle(self.iq_adjust))}")
          
 
         return 0
+
+    def _calc_iq_adjust(self, daq_rf):
+        """
+            Assembles the IQ adjustment vector of all the receiver channels for the given
+            RF center frequency, normalized to the standard channel
+        """
+        if self.iq_adjust_source == "explicit-time-delay":
+            iq_adjust_phase = self.iq_adjust_time*daq_rf*2*np.pi  # Convert time delay to phase         
+            iq_adjust = self.iq_adjust_amplitude * np.exp(1j*iq_adjust_phase) # Assemble IQ adjustment vector
+            iq_adjust = np.insert(iq_adjust, self.std_ch_ind_cfg, 1+0j)
+        else: # touchstone
+            iq_adjust = self.iq_adjust_table[np.argmin(abs(self.iq_adjust_table[:,0]-daq_rf)), 1::]
+        return iq_adjust / iq_adjust[self.std_ch_ind_cfg]
+
+    def _set_channel_mask(self, ch_mask):
+        """
+            Adapts the processing to the set of active channels. The payload of the frames
+            holds the active channels in ascending receiver channel order, the synchronization
+            is restarted on the new set of channels.
+
+            Parameters:
+            -----------
+                :param: ch_mask: Bit m stands for the mth receiver channel
+                :type : ch_mask: int
+        """
+        self.cal_worker.drain() # The result computed on the former channel set is dropped
+        self.ch_mask = ch_mask
+        self.active_chs = [m for m in range(self.M_total) if ch_mask & 1<<m]
+        self.M = len(self.active_chs)
+        if self.std_ch_ind_cfg in self.active_chs:
+            self.std_ch_ind = self.active_chs.index(self.std_ch_ind_cfg)
+        else:
+            self.logger.error("Standard channel {:d} is disabled, channel {:d} is used instead".format(self.std_ch_ind_cfg, self.active_chs[0]))
+            self.std_ch_ind = 0
+        self.logger.info("Active channel mask: 0x{:08X}, channels: {}".format(ch_mask, self.active_chs))
+
+        # List of the channels to be mathced 
+        self.channel_list=(np.arange(self.M).tolist())
+        self.channel_list.remove(self.std_ch_ind)        
+        
+        # Allocations
+        self.delays = np.zeros(self.M, dtype=int) # Holds the calculated samples delay
+        self.iq_diff_ref = np.ones(self.M, dtype=np.complex64) # Reference IQ difference vector used in the tracking mode
+        self.iq_adjust = self.iq_adjust_full[self.active_chs]
+        self.iq_adjust /= self.iq_adjust[self.std_ch_ind]
+        self._set_iq_corrections(self.iq_adjust) # This vector holds the IQ compensation values
+
+        # Disabled channels keep streaming, the sample sync of a tracked system is kept
+        self.keep_sample_sync = self.current_state in ("STATE_TRACK_LOCK", "STATE_TRACK")
+        self.blind_ref = None
+        self.sync_failed_cntr = 0
+        self.current_state = "STATE_INIT"
+
+    def _to_receiver_channels(self, values):
+        """
+            Scatters the values of the active channels to the receiver channels, disabled
+            channels get 0
+        """
+        values_rx = [0]*self.M_total
+        for m, ch in enumerate(self.active_chs):
+            values_rx[ch] = values[m]
+        return values_rx
+
     def open_interfaces(self):
         """
             Opens the communication interfaces of the module including the
             input and output shared memory interfaces and the FIFO control interface.
             
-            Input shared memory interface: IQ data from the decimator module
+            Input shared memory interface: IQ data from the decimator module, or the raw
+            IQ data from the rebuffer module when the decimator is bypassed
             Out shared memory interfaces: Towards the IQ Server or the DSP module and to
             the Hardware Controller module.
 
@@ -242,21 +418,34 @@ class delaySynchronizer():
         self.rtl_daq_socket.connect("tcp://localhost:1130")
         
         # Open shared memory interface to receive data from the decimator
-        self.in_shmem_iface = inShmemIface("decimator_out")
+        self.logger.info("Input link: {:s}".format(self.in_shmem_iface_name))
+        self.in_shmem_iface = inShmemIface(self.in_shmem_iface_name)
         if not self.in_shmem_iface.init_ok:
-            self.logger.critical("Shared memory (Decimator) initialization failed, exiting..")
+            self.logger.critical("Shared memory ({:s}) initialization failed, exiting..".format(self.in_shmem_iface_name))
             return -1
         
         # Open shared memory interface towards the iq server module
-        if self.N >= self.N_proc: out_shmem_size = int(1024+self.N*2*self.M*(32/8))
-        else: out_shmem_size = int(1024+self.N_proc*2*self.M*(32/8))
+        head_size = IQ_HEADER_SIZE + iq_ch_meta_length(self.M_total) # Header and per-channel metadata
+        out_shmem_size = int(head_size+max(self.iq_frame_length, self.N, self.N_proc)*2*self.M*(32/8))
+        if self.en_spectrum:
+            # The samples are corrected in a private buffer, the spectra are written into the output frames
+            self.spectrum_samples = np.empty(self.M*max(self.N, self.N_proc), dtype=np.complex64)
+            self.spectrum_bins = np.empty(self.M*self.iq_frame_length, dtype=np.complex64)
+            self.spectrum_header = np.empty(head_size, dtype=np.uint8)
         self.out_shmem_iface_iq = outShmemIface("delay_sync_iq",
                                  out_shmem_size,
-                                 drop_mode = True)
+                                 drop_mode = True,
+                                 numa = self.out_numa)
         if not self.out_shmem_iface_iq.init_ok:
             self.logger.critical("Shared memory (IQ server) initialization failed, exiting..")
             return -1
 
+        # Latest frame snapshot for the monitoring clients, they never block the chain
+        self.out_snapshot_iface_iq = outSnapshotIface("delay_sync_iq", out_shmem_size)
+        if not self.out_snapshot_iface_iq.init_ok:
+            self.logger.warning("Snapshot link is not available, monitoring clients are disabled")
+            self.out_snapshot_iface_iq = None
+
         # Open shared memory interface towards the hardware controller module
         self.out_shmem_iface_hwc = outShmemIface("delay_sync_hwc",
                                  out_shmem_size,
@@ -277,13 +466,16 @@ class delaySynchronizer():
             sleep(2)
             self.out_shmem_iface_iq.destory_sm_buffer()        
 
+        if self.out_snapshot_iface_iq is not None:
+            self.out_snapshot_iface_iq.destory_sm_buffer()
+
         if self.out_shmem_iface_hwc is not None:
             self.out_shmem_iface_hwc.send_ctr_terminate()
             sleep(2)
             self.out_shmem_iface_hwc.destory_sm_buffer()  
             
         self.logger.info("Interfaces are closed")
-    def calc_iq_sync(self, iq_samples):
+    def calc_iq_sync(self, iq_samples, channel_list, std_ch_ind):
         """
             This function calculates the synchronization status of the signal processing channels.
             
@@ -299,7 +491,11 @@ class delaySynchronizer():
             Parameters:
             -----------
                 :param: iq_samples: Processed IQ samples  (May contain less samples than what can be found in a frame)
+                :param: channel_list: Channels to be matched to the standard channel
+                :param: std_ch_ind: Index of the standard channel
                 :type : iq_samples: Complex 2D numpy array
+                :type : channel_list: list of ints
+                :type : std_ch_ind: int
             
             Return values:
             --------------
@@ -309,47 +505,124 @@ class delaySynchronizer():
                 :rtype : iq_diffs  : Complex 1D numpy array
                 
         """
-        iq_diffs   = np.ones(self.M, dtype=np.complex64)
-        dyn_ranges = []        
-
-        # Calculate cross-correlations to check sample level synchrony
-        for m in self.channel_list:
-            # Correlation at zero offset 
-            iq_diffs[m]     = self.N_proc / (np.dot(iq_samples[m, :], 
-                                                  iq_samples[self.std_ch_ind, :].conj()))
-            # Correlation at the spcified offset
-            corr_at_offset_m =  self.N_proc / (np.dot(iq_samples[m, self.corr_peak_offset::],
-                                                   iq_samples[self.std_ch_ind, 0:-self.corr_peak_offset].conj()))
-            # Check dynamic range
-            dyn_ranges.append(-20*np.log10(abs(iq_diffs[m]) / abs(corr_at_offset_m)))
-
-        # Calculate Spatial correlation matrix to determine amplitude-phase missmatches         
-        Rxx = iq_samples.dot(np.conj(iq_samples.T))
-        # Perform eigen-decomposition
-        eigenvalues, eigenvectors = lin.eig(Rxx)
-        # Get dominant eigenvector
-        max_eig_index = np.argmax(np.abs(eigenvalues))
-        vmax  = eigenvectors[:, max_eig_index] 
+        # Calculate cross-correlations with the standard channel to check sample level synchrony,
+        # all the channels at once
+        M = iq_samples.shape[0]
+        std_ch = iq_samples[std_ch_ind, :]
+        corr_at_zero   = iq_samples @ std_ch.conj() # Correlation at zero offset
+        corr_at_offset = iq_samples[:, self.corr_peak_offset::] @ std_ch[0:-self.corr_peak_offset].conj() # Correlation at the spcified offset
+        # Check dynamic range
+        dyn_ranges = (20*np.log10(abs(corr_at_zero) / abs(corr_at_offset)))[channel_list]
+
+        if M <= self.max_eig_ch:
+            # Calculate Spatial correlation matrix to determine amplitude-phase missmatches         
+            Rxx = iq_samples.dot(np.conj(iq_samples.T))
+            # Perform eigen-decomposition
+            eigenvalues, eigenvectors = lin.eig(Rxx)
+            # Get dominant eigenvector
+            max_eig_index = np.argmax(np.abs(eigenvalues))
+            vmax  = eigenvectors[:, max_eig_index] 
+        else:
+            vmax = dominant_eigvecs(iq_samples, 1, corr_at_zero)[1][:, 0]
         iq_diffs = 1 / vmax
-        iq_diffs /= iq_diffs[self.std_ch_ind]
+        iq_diffs /= iq_diffs[std_ch_ind]
 
         # Amplitude correction -  scaling IQ diferences
         if self.amplitude_cal_mode == "channel_power":
-            channel_powers = list(map(lambda ch_ind: np.dot(iq_samples[ch_ind, :], iq_samples[ch_ind, :].conj())/self.N_proc, np.arange(self.M)))
-            iq_diffs       = np.array(list(map(lambda m: iq_diffs[m]/np.abs(iq_diffs[m])*
-                                                         np.sqrt(channel_powers[self.std_ch_ind]/channel_powers[m]),
-                                           np.arange(self.M))))
+            channel_powers = np.array([np.vdot(iq_samples[m, :], iq_samples[m, :]).real for m in range(M)])/self.N_proc
+            iq_diffs       = iq_diffs/np.abs(iq_diffs)*np.sqrt(channel_powers[std_ch_ind]/channel_powers)
         elif self.amplitude_cal_mode == "disabled":            
-            iq_diffs        = np.array(list(map(lambda m: iq_diffs[m]/np.abs(iq_diffs[m]), np.arange(self.M))))
+            iq_diffs        = iq_diffs/np.abs(iq_diffs)
     
             return np.array(dyn_ranges), iq_diffs
 
-        for m in range(self.M):
+        for m in range(M):
             self.logger.debug("Channel: {:d}, Peak dyn. range: {:.2f}[min: {:.2f}], Amp.:{:.2f}, Phase:{:.2f} ".format(\
                             m, dyn_ranges[-1], self.min_corr_peak_dyn_range, 20*np.log10(abs(iq_diffs[m])), 
                             np.rad2deg(np.angle(iq_diffs[m]))))  
 
         return np.array(dyn_ranges), iq_diffs
+    def calc_blind_track(self, iq_samples, std_ch_ind):
+        """
+            Estimates the amplitude and phase of the channels from data frames, without the noise source.
+
+            Implementation notes:
+            ---------------------
+            When a single coherent signal dominates the scene, the dominant eigenvector of the 
+            spatial-correlation matrix is the array response of this signal multiplied by the residual
+            channel errors. Compared to the eigenvector taken after the last calibration burst, it reveals
+            the drift of the channels as long as the signal scene is static. A changing scene can not be 
+            distinguished from drift, therefore the estimate is only used to decide when a new calibration
+            burst is needed, the IQ corrections are updated only on calibration frames.
+
+            Parameters:
+            -----------
+                :param: iq_samples: Processed IQ samples of a data frame
+                :param: std_ch_ind: Index of the standard channel
+                :type : iq_samples: Complex 2D numpy array
+                :type : std_ch_ind: int
+            
+            Return values:
+            --------------
+                :return: dominance: Ratio of the two largest eigenvalues [dB], confidence of the estimate
+                :return: vmax     : Dominant eigenvector normalized to the standard channel
+                :rtype : dominance: float
+                :rtype : vmax     : Complex 1D numpy array
+        """
+        if iq_samples.shape[0] <= self.max_eig_ch:
+            Rxx = iq_samples.dot(np.conj(iq_samples.T))
+            eigenvalues, eigenvectors = lin.eigh(Rxx) # Ascending order
+        else:
+            std_ch = iq_samples[std_ch_ind, :]
+            eigenvalues, eigenvectors = dominant_eigvecs(iq_samples, 2, iq_samples @ std_ch.conj(), oversampling=2)
+            eigenvalues, eigenvectors = eigenvalues[::-1], eigenvectors[:, ::-1]
+        dominance = 10*np.log10(eigenvalues[-1] / max(eigenvalues[-2], np.finfo(np.float32).tiny))
+        vmax = eigenvectors[:, -1]
+        vmax = vmax / vmax[std_ch_ind]
+        return dominance, vmax
+
+    def check_coherence_step(self, iq_samples):
+        """
+            Coherence monitor, checks the synchronization of the channels on every data frame.
+
+            Implementation notes:
+            ---------------------
+            The normalized cross-correlation of the channels with the standard channel is calculated at zero 
+            lag on a subsampled copy of the frame and compared to the value measured on the previous data frame.
+            A phase step of a coherent channel pair, or the coherence loss of only a part of the channels 
+            indicates that the synchronization is lost. The signal scene changes slowly compared to the frame 
+            rate, and its changes tend to affect all the channels at once.
+
+            Parameters:
+            -----------
+                :param: iq_samples: Processed IQ samples of a data frame
+                :type : iq_samples: Complex 2D numpy array
+            
+            Return values:
+            --------------
+                :return: True when a step change is detected
+                :rtype : bool
+        """
+        x = iq_samples[:, ::max(1, iq_samples.shape[1]//self.coh_sample_cnt)]
+        powers = np.sum(np.abs(x)**2, axis=1)
+        coh = x.dot(x[self.std_ch_ind, :].conj()) / np.sqrt(powers*powers[self.std_ch_ind] + np.finfo(np.float32).tiny)
+        coh = coh[self.channel_list]
+        last_coh = self.last_coh
+        self.last_coh = coh
+        if last_coh is None:
+            return False
+
+        coherent      = abs(coh) >= self.min_coh
+        last_coherent = abs(last_coh) >= self.min_coh
+        monitored     = coherent & last_coherent
+        phase_steps   = abs(np.rad2deg(np.angle(coh[monitored] / last_coh[monitored])))
+        lost          = last_coherent & ~coherent
+        if (phase_steps > self.coh_step_tolerance).any() or (lost.any() and not lost.all()):
+            self.logger.warning("Coherence step detected [{:d}], magnitudes: {} phase steps: {}".format(
+                                self.iq_header.cpi_index, abs(coh), np.rad2deg(np.angle(coh / last_coh))))
+            return True
+        return False
+
     def estimate_frac_delays(self, iq_samples, block_size=2**10):
         """
             This function estimates the fractional sample delay between the coherent receiver channels
@@ -364,6 +637,8 @@ class delaySynchronizer():
             The phase-frequency function estimation is realized by splitting the full signal array into smaller block, on which 
             the phase difference is estimated individually. The block-wise obtained results are then are averaged. 
             The sample size of a cohrent-block is controlled by the "block_size" parameter of the function.
+            The blocks of corr_block_ch channels are transformed at once and the linear curves of all the
+            channels are fitted together (least squares), so the cost grows linearly with the channels.
 
             Parameters:
             -----------
@@ -383,9 +658,9 @@ class delaySynchronizer():
         """
             Initialization
         """
-        taus = []
         N = iq_samples.shape[1] # Number of samples
         M = iq_samples.shape[0] # Number of channels
+        block_cnt = N//block_size
         
         freq_scale = np.arange(-0.5,0.5,1/block_size)
         fit_mask   = np.logical_and(freq_scale < 0.4, freq_scale > -0.4)
@@ -394,38 +669,335 @@ class delaySynchronizer():
         """
             Processing
         """
+        # Correct fix phase offset
+        phase_shift_w0 = iq_samples[1:] @ iq_samples[0].conj() / N
+        iq_samples[1:] *= phase_shift_w0.conj()[:, None]
+
         # Estimate phase transfer
-        std_ch_w_block = np.zeros((N//block_size, block_size), dtype=np.complex64)
+        iq_blocks = iq_samples[:, 0:block_cnt*block_size].reshape(M, block_cnt, block_size)
         #  - Transform standard channel to frequency domain block-wise
-        for block_index, block_start in enumerate(np.arange(0,N, block_size)):
-            std_ch_w_block[block_index,:] =  fft.fftshift(fft.fft(iq_samples[0, block_start:block_start+block_size], workers=4, overwrite_x=False))
+        std_ch_w_block = fft.fftshift(fft.fft(iq_blocks[0], axis=1, workers=4), axes=1)
+
+        for m_start in range(1, M, self.corr_block_ch):
+            m_end = min(M, m_start+self.corr_block_ch)
+            # Transform the blocks of the current channels to frequency domain
+            corr_ch_w_block = fft.fftshift(fft.fft(iq_blocks[m_start:m_end], axis=2, workers=4), axes=2)
+            # Calculate phase transfer with non-coherent integration
+            phase_diff_w[m_start-1:m_end-1, :] = np.sum(std_ch_w_block/corr_ch_w_block, axis=1) / block_cnt # Normalization
+            
+        angle_diff_w = np.angle(phase_diff_w).real # Convert complex phasor to angle
+
+        # Fit linear curves on to the estimated phase transfers and derive fractional delays
+        x = freq_scale[fit_mask] - np.mean(freq_scale[fit_mask])
+        y = angle_diff_w[:, fit_mask]
+        slopes = (y @ x) / (x @ x)
+        taus = list(slopes/(2*np.pi))
 
-        for m in range(M-1):
-            # Correct fix phase offset
-            phase_shift_w0 = np.average(iq_samples[0]*iq_samples[m+1].conj())
-            iq_samples[m+1] *= phase_shift_w0
+        return taus
+
+    def calc_sample_delays(self, iq_samples, channel_list, std_ch_ind):
+        """
+            Estimates the integer sample delays of the channels from the peak positions
+            of their cross-correlation functions with the standard channel.
+
+            Parameters:
+            -----------
+                :param: iq_samples: Calibration IQ samples (N_proc samples per channel)
+                :param: channel_list: Channels to be matched to the standard channel
+                :param: std_ch_ind: Index of the standard channel
+                :type : iq_samples: Complex 2D numpy array
+                :type : channel_list: list of ints
+                :type : std_ch_ind: int
+
+            Return values:
+            --------------
+                :return: sample_sync_flag : True when all the channels are aligned
+                :return: delay_update_flag: True when the sampling frequencies have to be tuned
+                :return: fs_ppm_offsets   : Sampling frequency offsets to apply
+                :return: delays           : Estimated sample delays of the channels
+        """
+        M = iq_samples.shape[0]
+        sample_sync_flag  = True
+        delay_update_flag = False
+        fs_ppm_offsets    = [0]*M
+        delays            = np.zeros(M, dtype=int)
+
+        # ->  Calculate correlation functions, blocks of channels are transformed at once and
+        #     only the peaks are kept
+        np_zeros = np.zeros(self.N_proc, dtype=np.complex64)
+        x_padd = np.concatenate([iq_samples[std_ch_ind, 0:self.N_proc], np_zeros])
+        x_fft = fft.fft(x_padd, workers=4, overwrite_x=True)
+
+        peak_indexes = np.zeros(M, dtype=int)
+        dyn_ranges = np.zeros(M)
+        y_padd = np.zeros((min(self.corr_block_ch, M), 2*self.N_proc), dtype=np.complex64)
+        for block_start in range(0, len(channel_list), self.corr_block_ch):
+            chs = channel_list[block_start:block_start+self.corr_block_ch]
+            y_padd[0:len(chs), self.N_proc:] = iq_samples[chs, 0:self.N_proc]
+            y_fft = fft.fft(y_padd[0:len(chs)], axis=1, workers=4)
+            corr_functions = np.abs(fft.ifft(x_fft.conj() * y_fft, axis=1, workers=4, overwrite_x=True))**2
+            peaks = np.argmax(corr_functions, axis=1)
+            # TODO: Check overindexing
+            rows = np.arange(len(chs))
+            peak_indexes[chs] = peaks
+            dyn_ranges[chs] = 10*np.log10(corr_functions[rows, peaks].astype(np.float64) /
+                                          corr_functions[rows, peaks+self.corr_peak_offset])
+
+        # ->  Calculate sample delays, check dynamic range
+        # WARNING: This dynamic range checking assumes dirac like coorelation peak                    
+        for m in channel_list:
+            peak_index = peak_indexes[m]
+
+            # Check dynamic range
+            dyn_range = dyn_ranges[m]
+            if dyn_range < self.min_corr_peak_dyn_range:
+                self.logger.warning("Correlation peak dynamic range is insufficient to perform calibration")
+                self.logger.warning("Real value: {:.2f}, minimum: {:.2f}".format(dyn_range, self.min_corr_peak_dyn_range))
+                delay_update_flag = False
+                sample_sync_flag = False # Sync can not be checked properly
+                break
             
-            for block_index, block_start in enumerate(np.arange(0,N, block_size)):
-                # Transform current block of the m-th channel to frequency domain
-                corr_ch_w_block  = fft.fftshift(fft.fft(iq_samples[m+1, block_start:block_start+block_size], workers=4, overwrite_x=True))
-                # Calculate phase transfer with non-coherent integration
-                phase_diff_w[m,:] += std_ch_w_block[block_index,:]/corr_ch_w_block
-            phase_diff_w[m,:] /= (N//block_size) # Normalization
+            # Calculate sample offset
+            delays[m] = (self.N_proc - peak_index)                              
+            fs_tune_gain_m = (self.INT_FS_TUNE_GAIN[1,(self.INT_FS_TUNE_GAIN[0,:] <= abs(delays[m]))])[0]      
+            fs_ppm_offsets[m] = -1*delays[m] * fs_tune_gain_m * self.MIN_FS_PPM_OFFSET                        
+            if abs(fs_ppm_offsets[m]) > self.MAX_FS_PPM_OFFSET:
+                fs_ppm_offsets[m] = np.sign(fs_ppm_offsets[m])*self.MAX_FS_PPM_OFFSET                        
+
+            if np.abs(delays[m]) >= 1:
+                sample_sync_flag = False # Misalling detected
+                delay_update_flag = True
+            self.logger.debug("Channel {:d}, delay: {:d}, tune gain: {:d} ppm-offset: {:.7f}, ".format(m, delays[m], fs_tune_gain_m, fs_ppm_offsets[m]))
+
+        return sample_sync_flag, delay_update_flag, fs_ppm_offsets, delays
+
+    def _calc_calibration(self, state, frame_type, iq_samples, channel_list, std_ch_ind):
+        """
+            Calibration computation requested by the given state, runs on the calibration worker.
+            The channel layout is taken from the submitted job, the worker does not touch the
+            state of the synchronizer.
+        """
+        if state == "STATE_TRACK" and self.cal_track_mode == 3 and frame_type == IQHeader.FRAME_TYPE_DATA:
+            return self.calc_blind_track(iq_samples, std_ch_ind)
+        elif state == "STATE_SAMPLE_CAL":
+            return self.calc_sample_delays(iq_samples, channel_list, std_ch_ind)
+        elif state == "STATE_FRAC_SAMPLE_CAL":
+            return self.estimate_frac_delays(iq_samples)
+        else: # STATE_IQ_CAL, STATE_TRACK_LOCK, STATE_TRACK
+            return self.calc_iq_sync(iq_samples, channel_list, std_ch_ind)
+
+    def _submit_cal(self, iq_samples):
+        """
+            Hands over the first N_proc samples of the current frame to the calibration worker.
+            Frames arriving while the worker is busy are forwarded without being checked.
+        """
+        if not self.cal_worker.busy:
+            self.cal_worker.submit(self.current_state, self.iq_header.frame_type, self.iq_header.cpi_index,
+                                   self.iq_header.rf_center_freq, iq_samples[:, 0:self.N_proc],
+                                   self.channel_list, self.std_ch_ind)
+
+    def _set_iq_corrections(self, iq_corrections):
+        """
+            Replaces the IQ correction vector, it takes effect from the current frame
+        """
+        self.iq_corrections = np.array(iq_corrections, dtype=np.complex64)
+        self.iq_corr_cpi_index = self.iq_header.cpi_index
+        self.last_coh = None
+
+    def _enter_track(self, rf_center_freq):
+        self.track_sample_sync = True
+        self.track_iq_sync = True
+        self.last_rf = rf_center_freq
+        self.blind_ref = None
+        self.blind_frame_cntr = 0
+        self.cal_burst_request = False
+        self.last_coh = None
+        self.current_state = "STATE_TRACK"
+
+    def _apply_blind_result(self, dominance, vmax):
+        """
+            Requests a calibration burst when the drift estimated on the data frames exceeds the tolerances
+        """
+        if dominance < self.min_blind_dominance:
+            return # No dominant signal, the estimate is not reliable
+        self.blind_frame_cntr = 0
+        if self.blind_ref is None:
+            self.blind_ref = vmax
+            return
+        drifts = vmax / self.blind_ref
+        if (abs(np.rad2deg(np.angle(drifts))) > self.phase_diff_tolerance).any() or \
+           (abs(drifts) > self.amp_diff_tolerance).any() or (1/abs(drifts) > self.amp_diff_tolerance).any():
+            if not self.cal_burst_request:
+                self.logger.info("Blind drift estimate is out of tolerance, requesting calibration burst [{:d}]".format(self.iq_header.cpi_index))
+                self.logger.debug("Amplitude drifts: {0}".format(20*np.log10(np.abs(drifts))))
+                self.logger.debug("Phase drifts: {0}".format(np.rad2deg(np.angle(drifts))))
+            self.cal_burst_request = True
+
+    def _apply_cal_result(self, state, frame_type, cpi_index, rf_center_freq, result):
+        """
+            Steps the state machine with the result of a calibration computation.
+            Results are dropped when the requesting state has been left in the meantime.
+
+            Parameters:
+            -----------
+                :param: state         : State that requested the computation
+                :param: frame_type    : Type of the processed frame
+                :param: cpi_index     : CPI index of the processed frame
+                :param: rf_center_freq: RF center frequency of the processed frame
+                :param: result        : Return value of the computation, None if it has failed
+        """
+        if result is None or state != self.current_state:
+            return
+        self.logger.debug("Calibration result of {:s} [{:d}] applied at [{:d}]".format(state, cpi_index, self.iq_header.cpi_index))
+
+        if state == "STATE_SAMPLE_CAL":
+            sample_sync_flag, delay_update_flag, fs_ppm_offsets, self.delays = result
+            # Set time delay 
+            if delay_update_flag:
+                msg_byte_array = inter_module_messages.pack_msg_sample_freq_tune(self.module_identifier, self._to_receiver_channels(fs_ppm_offsets))
+                self.rtl_daq_socket.send(msg_byte_array)
+                reply = self.rtl_daq_socket.recv()
+                self.logger.debug(f"Received reply: {reply}")
+                self.last_update_ind=self.iq_header.cpi_index
+                self.current_state = "STATE_SYNC_WAIT"
+                
+            if sample_sync_flag:
+                self.sample_compensation_cntr+=1 # Used to track how many succesfull compenssation have been performed so far 
+                self.current_state = "STATE_FRAC_SAMPLE_CAL"  
+
+        elif state == "STATE_FRAC_SAMPLE_CAL":
+            taus = result
+            self.logger.debug(f"Fractional delays: {taus}")
+            
+            # Determine and set tune values
+            frac_delay_update_flag = False
+            fs_ppm_offsets=[0]*self.M 
+            
+            for m in range(self.M-1):
+                if abs(taus[m]) > self.frac_delay_tolerance:
+                    fs_ppm_offsets[m+1] = np.sign(taus[m]) * np.abs(taus[m] * self.FRAC_FS_TUNE_GAIN) * self.MIN_FS_PPM_OFFSET
+                    frac_delay_update_flag = True
             
-            angle_diff_w = np.angle(phase_diff_w[m,:]).real # Convert complex phasor to angle
+            if frac_delay_update_flag:
+                self.logger.debug(f"Sending ppm offsets: {fs_ppm_offsets}")
+                msg_byte_array = inter_module_messages.pack_msg_sample_freq_tune(self.module_identifier, self._to_receiver_channels(fs_ppm_offsets))
+                self.rtl_daq_socket.send(msg_byte_array)
+                reply = self.rtl_daq_socket.recv()
+                self.logger.debug(f"Received reply: {reply}")
+                self.last_update_ind=self.iq_header.cpi_index
+                self.current_state = "STATE_FRAC_SYNC_WAIT"
+            else:
+                self.current_state = "STATE_IQ_CAL"
 
+        elif state == "STATE_IQ_CAL":
+            dyn_ranges, iq_diffs = result
+            iq_diffs *= self.iq_adjust[:]
             
-                # Fit linear curve on to the estimated phase transfers and derive fractional delay
-            popt, pcov = curve_fit(linear_func, freq_scale[fit_mask], angle_diff_w[fit_mask])
-            taus.append(popt[0]/(2*np.pi))    
+            if (dyn_ranges < self.min_corr_peak_dyn_range).any():
+                self.logger.warning("Correlation peak dynamic range is insufficient to perform calibration")
+                for m in range(self.M-1):                        
+                    self.logger.warning("Real value: {:.2f}, minimum: {:.2f}".format(dyn_ranges[m], self.min_corr_peak_dyn_range))                        
+                # It seems that the sample sync has lost
+                self.current_state = "STATE_SAMPLE_CAL"
+               
+            # Check IQ calibration necessity
+            elif (abs(np.rad2deg(np.angle(iq_diffs))) > self.phase_diff_tolerance).any() or \
+                 (abs(iq_diffs) > self.amp_diff_tolerance).any():
+                self.logger.debug("Amplitude or phase differenceas are out of tolerance")                        
+                self.iq_compensation_cntr+=1  # Used to track how many iq compensations have we issued so far
+                self._set_iq_corrections(self.iq_corrections * iq_diffs)
+                self.logger.info("Updating IQ correction values, applied from CPI: {:d}".format(self.iq_corr_cpi_index))
+                self.logger.info("Amplitude differences: {0}".format(20*np.log10(np.abs(iq_diffs))))
+                self.logger.info("Phase differernces: {0}".format(np.rad2deg(np.angle(iq_diffs))))
+            else:
+                self.current_state = "STATE_TRACK_LOCK"  
+                if self.cal_track_mode >= 2:
+                    self.iq_diff_ref[:] = iq_diffs[:]
+
+        elif state == "STATE_TRACK_LOCK":
+            dyn_ranges, iq_diffs = result
+            self.iq_diff_ref[:] = iq_diffs[:] * self.iq_adjust[:]
+            self._enter_track(rf_center_freq)
+
+        elif state == "STATE_TRACK" and self.cal_track_mode == 3 and frame_type == IQHeader.FRAME_TYPE_DATA:
+            self._apply_blind_result(*result)
+
+        elif state == "STATE_TRACK":
+            dyn_ranges, iq_diffs = result
+            iq_diffs *= self.iq_adjust[:]
+            # Check sample sync loss
+            if (dyn_ranges < self.min_corr_peak_dyn_range).any():
+                self.logger.warning("Sample sync may lost")
+                self.track_sample_sync = False
+            else:
+                self.track_sample_sync = True
+
+            if self.en_iq_cal:
+                # Check IQ sync loss
+                if (abs(np.rad2deg(np.angle(iq_diffs/self.iq_diff_ref))) > self.phase_diff_tolerance).any() or \
+                   (abs(iq_diffs/self.iq_diff_ref) > self.amp_diff_tolerance).any():
+                       self.track_iq_sync = False
+                       self.logger.warning("IQ sync may lost")
+                       for m in range(self.M):
+                           self.logger.debug("Differences: Amplitude {:.2f}, Phase: {:.2f}".format(
+                                   20*np.log10((abs(iq_diffs[m]/self.iq_diff_ref[m]))), 
+                                   (abs(np.rad2deg(np.angle(iq_diffs[m]/self.iq_diff_ref[m]))))))
+                else:
+                    self.track_iq_sync = True
+
+            # Track loss control
+            if (not self.track_sample_sync) or (self.en_iq_cal and (not self.track_iq_sync)):
+                self.sync_failed_cntr +=1
+                self.sync_failed_cntr_total+=1
+            else:
+                self.sync_failed_cntr -=1                       
+            if self.sync_failed_cntr == self.max_sync_fails:
+                self.current_state = "STATE_INIT"
+                self.sync_failed_cntr = 0
+            elif self.sync_failed_cntr < 0: # Sync tracking holds
+                self.sync_failed_cntr = 0
 
-        return taus
-        
+    def _to_spectral_frame(self, header_uint8, iq_samples, active_buffer_index_iq):
+        """
+            Converts the corrected IQ samples of the frame to their per-channel spectra.
+            The spectra are written into the payload of the IQ server buffer, or into a
+            private buffer for the snapshot when the IQ server frame is dropped. The
+            hardware controller keeps receiving the time domain header.
+
+            Parameters:
+            -----------
+                :param: header_uint8: Header and per-channel metadata of the frame
+                :param: iq_samples: Corrected IQ samples, active channels x CPI length
+                :param: active_buffer_index_iq: Index of the IQ server buffer, 3: dropped
+
+            Return values:
+            --------------
+                :return: header: Header and metadata of the spectral frame
+                :return: spectra: Active channels x segments x FFT size complex bins
+        """
+        head_size = header_uint8.size
+        if active_buffer_index_iq != 3:
+            out = self.out_shmem_iface_iq.buffers[active_buffer_index_iq][head_size:].view(dtype=np.complex64)
+        else:
+            out = self.spectrum_bins
+        spectra = calc_spectra(iq_samples, self.fft_window, self.fft_hop, out)
+
+        header = self.spectrum_header[0:head_size]
+        np.copyto(header, header_uint8)
+        spectral_header = IQHeaderView(header)
+        spectral_header.data_type = IQ_DATA_TYPE_SPECTRUM
+        spectral_header.cpi_length = spectra.shape[1]*self.fft_size
+        spectral_header.fft_size = self.fft_size
+        spectral_header.fft_hop = self.fft_hop
+        spectral_header.fft_window = self.fft_window_code
+        return header, spectra
 
     def start(self):
         """
             Start the main processing loop
         """
+        self.cal_worker.start()
+        stage_notify(STAGE_EV_READY)
         while True:
             sample_sync_flag = False
             iq_sync_flag     = False
@@ -442,20 +1014,47 @@ class delaySynchronizer():
                 break;          
             iq_frame_buffer_in = self.in_shmem_iface.buffers[active_buff_index_dec]
 
-            # Read and convert header
-            iq_header_bytes = iq_frame_buffer_in[0:1024].tobytes()
-            self.iq_header.decode_header(iq_header_bytes)            
-            #self.iq_header.dump_header()
+            # Map the header, fields are accessed in place
+            self.iq_header = IQHeaderView(iq_frame_buffer_in)
             
             if self.iq_header.check_sync_word():
                 self.logger.critical("IQ header sync word check failed, exiting..")
                 break
+            if self.iq_header.check_ch_meta():
+                self.logger.critical("Invalid per-channel metadata in the IQ header, exiting..")
+                break
+            payload_offset = self.iq_header.payload_offset()
+
+            # Follow the channel set of the acquisition, frames without mask hold the first active_ant_chs channels
+            ch_mask = self.iq_header.get_ch_mask()
+            if ch_mask >> self.M_total or bin(ch_mask).count("1") != self.iq_header.active_ant_chs:
+                self.logger.critical("Invalid channel mask: 0x{:08X}, exiting..".format(ch_mask))
+                break
+            if ch_mask != self.ch_mask:
+                self._set_channel_mask(ch_mask)
+
+            # Apply the finished calibration, new corrections take effect from this frame
+            cal_result = self.cal_worker.poll()
+            if cal_result is not None:
+                self._apply_cal_result(*cal_result)
             
             # Prepare payload buffer
             incoming_payload_size = self.iq_header.cpi_length*self.iq_header.active_ant_chs*2*int(self.iq_header.sample_bit_depth/8)
+            raw_input = self.iq_header.sample_bit_depth == 8
             if incoming_payload_size > 0:
-                iq_samples_in = (iq_frame_buffer_in[1024:1024 + incoming_payload_size].view(dtype=np.complex64))\
-                                .reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length)
+                if raw_input:
+                    iq_samples_in = iq_frame_buffer_in[payload_offset:payload_offset + incoming_payload_size]\
+                                    .reshape(self.iq_header.active_ant_chs, 2*self.iq_header.cpi_length)
+                else:
+                    iq_samples_in = (iq_frame_buffer_in[payload_offset:payload_offset + incoming_payload_size].view(dtype=np.complex64))\
+                                    .reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length)
+            if raw_input:
+                # Bypassed decimator, its header updates are done here
+                self.cpi_index += 1
+                self.iq_header.data_type = 3
+                self.iq_header.sample_bit_depth = 32
+                self.iq_header.cpi_index = self.cpi_index
+                self.iq_header.sampling_freq = self.iq_header.adc_sampling_freq
                 
             # Get buffers from the sink blocks (IQ server, HW controller)
             active_buffer_index_iq = self.out_shmem_iface_iq.wait_buff_free()
@@ -474,21 +1073,29 @@ class delaySynchronizer():
                 # -> IQ Preprocessing <-
                 # TODO: Check payload size
                 if incoming_payload_size > 0:
-                    if active_buffer_index_iq !=3:
+                    if self.en_spectrum:
+                        # The output frame gets the spectra of these samples when sending
+                        iq_samples_out = self.spectrum_samples[0:self.iq_header.cpi_length*self.iq_header.active_ant_chs]\
+                                         .reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length)
+                    elif active_buffer_index_iq !=3:
                         iq_frame_buffer_out = (self.out_shmem_iface_iq.buffers[active_buffer_index_iq]).view(dtype=np.complex64)
                         # IQ header offset:1 sample -> 8 byte, 1024 byte length header -> 128 "sample"
-                        iq_samples_out = iq_frame_buffer_out[128:128+self.iq_header.cpi_length*self.iq_header.active_ant_chs].reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length)
+                        sample_offset = payload_offset // 8 # The metadata block keeps the 64 byte alignment
+                        iq_samples_out = iq_frame_buffer_out[sample_offset:sample_offset+self.iq_header.cpi_length*self.iq_header.active_ant_chs].reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length)
+                    else:
+                        iq_samples_out = None
 
+                    if raw_input:
+                        # The conversion replaces the copy, corrections are applied in place
+                        iq_samples_out = hdaq_kernels.cu8_to_cf32(iq_samples_in, iq_samples_out)
                         if self.en_iq_cal:
-                            iq_samples_out = correct_iq(iq_samples_in, iq_samples_out, self.iq_corrections, self.M)
-                        else:
-                            iq_samples_out = copy_iq(iq_samples_in, iq_samples_out, self.M)
+                            hdaq_kernels.correct_iq(iq_samples_out, iq_samples_out, self.iq_corrections)
+                    elif self.en_iq_cal:
+                        iq_samples_out = hdaq_kernels.correct_iq(iq_samples_in, iq_samples_out, self.iq_corrections)
+                    elif iq_samples_out is not None:
+                        np.copyto(iq_samples_out, iq_samples_in)
                     else:
-                        if self.en_iq_cal:
-                            iq_samples_out = np.zeros((self.iq_header.active_ant_chs, self.iq_header.cpi_length), dtype=np.complex64)
-                            iq_samples_out = correct_iq(iq_samples_in, iq_samples_out, self.iq_corrections, self.M)
-                        else:
-                            iq_samples_out = iq_samples_in.copy()
+                        iq_samples_out = iq_samples_in.copy()
 
                     # Truncate IQ sample matrix for further processing
                     if self.iq_header.frame_type == IQHeader.FRAME_TYPE_CAL:
@@ -502,83 +1109,31 @@ class delaySynchronizer():
                     sync_state = 1
                     # Recalculate IQ adjustment for the RF center frequency
                     daq_rf           = self.iq_header.rf_center_freq # Read RF center frequency for phase offset calculation
-                    if self.iq_adjust_source == "explicit-time-delay":
-                        iq_adjust_phase  = self.iq_adjust_time*daq_rf*2*np.pi  # Convert time delay to phase         
-
-                        self.iq_adjust = self.iq_adjust_amplitude * np.exp(1j*iq_adjust_phase) # Assemble IQ adjustment vector
-                        self.iq_adjust = np.insert(self.iq_adjust, self.std_ch_ind, 1+0j)
-                    elif self.iq_adjust_source == "touchstone":
-                        self.iq_adjust = self.iq_adjust_table[np.argmin(abs(self.iq_adjust_table[:,0]-daq_rf)),1::]
-
-                        self.logger.debug(f"IQ adjustment vector: abs:{abs(self.iq_adjust)}")
-                        self.logger.debug(f"IQ adjustment vector: phase:{np.rad2deg(np.angle(self.iq_adjust))}")
-                    
+                    self.iq_adjust_full = self._calc_iq_adjust(daq_rf)
+                    self.iq_adjust = self.iq_adjust_full[self.active_chs]
                     self.iq_adjust /= self.iq_adjust[self.std_ch_ind]
+                    self.logger.debug(f"IQ adjustment vector: abs:{abs(self.iq_adjust)}")
+                    self.logger.debug(f"IQ adjustment vector: phase:{np.rad2deg(np.angle(self.iq_adjust))}")
                     # Reset IQ corrections
-                    self.iq_corrections    = np.ones(self.M, dtype=np.complex64) 
-                    self.iq_corrections[:] = self.iq_adjust[:]
+                    self._set_iq_corrections(self.iq_adjust)
                     # Calibration frame                    
                     if self.iq_header.frame_type == IQHeader.FRAME_TYPE_CAL: 
-                        self.current_state = "STATE_SAMPLE_CAL"
+                        if self.keep_sample_sync:
+                            # Only the phase calibration is redone, STATE_IQ_CAL falls back
+                            # to the sample calibration if the sample sync turns out to be lost
+                            self.logger.info("Sample sync is kept after retune, recalibrating IQ")
+                            self.keep_sample_sync = False
+                            self.current_state = "STATE_IQ_CAL"
+                        else:
+                            self.current_state = "STATE_SAMPLE_CAL"
                         
                 #
                 #------------------------------------------>
                 #
                 elif self.current_state == "STATE_SAMPLE_CAL":
-                    sync_state        = 2
-                    sample_sync_flag  = True
-                    delay_update_flag = 0
-                    fs_ppm_offsets=[0]*self.M 
-
-                    # ->  Calculate correlation functions            
-                    np_zeros = np.zeros(self.N_proc, dtype=np.complex64)
-                    x_padd = np.concatenate([iq_samples[self.std_ch_ind, 0:self.N_proc], np_zeros])
-                    x_fft = fft.fft(x_padd, workers=4, overwrite_x=True)
-                    
-                    for m in self.channel_list:
-                        y_padd = np.concatenate([np_zeros, iq_samples[m, 0:self.N_proc]])
-                        y_fft = fft.fft(y_padd, workers=4, overwrite_x=True)
-                        self.corr_functions[m,:] = np.abs(fft.ifft(x_fft.conj() * y_fft, workers=4, overwrite_x=True))**2
-                    # ->  Calculate sample delays, check dynamic range
-                    # WARNING: This dynamic range checking assumes dirac like coorelation peak                    
-                    for m in self.channel_list:
-                        peak_index = np.argmax(self.corr_functions[m, :])
-
-                        # Check dynamic range
-                        # TODO: Check overindexing
-                        dyn_range = 10*np.log10(self.corr_functions[m, peak_index] / 
-                                                 self.corr_functions[m, peak_index+self.corr_peak_offset])
-                        if dyn_range < self.min_corr_peak_dyn_range:
-                            self.logger.warning("Correlation peak dynamic range is insufficient to perform calibration")
-                            self.logger.warning("Real value: {:.2f}, minimum: {:.2f}".format(dyn_range, self.min_corr_peak_dyn_range))
-                            delay_update_flag = 0
-                            sample_sync_flag = False # Sync can not be checked properly
-                            break
-                        
-                        # Calculate sample offset
-                        self.delays[m] = (self.N_proc - peak_index)                              
-                        fs_tune_gain_m = (self.INT_FS_TUNE_GAIN[1,(self.INT_FS_TUNE_GAIN[0,:] <= abs(self.delays[m]))])[0]      
-                        fs_ppm_offsets[m] = -1*self.delays[m] * fs_tune_gain_m * self.MIN_FS_PPM_OFFSET                        
-                        if abs(fs_ppm_offsets[m]) > self.MAX_FS_PPM_OFFSET:
-                            fs_ppm_offsets[m] = np.sign(fs_ppm_offsets[m])*self.MAX_FS_PPM_OFFSET                        
-
-                        if np.abs(self.delays[m]) >= 1:
-                            sample_sync_flag = False # Misalling detected
-                            delay_update_flag=1
-                        self.logger.debug("Channel {:d}, delay: {:d}, tune gain: {:d} ppm-offset: {:.7f}, ".format(m, self.delays[m], fs_tune_gain_m, fs_ppm_offsets[m]))
-
-                    # Set time delay 
-                    if delay_update_flag:
-                        msg_byte_array = inter_module_messages.pack_msg_sample_freq_tune(self.module_identifier, fs_ppm_offsets)
-                        self.rtl_daq_socket.send(msg_byte_array)
-                        reply = self.rtl_daq_socket.recv()
-                        self.logger.debug(f"Received reply: {reply}")
-                        self.last_update_ind=self.iq_header.cpi_index
-                        self.current_state = "STATE_SYNC_WAIT"
-                        
-                    if sample_sync_flag:
-                        self.sample_compensation_cntr+=1 # Used to track how many succesfull compenssation have been performed so far 
-                        self.current_state = "STATE_FRAC_SAMPLE_CAL"  
+                    sync_state = 2
+                    # Sample delays are estimated by the calibration worker
+                    self._submit_cal(iq_samples)
                 #
                 #------------------------------------------>
                 #
@@ -594,29 +1149,8 @@ class delaySynchronizer():
                 elif self.current_state == "STATE_FRAC_SAMPLE_CAL":
                     sync_state          = 3
                     # TODO: Change sync state -> changes have to take effect in the HWC module as well
-                    # Calculate fractional delays
-                    taus = self.estimate_frac_delays(iq_samples[0:self.N_proc])
-                    self.logger.debug(f"Fractional delays: {taus}")
-                    
-                    # Determine and set tune values
-                    frac_delay_update_flag = False
-                    fs_ppm_offsets=[0]*self.M 
-                    
-                    for m in range(self.M-1):
-                        if abs(taus[m]) > self.frac_delay_tolerance:
-                            fs_ppm_offsets[m+1] = np.sign(taus[m]) * np.abs(taus[m] * self.FRAC_FS_TUNE_GAIN) * self.MIN_FS_PPM_OFFSET
-                            frac_delay_update_flag = True
-                    
-                    if frac_delay_update_flag:
-                        self.logger.debug(f"Sending ppm offsets: {fs_ppm_offsets}")
-                        msg_byte_array = inter_module_messages.pack_msg_sample_freq_tune(self.module_identifier, fs_ppm_offsets)
-                        self.rtl_daq_socket.send(msg_byte_array)
-                        reply = self.rtl_daq_socket.recv()
-                        self.logger.debug(f"Received reply: {reply}")
-                        self.last_update_ind=self.iq_header.cpi_index
-                        self.current_state = "STATE_FRAC_SYNC_WAIT"
-                    else:
-                        self.current_state = "STATE_IQ_CAL"
+                    # Fractional delays are estimated by the calibration worker
+                    self._submit_cal(iq_samples)
                 #
                 #------------------------------------------>
                 #
@@ -631,45 +1165,14 @@ class delaySynchronizer():
                 #
                 elif self.current_state == "STATE_IQ_CAL":
                     sync_state          = 4
-                    iq_corr_update_flag = False
                     sample_sync_flag    = True
-                    iq_sync_flag        = True                
                     
                     if self.en_iq_cal:
-                        dyn_ranges, iq_diffs = self.calc_iq_sync(iq_samples)
-                        iq_diffs *= self.iq_adjust[:]
-                        
-                        if (dyn_ranges < self.min_corr_peak_dyn_range).any():
-                            self.logger.warning("Correlation peak dynamic range is insufficient to perform calibration")
-                            for m in range(self.M-1):                        
-                                self.logger.warning("Real value: {:.2f}, minimum: {:.2f}".format(dyn_ranges[m], self.min_corr_peak_dyn_range))                        
-                            
-                            sample_sync_flag = False # It seems that the sample sync has lost
-                            iq_sync_flag = False
-                            iq_corr_update_flag = False                            
-                           
-                        # Check IQ calibration necessity
-                        elif (abs(np.rad2deg(np.angle(iq_diffs[m]))) > self.phase_diff_tolerance) or \
-                             (abs(iq_diffs[m]) > self.amp_diff_tolerance):  
-                            iq_corr_update_flag = True
-                            self.logger.debug("Amplitude or phase differenceas are out of tolerance")                        
-                        
-                        # Update correction values if needed                
-                        if iq_corr_update_flag:
-                            iq_sync_flag = False
-                            self.iq_compensation_cntr+=1  # Used to track how many iq compensations have we issued so far
-                            self.logger.info("Updating IQ correction values")                                        
-                            self.iq_corrections *= iq_diffs
-                            self.logger.info("Amplitude differences: {0}".format(20*np.log10(np.abs(iq_diffs))))
-                            self.logger.info("Phase differernces: {0}".format(np.rad2deg(np.angle(iq_diffs))))
-                    
-                    if not sample_sync_flag:
-                        self.current_state = "STATE_SAMPLE_CAL"
-                    
-                    if sample_sync_flag and iq_sync_flag:                    
-                        self.current_state = "STATE_TRACK_LOCK"  
-                        if self.cal_track_mode == 2 and self.en_iq_cal:
-                            self.iq_diff_ref[:] = iq_diffs[:]
+                        # Amplitude and phase differences are estimated by the calibration worker
+                        self._submit_cal(iq_samples)
+                    else:
+                        iq_sync_flag = True
+                        self.current_state = "STATE_TRACK_LOCK"
                 #
                 #------------------------------------------>
                 #
@@ -679,13 +1182,11 @@ class delaySynchronizer():
                     iq_sync_flag     = True
                     # Wait here until the calibration frame is turned off
                     if self.iq_header.frame_type == IQHeader.FRAME_TYPE_DATA: # Normal data frame
-                        dyn_ranges, iq_diffs = self.calc_iq_sync(iq_samples)
-                        iq_diffs *= self.iq_adjust[:]
-
                         if self.cal_track_mode == 1:
-                            self.iq_diff_ref[:] = iq_diffs[:]
-                        self.current_state = "STATE_TRACK"
-                        self.last_rf = self.iq_header.rf_center_freq
+                            # The tracking reference is taken by the calibration worker
+                            self._submit_cal(iq_samples)
+                        else:
+                            self._enter_track(self.iq_header.rf_center_freq)
                         
                 #
                 #------------------------------------------>
@@ -695,56 +1196,62 @@ class delaySynchronizer():
                     # Caltrack mode 0: Calibration tracking is disabled
                     # Caltrack mode 1: Normal continous tracking
                     # Caltrack mode 2: Track only on calibration frames
+                    # Caltrack mode 3: Track on calibration frames, bursts are requested by the blind tracking
 
                     if self.cal_track_mode == 1 or \
-                       (self.cal_track_mode == 2 and self.iq_header.frame_type == IQHeader.FRAME_TYPE_CAL):
-
-                        dyn_ranges, iq_diffs = self.calc_iq_sync(iq_samples)
-                        iq_diffs *= self.iq_adjust[:]
-                        # Check sample sync loss
-                        if (dyn_ranges < self.min_corr_peak_dyn_range).any():
-                            self.logger.warning("Sample sync may lost")
-                            sample_sync_flag = False
-                        else:
-                            sample_sync_flag = True
-
-                        if self.en_iq_cal:
-                            # Check IQ sync loss
-                            if (abs(np.rad2deg(np.angle(iq_diffs/self.iq_diff_ref))) > self.phase_diff_tolerance).any() or \
-                               (abs(iq_diffs/self.iq_diff_ref) > self.amp_diff_tolerance).any():
-                                   iq_sync_flag = False
-                                   self.logger.warning("IQ sync may lost")
-                                   for m in range(self.M):
-                                       self.logger.debug("Differences: Amplitude {:.2f}, Phase: {:.2f}".format(
-                                               20*np.log10((abs(iq_diffs[m]/self.iq_diff_ref[m]))), 
-                                               (abs(np.rad2deg(np.angle(iq_diffs[m]/self.iq_diff_ref[m]))))))
-                            else:
-                                iq_sync_flag = True
-
-                        # Track loss control
-                        if (not sample_sync_flag) or (self.en_iq_cal and (not iq_sync_flag)):
-                            self.sync_failed_cntr +=1
-                            self.sync_failed_cntr_total+=1
-                        else:
-                            self.sync_failed_cntr -=1                       
-                        if self.sync_failed_cntr == self.max_sync_fails:
-                            self.current_state = "STATE_INIT"
-                            self.sync_failed_cntr = 0
-                        elif self.sync_failed_cntr < 0: # Sync tracking holds
-                            self.sync_failed_cntr = 0
-
+                       (self.cal_track_mode >= 2 and self.iq_header.frame_type == IQHeader.FRAME_TYPE_CAL):
+                        if self.cal_track_mode == 3: # Requested burst has started, blind reference is retaken after it
+                            self.cal_burst_request = False
+                            self.blind_ref = None
+                            self.blind_frame_cntr = 0
+                        # Checked by the calibration worker, frames carry the result of the last check
+                        self._submit_cal(iq_samples)
+                        sample_sync_flag = self.track_sample_sync
+                        iq_sync_flag     = self.track_iq_sync
+                    elif self.cal_track_mode == 3:
+                        # Drift is estimated on the data frames by the calibration worker
+                        self.blind_frame_cntr += 1
+                        if not self.cal_burst_request:
+                            if self.blind_frame_cntr >= self.cal_frame_interval:
+                                self.logger.info("No reliable blind drift estimate, requesting calibration burst [{:d}]".format(self.iq_header.cpi_index))
+                                self.cal_burst_request = True
+                            elif not self.track_sample_sync or (self.en_iq_cal and not self.track_iq_sync):
+                                # The last burst has failed the check, the next one is requested immediately
+                                self.cal_burst_request = True
+                        self._submit_cal(iq_samples)
+                        sample_sync_flag = self.track_sample_sync
+                        iq_sync_flag     = self.track_iq_sync
                     else:
                         self.logger.debug("Sync flags are set")
                         sample_sync_flag = True
                         iq_sync_flag = True
                     
+                    # Coherence monitor, runs on every data frame
+                    coh_step = False
+                    if self.cal_track_mode != 0:
+                        if self.iq_header.frame_type == IQHeader.FRAME_TYPE_DATA:
+                            coh_step = self.check_coherence_step(iq_samples)
+                        else:
+                            self.last_coh = None
+
                     # Has the RF center frequency changed?
                     if self.last_rf != self.iq_header.rf_center_freq:
                         self.logger.info("Center frequency changed, initiating recalibration")
                         sample_sync_flag = False
                         iq_sync_flag = False
                         self.sync_failed_cntr = 0
+                        self.keep_sample_sync = True
+                        self.current_state = "STATE_INIT"
+                    elif coh_step:
+                        self.logger.warning("Sync may lost, initiating recalibration")
+                        sample_sync_flag = False
+                        iq_sync_flag = False
+                        self.sync_failed_cntr = 0
+                        self.sync_failed_cntr_total+=1
+                        self.keep_sample_sync = True
                         self.current_state = "STATE_INIT"
+                    elif self.cal_burst_request:
+                        sync_state = 7 # Calibration frames are requested from the HW controller
     
                 # Uncomment it for long term delay compenstation stress!
                 self.logger.info("Delay track statistic [sync fails ,sample, iq, total][{:d},{:d},{:d}/{:d}]".format(
@@ -779,18 +1286,32 @@ class delaySynchronizer():
                 self.iq_header.iq_sync_flag=0
             
             self.iq_header.sync_state = sync_state
+            self.iq_header.iq_corr_cpi_index = self.iq_corr_cpi_index
 
             # -> Send IQ frame toward the iq server
-            header_uint8 = np.frombuffer(self.iq_header.encode_header(), dtype=np.uint8)
+            header_uint8 = iq_frame_buffer_in[0:payload_offset] # Header and per-channel metadata
+            header_iq = header_uint8
+            payload_iq = iq_samples_out if incoming_payload_size > 0 else None
+            if self.en_spectrum and payload_iq is not None and \
+               (active_buffer_index_iq != 3 or self.out_snapshot_iface_iq is not None):
+                header_iq, payload_iq = self._to_spectral_frame(header_uint8, payload_iq, active_buffer_index_iq)
             if active_buffer_index_iq !=3 :
-                (self.out_shmem_iface_iq.buffers[active_buffer_index_iq])[0:1024] = header_uint8
+                (self.out_shmem_iface_iq.buffers[active_buffer_index_iq])[0:payload_offset] = header_iq
                 self.out_shmem_iface_iq.send_ctr_buff_ready(active_buffer_index_iq)
+                if self.iq_header.frame_type != IQHeader.FRAME_TYPE_DUMMY:
+                    stage_notify(STAGE_EV_FIRST_FRAME)
+                if sample_sync_flag and (iq_sync_flag or not self.en_iq_cal):
+                    stage_notify(STAGE_EV_FIRST_SYNC)
             else:
                 if not self.ignore_frame_drop_warning: self.logger.warning("Dropping frame - IQ server, Total: {:d}".format(self.out_shmem_iface_iq.dropped_frame_cntr))
 
+            # -> Publish the IQ frame as the latest snapshot
+            if self.out_snapshot_iface_iq is not None:
+                self.out_snapshot_iface_iq.publish(header_iq, payload_iq)
+
             # -> Send IQ frame toward the hwc module
             if active_buffer_index_hwc !=3 :
-                (self.out_shmem_iface_hwc.buffers[active_buffer_index_hwc])[0:1024] = header_uint8
+                (self.out_shmem_iface_hwc.buffers[active_buffer_index_hwc])[0:payload_offset] = header_uint8
                 # TODO: For ADPIS control HWC module should get informed about the power levels from the header
                 self.out_shmem_iface_hwc.send_ctr_buff_ready(active_buffer_index_hwc)
             else:
@@ -798,20 +1319,66 @@ class delaySynchronizer():
             
             # -> Inform the preceeding block that we have finished the processing
             self.in_shmem_iface.send_ctr_buff_ready(active_buff_index_dec)
+        self.cal_worker.stop()
+
+class CalibrationWorker(threading.Thread):
+    """
+        Runs the calibration computations of the delay synchronizer off the data path.
+        A single job is processed at a time on a private copy of the samples, the
+        processing loop polls for the result and keeps forwarding frames meanwhile.
+    """
+    def __init__(self, compute):
+        """
+            :param compute: Function called with the requesting state, the frame type, the samples,
+                            the list of channels to be matched and the standard channel index
+        """
+        threading.Thread.__init__(self, daemon=True)
+        self.logger = logging.getLogger(__name__)
+        self.compute = compute
+        self.jobs    = queue.Queue(maxsize=1)
+        self.results = queue.Queue()
+        self.busy    = False
 
-@njit(fastmath=True, cache=True)
-def correct_iq(iq_samples_in, iq_samples_out, iq_corrections, M):
-    for m in range(M):
-        iq_samples_out[m,:] = (iq_samples_in[m,:]-np.mean(iq_samples_in[m,:]))*iq_corrections[m]
+    def submit(self, state, frame_type, cpi_index, rf_center_freq, iq_samples, channel_list, std_ch_ind):
+        self.busy = True
+        self.jobs.put((state, int(frame_type), int(cpi_index), int(rf_center_freq), iq_samples.copy(),
+                       list(channel_list), int(std_ch_ind)))
 
-    return iq_samples_out
+    def poll(self):
+        """
+            Returns the (state, frame_type, cpi_index, rf_center_freq, result) tuple of the finished job,
+            None when there is no new result
+        """
+        try:
+            result = self.results.get_nowait()
+        except queue.Empty:
+            return None
+        self.busy = False
+        return result
+
+    def drain(self):
+        """
+            Waits for the running job to finish and drops its result
+        """
+        if self.busy:
+            self.results.get()
+            self.busy = False
 
-@njit(fastmath=True, cache=True)
-def copy_iq(iq_samples_in, iq_samples_out, M):
-    for m in range(M):
-        iq_samples_out[m,:] = iq_samples_in[m,:]
+    def stop(self):
+        self.jobs.put(None)
 
-    return iq_samples_out
+    def run(self):
+        while True:
+            job = self.jobs.get()
+            if job is None:
+                break
+            state, frame_type, cpi_index, rf_center_freq, iq_samples, channel_list, std_ch_ind = job
+            try:
+                result = self.compute(state, frame_type, iq_samples, channel_list, std_ch_ind)
+            except Exception as e:
+                self.logger.error("Calibration computation failed: {0}".format(e))
+                result = None
+            self.results.put((state, frame_type, cpi_index, rf_center_freq, result))
 
 
 if __name__ == '__main__':
@@ -0,0 +1,99 @@
+/*
+ *
+ * Description :
+ * librtlsdr API implemented by the emulated librtlsdr (rtlsdr_emu.c)
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RTL_SDR_H
+#define RTL_SDR_H
+
+/*
+ * Used by the emulator targets (rtlsdr_emu, rtl_daq_emu) only, so they build
+ * without the KrakenSDR librtlsdr installed. The declarations follow the
+ * rtl-sdr.h of the KrakenSDR librtlsdr fork, the hardware build of rtl_daq
+ * uses the installed header.
+ */
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rtlsdr_dev rtlsdr_dev_t;
+
+enum rtlsdr_tuner {
+    RTLSDR_TUNER_UNKNOWN = 0,
+    RTLSDR_TUNER_E4000,
+    RTLSDR_TUNER_FC0012,
+    RTLSDR_TUNER_FC0013,
+    RTLSDR_TUNER_FC2580,
+    RTLSDR_TUNER_R820T,
+    RTLSDR_TUNER_R828D
+};
+
+typedef void(*rtlsdr_read_async_cb_t)(unsigned char *buf, uint32_t len, void *ctx);
+
+/* Device enumeration */
+uint32_t rtlsdr_get_device_count(void);
+const char* rtlsdr_get_device_name(uint32_t index);
+int rtlsdr_get_device_usb_strings(uint32_t index, char *manufact, char *product, char *serial);
+int rtlsdr_get_index_by_serial(const char *serial);
+int rtlsdr_open(rtlsdr_dev_t **dev, uint32_t index);
+int rtlsdr_close(rtlsdr_dev_t *dev);
+
+/* Configuration */
+int rtlsdr_set_xtal_freq(rtlsdr_dev_t *dev, uint32_t rtl_freq, uint32_t tuner_freq);
+int rtlsdr_get_xtal_freq(rtlsdr_dev_t *dev, uint32_t *rtl_freq, uint32_t *tuner_freq);
+int rtlsdr_get_usb_strings(rtlsdr_dev_t *dev, char *manufact, char *product, char *serial);
+int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq);
+uint32_t rtlsdr_get_center_freq(rtlsdr_dev_t *dev);
+int rtlsdr_set_freq_correction(rtlsdr_dev_t *dev, int ppm);
+int rtlsdr_get_freq_correction(rtlsdr_dev_t *dev);
+enum rtlsdr_tuner rtlsdr_get_tuner_type(rtlsdr_dev_t *dev);
+int rtlsdr_get_tuner_gains(rtlsdr_dev_t *dev, int *gains);
+int rtlsdr_set_tuner_gain(rtlsdr_dev_t *dev, int gain);
+int rtlsdr_get_tuner_gain(rtlsdr_dev_t *dev);
+int rtlsdr_set_tuner_gain_mode(rtlsdr_dev_t *dev, int manual);
+int rtlsdr_set_sample_rate(rtlsdr_dev_t *dev, uint32_t rate);
+uint32_t rtlsdr_get_sample_rate(rtlsdr_dev_t *dev);
+int rtlsdr_set_testmode(rtlsdr_dev_t *dev, int on);
+int rtlsdr_set_agc_mode(rtlsdr_dev_t *dev, int on);
+int rtlsdr_set_bias_tee(rtlsdr_dev_t *dev, int on);
+int rtlsdr_set_gpio(rtlsdr_dev_t *dev, int value, int gpio);
+
+/* KrakenSDR extensions */
+int rtlsdr_set_dithering(rtlsdr_dev_t *dev, int dither);
+int rtlsdr_set_sample_freq_correction_f(rtlsdr_dev_t *dev, float ppm);
+int rtlsdr_set_bias_tee_gpio(rtlsdr_dev_t *dev, int gpio, int on);
+
+/* Streaming */
+int rtlsdr_reset_buffer(rtlsdr_dev_t *dev);
+int rtlsdr_read_sync(rtlsdr_dev_t *dev, void *buf, int len, int *n_read);
+int rtlsdr_wait_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx);
+int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx, uint32_t buf_num, uint32_t buf_len);
+int rtlsdr_cancel_async(rtlsdr_dev_t *dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTL_SDR_H */
@@ -31,10 +31,14 @@
 #include <stdbool.h>
 #include <string.h>
 #include "log.h"
-#include "ini.h"
+#include "daq_config.h"
+#include "stage_ctrl.h"
 #include "iq_header.h"
 #include "sh_mem_util.h"
 #include "rtl_daq.h"
+#include "hdaq_simd.h"
+#include "perf_ctr.h"
+#include "alloc_audit.h"
 
 #ifdef ARM_NEON
 #include "NE10.h"
@@ -42,51 +46,11 @@
 #include <kfr/capi.h>
 #endif
 
-#define DC 127.5
 #define INI_FNAME "daq_chain_config.ini"
 #define FIR_COEFF "_data_control/fir_coeffs.txt"
 #define FATAL_ERR(l) log_fatal(l); return -1;
 #define CHK_MALLOC(m) if(m==NULL){log_fatal("Malloc failed, exiting.."); return -1;}
-/* 
- * This structure stores the configuration parameters, 
- * that are loaded from the ini file
- */ 
-typedef struct
-{
-    int num_ch;
-    int cpi_size;
-    int cal_size;
-    int decimation_ratio;
-    int en_filter_reset;
-    int tap_size;
-    int log_level;
-} configuration;
 
-/*
- * Ini configuration parser callback function  
-*/
-static int handler(void* conf_struct, const char* section, const char* name,
-                   const char* value)
-{
-    configuration* pconfig = (configuration*) conf_struct;
-    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-    if (MATCH("hw", "num_ch")) 
-    {pconfig->num_ch = atoi(value);}
-    else if (MATCH("pre_processing", "cpi_size")) 
-    {pconfig->cpi_size = atoi(value);}
-    else if (MATCH("calibration", "corr_size")) 
-    {pconfig->cal_size = atoi(value);}
-    else if (MATCH("pre_processing", "decimation_ratio")) 
-    {pconfig->decimation_ratio = atoi(value);}
-    else if (MATCH("pre_processing", "en_filter_reset")) 
-    {pconfig->en_filter_reset = atoi(value);}
-    else if(MATCH("pre_processing", "fir_tap_size"))
-    {pconfig->tap_size = atoi(value);}
-    else if (MATCH("daq", "log_level")) 
-    {pconfig->log_level = atoi(value);}
-    else {return 0;  /* unknown section/name, error */}
-    return 0;
-}
 int main(int argc, char **argv)
 /*
  *
@@ -97,7 +61,7 @@ int main(int argc, char **argv)
  */
 {
     log_set_level(LOG_TRACE);
-    configuration config;
+    struct daq_config config;
     bool filter_reset;
     int ch_no,dec;     
     int exit_flag=0;
@@ -110,7 +74,7 @@ int main(int argc, char **argv)
     if (argc == 2){drop_mode = atoi(argv[1]);}
     
     /* Set parameters from the config file*/
-    if (ini_parse(INI_FNAME, handler, &config) < 0) {FATAL_ERR("Configuration could not be loaded, exiting ..")}
+    if (load_daq_config(INI_FNAME, &config) != 0) {FATAL_ERR("Configuration could not be loaded, exiting ..")}
     
     ch_no = config.num_ch;
     dec = config.decimation_ratio;
@@ -120,7 +84,11 @@ int main(int argc, char **argv)
     log_info("Channel number: %d", ch_no);
     log_info("Decimation ratio: %d",dec);
     log_info("CPI size: %d", config.cpi_size);
-    log_info("Calibration sample size : %d", config.cal_size);
+    log_info("Calibration sample size : %d", config.corr_size);
+    log_info("SIMD kernel variant: %s", hdaq_simd_level_name(hdaq_simd_init()));
+    log_info("Streaming store threshold: %zu bytes", hdaq_stream_threshold());
+    perf_ctr_init("decimator", &config);
+    alloc_audit_init("decimator");
     
                 
     /*
@@ -131,10 +99,10 @@ int main(int argc, char **argv)
     
      /* Initializing input shared memory interface */
     struct shmem_transfer_struct* input_sm_buff = calloc(1, sizeof(struct shmem_transfer_struct));
-    if((config.cpi_size*dec)>=config.cal_size)
-    {input_sm_buff->shared_memory_size = config.cpi_size*config.num_ch*dec*4*2+IQ_HEADER_LENGTH;}
+    if((config.cpi_size*dec)>=config.corr_size)
+    {input_sm_buff->shared_memory_size = (size_t) config.cpi_size*config.num_ch*dec*4*2+IQ_HEADER_LENGTH+IQ_CH_META_LENGTH(config.num_ch);}
     else
-    {input_sm_buff->shared_memory_size = config.cal_size*config.num_ch*4*2+IQ_HEADER_LENGTH;}
+    {input_sm_buff->shared_memory_size = (size_t) config.corr_size*config.num_ch*4*2+IQ_HEADER_LENGTH+IQ_CH_META_LENGTH(config.num_ch);}
     input_sm_buff->io_type = 1; // Input type
     
     strcpy(input_sm_buff->shared_memory_names[0], DECIMATOR_IN_SM_NAME_A);
@@ -148,19 +116,24 @@ int main(int argc, char **argv)
     
     /* Initializing output shared memory interface */
     struct shmem_transfer_struct* output_sm_buff = calloc(1, sizeof(struct shmem_transfer_struct));
-    output_sm_buff->shared_memory_size = MAX_IQFRAME_PAYLOAD_SIZE*ch_no*4*2+IQ_HEADER_LENGTH;         
+    /* Sized for the larger of the decimated data and the calibration frames */
+    size_t out_cpi_size = config.cpi_size >= config.corr_size ? config.cpi_size : config.corr_size;
+    output_sm_buff->shared_memory_size = out_cpi_size*ch_no*4*2+IQ_HEADER_LENGTH+IQ_CH_META_LENGTH(ch_no);
     output_sm_buff->io_type = 0; // Output type
     output_sm_buff->drop_mode = drop_mode;
     strcpy(output_sm_buff->shared_memory_names[0], DECIMATOR_OUT_SM_NAME_A);
     strcpy(output_sm_buff->shared_memory_names[1], DECIMATOR_OUT_SM_NAME_B);
     strcpy(output_sm_buff->fw_ctr_fifo_name, DECIMATOR_OUT_FW_FIFO);
     strcpy(output_sm_buff->bw_ctr_fifo_name, DECIMATOR_OUT_BW_FIFO);
+    const char* numa_policy = daq_link_numa_policy(&config, DAQ_GRAPH_DECIMATOR, &output_sm_buff->numa_producer_cpu,
+                                                   &output_sm_buff->numa_consumer_cpu);
+    if (numa_policy != NULL) {strcpy(output_sm_buff->numa_policy, numa_policy);}
 
     succ = init_out_sm_buffer(output_sm_buff);
     if(succ !=0){FATAL_ERR("Shared memory initialization failed")}
     else{log_info("Output shared memory interface succesfully initialized");}
 
-    size_t tap_size = config.tap_size;
+    size_t tap_size = config.fir_tap_size;
     /* Allocating FIR filter data buffers */
     #ifdef ARM_NEON
         if (ne10_init() != NE10_OK){FATAL_ERR("Ne10 initialization failed")}	
@@ -182,6 +155,8 @@ int main(int argc, char **argv)
         CHK_MALLOC(fir_state_vectors)
 
         ne10_fir_decimate_instance_f32_t * fir_cfgs = malloc(ch_no*2*sizeof(ne10_fir_decimate_instance_f32_t));
+        struct iq_ch_mask last_ch_mask; // Channel mask of the last filtered frame
+        iq_ch_mask_all(&last_ch_mask, ch_no);
         ne10_uint16_t R = dec;
         ne10_uint32_t fir_blocksize=config.cpi_size*R;
 
@@ -217,21 +192,44 @@ int main(int argc, char **argv)
         KFR_FILTER_F32* fir_filter_plan = kfr_filter_create_fir_plan_f32(fir_coeffs, tap_size);
     #endif
     uint64_t cpi_index=-1;
+    struct iq_ch_mask frame_ch_mask;
+    char mask_str[IQ_MAX_CH/4+3];
+    size_t payload_offset;
     void* frame_ptr;
+    /* Output writers, large frames are written with streaming stores */
+    void (*cu8_to_cf32_out)(const uint8_t* in, float* out, size_t n);
+    void (*f32_interleave_out)(const float* in_i, const float* in_q, float* out, size_t n, size_t step);
+    stage_notify(STAGE_EV_READY);
 	/* Main Processing loop*/
 	while(!exit_flag){
 		
         // Acquire data buffer on the shared memory interface
+        perf_ctr_phase(PERF_PHASE_READ);
         active_buff_ind_in = wait_buff_ready(input_sm_buff);
         if (active_buff_ind_in < 0 ){exit_flag = 1; break;}
         if (active_buff_ind_in == TERMINATE) {exit_flag = TERMINATE; break;}
         iq_header = (struct iq_header_struct*) input_sm_buff->shm_ptr[active_buff_ind_in];
-		input_data_buffer = ((uint8_t *) input_sm_buff->shm_ptr[active_buff_ind_in] )+ IQ_HEADER_LENGTH/sizeof(uint8_t);
         CHK_SYNC_WORD(check_sync_word(iq_header));
+        if (iq_header_check_ch_meta(iq_header) != 0 || iq_header->ch_meta_length > IQ_CH_META_LENGTH(ch_no))
+        {
+            log_fatal("Invalid per-channel metadata: %u channels, %u bytes", iq_header->ch_meta_cnt, iq_header->ch_meta_length);
+            exit_flag = 1; break;
+        }
+        payload_offset = iq_header_payload_offset(iq_header);
+		input_data_buffer = ((uint8_t *) input_sm_buff->shm_ptr[active_buff_ind_in] )+ payload_offset;
+        /* The payload holds the channels of the mask in ascending order */
+        iq_header_get_ch_mask(iq_header, &frame_ch_mask);
+        if (!iq_ch_mask_within(&frame_ch_mask, ch_no) || iq_ch_mask_cnt(&frame_ch_mask) != (int) iq_header->active_ant_chs)
+        {
+            log_fatal("Channel mask of the frame: %s does not match the channel number: %d/%d",
+                      iq_ch_mask_str(&frame_ch_mask, mask_str, sizeof(mask_str)), iq_header->active_ant_chs, ch_no);
+            exit_flag = 1; break;
+        }
         
         cpi_index ++;
         
         /*Acquire buffer from the sink block*/
+        perf_ctr_phase(PERF_PHASE_WRITE);
         active_buff_ind = wait_buff_free(output_sm_buff);        
         switch(active_buff_ind)
         {
@@ -239,9 +237,9 @@ int main(int argc, char **argv)
         	case 1:
                 log_trace("--> Frame received: type: %d, daq ind:[%d]",iq_header->frame_type, iq_header->daq_block_index);
                 frame_ptr = output_sm_buff->shm_ptr[active_buff_ind];
-                float* output_data_buffer = ((float *) output_sm_buff->shm_ptr[active_buff_ind] )+ IQ_HEADER_LENGTH/sizeof(float);
-                /* Place IQ header into the output buffer*/
-                memcpy(frame_ptr, iq_header,1024);                
+                float* output_data_buffer = ((float *) output_sm_buff->shm_ptr[active_buff_ind] )+ payload_offset/sizeof(float);
+                /* Place IQ header and the per-channel metadata into the output buffer*/
+                memcpy(frame_ptr, iq_header, payload_offset);
 
                 /* Update header fields */
                 iq_header = (struct iq_header_struct*) frame_ptr;
@@ -253,35 +251,38 @@ int main(int argc, char **argv)
                 {
                     iq_header->sampling_freq = iq_header->adc_sampling_freq / (uint64_t) dec;
                     iq_header->cpi_length = (uint32_t) iq_header->cpi_length/dec; 
+                    /* Every output sample is the filter output at the last input sample of its decimation period */
+                    iq_header->first_sample_index += (uint64_t) (dec-1) * iq_header->sample_index_step;
+                    iq_header->sample_index_step *= (uint32_t) dec;
                 
                     /* Perform filtering on data type frames*/
                     if (iq_header->cpi_length > 0)
                     {
-                        if (filter_reset)
-                            #ifdef ARM_NEON
+                        f32_interleave_out = hdaq_stream_frame((size_t) iq_header->cpi_length*iq_header->active_ant_chs*2*sizeof(float)) ?
+                                             hdaq_stream_f32_interleave : hdaq_f32_interleave;
+                        #ifdef ARM_NEON
+                            /* Re-enabled channels must not continue from their samples before the mask change */
+                            if (filter_reset || !iq_ch_mask_equal(&frame_ch_mask, &last_ch_mask))
                                 {for(int m=0;m<ch_no*2;m++){memset(fir_state_vectors[m], 0, (tap_size+fir_blocksize-1)*sizeof(ne10_float32_t));}}
-                            #else
+                            last_ch_mask = frame_ch_mask;
+                        #else
+                            if (filter_reset)
                                 log_warn("Filter reset is not yet implemented on X86 platform");
-                            #endif
+                        #endif
+                        int ch_phys = -1; // Receiver channel of the current payload slot
                         for(int ch_index=0;ch_index<iq_header->active_ant_chs;ch_index++)                    
                         {
-                            #ifndef ARM_NEON
-                                // For downsampling  - X86
-                                int out_sample_index=0; 
-                                int dec_index = 0; 
-                            #endif
+                            ch_phys = iq_ch_mask_next(&frame_ch_mask, ch_phys);
                             //De-interleaving input data
-                            for(int sample_index=0; sample_index<iq_header->cpi_length*dec; sample_index++)
-                            {
-                                fir_input_buffer_i[sample_index] = (input_data_buffer[2*sample_index]-DC)/DC;   // I
-                                fir_input_buffer_q[sample_index] = (input_data_buffer[2*sample_index+1]-DC)/DC; // Q
-                            }
+                            perf_ctr_phase(PERF_PHASE_CONVERT);
+                            hdaq_cu8_to_f32_split(input_data_buffer, fir_input_buffer_i, fir_input_buffer_q, iq_header->cpi_length*dec);
                             // Perform filtering
+                            perf_ctr_phase(PERF_PHASE_FILTER);
                             #ifdef ARM_NEON
                                 for (int b = 0; b < iq_header->cpi_length*dec/fir_blocksize; b++)
                                 {
-                                    ne10_fir_decimate_float_c(&fir_cfgs[2*ch_index], fir_input_buffer_i + (b * fir_blocksize), fir_output_buffer_i + (b * config.cpi_size), fir_blocksize);
-                                    ne10_fir_decimate_float_c(&fir_cfgs[2*ch_index+1], fir_input_buffer_q + (b * fir_blocksize), fir_output_buffer_q + (b * config.cpi_size), fir_blocksize);
+                                    ne10_fir_decimate_float_c(&fir_cfgs[2*ch_phys], fir_input_buffer_i + (b * fir_blocksize), fir_output_buffer_i + (b * config.cpi_size), fir_blocksize);
+                                    ne10_fir_decimate_float_c(&fir_cfgs[2*ch_phys+1], fir_input_buffer_q + (b * fir_blocksize), fir_output_buffer_q + (b * config.cpi_size), fir_blocksize);
                                 }    
                             #else
                                 kfr_filter_process_f32(fir_filter_plan, fir_output_buffer_i, fir_input_buffer_i, iq_header->cpi_length*dec);
@@ -289,24 +290,12 @@ int main(int argc, char **argv)
                             #endif
 
                             //Re-interleave output data on ARM devices
+                            perf_ctr_phase(PERF_PHASE_WRITE);
                             #ifdef ARM_NEON
-                                for(int sample_index=0; sample_index<iq_header->cpi_length; sample_index++)
-                                {
-                                    output_data_buffer[2*sample_index]   = fir_output_buffer_i[sample_index];
-                                    output_data_buffer[2*sample_index+1] = fir_output_buffer_q[sample_index];
-                                }
+                                f32_interleave_out(fir_output_buffer_i, fir_output_buffer_q, output_data_buffer, iq_header->cpi_length, 1);
                             #else
-                            //Downsample and re-interleave output data on X86
-                                for(int sample_index=0; sample_index<iq_header->cpi_length*dec; sample_index++)
-                                {
-                                    dec_index  = (dec_index+1)%dec; // when zero the sample is forwarded
-                                    if(dec_index==0)
-                                    {
-                                        output_data_buffer[out_sample_index]   = fir_output_buffer_i[sample_index];
-                                        output_data_buffer[out_sample_index+1] = fir_output_buffer_q[sample_index];
-                                        out_sample_index+=2;
-                                    }
-                                }                            
+                            //Downsample and re-interleave output data on X86, the last sample of every decimation period is forwarded
+                                f32_interleave_out(fir_output_buffer_i+dec-1, fir_output_buffer_q+dec-1, output_data_buffer, iq_header->cpi_length, dec);
                             #endif
                             input_data_buffer  += 2*iq_header->cpi_length*dec;
                             output_data_buffer += 2*iq_header->cpi_length;
@@ -319,16 +308,16 @@ int main(int argc, char **argv)
                     iq_header->cpi_length = (uint32_t) iq_header->cpi_length;
 
                     /* Convert cint8 to cfloat32 without filtering and decimation on cal type frames*/
-                    for(int sample_index=0; sample_index<iq_header->cpi_length*iq_header->active_ant_chs; sample_index++)
-                        {
-                            output_data_buffer[2*sample_index]   = (float)(input_data_buffer[2*sample_index]-DC)/DC;   // I
-                            output_data_buffer[2*sample_index+1] = (float)(input_data_buffer[2*sample_index+1]-DC)/DC; // Q
-
-                        }
+                    perf_ctr_phase(PERF_PHASE_CONVERT);
+                    cu8_to_cf32_out = hdaq_stream_frame((size_t) iq_header->cpi_length*iq_header->active_ant_chs*2*sizeof(float)) ?
+                                      hdaq_stream_cu8_to_cf32 : hdaq_cu8_to_cf32;
+                    cu8_to_cf32_out(input_data_buffer, output_data_buffer, 2*iq_header->cpi_length*iq_header->active_ant_chs);
 
                 }
                 log_trace("<--Transfering frame type: %d, daq ind:[%d]",iq_header->frame_type, iq_header->daq_block_index);
+                perf_ctr_phase(PERF_PHASE_SIGNAL);
                 send_ctr_buff_ready(output_sm_buff, active_buff_ind);                
+                if (iq_header->frame_type != FRAME_TYPE_DUMMY) {stage_notify(STAGE_EV_FIRST_FRAME);}
                 break;
         	case 3:
             	/* Frame drop*/
@@ -337,9 +326,13 @@ int main(int argc, char **argv)
             	log_error("Failed to acquire free buffer");
             	exit_flag = 1;
         }
+        perf_ctr_phase(PERF_PHASE_SIGNAL);
         send_ctr_buff_free(input_sm_buff, active_buff_ind_in);
+        perf_ctr_frame_end();
+        alloc_audit_frame_end();
     } // End of the main processing loop
     error_code_log(exit_flag);
+    perf_ctr_close();
     send_ctr_terminate(output_sm_buff);
     sleep(3);    
     destory_sm_buffer(output_sm_buff);
@@ -349,5 +342,5 @@ int main(int argc, char **argv)
     free(fir_output_buffer_i);
     free(fir_output_buffer_q);
     log_info("Decimator exited");
-    return 0;
+    return alloc_audit_report();
 }
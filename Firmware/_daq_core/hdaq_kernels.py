@@ -0,0 +1,283 @@
+"""
+    HeIMDALL DAQ Firmware
+    Python binding of the vectorized signal processing kernels (hdaq_simd.c)
+
+    The functions operate directly on the memory of the passed numpy arrays, no
+    copies are made. Arrays must be C-contiguous (a row of a C-contiguous matrix is
+    also accepted) and have the exact data type of the kernel: uint8 for the raw
+    cu8 samples and complex64 for the complex samples. Other arrays are rejected
+    with a ValueError instead of being converted silently.
+
+    Author: Tamás Pető
+    License: GNU GPL V3
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+"""
+import ctypes
+from os.path import join, dirname, realpath
+import numpy as np
+
+SIMD_LEVELS = ["scalar", "sse2", "avx2", "avx512", "neon"]
+
+_f32_p = ctypes.POINTER(ctypes.c_float)
+_u8_p = ctypes.POINTER(ctypes.c_uint8)
+_size = ctypes.c_size_t
+
+def _load_library(lib_path=None):
+    if lib_path is None:
+        lib_path = join(dirname(realpath(__file__)), "libhdaq.so")
+    lib = ctypes.CDLL(lib_path)
+    signatures = {
+        "hdaq_simd_init"        : (ctypes.c_int, []),
+        "hdaq_simd_level"       : (ctypes.c_int, []),
+        "hdaq_simd_set_level"   : (ctypes.c_int, [ctypes.c_int]),
+        "hdaq_simd_supported"   : (ctypes.c_int, [ctypes.c_int]),
+        "hdaq_cu8_to_cf32"      : (None, [_u8_p, _f32_p, _size]),
+        "hdaq_cf32_transpose"   : (None, [_f32_p, _f32_p, _size, _size]),
+        "hdaq_u8_max"           : (ctypes.c_uint8, [_u8_p, _size]),
+        "hdaq_cf32_power"       : (ctypes.c_float, [_f32_p, _size]),
+        "hdaq_cf32_mean"        : (None, [_f32_p, _size, _f32_p]),
+        "hdaq_cf32_dotc"        : (None, [_f32_p, _f32_p, _size, _f32_p]),
+        "hdaq_cf32_mac"         : (None, [_f32_p, _f32_p, _f32_p, _size]),
+        "hdaq_cf32_scale"       : (None, [_f32_p, _f32_p, _size, _f32_p, _f32_p]),
+        "hdaq_cf32_xcorr"       : (None, [_f32_p, _f32_p, _size, _size, _f32_p]),
+        "hdaq_cf32_covariance"  : (None, [_f32_p, _size, _size, _f32_p]),
+        "hdaq_cf32_fir_decimate": (_size, [_f32_p, _f32_p, _size, _f32_p, _size, _size, _f32_p]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        func = getattr(lib, name)
+        func.restype = restype
+        func.argtypes = argtypes
+    return lib
+
+_lib = None
+def _get_lib():
+    global _lib
+    if _lib is None:
+        _lib = _load_library()
+    return _lib
+
+def _check(array, dtype, name):
+    if not isinstance(array, np.ndarray) or array.dtype != dtype:
+        raise ValueError("{:s} must be a numpy array of {:s}".format(name, np.dtype(dtype).name))
+    if not array.flags.c_contiguous:
+        raise ValueError("{:s} must be C-contiguous".format(name))
+
+def _ptr(array, dtype, name, writable=False):
+    """
+        Returns the float / uint8 pointer of the array data after checking the layout
+    """
+    _check(array, dtype, name)
+    if writable and not array.flags.writeable:
+        raise ValueError("{:s} must be writable".format(name))
+    return array.ctypes.data_as(_u8_p if dtype == np.uint8 else _f32_p)
+
+def _out(out, shape, name="out"):
+    if out is None:
+        return np.empty(shape, dtype=np.complex64)
+    _check(out, np.complex64, name)
+    if out.shape != tuple(shape):
+        raise ValueError("{:s} must have the shape {:s}".format(name, str(tuple(shape))))
+    return out
+
+def _cscalar(value):
+    return (ctypes.c_float * 2)(np.real(value), np.imag(value))
+
+def simd_level():
+    """
+        Returns the name of the selected kernel variant
+    """
+    return SIMD_LEVELS[_get_lib().hdaq_simd_init()]
+
+def set_simd_level(name):
+    """
+        Selects the kernel variant, e.g.: "scalar"
+
+        :return: 0 on success, -1 when the variant is not supported by the host
+    """
+    return _get_lib().hdaq_simd_set_level(SIMD_LEVELS.index(name))
+
+def simd_supported(name):
+    return bool(_get_lib().hdaq_simd_supported(SIMD_LEVELS.index(name)))
+
+#
+# Conversion
+#
+def cu8_to_cf32(raw, out=None):
+    """
+        Converts raw interleaved cu8 samples to complex64 (rtl_daq and decimator
+        sample format)
+
+        :param raw: uint8 array of the interleaved I/Q samples, e.g. the payload of
+                    a raw frame with the shape (M, 2*N)
+        :param out: Optional complex64 output array, its shape is that of the input
+                    with a halved last dimension
+
+        :return: The converted samples
+    """
+    if raw.shape[-1] % 2:
+        raise ValueError("raw must have an even number of I/Q values in its last dimension")
+    out = _out(out, raw.shape[:-1]+(raw.shape[-1]//2,))
+    _get_lib().hdaq_cu8_to_cf32(_ptr(raw, np.uint8, "raw"), _ptr(out, np.complex64, "out", True), raw.size)
+    return out
+
+def transpose(x, out=None):
+    """
+        Transposes a 2D complex64 matrix
+    """
+    if x.ndim != 2:
+        raise ValueError("x must be a 2D array")
+    rows, cols = x.shape
+    out = _out(out, (cols, rows))
+    _get_lib().hdaq_cf32_transpose(_ptr(x, np.complex64, "x"), _ptr(out, np.complex64, "out", True), rows, cols)
+    return out
+
+#
+# Statistics
+#
+def u8_max(raw):
+    return int(_get_lib().hdaq_u8_max(_ptr(raw, np.uint8, "raw"), raw.size))
+
+def power(x):
+    """
+        Total power (sum of the squared magnitudes) of the complex samples
+    """
+    return float(_get_lib().hdaq_cf32_power(_ptr(x, np.complex64, "x"), x.size))
+
+def mean(x):
+    result = (ctypes.c_float * 2)()
+    _get_lib().hdaq_cf32_mean(_ptr(x, np.complex64, "x"), x.size, result)
+    return complex(result[0], result[1])
+
+#
+# Complex arithmetic
+#
+def dotc(a, b):
+    """
+        Inner product of two complex arrays, sum(a*conj(b))
+    """
+    if a.size != b.size:
+        raise ValueError("a and b must have the same size")
+    result = (ctypes.c_float * 2)()
+    _get_lib().hdaq_cf32_dotc(_ptr(a, np.complex64, "a"), _ptr(b, np.complex64, "b"), a.size, result)
+    return complex(result[0], result[1])
+
+def mac(acc, x, c):
+    """
+        In-place complex multiply-accumulate, acc += x*c
+    """
+    if acc.size != x.size:
+        raise ValueError("acc and x must have the same size")
+    _get_lib().hdaq_cf32_mac(_ptr(acc, np.complex64, "acc", True), _ptr(x, np.complex64, "x"), _cscalar(c), x.size)
+    return acc
+
+def scale(x, c, offset=0, out=None):
+    """
+        Offset removal and complex scaling, out = (x-offset)*c. The operation can be
+        done in-place by passing x as the output array.
+    """
+    out = _out(out, x.shape)
+    _get_lib().hdaq_cf32_scale(_ptr(x, np.complex64, "x"), _ptr(out, np.complex64, "out", True), x.size,
+                               _cscalar(offset), _cscalar(c))
+    return out
+
+def correct_iq(iq_samples_in, iq_samples_out, iq_corrections):
+    """
+        Removes the DC component of the channels and applies the amplitude and
+        phase corrections, as done by the delay synchronizer on the output frames
+
+        :param iq_samples_in: Complex64 multichannel samples with the shape (M, N)
+        :param iq_samples_out: Output array with the same shape (can be the input),
+                               allocated when None
+        :param iq_corrections: Complex correction coefficients of the channels
+    """
+    iq_samples_out = _out(iq_samples_out, iq_samples_in.shape, "iq_samples_out")
+    for m in range(iq_samples_in.shape[0]):
+        scale(iq_samples_in[m, :], iq_corrections[m], mean(iq_samples_in[m, :]), iq_samples_out[m, :])
+    return iq_samples_out
+
+#
+# Correlation and filtering
+#
+def xcorr(a, b, max_lag):
+    """
+        Cross-correlation of two complex arrays on the lags -max_lag..max_lag
+
+        :return: Complex64 array of 2*max_lag+1 values, the value at index
+                 max_lag+l is sum(a[k+l]*conj(b[k]))
+    """
+    if a.size != b.size:
+        raise ValueError("a and b must have the same size")
+    out = np.empty(2*max_lag+1, dtype=np.complex64)
+    _get_lib().hdaq_cf32_xcorr(_ptr(a, np.complex64, "a"), _ptr(b, np.complex64, "b"), a.size, max_lag,
+                               _ptr(out, np.complex64, "out", True))
+    return out
+
+def covariance(x, out=None):
+    """
+        Spatial covariance matrix of multichannel samples, x*x^H/N
+
+        :param x: Complex64 samples with the shape (M, N)
+
+        :return: Complex64 (M, M) matrix
+    """
+    if x.ndim != 2:
+        raise ValueError("x must be a 2D array")
+    M, N = x.shape
+    out = _out(out, (M, M))
+    _get_lib().hdaq_cf32_covariance(_ptr(x, np.complex64, "x"), M, N, _ptr(out, np.complex64, "out", True))
+    return out
+
+class FIRDecimator():
+    """
+        Multichannel FIR filter and decimator with the sample selection of the
+        decimator stage: every output sample is the filter output at the last input
+        sample of its decimation period. The filter states are kept between the
+        calls, so consecutive frames can be processed as a continuous stream.
+    """
+    def __init__(self, coeffs, dec, ch_no):
+        """
+            :param coeffs: Real FIR filter coefficients
+            :param dec: Decimation ratio
+            :param ch_no: Number of channels
+        """
+        self.coeffs = np.ascontiguousarray(coeffs, dtype=np.float32)
+        if self.coeffs.ndim != 1 or not len(self.coeffs) or dec < 1:
+            raise ValueError("Invalid filter coefficients or decimation ratio")
+        self.dec = dec
+        self.states = np.zeros((ch_no, len(self.coeffs)-1), dtype=np.complex64)
+
+    def reset(self):
+        self.states[:] = 0
+
+    def process(self, x, out=None):
+        """
+            :param x: Complex64 samples with the shape (M, N), N is a multiple of
+                      the decimation ratio
+            :param out: Optional complex64 output array with the shape (M, N/dec)
+
+            :return: The filtered and decimated samples
+        """
+        if x.ndim != 2 or x.shape[0] != self.states.shape[0]:
+            raise ValueError("x must have the shape (channel number, N)")
+        if x.shape[1] % self.dec:
+            raise ValueError("The sample count must be a multiple of the decimation ratio")
+        out = _out(out, (x.shape[0], x.shape[1]//self.dec))
+        lib = _get_lib()
+        coeffs = self.coeffs.ctypes.data_as(_f32_p)
+        for m in range(x.shape[0]):
+            lib.hdaq_cf32_fir_decimate(_ptr(x[m, :], np.complex64, "x"), _ptr(out[m, :], np.complex64, "out", True),
+                                       x.shape[1], coeffs, len(self.coeffs), self.dec,
+                                       self.states[m, :].ctypes.data_as(_f32_p))
+        return out
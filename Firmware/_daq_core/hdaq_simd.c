@@ -0,0 +1,1406 @@
+/*
+ *
+ * Description :
+ * Vectorized signal processing primitives shared by the DAQ stages
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "hdaq_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HDAQ_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HDAQ_SIMD_ARM_NEON
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#define CU8_DC    127.5f
+#define CU8_SCALE (1.0f/127.5f)
+#define TRANSPOSE_BLOCK 16
+
+/*
+ * The variants must give the same results as the scalar implementation. The
+ * library is compiled with -ffp-contract=off, so the element wise kernels are
+ * bit exact, the reductions differ only in the order of the summation.
+ */
+struct hdaq_simd_kernels
+{
+    void    (*cu8_to_cf32)(const uint8_t* in, float* out, size_t n);
+    void    (*cu8_to_f32_split)(const uint8_t* in, float* out_i, float* out_q, size_t n);
+    void    (*f32_interleave)(const float* in_i, const float* in_q, float* out, size_t n);
+    uint8_t (*u8_max)(const uint8_t* in, size_t n);
+    float   (*cf32_power)(const float* x, size_t n);
+    void    (*cf32_sum)(const float* x, size_t n, float* sum);
+    void    (*cf32_dotc)(const float* a, const float* b, size_t n, float* result);
+    void    (*cf32_mac)(float* acc, const float* x, const float* c, size_t n);
+    void    (*cf32_scale)(const float* in, float* out, size_t n, const float* offset, const float* c);
+};
+
+/*
+ * Output writers of the large shared memory frames. They store the same values
+ * as the regular kernels, the non-temporal stores only bypass the cache.
+ */
+struct hdaq_stream_kernels
+{
+    void (*copy)(void* dst, const void* src, size_t size);
+    void (*cu8_to_cf32)(const uint8_t* in, float* out, size_t n);
+    void (*f32_interleave)(const float* in_i, const float* in_q, float* out, size_t n, size_t step);
+};
+
+/*
+ *-------------------------------------
+ *  Scalar implementations
+ *-------------------------------------
+ */
+static void cu8_to_cf32_scalar(const uint8_t* in, float* out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = ((float) in[i] - CU8_DC) * CU8_SCALE;
+}
+
+static void cu8_to_f32_split_scalar(const uint8_t* in, float* out_i, float* out_q, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        out_i[i] = ((float) in[2*i]   - CU8_DC) * CU8_SCALE;
+        out_q[i] = ((float) in[2*i+1] - CU8_DC) * CU8_SCALE;
+    }
+}
+
+static void f32_interleave_scalar(const float* in_i, const float* in_q, float* out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        out[2*i]   = in_i[i];
+        out[2*i+1] = in_q[i];
+    }
+}
+
+static void f32_interleave_step_scalar(const float* in_i, const float* in_q, float* out, size_t n, size_t step)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        out[2*i]   = in_i[i*step];
+        out[2*i+1] = in_q[i*step];
+    }
+}
+
+static void copy_scalar(void* dst, const void* src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+
+static uint8_t u8_max_scalar(const uint8_t* in, size_t n)
+{
+    uint8_t max = 0;
+    for (size_t i = 0; i < n; i++)
+        if (in[i] > max) {max = in[i];}
+    return max;
+}
+
+static float cf32_power_scalar(const float* x, size_t n)
+{
+    double power = 0;
+    for (size_t i = 0; i < 2*n; i++)
+        power += x[i] * x[i];
+    return (float) power;
+}
+
+static void cf32_sum_scalar(const float* x, size_t n, float* sum)
+{
+    double re = 0, im = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        re += x[2*i];
+        im += x[2*i+1];
+    }
+    sum[0] = (float) re;
+    sum[1] = (float) im;
+}
+
+static void cf32_dotc_scalar(const float* a, const float* b, size_t n, float* result)
+{
+    double re = 0, im = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        re += a[2*i] * b[2*i] + a[2*i+1] * b[2*i+1];
+        im += a[2*i+1] * b[2*i] - a[2*i] * b[2*i+1];
+    }
+    result[0] = (float) re;
+    result[1] = (float) im;
+}
+
+static void cf32_mac_scalar(float* acc, const float* x, const float* c, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        float re = x[2*i] * c[0] - x[2*i+1] * c[1];
+        float im = x[2*i+1] * c[0] + x[2*i] * c[1];
+        acc[2*i]   += re;
+        acc[2*i+1] += im;
+    }
+}
+
+static void cf32_scale_scalar(const float* in, float* out, size_t n, const float* offset, const float* c)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        float re = in[2*i]   - offset[0];
+        float im = in[2*i+1] - offset[1];
+        out[2*i]   = re * c[0] - im * c[1];
+        out[2*i+1] = im * c[0] + re * c[1];
+    }
+}
+
+/*
+ * Sums the partial results of the vector accumulators. Even lanes hold real,
+ * odd lanes imaginary parts.
+ */
+static void sum_lanes(const float* lanes, int lane_cnt, double* even, double* odd)
+{
+    *even = 0;
+    *odd  = 0;
+    for (int l = 0; l < lane_cnt; l += 2)
+    {
+        *even += lanes[l];
+        *odd  += lanes[l+1];
+    }
+}
+
+/*
+ * Reductions finish the remaining samples with the scalar implementation and
+ * add the vector partial sums to its result.
+ */
+#define FINISH_POWER(lanes, lane_cnt, x, i, n)                   \
+    {                                                            \
+        double even, odd;                                        \
+        sum_lanes(lanes, lane_cnt, &even, &odd);                 \
+        return (float) (even + odd + cf32_power_scalar(x+2*i, n-i)); \
+    }
+
+#define FINISH_SUM(lanes, lane_cnt, x, i, n, sum)                \
+    {                                                            \
+        double even, odd;                                        \
+        sum_lanes(lanes, lane_cnt, &even, &odd);                 \
+        cf32_sum_scalar(x+2*i, n-i, sum);                        \
+        sum[0] = (float) (sum[0] + even);                        \
+        sum[1] = (float) (sum[1] + odd);                         \
+    }
+
+#define FINISH_DOTC(lanes_re, lanes_im, lane_cnt, a, b, i, n, result) \
+    {                                                            \
+        double re_even, re_odd, im_even, im_odd;                 \
+        sum_lanes(lanes_re, lane_cnt, &re_even, &re_odd);        \
+        sum_lanes(lanes_im, lane_cnt, &im_even, &im_odd);        \
+        cf32_dotc_scalar(a+2*i, b+2*i, n-i, result);             \
+        result[0] = (float) (result[0] + re_even + re_odd);      \
+        result[1] = (float) (result[1] + im_odd - im_even);      \
+    }
+
+#ifdef HDAQ_SIMD_X86
+/*
+ *-------------------------------------
+ *  SSE2
+ *-------------------------------------
+ */
+#define SSE2 __attribute__((target("sse2")))
+
+SSE2 static inline __m128 cvt_u32_sse2(__m128i v)
+{
+    return _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(CU8_DC)), _mm_set1_ps(CU8_SCALE));
+}
+
+/* (x*c), x holds two complex samples, cr and ci are the broadcasted parts of c */
+SSE2 static inline __m128 cmul_sse2(__m128 x, __m128 cr, __m128 ci)
+{
+    const __m128 sign = _mm_castsi128_ps(_mm_set1_epi64x(0x80000000));
+    __m128 t1 = _mm_mul_ps(x, cr);
+    __m128 t2 = _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2,3,0,1)), ci);
+    return _mm_add_ps(t1, _mm_xor_ps(t2, sign));
+}
+
+SSE2 static void cu8_to_cf32_sse2(const uint8_t* in, float* out, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v  = _mm_loadu_si128((const __m128i*) (in+i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps(out+i,    cvt_u32_sse2(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(out+i+4,  cvt_u32_sse2(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(out+i+8,  cvt_u32_sse2(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(out+i+12, cvt_u32_sse2(_mm_unpackhi_epi16(hi, zero)));
+    }
+    cu8_to_cf32_scalar(in+i, out+i, n-i);
+}
+
+SSE2 static void cu8_to_f32_split_sse2(const uint8_t* in, float* out_i, float* out_q, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v  = _mm_loadu_si128((const __m128i*) (in+2*i));
+        __m128i iv = _mm_and_si128(v, mask);
+        __m128i qv = _mm_srli_epi16(v, 8);
+        _mm_storeu_ps(out_i+i,   cvt_u32_sse2(_mm_unpacklo_epi16(iv, zero)));
+        _mm_storeu_ps(out_i+i+4, cvt_u32_sse2(_mm_unpackhi_epi16(iv, zero)));
+        _mm_storeu_ps(out_q+i,   cvt_u32_sse2(_mm_unpacklo_epi16(qv, zero)));
+        _mm_storeu_ps(out_q+i+4, cvt_u32_sse2(_mm_unpackhi_epi16(qv, zero)));
+    }
+    cu8_to_f32_split_scalar(in+2*i, out_i+i, out_q+i, n-i);
+}
+
+SSE2 static void f32_interleave_sse2(const float* in_i, const float* in_q, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(in_i+i);
+        __m128 b = _mm_loadu_ps(in_q+i);
+        _mm_storeu_ps(out+2*i,   _mm_unpacklo_ps(a, b));
+        _mm_storeu_ps(out+2*i+4, _mm_unpackhi_ps(a, b));
+    }
+    f32_interleave_scalar(in_i+i, in_q+i, out+2*i, n-i);
+}
+
+SSE2 static uint8_t reduce_max_sse2(__m128i m)
+{
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+    return (uint8_t) (_mm_cvtsi128_si32(m) & 0xFF);
+}
+
+SSE2 static uint8_t u8_max_sse2(const uint8_t* in, size_t n)
+{
+    __m128i m = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        m = _mm_max_epu8(m, _mm_loadu_si128((const __m128i*) (in+i)));
+    uint8_t max = reduce_max_sse2(m);
+    uint8_t tail_max = u8_max_scalar(in+i, n-i);
+    return tail_max > max ? tail_max : max;
+}
+
+SSE2 static float cf32_power_sse2(const float* x, size_t n)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    float lanes[4];
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(x+2*i);
+        __m128 b = _mm_loadu_ps(x+2*i+4);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+    }
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    FINISH_POWER(lanes, 4, x, i, n)
+}
+
+SSE2 static void cf32_sum_sse2(const float* x, size_t n, float* sum)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    float lanes[4];
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_loadu_ps(x+2*i));
+        acc1 = _mm_add_ps(acc1, _mm_loadu_ps(x+2*i+4));
+    }
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    FINISH_SUM(lanes, 4, x, i, n, sum)
+}
+
+SSE2 static void cf32_dotc_sse2(const float* a, const float* b, size_t n, float* result)
+{
+    __m128 acc_re = _mm_setzero_ps(), acc_im = _mm_setzero_ps();
+    float lanes_re[4], lanes_im[4];
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128 va = _mm_loadu_ps(a+2*i);
+        __m128 vb = _mm_loadu_ps(b+2*i);
+        acc_re = _mm_add_ps(acc_re, _mm_mul_ps(va, vb));
+        acc_im = _mm_add_ps(acc_im, _mm_mul_ps(va, _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2,3,0,1))));
+    }
+    _mm_storeu_ps(lanes_re, acc_re);
+    _mm_storeu_ps(lanes_im, acc_im);
+    FINISH_DOTC(lanes_re, lanes_im, 4, a, b, i, n, result)
+}
+
+SSE2 static void cf32_mac_sse2(float* acc, const float* x, const float* c, size_t n)
+{
+    const __m128 cr = _mm_set1_ps(c[0]), ci = _mm_set1_ps(c[1]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_ps(acc+2*i, _mm_add_ps(_mm_loadu_ps(acc+2*i), cmul_sse2(_mm_loadu_ps(x+2*i), cr, ci)));
+    cf32_mac_scalar(acc+2*i, x+2*i, c, n-i);
+}
+
+SSE2 static void cf32_scale_sse2(const float* in, float* out, size_t n, const float* offset, const float* c)
+{
+    const __m128 cr = _mm_set1_ps(c[0]), ci = _mm_set1_ps(c[1]);
+    const __m128 off = _mm_setr_ps(offset[0], offset[1], offset[0], offset[1]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_ps(out+2*i, cmul_sse2(_mm_sub_ps(_mm_loadu_ps(in+2*i), off), cr, ci));
+    cf32_scale_scalar(in+2*i, out+2*i, n-i, offset, c);
+}
+
+/*
+ * Non-temporal variants of the output writers, the aligned body of the output
+ * is streamed, the unaligned edges are written with regular stores. The
+ * streaming stores are weakly ordered, they are fenced before returning, so the
+ * frame is complete when the buffer is passed to the next stage. The wider
+ * instruction sets do not make them faster, writing the memory is the limit.
+ */
+SSE2 static void copy_stream_sse2(void* dst, const void* src, size_t size)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i = (16 - ((uintptr_t) d & 15)) & 15;
+    if (i > size) {i = size;}
+    memcpy(d, s, i);
+    for (; i + 64 <= size; i += 64)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i*) (s+i));
+        __m128i v1 = _mm_loadu_si128((const __m128i*) (s+i+16));
+        __m128i v2 = _mm_loadu_si128((const __m128i*) (s+i+32));
+        __m128i v3 = _mm_loadu_si128((const __m128i*) (s+i+48));
+        _mm_stream_si128((__m128i*) (d+i),    v0);
+        _mm_stream_si128((__m128i*) (d+i+16), v1);
+        _mm_stream_si128((__m128i*) (d+i+32), v2);
+        _mm_stream_si128((__m128i*) (d+i+48), v3);
+    }
+    for (; i + 16 <= size; i += 16)
+        _mm_stream_si128((__m128i*) (d+i), _mm_loadu_si128((const __m128i*) (s+i)));
+    memcpy(d+i, s+i, size-i);
+    _mm_sfence();
+}
+
+SSE2 static void cu8_to_cf32_stream_sse2(const uint8_t* in, float* out, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = ((16 - ((uintptr_t) out & 15)) & 15) / sizeof(float);
+    if (i > n) {i = n;}
+    cu8_to_cf32_scalar(in, out, i);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v  = _mm_loadu_si128((const __m128i*) (in+i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_stream_ps(out+i,    cvt_u32_sse2(_mm_unpacklo_epi16(lo, zero)));
+        _mm_stream_ps(out+i+4,  cvt_u32_sse2(_mm_unpackhi_epi16(lo, zero)));
+        _mm_stream_ps(out+i+8,  cvt_u32_sse2(_mm_unpacklo_epi16(hi, zero)));
+        _mm_stream_ps(out+i+12, cvt_u32_sse2(_mm_unpackhi_epi16(hi, zero)));
+    }
+    cu8_to_cf32_scalar(in+i, out+i, n-i);
+    _mm_sfence();
+}
+
+SSE2 static void f32_interleave_stream_sse2(const float* in_i, const float* in_q, float* out, size_t n, size_t step)
+{
+    size_t i = 0;
+    if ((uintptr_t) out & 7) // The complex samples can not be aligned
+    {
+        f32_interleave_step_scalar(in_i, in_q, out, n, step);
+        return;
+    }
+    if (((uintptr_t) out & 15) && n > 0)
+    {
+        out[0] = in_i[0];
+        out[1] = in_q[0];
+        i = 1;
+    }
+    if (step == 1)
+    {
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 a = _mm_loadu_ps(in_i+i);
+            __m128 b = _mm_loadu_ps(in_q+i);
+            _mm_stream_ps(out+2*i,   _mm_unpacklo_ps(a, b));
+            _mm_stream_ps(out+2*i+4, _mm_unpackhi_ps(a, b));
+        }
+    }
+    else
+    {
+        for (; i + 4 <= n; i += 4)
+        {
+            const float* pi = in_i + i*step;
+            const float* pq = in_q + i*step;
+            __m128 a = _mm_set_ps(pi[3*step], pi[2*step], pi[step], pi[0]);
+            __m128 b = _mm_set_ps(pq[3*step], pq[2*step], pq[step], pq[0]);
+            _mm_stream_ps(out+2*i,   _mm_unpacklo_ps(a, b));
+            _mm_stream_ps(out+2*i+4, _mm_unpackhi_ps(a, b));
+        }
+    }
+    f32_interleave_step_scalar(in_i+i*step, in_q+i*step, out+2*i, n-i, step);
+    _mm_sfence();
+}
+
+/*
+ *-------------------------------------
+ *  AVX2
+ *-------------------------------------
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256 cvt_u32_avx2(__m256i v)
+{
+    return _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(CU8_DC)), _mm256_set1_ps(CU8_SCALE));
+}
+
+AVX2 static inline __m256 cmul_avx2(__m256 x, __m256 cr, __m256 ci)
+{
+    const __m256 sign = _mm256_castsi256_ps(_mm256_set1_epi64x(0x80000000));
+    __m256 t1 = _mm256_mul_ps(x, cr);
+    __m256 t2 = _mm256_mul_ps(_mm256_permute_ps(x, 0xB1), ci);
+    return _mm256_add_ps(t1, _mm256_xor_ps(t2, sign));
+}
+
+AVX2 static void cu8_to_cf32_avx2(const uint8_t* in, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        for (int k = 0; k < 32; k += 8)
+        {
+            __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (in+i+k)));
+            _mm256_storeu_ps(out+i+k, cvt_u32_avx2(v));
+        }
+    }
+    cu8_to_cf32_scalar(in+i, out+i, n-i);
+}
+
+AVX2 static void cu8_to_f32_split_avx2(const uint8_t* in, float* out_i, float* out_q, size_t n)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i v  = _mm256_loadu_si256((const __m256i*) (in+2*i));
+        __m256i iv = _mm256_and_si256(v, mask);
+        __m256i qv = _mm256_srli_epi16(v, 8);
+        _mm256_storeu_ps(out_i+i,   cvt_u32_avx2(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(iv))));
+        _mm256_storeu_ps(out_i+i+8, cvt_u32_avx2(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(iv, 1))));
+        _mm256_storeu_ps(out_q+i,   cvt_u32_avx2(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(qv))));
+        _mm256_storeu_ps(out_q+i+8, cvt_u32_avx2(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(qv, 1))));
+    }
+    cu8_to_f32_split_scalar(in+2*i, out_i+i, out_q+i, n-i);
+}
+
+AVX2 static void f32_interleave_avx2(const float* in_i, const float* in_q, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 a  = _mm256_loadu_ps(in_i+i);
+        __m256 b  = _mm256_loadu_ps(in_q+i);
+        __m256 lo = _mm256_unpacklo_ps(a, b); // a0 b0 a1 b1 | a4 b4 a5 b5
+        __m256 hi = _mm256_unpackhi_ps(a, b); // a2 b2 a3 b3 | a6 b6 a7 b7
+        _mm256_storeu_ps(out+2*i,   _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(out+2*i+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    f32_interleave_scalar(in_i+i, in_q+i, out+2*i, n-i);
+}
+
+AVX2 static uint8_t u8_max_avx2(const uint8_t* in, size_t n)
+{
+    __m256i m = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+        m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i*) (in+i)));
+    uint8_t max = reduce_max_sse2(_mm_max_epu8(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1)));
+    uint8_t tail_max = u8_max_scalar(in+i, n-i);
+    return tail_max > max ? tail_max : max;
+}
+
+AVX2 static float cf32_power_avx2(const float* x, size_t n)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    float lanes[8];
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 a = _mm256_loadu_ps(x+2*i);
+        __m256 b = _mm256_loadu_ps(x+2*i+8);
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(a, a));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(b, b));
+    }
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+    FINISH_POWER(lanes, 8, x, i, n)
+}
+
+AVX2 static void cf32_sum_avx2(const float* x, size_t n, float* sum)
+{
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    float lanes[8];
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_add_ps(acc0, _mm256_loadu_ps(x+2*i));
+        acc1 = _mm256_add_ps(acc1, _mm256_loadu_ps(x+2*i+8));
+    }
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+    FINISH_SUM(lanes, 8, x, i, n, sum)
+}
+
+AVX2 static void cf32_dotc_avx2(const float* a, const float* b, size_t n, float* result)
+{
+    __m256 acc_re = _mm256_setzero_ps(), acc_im = _mm256_setzero_ps();
+    float lanes_re[8], lanes_im[8];
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256 va = _mm256_loadu_ps(a+2*i);
+        __m256 vb = _mm256_loadu_ps(b+2*i);
+        acc_re = _mm256_add_ps(acc_re, _mm256_mul_ps(va, vb));
+        acc_im = _mm256_add_ps(acc_im, _mm256_mul_ps(va, _mm256_permute_ps(vb, 0xB1)));
+    }
+    _mm256_storeu_ps(lanes_re, acc_re);
+    _mm256_storeu_ps(lanes_im, acc_im);
+    FINISH_DOTC(lanes_re, lanes_im, 8, a, b, i, n, result)
+}
+
+AVX2 static void cf32_mac_avx2(float* acc, const float* x, const float* c, size_t n)
+{
+    const __m256 cr = _mm256_set1_ps(c[0]), ci = _mm256_set1_ps(c[1]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_ps(acc+2*i, _mm256_add_ps(_mm256_loadu_ps(acc+2*i), cmul_avx2(_mm256_loadu_ps(x+2*i), cr, ci)));
+    cf32_mac_scalar(acc+2*i, x+2*i, c, n-i);
+}
+
+AVX2 static void cf32_scale_avx2(const float* in, float* out, size_t n, const float* offset, const float* c)
+{
+    const __m256 cr = _mm256_set1_ps(c[0]), ci = _mm256_set1_ps(c[1]);
+    const __m256 off = _mm256_setr_ps(offset[0], offset[1], offset[0], offset[1],
+                                      offset[0], offset[1], offset[0], offset[1]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_ps(out+2*i, cmul_avx2(_mm256_sub_ps(_mm256_loadu_ps(in+2*i), off), cr, ci));
+    cf32_scale_scalar(in+2*i, out+2*i, n-i, offset, c);
+}
+
+/*
+ *-------------------------------------
+ *  AVX-512 (F + BW)
+ *-------------------------------------
+ */
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+AVX512 static inline __m512 cvt_u32_avx512(__m512i v)
+{
+    return _mm512_mul_ps(_mm512_sub_ps(_mm512_cvtepi32_ps(v), _mm512_set1_ps(CU8_DC)), _mm512_set1_ps(CU8_SCALE));
+}
+
+AVX512 static inline __m512 cmul_avx512(__m512 x, __m512 cr, __m512 ci)
+{
+    const __m512i sign = _mm512_set1_epi64(0x80000000);
+    __m512 t1 = _mm512_mul_ps(x, cr);
+    __m512 t2 = _mm512_mul_ps(_mm512_permute_ps(x, 0xB1), ci);
+    return _mm512_add_ps(t1, _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(t2), sign)));
+}
+
+AVX512 static void cu8_to_cf32_avx512(const uint8_t* in, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        for (int k = 0; k < 64; k += 16)
+        {
+            __m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (in+i+k)));
+            _mm512_storeu_ps(out+i+k, cvt_u32_avx512(v));
+        }
+    }
+    cu8_to_cf32_scalar(in+i, out+i, n-i);
+}
+
+AVX512 static void cu8_to_f32_split_avx512(const uint8_t* in, float* out_i, float* out_q, size_t n)
+{
+    const __m512i mask = _mm512_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i v  = _mm512_loadu_si512((const void*) (in+2*i));
+        __m512i iv = _mm512_and_si512(v, mask);
+        __m512i qv = _mm512_srli_epi16(v, 8);
+        _mm512_storeu_ps(out_i+i,    cvt_u32_avx512(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(iv))));
+        _mm512_storeu_ps(out_i+i+16, cvt_u32_avx512(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(iv, 1))));
+        _mm512_storeu_ps(out_q+i,    cvt_u32_avx512(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(qv))));
+        _mm512_storeu_ps(out_q+i+16, cvt_u32_avx512(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(qv, 1))));
+    }
+    cu8_to_f32_split_scalar(in+2*i, out_i+i, out_q+i, n-i);
+}
+
+AVX512 static void f32_interleave_avx512(const float* in_i, const float* in_q, float* out, size_t n)
+{
+    const __m512i idx_lo = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    const __m512i idx_hi = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 a = _mm512_loadu_ps(in_i+i);
+        __m512 b = _mm512_loadu_ps(in_q+i);
+        _mm512_storeu_ps(out+2*i,    _mm512_permutex2var_ps(a, idx_lo, b));
+        _mm512_storeu_ps(out+2*i+16, _mm512_permutex2var_ps(a, idx_hi, b));
+    }
+    f32_interleave_scalar(in_i+i, in_q+i, out+2*i, n-i);
+}
+
+AVX512 static uint8_t u8_max_avx512(const uint8_t* in, size_t n)
+{
+    __m512i m = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+        m = _mm512_max_epu8(m, _mm512_loadu_si512((const void*) (in+i)));
+    __m256i m256 = _mm256_max_epu8(_mm512_castsi512_si256(m), _mm512_extracti64x4_epi64(m, 1));
+    uint8_t max = reduce_max_sse2(_mm_max_epu8(_mm256_castsi256_si128(m256), _mm256_extracti128_si256(m256, 1)));
+    uint8_t tail_max = u8_max_scalar(in+i, n-i);
+    return tail_max > max ? tail_max : max;
+}
+
+AVX512 static float cf32_power_avx512(const float* x, size_t n)
+{
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    float lanes[16];
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 a = _mm512_loadu_ps(x+2*i);
+        __m512 b = _mm512_loadu_ps(x+2*i+16);
+        acc0 = _mm512_add_ps(acc0, _mm512_mul_ps(a, a));
+        acc1 = _mm512_add_ps(acc1, _mm512_mul_ps(b, b));
+    }
+    _mm512_storeu_ps(lanes, _mm512_add_ps(acc0, acc1));
+    FINISH_POWER(lanes, 16, x, i, n)
+}
+
+AVX512 static void cf32_sum_avx512(const float* x, size_t n, float* sum)
+{
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    float lanes[16];
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        acc0 = _mm512_add_ps(acc0, _mm512_loadu_ps(x+2*i));
+        acc1 = _mm512_add_ps(acc1, _mm512_loadu_ps(x+2*i+16));
+    }
+    _mm512_storeu_ps(lanes, _mm512_add_ps(acc0, acc1));
+    FINISH_SUM(lanes, 16, x, i, n, sum)
+}
+
+AVX512 static void cf32_dotc_avx512(const float* a, const float* b, size_t n, float* result)
+{
+    __m512 acc_re = _mm512_setzero_ps(), acc_im = _mm512_setzero_ps();
+    float lanes_re[16], lanes_im[16];
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m512 va = _mm512_loadu_ps(a+2*i);
+        __m512 vb = _mm512_loadu_ps(b+2*i);
+        acc_re = _mm512_add_ps(acc_re, _mm512_mul_ps(va, vb));
+        acc_im = _mm512_add_ps(acc_im, _mm512_mul_ps(va, _mm512_permute_ps(vb, 0xB1)));
+    }
+    _mm512_storeu_ps(lanes_re, acc_re);
+    _mm512_storeu_ps(lanes_im, acc_im);
+    FINISH_DOTC(lanes_re, lanes_im, 16, a, b, i, n, result)
+}
+
+AVX512 static void cf32_mac_avx512(float* acc, const float* x, const float* c, size_t n)
+{
+    const __m512 cr = _mm512_set1_ps(c[0]), ci = _mm512_set1_ps(c[1]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm512_storeu_ps(acc+2*i, _mm512_add_ps(_mm512_loadu_ps(acc+2*i), cmul_avx512(_mm512_loadu_ps(x+2*i), cr, ci)));
+    cf32_mac_scalar(acc+2*i, x+2*i, c, n-i);
+}
+
+AVX512 static void cf32_scale_avx512(const float* in, float* out, size_t n, const float* offset, const float* c)
+{
+    const __m512 cr = _mm512_set1_ps(c[0]), ci = _mm512_set1_ps(c[1]);
+    double off_pair;
+    memcpy(&off_pair, offset, sizeof(off_pair));
+    const __m512 off = _mm512_castpd_ps(_mm512_set1_pd(off_pair));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm512_storeu_ps(out+2*i, cmul_avx512(_mm512_sub_ps(_mm512_loadu_ps(in+2*i), off), cr, ci));
+    cf32_scale_scalar(in+2*i, out+2*i, n-i, offset, c);
+}
+#endif // HDAQ_SIMD_X86
+
+#ifdef HDAQ_SIMD_ARM_NEON
+/*
+ *-------------------------------------
+ *  NEON
+ *-------------------------------------
+ */
+static inline float32x4_t cvt_u16_lo_neon(uint16x8_t v)
+{
+    float32x4_t f = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+    return vmulq_f32(vsubq_f32(f, vdupq_n_f32(CU8_DC)), vdupq_n_f32(CU8_SCALE));
+}
+
+static inline float32x4_t cvt_u16_hi_neon(uint16x8_t v)
+{
+    float32x4_t f = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)));
+    return vmulq_f32(vsubq_f32(f, vdupq_n_f32(CU8_DC)), vdupq_n_f32(CU8_SCALE));
+}
+
+/* Converts 16 unsigned bytes */
+static inline void cvt_u8x16_neon(uint8x16_t v, float* out)
+{
+    uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+    vst1q_f32(out,    cvt_u16_lo_neon(lo));
+    vst1q_f32(out+4,  cvt_u16_hi_neon(lo));
+    vst1q_f32(out+8,  cvt_u16_lo_neon(hi));
+    vst1q_f32(out+12, cvt_u16_hi_neon(hi));
+}
+
+static inline float32x4_t cmul_neon(float32x4_t x, float32x4_t cr, float32x4_t ci)
+{
+    static const float sign[4] = {-1.0f, 1.0f, -1.0f, 1.0f};
+    float32x4_t t1 = vmulq_f32(x, cr);
+    float32x4_t t2 = vmulq_f32(vmulq_f32(vrev64q_f32(x), ci), vld1q_f32(sign));
+    return vaddq_f32(t1, t2);
+}
+
+static void cu8_to_cf32_neon(const uint8_t* in, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        cvt_u8x16_neon(vld1q_u8(in+i), out+i);
+    cu8_to_cf32_scalar(in+i, out+i, n-i);
+}
+
+static void cu8_to_f32_split_neon(const uint8_t* in, float* out_i, float* out_q, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16x2_t v = vld2q_u8(in+2*i);
+        cvt_u8x16_neon(v.val[0], out_i+i);
+        cvt_u8x16_neon(v.val[1], out_q+i);
+    }
+    cu8_to_f32_split_scalar(in+2*i, out_i+i, out_q+i, n-i);
+}
+
+static void f32_interleave_neon(const float* in_i, const float* in_q, float* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4x2_t v;
+        v.val[0] = vld1q_f32(in_i+i);
+        v.val[1] = vld1q_f32(in_q+i);
+        vst2q_f32(out+2*i, v);
+    }
+    f32_interleave_scalar(in_i+i, in_q+i, out+2*i, n-i);
+}
+
+static uint8_t u8_max_neon(const uint8_t* in, size_t n)
+{
+    uint8x16_t m = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        m = vmaxq_u8(m, vld1q_u8(in+i));
+    uint8x8_t d = vmax_u8(vget_low_u8(m), vget_high_u8(m));
+    d = vpmax_u8(d, d);
+    d = vpmax_u8(d, d);
+    d = vpmax_u8(d, d);
+    uint8_t max = vget_lane_u8(d, 0);
+    uint8_t tail_max = u8_max_scalar(in+i, n-i);
+    return tail_max > max ? tail_max : max;
+}
+
+static float cf32_power_neon(const float* x, size_t n)
+{
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    float lanes[4];
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t a = vld1q_f32(x+2*i);
+        float32x4_t b = vld1q_f32(x+2*i+4);
+        acc0 = vaddq_f32(acc0, vmulq_f32(a, a));
+        acc1 = vaddq_f32(acc1, vmulq_f32(b, b));
+    }
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    FINISH_POWER(lanes, 4, x, i, n)
+}
+
+static void cf32_sum_neon(const float* x, size_t n, float* sum)
+{
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    float lanes[4];
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = vaddq_f32(acc0, vld1q_f32(x+2*i));
+        acc1 = vaddq_f32(acc1, vld1q_f32(x+2*i+4));
+    }
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    FINISH_SUM(lanes, 4, x, i, n, sum)
+}
+
+static void cf32_dotc_neon(const float* a, const float* b, size_t n, float* result)
+{
+    float32x4_t acc_re = vdupq_n_f32(0), acc_im = vdupq_n_f32(0);
+    float lanes_re[4], lanes_im[4];
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        float32x4_t va = vld1q_f32(a+2*i);
+        float32x4_t vb = vld1q_f32(b+2*i);
+        acc_re = vaddq_f32(acc_re, vmulq_f32(va, vb));
+        acc_im = vaddq_f32(acc_im, vmulq_f32(va, vrev64q_f32(vb)));
+    }
+    vst1q_f32(lanes_re, acc_re);
+    vst1q_f32(lanes_im, acc_im);
+    FINISH_DOTC(lanes_re, lanes_im, 4, a, b, i, n, result)
+}
+
+static void cf32_mac_neon(float* acc, const float* x, const float* c, size_t n)
+{
+    const float32x4_t cr = vdupq_n_f32(c[0]), ci = vdupq_n_f32(c[1]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        vst1q_f32(acc+2*i, vaddq_f32(vld1q_f32(acc+2*i), cmul_neon(vld1q_f32(x+2*i), cr, ci)));
+    cf32_mac_scalar(acc+2*i, x+2*i, c, n-i);
+}
+
+static void cf32_scale_neon(const float* in, float* out, size_t n, const float* offset, const float* c)
+{
+    const float32x4_t cr = vdupq_n_f32(c[0]), ci = vdupq_n_f32(c[1]);
+    const float off_lanes[4] = {offset[0], offset[1], offset[0], offset[1]};
+    const float32x4_t off = vld1q_f32(off_lanes);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        vst1q_f32(out+2*i, cmul_neon(vsubq_f32(vld1q_f32(in+2*i), off), cr, ci));
+    cf32_scale_scalar(in+2*i, out+2*i, n-i, offset, c);
+}
+
+/*
+ * Non-temporal variants of the output writers. AArch64 has the non-temporal
+ * pair store (stnp), ARMv7 has no such hint, the regular stores are used there.
+ * Unlike on x86 the hint does not relax the ordering of the stores, no barrier
+ * is needed before passing the frame on.
+ */
+static inline void stream_store_neon(float* out, float32x4_t a, float32x4_t b)
+{
+#if defined(__aarch64__)
+    __asm__ volatile("stnp %q1, %q2, [%0]" : : "r" (out), "w" (a), "w" (b) : "memory");
+#else
+    vst1q_f32(out,   a);
+    vst1q_f32(out+4, b);
+#endif
+}
+
+static void copy_stream_neon(void* dst, const void* src, size_t size)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i = (16 - ((uintptr_t) d & 15)) & 15;
+    if (i > size) {i = size;}
+    memcpy(d, s, i);
+    for (; i + 32 <= size; i += 32)
+        stream_store_neon((float*) (d+i), vreinterpretq_f32_u8(vld1q_u8(s+i)), vreinterpretq_f32_u8(vld1q_u8(s+i+16)));
+    memcpy(d+i, s+i, size-i);
+}
+
+static void cu8_to_cf32_stream_neon(const uint8_t* in, float* out, size_t n)
+{
+    size_t i = ((16 - ((uintptr_t) out & 15)) & 15) / sizeof(float);
+    if (i > n) {i = n;}
+    cu8_to_cf32_scalar(in, out, i);
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(in+i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        stream_store_neon(out+i,   cvt_u16_lo_neon(lo), cvt_u16_hi_neon(lo));
+        stream_store_neon(out+i+8, cvt_u16_lo_neon(hi), cvt_u16_hi_neon(hi));
+    }
+    cu8_to_cf32_scalar(in+i, out+i, n-i);
+}
+
+static void f32_interleave_stream_neon(const float* in_i, const float* in_q, float* out, size_t n, size_t step)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t a, b;
+        if (step == 1)
+        {
+            a = vld1q_f32(in_i+i);
+            b = vld1q_f32(in_q+i);
+        }
+        else
+        {
+            const float* pi = in_i + i*step;
+            const float* pq = in_q + i*step;
+            const float ta[4] = {pi[0], pi[step], pi[2*step], pi[3*step]};
+            const float tb[4] = {pq[0], pq[step], pq[2*step], pq[3*step]};
+            a = vld1q_f32(ta);
+            b = vld1q_f32(tb);
+        }
+        float32x4x2_t z = vzipq_f32(a, b);
+        stream_store_neon(out+2*i, z.val[0], z.val[1]);
+    }
+    f32_interleave_step_scalar(in_i+i*step, in_q+i*step, out+2*i, n-i, step);
+}
+#endif // HDAQ_SIMD_ARM_NEON
+
+/*
+ *-------------------------------------
+ *  Runtime dispatch
+ *-------------------------------------
+ */
+#define KERNEL_TABLE(s)              \
+    {                                \
+        cu8_to_cf32_##s,             \
+        cu8_to_f32_split_##s,        \
+        f32_interleave_##s,          \
+        u8_max_##s,                  \
+        cf32_power_##s,              \
+        cf32_sum_##s,                \
+        cf32_dotc_##s,               \
+        cf32_mac_##s,                \
+        cf32_scale_##s               \
+    }
+
+static const struct hdaq_simd_kernels kernel_tables[HDAQ_SIMD_LEVEL_CNT] =
+{
+    [HDAQ_SIMD_SCALAR] = KERNEL_TABLE(scalar),
+#ifdef HDAQ_SIMD_X86
+    [HDAQ_SIMD_SSE2]   = KERNEL_TABLE(sse2),
+    [HDAQ_SIMD_AVX2]   = KERNEL_TABLE(avx2),
+    [HDAQ_SIMD_AVX512] = KERNEL_TABLE(avx512),
+#endif
+#ifdef HDAQ_SIMD_ARM_NEON
+    [HDAQ_SIMD_NEON]   = KERNEL_TABLE(neon),
+#endif
+};
+
+/* The wider x86 variants stream with the SSE2 writers, the scalar level does not stream */
+static const struct hdaq_stream_kernels stream_tables[HDAQ_SIMD_LEVEL_CNT] =
+{
+    [HDAQ_SIMD_SCALAR] = {copy_scalar, cu8_to_cf32_scalar, f32_interleave_step_scalar},
+#ifdef HDAQ_SIMD_X86
+    [HDAQ_SIMD_SSE2]   = {copy_stream_sse2, cu8_to_cf32_stream_sse2, f32_interleave_stream_sse2},
+    [HDAQ_SIMD_AVX2]   = {copy_stream_sse2, cu8_to_cf32_stream_sse2, f32_interleave_stream_sse2},
+    [HDAQ_SIMD_AVX512] = {copy_stream_sse2, cu8_to_cf32_stream_sse2, f32_interleave_stream_sse2},
+#endif
+#ifdef HDAQ_SIMD_ARM_NEON
+    [HDAQ_SIMD_NEON]   = {copy_stream_neon, cu8_to_cf32_stream_neon, f32_interleave_stream_neon},
+#endif
+};
+
+static const char* level_names[HDAQ_SIMD_LEVEL_CNT] = {"scalar", "sse2", "avx2", "avx512", "neon"};
+
+static const struct hdaq_simd_kernels* kernels = NULL;
+static int active_level = HDAQ_SIMD_SCALAR;
+static const struct hdaq_stream_kernels* stream_kernels = NULL;
+static size_t stream_threshold = HDAQ_STREAM_THRESHOLD_DEFAULT;
+static int stream_threshold_set = 0;
+
+int hdaq_simd_supported(int level)
+/*
+ * Checks whether the variant is compiled in and the host CPU is able to run it
+ */
+{
+    if (level < 0 || level >= HDAQ_SIMD_LEVEL_CNT) {return 0;}
+    if (kernel_tables[level].cu8_to_cf32 == NULL) {return 0;}
+    switch (level)
+    {
+#ifdef HDAQ_SIMD_X86
+        case HDAQ_SIMD_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case HDAQ_SIMD_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        case HDAQ_SIMD_AVX512:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+#ifdef HDAQ_SIMD_ARM_NEON
+        case HDAQ_SIMD_NEON:
+    #if defined(__aarch64__)
+            return 1; // Mandatory on AArch64
+    #else
+            return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+    #endif
+#endif
+        default:
+            return 1; // Scalar
+    }
+}
+
+const char* hdaq_simd_level_name(int level)
+{
+    if (level < 0 || level >= HDAQ_SIMD_LEVEL_CNT) {return "unknown";}
+    return level_names[level];
+}
+
+int hdaq_simd_set_level(int level)
+/*
+ * Selects the kernel variant, returns -1 when it can not run on the host
+ */
+{
+    if (!hdaq_simd_supported(level)) {return -1;}
+    active_level = level;
+    kernels = &kernel_tables[level];
+    stream_kernels = &stream_tables[level];
+    return 0;
+}
+
+int hdaq_simd_init(void)
+/*
+ * Selects the fastest variant supported by the host unless the HDAQ_SIMD
+ * environment variable requests a specific one. It is called implicitly by
+ * the first kernel call, the selected level is returned.
+ */
+{
+    if (kernels != NULL) {return active_level;}
+
+    const char* requested = getenv(HDAQ_SIMD_ENV);
+    if (requested != NULL)
+    {
+        for (int level = 0; level < HDAQ_SIMD_LEVEL_CNT; level++)
+        {
+            if (strcmp(requested, level_names[level]) == 0 && hdaq_simd_set_level(level) == 0)
+                {return active_level;}
+        }
+        log_warn("Requested SIMD kernel variant is not available: %s", requested);
+    }
+
+    static const int preference[] = {HDAQ_SIMD_AVX512, HDAQ_SIMD_AVX2, HDAQ_SIMD_SSE2, HDAQ_SIMD_NEON};
+    for (size_t p = 0; p < sizeof(preference)/sizeof(preference[0]); p++)
+    {
+        if (hdaq_simd_set_level(preference[p]) == 0) {return active_level;}
+    }
+    hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+    return active_level;
+}
+
+int hdaq_simd_level(void)
+{
+    return hdaq_simd_init();
+}
+
+static inline const struct hdaq_simd_kernels* get_kernels(void)
+{
+    if (kernels == NULL) {hdaq_simd_init();}
+    return kernels;
+}
+
+/*
+ *-------------------------------------
+ *  Kernels
+ *-------------------------------------
+ */
+void hdaq_cu8_to_cf32(const uint8_t* in, float* out, size_t n)
+/*
+ * Converts n unsigned 8 bit values to float (n is twice the number of complex samples)
+ */
+{
+    get_kernels()->cu8_to_cf32(in, out, n);
+}
+
+void hdaq_cu8_to_f32_split(const uint8_t* in, float* out_i, float* out_q, size_t n)
+/*
+ * Converts n cu8 complex samples to separate I and Q float arrays
+ */
+{
+    get_kernels()->cu8_to_f32_split(in, out_i, out_q, n);
+}
+
+void hdaq_f32_interleave(const float* in_i, const float* in_q, float* out, size_t n, size_t step)
+/*
+ * Interleaves n samples of the I and Q arrays into a complex array, taking
+ * every step-th input sample. Strided access is memory bound, only the step=1
+ * case is vectorized.
+ */
+{
+    if (step == 1)
+    {
+        get_kernels()->f32_interleave(in_i, in_q, out, n);
+        return;
+    }
+    f32_interleave_step_scalar(in_i, in_q, out, n, step);
+}
+
+void hdaq_cf32_transpose(const float* in, float* out, size_t rows, size_t cols)
+/*
+ * Transposes a rows x cols complex matrix (row-major). The operation is memory
+ * bound, the same cache blocked implementation is used on every host.
+ */
+{
+    const uint64_t* src = (const uint64_t*) in; // One complex sample is moved as a 64 bit word
+    uint64_t* dst = (uint64_t*) out;
+    for (size_t rb = 0; rb < rows; rb += TRANSPOSE_BLOCK)
+    {
+        size_t r_end = rb + TRANSPOSE_BLOCK < rows ? rb + TRANSPOSE_BLOCK : rows;
+        for (size_t cb = 0; cb < cols; cb += TRANSPOSE_BLOCK)
+        {
+            size_t c_end = cb + TRANSPOSE_BLOCK < cols ? cb + TRANSPOSE_BLOCK : cols;
+            for (size_t r = rb; r < r_end; r++)
+                for (size_t c = cb; c < c_end; c++)
+                    dst[c*rows + r] = src[r*cols + c];
+        }
+    }
+}
+
+uint8_t hdaq_u8_max(const uint8_t* in, size_t n)
+/*
+ * Maximum of n unsigned 8 bit values, used for the ADC overdrive detection
+ */
+{
+    return get_kernels()->u8_max(in, n);
+}
+
+float hdaq_cf32_power(const float* x, size_t n)
+/*
+ * Total power (sum of the squared magnitudes) of n complex samples
+ */
+{
+    return get_kernels()->cf32_power(x, n);
+}
+
+void hdaq_cf32_mean(const float* x, size_t n, float* mean)
+{
+    if (n == 0)
+    {
+        mean[0] = 0;
+        mean[1] = 0;
+        return;
+    }
+    get_kernels()->cf32_sum(x, n, mean);
+    mean[0] /= (float) n;
+    mean[1] /= (float) n;
+}
+
+void hdaq_cf32_dotc(const float* a, const float* b, size_t n, float* result)
+/*
+ * Inner product of n complex samples, sum(a*conj(b))
+ */
+{
+    get_kernels()->cf32_dotc(a, b, n, result);
+}
+
+void hdaq_cf32_mac(float* acc, const float* x, const float* c, size_t n)
+/*
+ * Complex multiply-accumulate, acc += x*c
+ */
+{
+    get_kernels()->cf32_mac(acc, x, c, n);
+}
+
+void hdaq_cf32_scale(const float* in, float* out, size_t n, const float* offset, const float* c)
+/*
+ * Offset removal and complex scaling, out = (in-offset)*c. In-place operation is allowed.
+ */
+{
+    get_kernels()->cf32_scale(in, out, n, offset, c);
+}
+
+/*
+ *-------------------------------------
+ *  Streaming output writers
+ *-------------------------------------
+ */
+size_t hdaq_stream_threshold(void)
+/*
+ * Returns the frame size from which the output writes are streamed, it is taken
+ * from the HDAQ_STREAM environment variable on the first call ("off" disables
+ * the streaming stores)
+ */
+{
+    if (stream_threshold_set) {return stream_threshold;}
+    stream_threshold_set = 1;
+
+    const char* requested = getenv(HDAQ_STREAM_ENV);
+    if (requested == NULL) {return stream_threshold;}
+    char* end;
+    unsigned long long threshold = strtoull(requested, &end, 10);
+    if (strcmp(requested, "off") == 0)
+        {stream_threshold = HDAQ_STREAM_OFF;}
+    else if (end != requested && *end == '\0')
+        {stream_threshold = (size_t) threshold;}
+    else
+        {log_warn("Invalid streaming store threshold: %s, using %zu bytes", requested, stream_threshold);}
+    return stream_threshold;
+}
+
+void hdaq_stream_set_threshold(size_t size)
+{
+    stream_threshold = size;
+    stream_threshold_set = 1;
+}
+
+int hdaq_stream_frame(size_t size)
+/*
+ * Checks whether the output frame of the given size [byte] is written with
+ * streaming stores
+ */
+{
+    return size >= hdaq_stream_threshold();
+}
+
+void hdaq_stream_copy(void* dst, const void* src, size_t size)
+{
+    get_kernels();
+    stream_kernels->copy(dst, src, size);
+}
+
+void hdaq_stream_cu8_to_cf32(const uint8_t* in, float* out, size_t n)
+{
+    get_kernels();
+    stream_kernels->cu8_to_cf32(in, out, n);
+}
+
+void hdaq_stream_f32_interleave(const float* in_i, const float* in_q, float* out, size_t n, size_t step)
+{
+    get_kernels();
+    stream_kernels->f32_interleave(in_i, in_q, out, n, step);
+}
+
+/*
+ *-------------------------------------
+ *  Correlation and filtering
+ *-------------------------------------
+ */
+void hdaq_cf32_xcorr(const float* a, const float* b, size_t n, size_t max_lag, float* out)
+/*
+ * Cross-correlation of two complex arrays of n samples, evaluated on the lags
+ * -max_lag..max_lag: out[max_lag+l] = sum(a[k+l]*conj(b[k])) over the overlapping
+ * samples. The output has 2*max_lag+1 complex values.
+ */
+{
+    for (size_t l = 0; l <= max_lag; l++)
+    {
+        float* pos = out + 2*(max_lag+l);
+        float* neg = out + 2*(max_lag-l);
+        if (l >= n)
+        {
+            pos[0] = pos[1] = neg[0] = neg[1] = 0;
+            continue;
+        }
+        hdaq_cf32_dotc(a+2*l, b, n-l, pos);
+        if (l > 0) {hdaq_cf32_dotc(a, b+2*l, n-l, neg);}
+    }
+}
+
+void hdaq_cf32_covariance(const float* x, size_t m, size_t n, float* out)
+/*
+ * Spatial covariance matrix of m channels of n samples (row-major m x n input),
+ * out = x*x^H/n as a row-major m x m complex matrix. Only the upper triangle is
+ * computed, the lower one is filled with the conjugates.
+ */
+{
+    float scale = n ? 1.0f / (float) n : 0;
+    for (size_t r = 0; r < m; r++)
+    {
+        for (size_t c = r; c < m; c++)
+        {
+            float* rc = out + 2*(r*m+c);
+            float* cr = out + 2*(c*m+r);
+            hdaq_cf32_dotc(x+2*r*n, x+2*c*n, n, rc);
+            rc[0] *= scale;
+            rc[1] *= scale;
+            cr[0] = rc[0];
+            cr[1] = (r == c) ? 0 : -rc[1];
+        }
+    }
+}
+
+size_t hdaq_cf32_fir_decimate(const float* in, float* out, size_t n, const float* coeffs, size_t tap_size,
+                              size_t dec, float* state)
+/*
+ * Filters n complex samples with a real FIR filter and keeps every dec-th output
+ * sample, the one at the last input sample of each decimation period, as the
+ * decimator stage does. The state array holds the last tap_size-1 complex input
+ * samples (oldest first) between the calls, it has to be zeroed before the first
+ * call. n should be a multiple of dec.
+ *
+ * This is a portable reference implementation of the decimator, the decimator
+ * stage itself uses the KFR (x86) or Ne10 (ARM) filter implementations.
+ *
+ * Returns the number of output samples (n/dec).
+ */
+{
+    size_t hist = tap_size - 1;
+    size_t n_out = n / dec;
+    for (size_t k = 0; k < n_out; k++)
+    {
+        size_t p = k*dec + dec-1;
+        float acc_i = 0, acc_q = 0;
+        if (p >= hist) // Every tap is on the input array
+        {
+            const float* s = in + 2*p;
+            for (size_t j = 0; j < tap_size; j++)
+            {
+                acc_i += coeffs[j] * s[-2*(ptrdiff_t)j];
+                acc_q += coeffs[j] * s[-2*(ptrdiff_t)j+1];
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < tap_size; j++)
+            {
+                const float* s = (j <= p) ? in + 2*(p-j) : state + 2*(hist+p-j);
+                acc_i += coeffs[j] * s[0];
+                acc_q += coeffs[j] * s[1];
+            }
+        }
+        out[2*k]   = acc_i;
+        out[2*k+1] = acc_q;
+    }
+    /* Keep the last tap_size-1 input samples for the next call */
+    if (n >= hist)
+    {
+        memcpy(state, in + 2*(n-hist), 2*hist*sizeof(float));
+    }
+    else
+    {
+        memmove(state, state + 2*n, 2*(hist-n)*sizeof(float));
+        memcpy(state + 2*(hist-n), in, 2*n*sizeof(float));
+    }
+    return n_out;
+}
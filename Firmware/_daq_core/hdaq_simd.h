@@ -0,0 +1,107 @@
+/*
+ *
+ * Description :
+ * Vectorized signal processing primitives shared by the DAQ stages
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HDAQ_SIMD_H
+#define HDAQ_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The kernels have a scalar implementation and SSE2, AVX2, AVX-512 and NEON
+ * variants, except for the memory bound transpose and strided interleave
+ * operations. The best variant supported by the host is selected at runtime
+ * (cpuid / hwcaps) on the first call, so the same binary runs on any CPU of the
+ * architecture. The selection can be overridden with the HDAQ_SIMD environment
+ * variable (e.g.: HDAQ_SIMD=scalar) or with hdaq_simd_set_level.
+ *
+ * Complex arrays are interleaved I/Q float arrays, a complex scalar parameter
+ * or result is passed as a pointer to two floats (real, imaginary). The cu8
+ * format is the interleaved unsigned 8 bit I/Q format of the RTL-SDR, it is
+ * converted to the [-1, 1] range as (x-127.5)/127.5.
+ */
+#define HDAQ_SIMD_ENV "HDAQ_SIMD"
+
+enum hdaq_simd_level
+{
+    HDAQ_SIMD_SCALAR = 0,
+    HDAQ_SIMD_SSE2,
+    HDAQ_SIMD_AVX2,
+    HDAQ_SIMD_AVX512,
+    HDAQ_SIMD_NEON,
+    HDAQ_SIMD_LEVEL_CNT
+};
+
+int hdaq_simd_init(void);
+int hdaq_simd_level(void);
+int hdaq_simd_set_level(int level);
+int hdaq_simd_supported(int level);
+const char* hdaq_simd_level_name(int level);
+
+/* Conversion */
+void hdaq_cu8_to_cf32(const uint8_t* in, float* out, size_t n);
+void hdaq_cu8_to_f32_split(const uint8_t* in, float* out_i, float* out_q, size_t n);
+void hdaq_f32_interleave(const float* in_i, const float* in_q, float* out, size_t n, size_t step);
+void hdaq_cf32_transpose(const float* in, float* out, size_t rows, size_t cols);
+
+/* Statistics */
+uint8_t hdaq_u8_max(const uint8_t* in, size_t n);
+float hdaq_cf32_power(const float* x, size_t n);
+void hdaq_cf32_mean(const float* x, size_t n, float* mean);
+
+/* Complex arithmetic */
+void hdaq_cf32_dotc(const float* a, const float* b, size_t n, float* result);
+void hdaq_cf32_mac(float* acc, const float* x, const float* c, size_t n);
+void hdaq_cf32_scale(const float* in, float* out, size_t n, const float* offset, const float* c);
+
+/*
+ * Output writers of the shared memory frames. A frame is not read again by the
+ * stage that writes it, so the large ones are written with non-temporal
+ * (streaming) stores: they do not evict the working set of the stage (filter
+ * states, coefficients) from the cache and save the read-for-ownership traffic.
+ * The writers store the same values as the regular functions, the caller
+ * selects them with hdaq_stream_frame based on the size of the whole output
+ * frame. The threshold can be set with the HDAQ_STREAM environment variable (in
+ * bytes or "off") or with hdaq_stream_set_threshold. The scalar variant does not
+ * stream.
+ */
+#define HDAQ_STREAM_ENV "HDAQ_STREAM"
+#define HDAQ_STREAM_OFF ((size_t) -1)
+#define HDAQ_STREAM_THRESHOLD_DEFAULT (4*1024*1024)
+
+size_t hdaq_stream_threshold(void);
+void hdaq_stream_set_threshold(size_t size);
+int hdaq_stream_frame(size_t size);
+void hdaq_stream_copy(void* dst, const void* src, size_t size);
+void hdaq_stream_cu8_to_cf32(const uint8_t* in, float* out, size_t n);
+void hdaq_stream_f32_interleave(const float* in_i, const float* in_q, float* out, size_t n, size_t step);
+
+/* Correlation and filtering, built on the kernels above */
+void hdaq_cf32_xcorr(const float* a, const float* b, size_t n, size_t max_lag, float* out);
+void hdaq_cf32_covariance(const float* x, size_t m, size_t n, float* out);
+size_t hdaq_cf32_fir_decimate(const float* in, float* out, size_t n, const float* coeffs, size_t tap_size,
+                              size_t dec, float* state);
+
+#endif
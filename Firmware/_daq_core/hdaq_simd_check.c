@@ -0,0 +1,513 @@
+/*
+ *
+ * Description :
+ * Equivalence and speed check of the SIMD kernel variants (hdaq_simd.c)
+ *
+ * Every kernel variant supported by the host is compared against the scalar
+ * reference on randomized and edge case inputs (saturated samples, odd lengths,
+ * misaligned buffers). Element wise kernels must match within MAX_ULP_DIFF, the
+ * reductions within MIN_REDUCTION_SNR. The failed checks are printed to the
+ * standard error, the return value is the number of failures. With the -b
+ * option the throughput of every variant is measured and printed as well.
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "hdaq_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0
+#endif
+
+#define MAX_ULP_DIFF      0     // Element wise kernels are expected to be bit exact
+#define MIN_REDUCTION_SNR 100.0 // [dB]
+#define MAX_LEN           70000 // Complex samples
+#define MAX_MISALIGN      3
+#define BUF_ALIGN         64
+#define BENCH_LEN         (1<<20)
+#define BENCH_TIME        0.2   // [s]
+#define STEP              3     // Strided interleave
+#define FRAME_CH          5
+#define FRAME_LEN         (1<<20) // Complex samples per channel at the decimator input
+#define FRAME_DEC         4
+#define FRAME_TAPS        32
+#define FIR_BLOCK         1024
+
+static const size_t test_lens[] = {0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 1000, 4097, 65537};
+#define TEST_LEN_CNT (sizeof(test_lens)/sizeof(test_lens[0]))
+
+enum u8_pattern {U8_RANDOM, U8_ZEROS, U8_SATURATED, U8_ALTERNATING, U8_PATTERN_CNT};
+static const char* u8_pattern_names[U8_PATTERN_CNT] = {"random", "zeros", "saturated", "alternating"};
+
+static int fail_cnt = 0;
+
+static void* alloc_buf(size_t size)
+{
+    void* buf = NULL;
+    if (posix_memalign(&buf, BUF_ALIGN, size + BUF_ALIGN) != 0)
+    {
+        fprintf(stderr, "Buffer allocation failed\n");
+        exit(-1);
+    }
+    return buf;
+}
+
+static void fill_u8(uint8_t* buf, size_t n, enum u8_pattern pattern)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (pattern)
+        {
+            case U8_RANDOM:      buf[i] = (uint8_t) (rand() & 0xFF); break;
+            case U8_ZEROS:       buf[i] = 0; break;
+            case U8_SATURATED:   buf[i] = 255; break;
+            case U8_ALTERNATING: buf[i] = (i & 1) ? 255 : 0; break;
+            default: break;
+        }
+    }
+}
+
+static void fill_f32(float* buf, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        buf[i] = (float) rand() / (float) RAND_MAX * 2.0f - 1.0f;
+}
+
+/* Distance of two floats in units of least precision */
+static int64_t ulp_diff(float a, float b)
+{
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    if (ia < 0) {ia = INT32_MIN - ia;}
+    if (ib < 0) {ib = INT32_MIN - ib;}
+    return llabs((int64_t) ia - (int64_t) ib);
+}
+
+static void check_ulp(const char* kernel, int level, const char* input, size_t n, size_t misalign,
+                      const float* ref, const float* res, size_t cnt)
+{
+    for (size_t i = 0; i < cnt; i++)
+    {
+        if (ulp_diff(ref[i], res[i]) > MAX_ULP_DIFF)
+        {
+            fprintf(stderr, "%s [%s] failed, input: %s, length: %zu, misalignment: %zu, index: %zu, %.9g != %.9g\n",
+                    kernel, hdaq_simd_level_name(level), input, n, misalign, i, res[i], ref[i]);
+            fail_cnt++;
+            return;
+        }
+    }
+}
+
+static void check_snr(const char* kernel, int level, size_t n, size_t misalign,
+                      const float* ref, const float* res, size_t cnt)
+{
+    double signal = 0, error = 0;
+    for (size_t i = 0; i < cnt; i++)
+    {
+        signal += (double) ref[i] * ref[i];
+        error  += ((double) res[i] - ref[i]) * ((double) res[i] - ref[i]);
+    }
+    if (error == 0) {return;}
+    double snr = 10*log10(signal / error);
+    if (snr < MIN_REDUCTION_SNR)
+    {
+        fprintf(stderr, "%s [%s] failed, length: %zu, misalignment: %zu, SNR: %.1f dB\n",
+                kernel, hdaq_simd_level_name(level), n, misalign, snr);
+        fail_cnt++;
+    }
+}
+
+static void check_level(int level)
+/*
+ * Runs all the kernels with the given variant and with the scalar reference
+ */
+{
+    uint8_t* u8_buf = alloc_buf(2*MAX_LEN);
+    float* a_buf    = alloc_buf(2*MAX_LEN*sizeof(float));
+    float* b_buf    = alloc_buf(2*MAX_LEN*sizeof(float));
+    float* ref_buf  = alloc_buf(2*MAX_LEN*sizeof(float));
+    float* res_buf  = alloc_buf(2*MAX_LEN*sizeof(float));
+    float* ref_q    = alloc_buf(MAX_LEN*sizeof(float));
+    float* res_q    = alloc_buf(MAX_LEN*sizeof(float));
+    const float c[2] = {0.7071f, -1.25f};
+    const float offset[2] = {0.003f, -0.01f};
+
+    for (size_t l = 0; l < TEST_LEN_CNT; l++)
+    {
+        size_t n = test_lens[l];
+        for (size_t misalign = 0; misalign <= MAX_MISALIGN; misalign++)
+        {
+            /* Integer input kernels */
+            for (int pattern = 0; pattern < U8_PATTERN_CNT; pattern++)
+            {
+                uint8_t* u8 = u8_buf + misalign;
+                const char* input = u8_pattern_names[pattern];
+                fill_u8(u8, 2*n, pattern);
+
+                hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+                hdaq_cu8_to_cf32(u8, ref_buf, 2*n);
+                hdaq_simd_set_level(level);
+                hdaq_cu8_to_cf32(u8, res_buf + misalign, 2*n);
+                check_ulp("cu8_to_cf32", level, input, n, misalign, ref_buf, res_buf + misalign, 2*n);
+                hdaq_stream_cu8_to_cf32(u8, res_buf + misalign, 2*n);
+                check_ulp("stream_cu8_to_cf32", level, input, n, misalign, ref_buf, res_buf + misalign, 2*n);
+
+                hdaq_stream_copy((uint8_t*) res_buf + misalign, u8, 2*n);
+                if (memcmp((uint8_t*) res_buf + misalign, u8, 2*n) != 0)
+                {
+                    fprintf(stderr, "stream_copy [%s] failed, length: %zu, misalignment: %zu\n",
+                            hdaq_simd_level_name(level), 2*n, misalign);
+                    fail_cnt++;
+                }
+
+                hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+                hdaq_cu8_to_f32_split(u8, ref_buf, ref_q, n);
+                hdaq_simd_set_level(level);
+                hdaq_cu8_to_f32_split(u8, res_buf + misalign, res_q + misalign, n);
+                check_ulp("cu8_to_f32_split (I)", level, input, n, misalign, ref_buf, res_buf + misalign, n);
+                check_ulp("cu8_to_f32_split (Q)", level, input, n, misalign, ref_q, res_q + misalign, n);
+
+                /* The odd length is checked as well for the byte wise kernel */
+                for (size_t len = 2*n; len <= 2*n+1 && len > 0; len++)
+                {
+                    hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+                    uint8_t ref_max = hdaq_u8_max(u8, len-1);
+                    hdaq_simd_set_level(level);
+                    uint8_t res_max = hdaq_u8_max(u8, len-1);
+                    if (ref_max != res_max)
+                    {
+                        fprintf(stderr, "u8_max [%s] failed, input: %s, length: %zu, misalignment: %zu, %d != %d\n",
+                                hdaq_simd_level_name(level), input, len-1, misalign, res_max, ref_max);
+                        fail_cnt++;
+                    }
+                }
+            }
+
+            /* Floating point input kernels */
+            float* a = a_buf + misalign;
+            float* b = b_buf + (MAX_MISALIGN - misalign);
+            fill_f32(a, 2*n);
+            fill_f32(b, 2*n);
+            float ref_scalar[2], res_scalar[2];
+
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            hdaq_f32_interleave(a, b, ref_buf, n, 1);
+            hdaq_simd_set_level(level);
+            hdaq_f32_interleave(a, b, res_buf + misalign, n, 1);
+            check_ulp("f32_interleave", level, "random", n, misalign, ref_buf, res_buf + misalign, 2*n);
+            hdaq_stream_f32_interleave(a, b, res_buf + misalign, n, 1);
+            check_ulp("stream_f32_interleave", level, "random", n, misalign, ref_buf, res_buf + misalign, 2*n);
+
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            hdaq_f32_interleave(a, b, ref_buf, 2*n/STEP, STEP);
+            hdaq_simd_set_level(level);
+            hdaq_stream_f32_interleave(a, b, res_buf + misalign, 2*n/STEP, STEP);
+            check_ulp("stream_f32_interleave (strided)", level, "random", n, misalign, ref_buf, res_buf + misalign,
+                      2*(2*n/STEP));
+
+            memcpy(ref_buf, b, 2*n*sizeof(float));
+            memcpy(res_buf + misalign, b, 2*n*sizeof(float));
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            hdaq_cf32_mac(ref_buf, a, c, n);
+            hdaq_simd_set_level(level);
+            hdaq_cf32_mac(res_buf + misalign, a, c, n);
+            check_ulp("cf32_mac", level, "random", n, misalign, ref_buf, res_buf + misalign, 2*n);
+
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            hdaq_cf32_scale(a, ref_buf, n, offset, c);
+            hdaq_simd_set_level(level);
+            hdaq_cf32_scale(a, res_buf + misalign, n, offset, c);
+            check_ulp("cf32_scale", level, "random", n, misalign, ref_buf, res_buf + misalign, 2*n);
+
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            ref_scalar[0] = hdaq_cf32_power(a, n);
+            hdaq_simd_set_level(level);
+            res_scalar[0] = hdaq_cf32_power(a, n);
+            check_snr("cf32_power", level, n, misalign, ref_scalar, res_scalar, 1);
+
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            hdaq_cf32_mean(a, n, ref_scalar);
+            hdaq_simd_set_level(level);
+            hdaq_cf32_mean(a, n, res_scalar);
+            check_snr("cf32_mean", level, n, misalign, ref_scalar, res_scalar, 2);
+
+            hdaq_simd_set_level(HDAQ_SIMD_SCALAR);
+            hdaq_cf32_dotc(a, b, n, ref_scalar);
+            hdaq_simd_set_level(level);
+            hdaq_cf32_dotc(a, b, n, res_scalar);
+            check_snr("cf32_dotc", level, n, misalign, ref_scalar, res_scalar, 2);
+        }
+    }
+    free(u8_buf);
+    free(a_buf);
+    free(b_buf);
+    free(ref_buf);
+    free(res_buf);
+    free(ref_q);
+    free(res_q);
+}
+
+static void check_common(void)
+/*
+ * Kernels with a single implementation are checked against a naive reference
+ */
+{
+    const size_t rows = 37, cols = 53, step = 3;
+    float* in  = alloc_buf(2*rows*cols*sizeof(float));
+    float* out = alloc_buf(2*rows*cols*sizeof(float));
+    fill_f32(in, 2*rows*cols);
+
+    hdaq_cf32_transpose(in, out, rows, cols);
+    for (size_t r = 0; r < rows; r++)
+        for (size_t c = 0; c < cols; c++)
+            if (memcmp(&out[2*(c*rows+r)], &in[2*(r*cols+c)], 2*sizeof(float)) != 0)
+            {
+                fprintf(stderr, "cf32_transpose failed at [%zu, %zu]\n", r, c);
+                fail_cnt++;
+                r = rows;
+                break;
+            }
+
+    size_t n = rows*cols/step;
+    hdaq_f32_interleave(in + step-1, in + rows*cols + step-1, out, n-1, step);
+    for (size_t i = 0; i < n-1; i++)
+        if (out[2*i] != in[i*step + step-1] || out[2*i+1] != in[rows*cols + i*step + step-1])
+        {
+            fprintf(stderr, "f32_interleave (step: %zu) failed at %zu\n", step, i);
+            fail_cnt++;
+            break;
+        }
+    free(in);
+    free(out);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Repeats the kernel call for BENCH_TIME and returns the throughput [Msample/s] */
+#define BENCH(call)                                               \
+    ({                                                            \
+        size_t rep = 0;                                           \
+        double t_start = now(), t_elapsed;                        \
+        do {call; rep++; t_elapsed = now() - t_start;}            \
+        while (t_elapsed < BENCH_TIME);                           \
+        (double) rep * BENCH_LEN / t_elapsed / 1e6;               \
+    })
+
+static void bench(void)
+/*
+ * Measures the throughput of the kernels with every supported variant on
+ * BENCH_LEN complex samples
+ */
+{
+    uint8_t* u8 = alloc_buf(2*BENCH_LEN);
+    float* a    = alloc_buf(2*BENCH_LEN*sizeof(float));
+    float* b    = alloc_buf(2*BENCH_LEN*sizeof(float));
+    float* out  = alloc_buf(2*BENCH_LEN*sizeof(float));
+    float* q    = alloc_buf(BENCH_LEN*sizeof(float));
+    const float c[2] = {0.7071f, -1.25f};
+    const float offset[2] = {0.003f, -0.01f};
+    float result[2];
+    volatile float sink;
+    fill_u8(u8, 2*BENCH_LEN, U8_RANDOM);
+    fill_f32(a, 2*BENCH_LEN);
+    fill_f32(b, 2*BENCH_LEN);
+
+    static const char* kernel_names[] = {"cu8_to_cf32", "cu8_to_f32_split", "f32_interleave", "u8_max",
+                                         "cf32_power", "cf32_mean", "cf32_dotc", "cf32_mac", "cf32_scale"};
+    const int kernel_cnt = sizeof(kernel_names)/sizeof(kernel_names[0]);
+    double speed[HDAQ_SIMD_LEVEL_CNT][sizeof(kernel_names)/sizeof(kernel_names[0])];
+
+    printf("Throughput [Msample/s], %d complex samples\n", BENCH_LEN);
+    printf("%-18s", "kernel");
+    for (int level = 0; level < HDAQ_SIMD_LEVEL_CNT; level++)
+        if (hdaq_simd_supported(level)) {printf("%10s", hdaq_simd_level_name(level));}
+    printf("\n");
+
+    for (int level = 0; level < HDAQ_SIMD_LEVEL_CNT; level++)
+    {
+        if (hdaq_simd_set_level(level) != 0) {continue;}
+        int k = 0;
+        speed[level][k++] = BENCH(hdaq_cu8_to_cf32(u8, out, 2*BENCH_LEN));
+        speed[level][k++] = BENCH(hdaq_cu8_to_f32_split(u8, out, q, BENCH_LEN));
+        speed[level][k++] = BENCH(hdaq_f32_interleave(a, b, out, BENCH_LEN, 1));
+        speed[level][k++] = BENCH(sink = hdaq_u8_max(u8, 2*BENCH_LEN));
+        speed[level][k++] = BENCH(sink = hdaq_cf32_power(a, BENCH_LEN));
+        speed[level][k++] = BENCH(hdaq_cf32_mean(a, BENCH_LEN, result));
+        speed[level][k++] = BENCH(hdaq_cf32_dotc(a, b, BENCH_LEN, result));
+        speed[level][k++] = BENCH(hdaq_cf32_mac(out, a, c, BENCH_LEN));
+        speed[level][k++] = BENCH(hdaq_cf32_scale(a, out, BENCH_LEN, offset, c));
+    }
+    (void) sink;
+
+    for (int k = 0; k < kernel_cnt; k++)
+    {
+        printf("%-18s", kernel_names[k]);
+        for (int level = 0; level < HDAQ_SIMD_LEVEL_CNT; level++)
+            if (hdaq_simd_supported(level)) {printf("%10.1f", speed[level][k]);}
+        printf("\n");
+    }
+    free(u8);
+    free(a);
+    free(b);
+    free(out);
+    free(q);
+}
+
+static void fir_cf32(float* buf, float* out, size_t n, const float* coeffs, float* state)
+/*
+ * Complex FIR filter with FRAME_TAPS real taps built on the multiply-accumulate
+ * kernel, it stands for the KFR filter of the decimator. The n input samples
+ * start at buf+2*(FRAME_TAPS-1), the filter state (the last FRAME_TAPS-1 input
+ * samples) is placed in front of them.
+ */
+{
+    const float* in = buf + 2*(FRAME_TAPS-1);
+    memcpy(buf, state, 2*(FRAME_TAPS-1)*sizeof(float));
+    for (size_t b = 0; b < n; b += FIR_BLOCK)
+    {
+        size_t len = n-b < FIR_BLOCK ? n-b : FIR_BLOCK;
+        memset(out+2*b, 0, 2*len*sizeof(float));
+        for (size_t j = 0; j < FRAME_TAPS; j++)
+        {
+            const float c[2] = {coeffs[j], 0};
+            hdaq_cf32_mac(out+2*b, in+2*((ptrdiff_t) b-(ptrdiff_t) j), c, len);
+        }
+    }
+    memcpy(state, in+2*(n-(FRAME_TAPS-1)), 2*(FRAME_TAPS-1)*sizeof(float));
+}
+
+/* Repeats the frame write for BENCH_TIME, prints the TSC cycles (x86) and the time per input sample */
+#define BENCH_FRAME(name, in_bytes, out_bytes, call)                                                 \
+    {                                                                                                \
+        size_t rep = 0;                                                                              \
+        unsigned long long c_start = CYCLES();                                                       \
+        double t_start = now(), t_elapsed;                                                           \
+        do {call; rep++; t_elapsed = now() - t_start;}                                               \
+        while (t_elapsed < BENCH_TIME);                                                              \
+        double samples = (double) rep * FRAME_CH * FRAME_LEN;                                        \
+        printf("%-22s%-8s%12.2f%12.2f%17.2f\n", name, stream ? "stream" : "regular",                  \
+               (double) (CYCLES() - c_start) / samples, t_elapsed / samples * 1e9,                   \
+               (double) rep * ((in_bytes) + (out_bytes)) / t_elapsed / 1e9);                          \
+    }
+
+static void bench_frame_writes(void)
+/*
+ * Writes multichannel frames as the stages do, with regular and with streaming
+ * stores: the rebuffer copy, the decimator conversion of the calibration frames
+ * and the decimator data path (cu8 conversion, FIR filter, decimating
+ * re-interleave). The bandwidth counts the bytes read and written by the stage.
+ */
+{
+    const size_t in_size = 2*FRAME_LEN;
+    uint8_t* u8_in  = alloc_buf(FRAME_CH*in_size);
+    uint8_t* u8_out = alloc_buf(FRAME_CH*in_size);
+    float* cf32_out = alloc_buf(FRAME_CH*in_size*sizeof(float));
+    float* fir_in   = alloc_buf(2*(FRAME_TAPS-1+FRAME_LEN)*sizeof(float));
+    float* fir_out  = alloc_buf(2*FRAME_LEN*sizeof(float));
+    float coeffs[FRAME_TAPS], state[FRAME_CH][2*(FRAME_TAPS-1)];
+    fill_u8(u8_in, FRAME_CH*in_size, U8_RANDOM);
+    fill_f32(coeffs, FRAME_TAPS);
+    memset(state, 0, sizeof(state));
+    memset(u8_out, 0, FRAME_CH*in_size);
+    memset(cf32_out, 0, FRAME_CH*in_size*sizeof(float));
+
+    printf("\nFrame writes, %d channels x %d complex samples, variant: %s\n", FRAME_CH, FRAME_LEN,
+           hdaq_simd_level_name(hdaq_simd_level()));
+    printf("%-22s%-8s%12s%12s%17s\n", "stage", "stores", "cycles/smp", "ns/smp", "bandwidth[GB/s]");
+    for (int stream = 0; stream <= 1; stream++)
+    {
+        hdaq_stream_set_threshold(stream ? 0 : HDAQ_STREAM_OFF);
+        BENCH_FRAME("rebuffer copy", FRAME_CH*in_size, FRAME_CH*in_size,
+            for (int m = 0; m < FRAME_CH; m++)
+            {
+                if (hdaq_stream_frame(FRAME_CH*in_size)) {hdaq_stream_copy(u8_out+m*in_size, u8_in+m*in_size, in_size);}
+                else {memcpy(u8_out+m*in_size, u8_in+m*in_size, in_size);}
+            })
+        BENCH_FRAME("decimator cu8->cf32", FRAME_CH*in_size, FRAME_CH*in_size*sizeof(float),
+            if (hdaq_stream_frame(FRAME_CH*in_size*sizeof(float))) {hdaq_stream_cu8_to_cf32(u8_in, cf32_out, FRAME_CH*in_size);}
+            else {hdaq_cu8_to_cf32(u8_in, cf32_out, FRAME_CH*in_size);})
+        BENCH_FRAME("decimator FIR+dec", FRAME_CH*in_size, FRAME_CH*in_size*sizeof(float)/FRAME_DEC,
+            for (int m = 0; m < FRAME_CH; m++)
+            {
+                hdaq_cu8_to_cf32(u8_in+m*in_size, fir_in+2*(FRAME_TAPS-1), in_size);
+                fir_cf32(fir_in, fir_out, FRAME_LEN, coeffs, state[m]);
+                /* The last sample of every decimation period is kept */
+                const float* last = fir_out + 2*(FRAME_DEC-1);
+                float* out = cf32_out + m*in_size/FRAME_DEC;
+                if (hdaq_stream_frame(FRAME_CH*in_size*sizeof(float)/FRAME_DEC))
+                    {hdaq_stream_f32_interleave(last, last+1, out, FRAME_LEN/FRAME_DEC, 2*FRAME_DEC);}
+                else
+                    {hdaq_f32_interleave(last, last+1, out, FRAME_LEN/FRAME_DEC, 2*FRAME_DEC);}
+            })
+    }
+    hdaq_stream_set_threshold(HDAQ_STREAM_THRESHOLD_DEFAULT);
+    free(u8_in);
+    free(u8_out);
+    free(cf32_out);
+    free(fir_in);
+    free(fir_out);
+}
+
+int main(int argc, char* argv[])
+/*
+ * argv[1]: -b: Run the speed measurement as well (optional)
+ */
+{
+    int default_level = hdaq_simd_init();
+    printf("Default SIMD kernel variant: %s\n", hdaq_simd_level_name(default_level));
+    srand(1);
+
+    check_common();
+    for (int level = 0; level < HDAQ_SIMD_LEVEL_CNT; level++)
+    {
+        if (level == HDAQ_SIMD_SCALAR) {continue;}
+        if (!hdaq_simd_supported(level))
+        {
+            printf("%-8s not supported\n", hdaq_simd_level_name(level));
+            continue;
+        }
+        int fail_cnt_prev = fail_cnt;
+        check_level(level);
+        printf("%-8s %s\n", hdaq_simd_level_name(level), fail_cnt == fail_cnt_prev ? "OK" : "FAILED");
+    }
+
+    hdaq_simd_set_level(default_level);
+    if (argc == 2 && strcmp(argv[1], "-b") == 0)
+    {
+        bench();
+        hdaq_simd_set_level(default_level);
+        bench_frame_writes();
+    }
+    return fail_cnt;
+}
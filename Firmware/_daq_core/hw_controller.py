@@ -23,21 +23,27 @@
 from struct import pack, unpack
 import threading
 import logging
+import queue
 
 # Import third-party modules
 import numpy as np
 import socket
-from configparser import ConfigParser
 
 # Import HeIMDALL modules
-from iq_header import IQHeader
+from iq_header import IQHeader, IQHeaderView
 from shmemIface import inShmemIface
+from daq_config import load_daq_config
+from stage_ctrl import stage_notify, STAGE_EV_READY
 import zmq
 import inter_module_messages
 
 # Global: Used to communicate between the HWC module and the Control Interface server
-ctr_request = [] # This list stores the confiuration command and parameters [cmd, param 1, param 2, ..]
-ctr_request_condition = threading.Condition()
+# Items are lists of the command ID, the configuration command and its parameters [cmd_id, cmd, param 1, param 2, ..]
+ctr_request_queue = queue.Queue()
+
+# Status codes of the completion events
+CMD_STATUS_DONE   = 0 # The requested change is visible in the IQ header
+CMD_STATUS_FAILED = 1 # The command could not be executed
 
 class HWC():
     
@@ -73,7 +79,7 @@ class HWC():
         
         # Support for calibration track mode 
         self.cal_track_mode = 0
-        self.cal_frame_interval = 50 # Number of frames between two cal frames in cal_track_mode=2
+        self.cal_frame_interval = 50 # Number of frames between two cal frames in cal_track_mode=2, maximum interval in cal_track_mode=3
         self.cal_frame_burst_size = 5 # Number of cal frames in a burst
         self.cal_frame_cntr = 0
         self.en_iq_cal = False
@@ -83,6 +89,14 @@ class HWC():
         self.require_track_lock_intervention = True
         self.rf_center_frequency = 1
 
+        # External control requests are executed by the command worker thread.
+        # The lock serializes the worker with the frame processing of the main loop.
+        self.hw_lock = threading.RLock()
+        self.pending_cmds = [] # Executed commands waiting for their completion [cmd_id, cmd, expected value]
+        self.cpi_index = 0 # CPI index of the frame processed last, the worker must not read the shared header
+        self.cmd_worker = None
+        self.cmd_socket = None
+
         # Overwrite default configuration
         self._read_config_file("daq_chain_config.ini")
         self.iq_header = IQHeader()
@@ -122,47 +136,47 @@ class HWC():
                 :return: 0: Confiugrations fields succesfully applied
                         -1: Configuration file not found
         """
-        parser = ConfigParser()
-        found = parser.read([config_filename])
-        if not found:
+        config, ret = load_daq_config(config_filename)
+        if ret == -1:
             self.logger.error("DAQ core configuration file not found. Default parameters will be used!")
             return -1
-        self.N = parser.getint('pre_processing', 'cpi_size')
-        self.M = parser.getint('hw', 'num_ch')                
-        self.N_proc = parser.getint('adpis', 'adpis_proc_size')
-        gains_init_str=parser.get('adpis','adpis_gains_init')
-        self.cal_track_mode = parser.getint('calibration','cal_track_mode')        
-        self.rf_center_frequency = parser.getint('daq','center_freq')
-        self.max_sync_fails = parser.getint('calibration','maximum_sync_fails')
-        self.cal_frame_burst_size = parser.getint('calibration','cal_frame_burst_size')
-        self.cal_frame_interval = parser.getint('calibration','cal_frame_interval')
-        self.gain_lock_interval = parser.getint('calibration','gain_lock_interval')     
+        elif ret == -2:
+            self.logger.error("Invalid configuration fields: {0}".format(config.invalid_fields.decode()))
+        self.N = config.cpi_size
+        self.M = config.num_ch
+        self.std_ch_ind = config.std_ch_ind
+        self.ch_mask = (1<<self.M)-1 # Active channels of the acquisition
+        self.N_proc = config.adpis_proc_size
+        self.cal_track_mode = config.cal_track_mode
+        self.rf_center_frequency = config.center_freq
+        self.max_sync_fails = config.maximum_sync_fails
+        self.cal_frame_burst_size = config.cal_frame_burst_size
+        self.cal_frame_interval = config.cal_frame_interval
+        self.gain_lock_interval = config.gain_lock_interval
         
-        if parser.getint('calibration', 'unified_gain_control'):
+        if config.unified_gain_control:
             self.unified_gain_control=1
         else:
             self.unified_gain_control=0
-        if parser.getint('calibration','en_gain_tune_init'):
+        if config.en_gain_tune_init:
             self.gain_tune_states=[True]*self.M
         else:
             self.gain_tune_states=[False]*self.M
-        if parser.getint('adpis','en_adpis'):
+        if config.en_adpis:
             self.en_adpis=1
         else:
             self.en_adpis=0
-        if parser.getint('calibration','require_track_lock_intervention'):
+        if config.require_track_lock_intervention:
             self.require_track_lock_intervention=True
         else:
             self.require_track_lock_intervention=False
-        if parser.getint('calibration', 'en_iq_cal'):
+        if config.en_iq_cal:
             self.en_iq_cal = True
         else:
             self.en_iq_cal = False
-        self.log_level = parser.getint('daq','log_level')*10
+        self.log_level = config.log_level*10
 
-        # Convert the gain list
-        gains_init_str = gains_init_str.split(',')
-        gains_init_ind = list(map(int, gains_init_str))
+        gains_init_ind = config.get_list('adpis_gains_init')
         # -> Channel number check
         if len(gains_init_ind) != self.M:
             logging.warning("Channel number missmatch when reading initial gain values")
@@ -196,6 +210,9 @@ class HWC():
         context = zmq.Context()        
         self.rtl_daq_socket = context.socket(zmq.REQ)
         self.rtl_daq_socket.connect("tcp://localhost:1130")
+        # ZMQ sockets can not be shared between threads, the command worker uses its own one
+        self.cmd_socket = context.socket(zmq.REQ)
+        self.cmd_socket.connect("tcp://localhost:1130")
 
         # Open control FIFOs
         try:            
@@ -226,6 +243,9 @@ class HWC():
                     self.iq_mod.set_IQ_value(0.5, 0.5, m)
             except:
                 logging.error("DAC Controller initialization failed")
+
+        self.cmd_worker = threading.Thread(target=self._command_worker, daemon=True)
+        self.cmd_worker.start()
         return 0
     
     def close(self):
@@ -241,12 +261,23 @@ class HWC():
         self.logger.info("Module interfaces are closed")
 
 
+    def _send_rtl_daq_msg(self, msg_byte_array):
+        """
+            Sends a control message to the RTL-DAQ module and waits for its reply.
+            Requests are sent on the socket of the calling thread.
+        """
+        if threading.current_thread() is self.cmd_worker:
+            ctr_socket = self.cmd_socket
+        else:
+            ctr_socket = self.rtl_daq_socket
+        ctr_socket.send(msg_byte_array)
+        reply = ctr_socket.recv()
+        self.logger.debug(f"Received reply: {reply}")
+
     def _enable_agc(self):
         if self.agc:
             msg_byte_array = inter_module_messages.pack_msg_enable_agc(self.module_identifier)
-            self.rtl_daq_socket.send(msg_byte_array)
-            reply = self.rtl_daq_socket.recv()
-            self.logger.debug(f"Received reply: {reply}")
+            self._send_rtl_daq_msg(msg_byte_array)
 
 
     def _change_gains(self):
@@ -267,26 +298,30 @@ class HWC():
         gains=[]
         for m in range(self.M):
             gains.append(self.valid_gains[self.gains[m]])
-            self.logger.info("Send Ch {:d} Gain: {:d} [{:d}]".format(m, int(gains[m]), self.iq_header.cpi_index))
+            self.logger.info("Send Ch {:d} Gain: {:d} [{:d}]".format(m, int(gains[m]), self.cpi_index))
         # Send gain list
         msg_byte_array = inter_module_messages.pack_msg_set_gain(self.module_identifier, gains)
-        self.rtl_daq_socket.send(msg_byte_array)
-        reply = self.rtl_daq_socket.recv()
-        self.logger.debug(f"Received reply: {reply}")        
+        self._send_rtl_daq_msg(msg_byte_array)
     def _tune_gains(self):
         """
             Performs IF gain tuning in order to maximaze the SINR in each channels by
             minimizing the effect of the quantization noise.
         """
         # Check gain states
+        if_gains = self.iq_header.get_if_gains()
         for m in range(self.M):
-            if self.valid_gains[self.gains[m]] != self.iq_header.if_gains[m]:
+            if self.valid_gains[self.gains[m]] != if_gains[m]:
                 self.logger.error("Incosistent IF gains. Tuning is bypassed")
                 return -1
 
+        overdrive_flags = self.iq_header.get_overdrive_flags()
         for m in range(self.M):
+            # Disabled channels are left on their current gain
+            if not self.ch_mask & 1<<m:
+                self.gain_tune_states[m]=False
+                continue
             # Check overdrive
-            if self.iq_header.adc_overdrive_flags & 1<<m:
+            if overdrive_flags & 1<<m:
                 self.logger.warning("ADC overdriven at channel: {:d}".format(m))
                 if self.gains[m] != 0:
                     self.gains[m] -=1
@@ -321,32 +356,102 @@ class HWC():
             Implemented valid command strings:
             - FREQ: Changes the center frequency of the receiver
             - GAIN: Sets the IF gain values
+            - CHMK: Sets the active channel mask, bit m enables the mth channel.
+                    The standard channel of the delay synchronization can not be disabled.
 
+            Return values:
+            --------------
+                :return: Value expected to appear in the IQ header once the command has taken effect
+                         (center frequency for FREQ, list of IF gains for GAIN, channel mask for CHMK),
+                         True when there is nothing to wait for and False when the command has failed
         """
         if command == "FREQ":            
             msg_byte_array = inter_module_messages.pack_msg_rf_tune(self.module_identifier, params[0])
-            self.rtl_daq_socket.send(msg_byte_array)
-            reply = self.rtl_daq_socket.recv()
-            self.logger.debug(f"Received reply: {reply}")
+            self._send_rtl_daq_msg(msg_byte_array)
+            return params[0]
         elif command == "GAIN":
             try:
-                if self.noise_source_state: # The noise source is turned on, we are storing only the gains
-                    for m in range(self.M):
-                        self.last_gains[m] = self.valid_gains.index(params[m])
-                else:
-                    for m in range(self.M):
-                        self.gains[m] = self.valid_gains.index(params[m])
-                    self._change_gains()
-                # Setting gain implies disabling AGC
-                self.agc = False
+                gain_indexes = [self.valid_gains.index(params[m]) for m in range(self.M)]
             except ValueError:
-                self.logger.error("Improper gain value {:d}".format(params[m]))
+                self.logger.error("Improper gain values {0}".format(params))
+                return False
+            if self.noise_source_state: # The noise source is turned on, we are storing only the gains
+                self.last_gains = gain_indexes
+            else:
+                self.gains = gain_indexes
+                self._change_gains()
+            # Setting gain implies disabling AGC and overrides the initial gain tuning
+            self.agc = False
+            self.gain_tune_states = [False]*self.M
+            if self.unified_gain_control:
+                gain_indexes = [min(gain_indexes)]*self.M
+            return [self.valid_gains[gain_index] for gain_index in gain_indexes]
+        elif command == "CHMK":
+            ch_mask = params[0]
+            if ch_mask == 0 or ch_mask >> self.M or not ch_mask & 1<<self.std_ch_ind:
+                self.logger.error("Improper channel mask 0x{:0{:d}X}, standard channel: {:d}".format(ch_mask, max(8, (self.M+3)//4), self.std_ch_ind))
+                return False
+            msg_byte_array = inter_module_messages.pack_msg_channel_mask(self.module_identifier, ch_mask)
+            self._send_rtl_daq_msg(msg_byte_array)
+            self.ch_mask = ch_mask
+            return ch_mask
         elif command == "AGC ":
             if self.noise_source_state: # The noise source is turned on, we are only storing the AGC state
                 self.last_agc = True
             else:
                 self.agc = True
                 self._enable_agc()
+        return True
+
+    def _command_worker(self):
+        """
+            Executes the external control requests in the order of their arrival.
+            Commands are issued right away, independently of the state of the main loop.
+        """
+        while True:
+            request = ctr_request_queue.get()
+            cmd_id, command, params = request[0], request[1], request[2:]
+            self.logger.info("Control request: {:s} [{:d}]".format(command, cmd_id))
+            with self.hw_lock:
+                try:
+                    expected = self._handle_control_reqest(command, params)
+                except zmq.ZMQError as err:
+                    self.logger.error("Failed to forward control request: {0}".format(err))
+                    expected = False
+                if expected is False:
+                    self.ctr_iface_server.send_event(cmd_id, command, CMD_STATUS_FAILED, self.cpi_index)
+                elif expected is True:
+                    self.ctr_iface_server.send_event(cmd_id, command, CMD_STATUS_DONE, self.cpi_index)
+                else:
+                    # A newer request of the same type supersedes the pending one
+                    for pending_cmd in self.pending_cmds:
+                        if pending_cmd[1] == command:
+                            self.ctr_iface_server.send_event(pending_cmd[0], command, CMD_STATUS_FAILED, self.cpi_index)
+                    self.pending_cmds = [pending_cmd for pending_cmd in self.pending_cmds if pending_cmd[1] != command]
+                    self.pending_cmds.append([cmd_id, command, expected])
+
+    def _check_pending_commands(self):
+        """
+            Reports the completion of the executed control requests whose effect is
+            visible in the header of the current frame
+        """
+        completed = []
+        for pending_cmd in self.pending_cmds:
+            cmd_id, command, expected = pending_cmd
+            if command == "FREQ":
+                done = self.iq_header.rf_center_freq == expected
+            elif command == "GAIN":
+                done = list(self.iq_header.get_if_gains()[0:self.M]) == expected
+            elif command == "CHMK":
+                done = self.iq_header.get_ch_mask() == expected
+            else:
+                done = True
+            if done:
+                self.logger.info("Control request completed: {:s} [{:d}], CPI: {:d}".format(command, cmd_id, self.iq_header.cpi_index))
+                self.ctr_iface_server.send_event(cmd_id, command, CMD_STATUS_DONE, self.iq_header.cpi_index)
+                completed.append(pending_cmd)
+        for pending_cmd in completed:
+            self.pending_cmds.remove(pending_cmd)
 
     
     def _control_noise_source(self, noise_source_state):
@@ -376,17 +481,13 @@ class HWC():
 
             self.logger.info("Enable noise source, [{:d}]".format(self.iq_header.cpi_index))
             msg_byte_array = inter_module_messages.pack_msg_noise_source_ctr(self.module_identifier, True)
-            self.rtl_daq_socket.send(msg_byte_array)
-            reply = self.rtl_daq_socket.recv()
-            self.logger.debug(f"Received reply: {reply}")                 
+            self._send_rtl_daq_msg(msg_byte_array)
             self.noise_source_state = True # Next state
             self.current_state = "STATE_NOISE_CTR_WAIT"
         else:
             self.logger.info("Disabling noise source [{:d}]".format(self.iq_header.cpi_index))
             msg_byte_array = inter_module_messages.pack_msg_noise_source_ctr(self.module_identifier, False)
-            self.rtl_daq_socket.send(msg_byte_array)
-            reply = self.rtl_daq_socket.recv()
-            self.logger.debug(f"Received reply: {reply}")
+            self._send_rtl_daq_msg(msg_byte_array)
             self.noise_source_state = False # Next state
 
             self.logger.info("Restore gain values after calibration")            
@@ -405,6 +506,7 @@ class HWC():
         """
             Start the main processing loop
         """
+        stage_notify(STAGE_EV_READY)
         while True:
             
             #############################################
@@ -418,156 +520,159 @@ class HWC():
                 break;          
 
             buffer = self.in_shmem_iface.buffers[active_buff_index]
-            iq_header_bytes = buffer[0:1024].tobytes()
-            self.iq_header.decode_header(iq_header_bytes)            
-            #self.iq_header.dump_header()
+            self.iq_header = IQHeaderView(buffer)
 
             if self.iq_header.check_sync_word():
                 logging.critical("IQ header sync word check failed, exiting..")
                 break
+            if self.iq_header.check_ch_meta():
+                logging.critical("Invalid per-channel metadata in the IQ header, exiting..")
+                break
+            if_gains = self.iq_header.get_if_gains()
                 
             # IQ samples are currently not required in this module, hence this section is disabled
             # incoming_payload_size = self.iq_header.cpi_length*self.iq_header.active_ant_chs*2*int(self.iq_header.sample_bit_depth/8)
             # if incoming_payload_size > 0:
-            	# iq_samples = buffer[1024:1024 + incoming_payload_size].view(dtype=np.complex64).reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length) [:,0:self.N_proc] 
+            	# iq_samples = buffer[self.iq_header.payload_offset():self.iq_header.payload_offset() + incoming_payload_size].view(dtype=np.complex64).reshape(self.iq_header.active_ant_chs, self.iq_header.cpi_length) [:,0:self.N_proc] 
                 
             self.logger.debug("Type:{:d}, CPI: {:d}, State:{:s}".format(self.iq_header.frame_type, self.iq_header.cpi_index, self.current_state))
             ##############################################
             #  Hardware Controller Finite State Machine  #
             ##############################################
             
-            if self.iq_header.frame_type != IQHeader.FRAME_TYPE_DUMMY : # Not Dummy Frame 
+            with self.hw_lock:
+                self.cpi_index = int(self.iq_header.cpi_index)
+                if self.iq_header.frame_type != IQHeader.FRAME_TYPE_DUMMY : # Not Dummy Frame 
                 
-                # -> Check power levels and gain values from the header
-                if self.iq_header.frame_type == IQHeader.FRAME_TYPE_DATA:
-                    for m in range(self.M):
-                        power = 0 # TODO: Read out from the header
-                        self.logger.debug("Channel {:d} power:{:.2f} dB, gain:{:d} [{:d}]".format(m, power, 
-                                        self.iq_header.if_gains[m], self.iq_header.cpi_index))                                            
-
-                # -> Chech overdrive per channel
-                for m in range(self.M):
-                    if(self.iq_header.adc_overdrive_flags & 1<<m):
-                        self.logger.warning("Overdrive ch {:d} [{:d}]".format(m, self.iq_header.cpi_index))
-
-                #
-                #------------------------------------------>
-                #            
-                if self.current_state == "STATE_INIT": 
-                    # Set initial gain values
-                    self._change_gains()
-
-                    # Disable internal noise source
-                    msg_byte_array = inter_module_messages.pack_msg_noise_source_ctr(self.module_identifier, False)
-                    self.rtl_daq_socket.send(msg_byte_array)
-                    reply = self.rtl_daq_socket.recv()
-                    self.logger.debug(f"Received reply: {reply}")                    
-
-                    # TODO: Set initial ADPIS values here
-                    if any(self.gain_tune_states):
-                        self.current_state = "STATE_GAIN_CTR_WAIT" 
-                    else:
-                        self.current_state = "STATE_IQ_CAL" 
-                #
-                #------------------------------------------>
-                #   
-                elif self.current_state == "STATE_GAIN_CTR_WAIT":
-                    gain_ctr_ready = True
-                    # Check gain states
+                    # -> Report completed control requests
+                    if len(self.pending_cmds):
+                        self._check_pending_commands()
+
+                    # -> Check power levels and gain values from the header
+                    if self.iq_header.frame_type == IQHeader.FRAME_TYPE_DATA:
+                        for m in range(self.M):
+                            power = 0 # TODO: Read out from the header
+                            self.logger.debug("Channel {:d} power:{:.2f} dB, gain:{:d} [{:d}]".format(m, power, 
+                                            if_gains[m], self.iq_header.cpi_index))                                            
+
+                    # -> Chech overdrive per channel
+                    overdrive_flags = self.iq_header.get_overdrive_flags()
                     for m in range(self.M):
-                        if self.valid_gains[self.gains[m]] != self.iq_header.if_gains[m]:
-                            gain_ctr_ready = False
-                    if gain_ctr_ready:
-                        self.current_state = "STATE_GAIN_TUNE"
-
-                #
-                #------------------------------------------>
-                #   
-                elif self.current_state == "STATE_GAIN_TUNE":
-                    # Decrease gain if overdrive is detected
-                    if self.iq_header.adc_overdrive_flags:
-                        self._tune_gains()
-                        self.current_state="STATE_GAIN_CTR_WAIT"
-                        self.gain_lock_cntr = 0
-
-                    # Increse gain to drive full scale
-                    elif any(self.gain_tune_states):
-                        self._tune_gains()
-                        self.current_state="STATE_GAIN_CTR_WAIT"
-                        self.gain_lock_cntr = 0
-
-                    else: # Gain tuning may finished - check gain lock
-                        if self.gain_lock_cntr == self.gain_lock_interval:
-                            self.current_state = "STATE_IQ_CAL"
-                            self.gain_lock_cntr = 0
+                        if(overdrive_flags & 1<<m):
+                            self.logger.warning("Overdrive ch {:d} [{:d}]".format(m, self.iq_header.cpi_index))
+
+                    #
+                    #------------------------------------------>
+                    #            
+                    if self.current_state == "STATE_INIT": 
+                        # Set initial gain values
+                        self._change_gains()
+
+                        # Disable internal noise source
+                        msg_byte_array = inter_module_messages.pack_msg_noise_source_ctr(self.module_identifier, False)
+                        self._send_rtl_daq_msg(msg_byte_array)
+
+                        # TODO: Set initial ADPIS values here
+                        if any(self.gain_tune_states):
+                            self.current_state = "STATE_GAIN_CTR_WAIT" 
                         else:
-                            self.gain_lock_cntr +=1
+                            self.current_state = "STATE_IQ_CAL" 
+                    #
+                    #------------------------------------------>
+                    #   
+                    elif self.current_state == "STATE_GAIN_CTR_WAIT":
+                        gain_ctr_ready = True
+                        # Check gain states
+                        for m in range(self.M):
+                            if self.valid_gains[self.gains[m]] != if_gains[m]:
+                                gain_ctr_ready = False
+                        if gain_ctr_ready:
+                            self.current_state = "STATE_GAIN_TUNE"
+
+                    #
+                    #------------------------------------------>
+                    #   
+                    elif self.current_state == "STATE_GAIN_TUNE":
+                        # Decrease gain if overdrive is detected
+                        if overdrive_flags:
+                            self._tune_gains()
+                            self.current_state="STATE_GAIN_CTR_WAIT"
+                            self.gain_lock_cntr = 0
 
-                #
-                #------------------------------------------>
-                #
-                elif self.current_state == "STATE_IQ_CAL":             
+                        # Increse gain to drive full scale
+                        elif any(self.gain_tune_states):
+                            self._tune_gains()
+                            self.current_state="STATE_GAIN_CTR_WAIT"
+                            self.gain_lock_cntr = 0
 
-                    # --> Noise Source Control 
-                    if  self.cal_track_mode == 0 or self.cal_track_mode == 1 or \
-                        (self.cal_track_mode == 2 and self.cal_frame_cntr < self.cal_frame_interval):
+                        else: # Gain tuning may finished - check gain lock
+                            if self.gain_lock_cntr == self.gain_lock_interval:
+                                self.current_state = "STATE_IQ_CAL"
+                                self.gain_lock_cntr = 0
+                            else:
+                                self.gain_lock_cntr +=1
+
+                    #
+                    #------------------------------------------>
+                    #
+                    elif self.current_state == "STATE_IQ_CAL":             
+
+                        # --> Noise Source Control 
+                        if  self.cal_track_mode == 0 or self.cal_track_mode == 1 or \
+                            (self.cal_track_mode >= 2 and self.cal_frame_cntr < self.cal_frame_interval):
                         
-                        # Enable noise source 
-                        if self.iq_header.sync_state < 5 : # Delay synchronizer is not in track or track lock mode
-                            if self.iq_header.noise_source_state == 0:
-                                self._control_noise_source(noise_source_state=True)
-                        else: # Delay synchronizer is in track mode - Disable Noise Source
-                            if self.iq_header.noise_source_state == 1: # Has sync, disable noise source if enabled                                    
-                               # Check Track lock approval (Used, when the system is calibrated and the antennas are detached)
-                               track_lock_approval = True
-                               if self.require_track_lock_intervention:
-                                   self.track_lock_ctr_fd.seek(0, 0)
-                                   ctr_char = self.track_lock_ctr_fd.read(1)
-                                   if ctr_char == '1':
-                                       logging.info("User has approved track lock state initialization")
+                            # Enable noise source 
+                            if self.iq_header.sync_state < 5 : # Delay synchronizer is not in track or track lock mode
+                                if self.iq_header.noise_source_state == 0:
+                                    self._control_noise_source(noise_source_state=True)
+                            else: # Delay synchronizer is in track mode - Disable Noise Source
+                                if self.iq_header.noise_source_state == 1: # Has sync, disable noise source if enabled                                    
+                                   # Check Track lock approval (Used, when the system is calibrated and the antennas are detached)
+                                   track_lock_approval = True
+                                   if self.require_track_lock_intervention:
                                        self.track_lock_ctr_fd.seek(0, 0)
-                                   else:
-                                       logging.info("Waiting for track lock init. approval")
-                                       track_lock_approval = False                               
-                               if track_lock_approval:
-                                   self._control_noise_source(noise_source_state=False)
+                                       ctr_char = self.track_lock_ctr_fd.read(1)
+                                       if ctr_char == '1':
+                                           logging.info("User has approved track lock state initialization")
+                                           self.track_lock_ctr_fd.seek(0, 0)
+                                       else:
+                                           logging.info("Waiting for track lock init. approval")
+                                           track_lock_approval = False                               
+                                   if track_lock_approval:
+                                       self._control_noise_source(noise_source_state=False)
                        
-                    # --> Burst calibration frames
-                    if self.cal_track_mode == 2: 
-                        if self.iq_header.sync_state == 6:
-                            self.cal_frame_cntr +=1
-                            if self.cal_frame_cntr == self.cal_frame_interval:
-                                self.logger.info("Enable noise source burst [{:d}]".format(self.iq_header.cpi_index))
-                                self._control_noise_source(noise_source_state=True)
+                        # --> Burst calibration frames
+                        # Mode 2: periodic bursts, Mode 3: bursts requested by the delay synchronizer
+                        if self.cal_track_mode == 2 or self.cal_track_mode == 3:
+                            if self.iq_header.sync_state >= 6:
+                                if self.cal_track_mode == 3 and self.cal_frame_cntr < self.cal_frame_interval:
+                                    if self.iq_header.sync_state == 7: # Burst requested
+                                        self.cal_frame_cntr = self.cal_frame_interval
+                                else:
+                                    self.cal_frame_cntr +=1
+                                if self.cal_frame_cntr == self.cal_frame_interval:
+                                    self.logger.info("Enable noise source burst [{:d}]".format(self.iq_header.cpi_index))
+                                    self._control_noise_source(noise_source_state=True)
                                 
-                            elif self.cal_frame_cntr == self.cal_frame_interval+self.cal_frame_burst_size:
-                                self.logger.info("Disabling noise source burst [{:d}]".format(self.iq_header.cpi_index))
-                                self._control_noise_source(noise_source_state=False)
-                                self.cal_frame_cntr=0
-                        else: # self.iq_header.sync_state < 6
-                            self.cal_frame_cntr = 0
-                    
-                    # --> External control request handling
-                    ctr_request_condition.acquire()                    
-                    if len(ctr_request) !=0 :
-                        self.logger.info("Control request: {:s}".format(ctr_request[0]))
-                        self._handle_control_reqest(ctr_request[0], ctr_request[1:])
-                        ctr_request.clear()
-                        ctr_request_condition.notify()
-                    ctr_request_condition.release()
-
-                #          
-                #------------------------------------------>
-                #   
-                elif self.current_state == "STATE_NOISE_CTR_WAIT":                 
-                    if self.noise_source_state == self.iq_header.noise_source_state:
-                        gain_ctr_ready = True
-                        # Check gain states
-                        for m in range(self.M):
-                            if self.valid_gains[self.gains[m]] != self.iq_header.if_gains[m]:
-                                gain_ctr_ready = False
-                        if gain_ctr_ready:
-                            self.current_state = "STATE_IQ_CAL"
+                                elif self.cal_frame_cntr == self.cal_frame_interval+self.cal_frame_burst_size:
+                                    self.logger.info("Disabling noise source burst [{:d}]".format(self.iq_header.cpi_index))
+                                    self._control_noise_source(noise_source_state=False)
+                                    self.cal_frame_cntr=0
+                            else: # self.iq_header.sync_state < 6
+                                self.cal_frame_cntr = 0
+
+                    #          
+                    #------------------------------------------>
+                    #   
+                    elif self.current_state == "STATE_NOISE_CTR_WAIT":                 
+                        if self.noise_source_state == self.iq_header.noise_source_state:
+                            gain_ctr_ready = True
+                            # Check gain states
+                            for m in range(self.M):
+                                if self.valid_gains[self.gains[m]] != if_gains[m]:
+                                    gain_ctr_ready = False
+                            if gain_ctr_ready:
+                                self.current_state = "STATE_IQ_CAL"
                         
             self.in_shmem_iface.send_ctr_buff_ready(active_buff_index)
             
@@ -585,7 +690,7 @@ class CtrIfaceServer(threading.Thread):
         """
 
         self.logger = logging.getLogger(__name__)
-        threading.Thread.__init__(self)  
+        threading.Thread.__init__(self, daemon=True) # Does not keep the module alive after the main loop has exited
 
         # Control interface server parameters
         self.ctr_iface_port_no = 5001 # TODO: Set this port number from the ini file
@@ -593,7 +698,12 @@ class CtrIfaceServer(threading.Thread):
         self.ctr_iface_socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
         self.ctr_iface_addr = ("", self.ctr_iface_port_no)
         self.M = M
+        self.ctr_frame_length = max(128, 4+4*M) # The per-channel GAIN payload of more than 31 channels is longer
         self.status=True
+        self.cmd_id_cntr = 0 # IDs of the queued commands, 0 is reserved for the not queued ones
+        self.connection = None
+        self.connection_lock = threading.Lock() # Acks and completion events are sent from different threads
+        self.en_events = False # Completion events are sent only on request
        
     def run(self):
         """
@@ -613,92 +723,151 @@ class CtrIfaceServer(threading.Thread):
             # Wait for a connection
             self.logger.info("Waiting for new connection")
             connection, client_address = self.ctr_iface_socket.accept()
+            with self.connection_lock:
+                self.connection = connection
+                self.en_events = False
 
             try:
                 self.logger.info("Conenction established ")
 
                 # Main server loop
                 while True:
-                    ctr_frame = connection.recv(128)
+                    ctr_frame = self._recv_ctr_frame(connection)
                     if ctr_frame:
-                        exit_flag = self.process_ctr_frame(ctr_frame)
-                        if exit_flag:
+                        cmd_id = self.process_ctr_frame(ctr_frame)
+                        if cmd_id < 0:
                             break
-                        # Send config success
-                        msg_bytes=("FNSD".encode()+bytearray(124))
-                        connection.send(msg_bytes)
+                        # Send config success, the command is queued but not yet executed
+                        msg_bytes=("FNSD".encode()+pack('I', cmd_id)+bytearray(120))
+                        with self.connection_lock:
+                            connection.send(msg_bytes)
                     else:
                         self.logger.info("No more data from client, closing connection")
                         break
+            except OSError as err:
+                self.logger.error("Control connection failed: {0}".format(err))
             finally:
                 # Clean up the connection
+                with self.connection_lock:
+                    self.connection = None
                 connection.close()
 
+    def _recv_ctr_frame(self, connection):
+        """
+            Receives a complete control frame, returns an empty byte array
+            when the client has closed the connection
+        """
+        ctr_frame = bytearray()
+        while len(ctr_frame) < self.ctr_frame_length:
+            chunk = connection.recv(self.ctr_frame_length-len(ctr_frame))
+            if not chunk:
+                return bytearray()
+            ctr_frame += chunk
+        return ctr_frame
+
+    def send_event(self, cmd_id, command, status, cpi_index):
+        """
+            Sends a completion event of a queued command to the connected client
+            if it has enabled the events with the EVNT command.
+
+            The event message is composed as follows:
+            Total length: 128 byte
+            -------------------------------------------------------------------------------
+            |"EVNT"|4 byte cmd ID|4 byte cmd|4 byte status|4 byte CPI index|...reserved...|
+            -------------------------------------------------------------------------------
+            Parameters:
+            -----------
+            :param: cmd_id   : Command ID acknowledged in the FNSD reply
+            :param: command  : Command string
+            :param: status   : CMD_STATUS_DONE or CMD_STATUS_FAILED
+            :param: cpi_index: Index of the first CPI on which the change is visible
+        """
+        with self.connection_lock:
+            if self.connection is None or not self.en_events:
+                return
+            msg_bytes = "EVNT".encode()+pack('I', cmd_id)+command.encode()+pack('II', status, cpi_index)
+            msg_bytes += bytearray(128-len(msg_bytes))
+            try:
+                self.connection.send(msg_bytes)
+            except OSError as err:
+                self.logger.error("Failed to send completion event: {0}".format(err))
+
     def process_ctr_frame(self, msg_bytes):
         """
             Processes the control interface message and prepares the command parameters
             for further command handling.
             
             The input message is composed as follows:
-            Total length: 128 byte
+            Total length: 128 byte (4 + 4 x M byte for more than 31 channels)
             -----------------------------------
             |4 byte cmd|...124 byte payload...|
             -----------------------------------
+            The CHMK payload is a little endian bitmap of max(4, (M+7)/8) bytes.
             For the detailed description of the valid command please check the corresponding
             documentation.
+
+            The command is only queued here, it is executed by the command worker of the
+            Hardware Controller. The client can follow its execution by enabling the
+            completion events with the EVNT command (1 byte payload, 1: enable, 0: disable).
             Parameters:
             -----------
             :param: msg_bytes: Received command, that has to be processed
-            :type : msg_bytes: 128 byte length byte array
+            :type : msg_bytes: 128 byte (or 4 + 4 x M byte) length byte array
+
+            Return values:
+            --------------
+                :return: ID of the queued command, 0 when no command has been queued,
+                         -1 on EXIT request
         """
-        ctr_request_condition.acquire()
         command = msg_bytes[0:4].decode()
         self.logger.warning("Got command %s", command)
+        request = [command]
         if command == "EXIT":
-            ctr_request_condition.release()
             return -1
 
+        elif command == "EVNT":
+            self.en_events = bool(msg_bytes[4])
+            self.logger.info("Completion events {:s}".format("enabled" if self.en_events else "disabled"))
+            return 0
+
         elif command == "STHU":
             threshold = unpack('f',msg_bytes[4:8])[0]
             self.logger.info("Received threshold value: {:f}".format(threshold))
-            ctr_request.clear()
-            ctr_request.append(command)
-            ctr_request.append(threshold)
+            request.append(threshold)
 
         elif command == "FREQ":
             frequency = unpack('Q',msg_bytes[4:12])[0]
             self.logger.info("Received frequency value: {:f} Hz".format(frequency))
-            ctr_request.clear()
-            ctr_request.append(command)
-            ctr_request.append(frequency)
+            request.append(frequency)
 
         elif command == "GAIN":
             gains = unpack('I'*self.M, msg_bytes[4:4+4*self.M])
-            ctr_request.clear()
-            ctr_request.append(command)
             for m in range(self.M):
                 self.logger.info("Received gain values - CH{:d}: {:d} dB x 10".format(m, gains[m]))            
-                ctr_request.append(gains[m])
+                request.append(gains[m])
+
+        elif command == "CHMK":
+            mask_length = max(4, (self.M+7)//8)
+            ch_mask = int.from_bytes(msg_bytes[4:4+mask_length], "little")
+            self.logger.info("Received channel mask: 0x{:0{:d}X}".format(ch_mask, 2*mask_length))
+            request.append(ch_mask)
 
         elif command == "AGC ":
             self.logger.info("Received AGC request")
-            ctr_request.clear()
-            ctr_request.append(command)
 
         elif command == "INIT":
             self.logger.info("Inititalization command received")
-            ctr_request.clear()
-            ctr_request.append(command)
         else:
             self.logger.error("Unidentified control command: {:s}".format(command))
+            return 0
 
-        ctr_request_condition.wait() # Let the main thread process the request       
-        ctr_request_condition.release()
-        return 0
+        self.cmd_id_cntr = (self.cmd_id_cntr % 0xFFFFFFFF) + 1
+        ctr_request_queue.put([self.cmd_id_cntr] + request)
+        return self.cmd_id_cntr
 
 if __name__ == "__main__":
     HWC_inst0 = HWC()
     if HWC_inst0.init() == 0:
         HWC_inst0.start()
 
-HWC_inst0.close()
+    HWC_inst0.close()
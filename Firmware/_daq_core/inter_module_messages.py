@@ -71,7 +71,7 @@ def pack_msg_set_gain(module_identifier, gains):
         -------
             Assembled message structure in byte array 
     """    
-    msg_length = 128 # Total message length 128 byte
+    msg_length = max(128, 1+1+len(gains)*4) # Total message length 128 byte, longer above 31 channels
     msg_byte_array  = pack("b", module_identifier) # 1byte
     msg_byte_array += 'g'.encode('ascii') # 1 byte
     for gain in gains:
@@ -146,7 +146,7 @@ def pack_msg_sample_freq_tune(module_identifier, fs_ppm_offsets):
         -------
             Assembled message structure in byte array
     """    
-    msg_length = 128 # Total message length 128 byte
+    msg_length = max(128, 1+1+len(fs_ppm_offsets)*4) # Total message length 128 byte, longer above 31 channels
     msg_byte_array  = pack("b", module_identifier) # 1byte
     msg_byte_array += 's'.encode('ascii') # 1 byte
     for fs_offset in fs_ppm_offsets:
@@ -155,4 +155,30 @@ def pack_msg_sample_freq_tune(module_identifier, fs_ppm_offsets):
         msg_byte_array +=pack('b',0)    
        
     return msg_byte_array
-    
\ No newline at end of file
+    
+def pack_msg_channel_mask(module_identifier, ch_mask):
+    """
+        Prepares the byte array of an inter-module ZMQ message for setting the active channels
+        of the acquisition.
+
+        Parameters:
+        -----------
+            :param: module_identifier: Source module id
+            :param: ch_mask: Bit m enables the mth receiver channel, sent as a little endian
+                             bitmap of at least 4 bytes
+
+            :type: module_identifier: int
+            :type: ch_mask: int
+
+        Return:
+        -------
+            Assembled message structure in byte array
+    """
+    msg_length = 128 # Total message length 128 byte
+    msg_byte_array  = pack("b", module_identifier) # 1byte
+    msg_byte_array += 'm'.encode('ascii') # 1 byte
+    mask_bytes = ch_mask.to_bytes(max(4, (ch_mask.bit_length()+7)//8), "little")
+    msg_byte_array += mask_bytes # 4 byte for the first 32 channels
+    for m in range(msg_length-1-1-len(mask_bytes)):
+        msg_byte_array +=pack('b',0)
+    return msg_byte_array
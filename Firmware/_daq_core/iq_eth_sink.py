@@ -49,6 +49,9 @@ class IQRecorder():
         self.channel_number = 4
         self.sample_number = 2**18
         self.iq_header = IQHeader()
+        # Receive buffers, reused for every frame and only grown when a larger frame arrives
+        self.iq_header_bytes = bytearray(self.iq_header.header_size)
+        self.iq_data_bytes = bytearray(0)
        
         # Misc parameters
         self.first_frame=0
@@ -157,7 +160,7 @@ class IQRecorder():
         """        
         total_received_bytes = 0
         recv_bytes_count = 0
-        iq_header_bytes = bytearray(self.iq_header.header_size)  # allocate array
+        iq_header_bytes = self.iq_header_bytes
         view = memoryview(iq_header_bytes)  # Get buffer
         
         self.logger.debug("Starting IQ header reception")
@@ -171,26 +174,31 @@ class IQRecorder():
         self.iq_header.decode_header(iq_header_bytes)
         self.logger.debug("IQ header received and decoded")
         
-        # Calculate total bytes to receive from the iq header data        
-        total_bytes_to_receive = int((self.iq_header.cpi_length * self.iq_header.active_ant_chs * (2*self.iq_header.sample_bit_depth))/8)
+        # Calculate total bytes to receive from the iq header data, the per-channel metadata of large arrays precedes the payload
+        meta_length = self.iq_header.ch_meta_length
+        total_bytes_to_receive = meta_length + int((self.iq_header.cpi_length * self.iq_header.active_ant_chs * (2*self.iq_header.sample_bit_depth))/8)
         receiver_buffer_size = 2**18
         
         self.logger.debug("Total bytes to receive: {:d}".format(total_bytes_to_receive))
         
         total_received_bytes = 0
         recv_bytes_count = 0
-        iq_data_bytes = bytearray(total_bytes_to_receive + receiver_buffer_size)  # allocate array
+        if len(self.iq_data_bytes) < total_bytes_to_receive:
+            self.iq_data_bytes = bytearray(total_bytes_to_receive)
+        iq_data_bytes = self.iq_data_bytes
         view = memoryview(iq_data_bytes)  # Get buffer
         
         self.logger.debug("Starting IQ reception")
         
         while total_received_bytes < total_bytes_to_receive:
             # Receive into buffer
-            recv_bytes_count = self.socket_inst.recv_into(view, receiver_buffer_size)
+            recv_bytes_count = self.socket_inst.recv_into(view, min(receiver_buffer_size, total_bytes_to_receive-total_received_bytes))
             view = view[recv_bytes_count:]  # reset memory region
             total_received_bytes += recv_bytes_count
         
         self.logger.debug("Succesfully received")
+        if meta_length:
+            self.iq_header.decode_ch_meta(iq_data_bytes[0:meta_length])
         
         # Dump IQ header        
         #self.iq_header.dump_header()
@@ -6,9 +6,56 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include <inttypes.h>
 #include "iq_header.h"
 
+/* Layout of the per-channel metadata block that follows the header */
+#define CH_META_WORDS(h) (((h)->ch_meta_cnt + 63) / 64)
+#define CH_META_ACTIVE(h) ((uint64_t*) ((uint8_t*) (h) + IQ_HEADER_LENGTH))
+#define CH_META_OVERDRIVE(h) (CH_META_ACTIVE(h) + CH_META_WORDS(h))
+#define CH_META_GAINS(h) ((uint32_t*) (CH_META_ACTIVE(h) + 2*CH_META_WORDS(h)))
+
+#define IQ_HEADER_FIELD(field) {#field, offsetof(struct iq_header_struct, field), sizeof(((struct iq_header_struct*)0)->field)}
+
+static const struct iq_header_field_desc iq_header_fields[] = {
+	IQ_HEADER_FIELD(sync_word),
+	IQ_HEADER_FIELD(frame_type),
+	IQ_HEADER_FIELD(hardware_id),
+	IQ_HEADER_FIELD(unit_id),
+	IQ_HEADER_FIELD(active_ant_chs),
+	IQ_HEADER_FIELD(ioo_type),
+	IQ_HEADER_FIELD(rf_center_freq),
+	IQ_HEADER_FIELD(adc_sampling_freq),
+	IQ_HEADER_FIELD(sampling_freq),
+	IQ_HEADER_FIELD(cpi_length),
+	IQ_HEADER_FIELD(time_stamp),
+	IQ_HEADER_FIELD(daq_block_index),
+	IQ_HEADER_FIELD(cpi_index),
+	IQ_HEADER_FIELD(ext_integration_cntr),
+	IQ_HEADER_FIELD(data_type),
+	IQ_HEADER_FIELD(sample_bit_depth),
+	IQ_HEADER_FIELD(adc_overdrive_flags),
+	IQ_HEADER_FIELD(if_gains),
+	IQ_HEADER_FIELD(delay_sync_flag),
+	IQ_HEADER_FIELD(iq_sync_flag),
+	IQ_HEADER_FIELD(sync_state),
+	IQ_HEADER_FIELD(noise_source_state),
+	IQ_HEADER_FIELD(sample_index_step),
+	IQ_HEADER_FIELD(first_sample_index),
+	IQ_HEADER_FIELD(noise_source_switch_index),
+	IQ_HEADER_FIELD(iq_corr_cpi_index),
+	IQ_HEADER_FIELD(active_ch_mask),
+	IQ_HEADER_FIELD(ch_meta_cnt),
+	IQ_HEADER_FIELD(ch_meta_length),
+	IQ_HEADER_FIELD(fft_size),
+	IQ_HEADER_FIELD(fft_hop),
+	IQ_HEADER_FIELD(fft_window),
+	IQ_HEADER_FIELD(reserved),
+	IQ_HEADER_FIELD(header_version),
+};
+
 void dump_iq_header(struct iq_header_struct* iq_header){
 	fprintf(stderr, "Sync word: %u\n", iq_header->sync_word);
 	fprintf(stderr, "Header version: %u\n", iq_header->header_version);
@@ -27,19 +74,153 @@ void dump_iq_header(struct iq_header_struct* iq_header){
 	fprintf(stderr, "Extended integration counter: %"PRIu64"\n", iq_header->ext_integration_cntr);
 	fprintf(stderr, "Data type: %u \n", iq_header->data_type);
 	fprintf(stderr, "Sample bit depth: %u \n", iq_header->sample_bit_depth);
-	fprintf(stderr, "ADC overdrive flag: 0x%08X \n", iq_header->adc_overdrive_flags);
-	for(int m=0;m<32;m++)
+	if (iq_header->data_type == IQ_DATA_TYPE_SPECTRUM)
+		{fprintf(stderr, "FFT size: %u, hop: %u, window: %u\n", iq_header->fft_size, iq_header->fft_hop, iq_header->fft_window);}
+	char mask_str[IQ_MAX_CH/4+3];
+	struct iq_ch_mask mask;
+	int meta_ok = iq_header_check_ch_meta(iq_header) == 0;
+	fprintf(stderr, "Per-channel metadata: %u channels, %u bytes%s\n", iq_header->ch_meta_cnt, iq_header->ch_meta_length,
+	        meta_ok ? "" : " (invalid)");
+	if (meta_ok) {iq_header_get_overdrive(iq_header, &mask);}
+	else {iq_ch_mask_all(&mask, 0); mask.w[0] = iq_header->adc_overdrive_flags;}
+	fprintf(stderr, "ADC overdrive flag: %s \n", iq_ch_mask_str(&mask, mask_str, sizeof(mask_str)));
+	int gain_cnt = meta_ok && iq_header->ch_meta_cnt ? (int) iq_header->ch_meta_cnt : IQ_HEADER_CH_CNT;
+	for(int m=0;m<gain_cnt;m++)
 	{
-	    fprintf(stderr, "Ch: %u IF gain: %u \n",m, iq_header->if_gains[m]);
+	    fprintf(stderr, "Ch: %u IF gain: %u \n",m, meta_ok ? iq_header_if_gain(iq_header, m) : iq_header->if_gains[m]);
 	}
 	fprintf(stderr, "Delay sync flag: %u \n", iq_header->delay_sync_flag);
 	fprintf(stderr, "IQ sync flag: %u \n", iq_header->iq_sync_flag);
 	fprintf(stderr, "Sync state: %u \n", iq_header->sync_state);
 	fprintf(stderr, "Noise source state: %u \n", iq_header->noise_source_state);
+	fprintf(stderr, "First sample index: %"PRIu64" (step: %u)\n", iq_header->first_sample_index, iq_header->sample_index_step);
+	fprintf(stderr, "Noise source switch index: %"PRIu64"\n", iq_header->noise_source_switch_index);
+	fprintf(stderr, "IQ corrections applied from CPI: %u\n", iq_header->iq_corr_cpi_index);
+	if (meta_ok) {iq_header_get_ch_mask(iq_header, &mask);}
+	else {iq_ch_mask_all(&mask, 0); mask.w[0] = iq_header->active_ch_mask;}
+	fprintf(stderr, "Active channel mask: %s\n", iq_ch_mask_str(&mask, mask_str, sizeof(mask_str)));
 }
 
 int check_sync_word(struct iq_header_struct* iq_header)
 {
 	if (iq_header->sync_word != SYNC_WORD){return -1;}
 	else{return 0;}
-}
\ No newline at end of file
+}
+
+const char* iq_ch_mask_str(const struct iq_ch_mask* mask, char* str, size_t size)
+/*
+ * Formats the mask as a hexadecimal number into str, masks of the first 32
+ * channels are printed with 8 digits.
+ */
+{
+	int top = IQ_CH_MASK_WORDS-1;
+	while (top > 0 && mask->w[top] == 0) {top--;}
+	int len = snprintf(str, size, top ? "0x%"PRIX64 : "0x%08"PRIX64, mask->w[top]);
+	for (int i = top-1; i >= 0 && len > 0 && (size_t) len < size; i--)
+	{
+		len += snprintf(str+len, size-len, "%016"PRIX64, mask->w[i]);
+	}
+	return str;
+}
+
+size_t iq_ch_meta_length(int ch_cnt)
+{
+	return IQ_CH_META_LENGTH(ch_cnt);
+}
+
+int iq_header_check_ch_meta(const struct iq_header_struct* iq_header)
+/*
+ * Checks the size fields of the per-channel metadata block,
+ * returns 0 when they are consistent, -1 otherwise.
+ */
+{
+	if (iq_header->ch_meta_cnt == 0 && iq_header->ch_meta_length == 0) {return 0;}
+	if (iq_header->ch_meta_cnt <= IQ_HEADER_CH_CNT || iq_header->ch_meta_cnt > IQ_MAX_CH) {return -1;}
+	if (iq_header->ch_meta_length != IQ_CH_META_LENGTH(iq_header->ch_meta_cnt)) {return -1;}
+	return 0;
+}
+
+void iq_header_init_ch_meta(struct iq_header_struct* iq_header, int ch_cnt)
+/*
+ * Sets up the header for ch_cnt receiver channels, the metadata block is
+ * cleared when it is needed. The buffer of the header must have room for
+ * IQ_CH_META_LENGTH(ch_cnt) bytes after the header.
+ */
+{
+	iq_header->ch_meta_length = IQ_CH_META_LENGTH(ch_cnt);
+	iq_header->ch_meta_cnt = iq_header->ch_meta_length ? ch_cnt : 0;
+	if (iq_header->ch_meta_length) {memset(CH_META_ACTIVE(iq_header), 0, iq_header->ch_meta_length);}
+}
+
+size_t iq_header_payload_offset(const struct iq_header_struct* iq_header)
+{
+	return IQ_HEADER_LENGTH + iq_header->ch_meta_length;
+}
+
+void iq_header_get_ch_mask(const struct iq_header_struct* iq_header, struct iq_ch_mask* mask)
+/*
+ * Returns the channel mask of the frame, frames without the
+ * active_ch_mask field hold the first active_ant_chs channels.
+ */
+{
+	if (iq_header->ch_meta_cnt)
+	{
+		memset(mask, 0, sizeof(*mask));
+		memcpy(mask->w, CH_META_ACTIVE(iq_header), CH_META_WORDS(iq_header)*sizeof(uint64_t));
+	}
+	else if (iq_header->active_ch_mask != 0)
+	{
+		iq_ch_mask_all(mask, 0);
+		mask->w[0] = iq_header->active_ch_mask;
+	}
+	else {iq_ch_mask_all(mask, iq_header->active_ant_chs);}
+}
+
+void iq_header_set_ch_mask(struct iq_header_struct* iq_header, const struct iq_ch_mask* mask)
+{
+	iq_header->active_ch_mask = (uint32_t) mask->w[0];
+	if (iq_header->ch_meta_cnt)
+		{memcpy(CH_META_ACTIVE(iq_header), mask->w, CH_META_WORDS(iq_header)*sizeof(uint64_t));}
+}
+
+void iq_header_get_overdrive(const struct iq_header_struct* iq_header, struct iq_ch_mask* flags)
+{
+	iq_ch_mask_all(flags, 0);
+	if (iq_header->ch_meta_cnt)
+		{memcpy(flags->w, CH_META_OVERDRIVE(iq_header), CH_META_WORDS(iq_header)*sizeof(uint64_t));}
+	else {flags->w[0] = iq_header->adc_overdrive_flags;}
+}
+
+void iq_header_set_overdrive(struct iq_header_struct* iq_header, const struct iq_ch_mask* flags)
+{
+	iq_header->adc_overdrive_flags = (uint32_t) flags->w[0];
+	if (iq_header->ch_meta_cnt)
+		{memcpy(CH_META_OVERDRIVE(iq_header), flags->w, CH_META_WORDS(iq_header)*sizeof(uint64_t));}
+}
+
+uint32_t iq_header_if_gain(const struct iq_header_struct* iq_header, int ch)
+{
+	if (iq_header->ch_meta_cnt) {return ch < (int) iq_header->ch_meta_cnt ? CH_META_GAINS(iq_header)[ch] : 0;}
+	return ch < IQ_HEADER_CH_CNT ? iq_header->if_gains[ch] : 0;
+}
+
+void iq_header_set_if_gain(struct iq_header_struct* iq_header, int ch, uint32_t gain)
+{
+	if (ch < IQ_HEADER_CH_CNT) {iq_header->if_gains[ch] = gain;}
+	if (ch < (int) iq_header->ch_meta_cnt) {CH_META_GAINS(iq_header)[ch] = gain;}
+}
+
+int iq_header_field_cnt(void)
+{
+	return sizeof(iq_header_fields)/sizeof(iq_header_fields[0]);
+}
+
+const struct iq_header_field_desc* iq_header_field(int index)
+/*
+ * Returns the name, offset and size of the indexed header field,
+ * NULL when the index is out of range.
+ */
+{
+	if (index < 0 || index >= iq_header_field_cnt()){return NULL;}
+	return &iq_header_fields[index];
+}
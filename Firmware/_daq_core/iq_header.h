@@ -4,9 +4,12 @@
  *	Project: HeIMDALL DAQ Firmware
  *	Author: Tamás Pető
  */
+#ifndef IQ_HEADER_H
+#define IQ_HEADER_H
 
 #define __STDC_FORMAT_MACROS
 #include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
 
 #define FRAME_TYPE_DATA  0
@@ -18,6 +21,26 @@
 #define SYNC_WORD 0x2bf7b95a
 
 #define IQ_HEADER_LENGTH 1024
+#define IQ_HEADER_VERSION 13
+#define IQ_HEADER_CH_CNT 32 // Receiver channels covered by the fixed per-channel fields of the header
+#define IQ_MAX_CH 256 // Receiver channels addressable by the channel masks
+#define IQ_CH_MASK_WORDS (IQ_MAX_CH/64)
+/* Length of the per-channel metadata of ch_cnt receiver channels (see below), 64 byte aligned */
+#define IQ_CH_META_LENGTH(ch_cnt) ((ch_cnt) <= IQ_HEADER_CH_CNT ? 0 : \
+                                   ((((ch_cnt)+63)/64*16 + (ch_cnt)*4 + 63) / 64 * 64))
+#define IQ_CH_META_MAX_LENGTH IQ_CH_META_LENGTH(IQ_MAX_CH)
+/* data_type of the spectral frames, time domain frames are 0 (dummy) to 3 (decimated IQ) */
+#define IQ_DATA_TYPE_SPECTRUM 4
+/* fft_window values of the spectral frames, in the order of the [spectrum] window names */
+enum iq_fft_window {
+	IQ_FFT_WINDOW_RECTANGULAR,
+	IQ_FFT_WINDOW_HANN,
+	IQ_FFT_WINDOW_HAMMING,
+	IQ_FFT_WINDOW_BLACKMAN,
+	IQ_FFT_WINDOW_CNT
+};
+#define MAX_IQFRAME_PAYLOAD_SIZE 8388608 // 2^23[sample] per channel
+//Should be greather than the cpi_size in the daq_chain_config.ini
 struct iq_frame_struct 
 {
 	struct iq_header_struct* header;
@@ -32,6 +55,40 @@ struct iq_frame_struct_32 // Complex float 32 compatible
 	int payload_size; // Used when the channel buffer is not equal to the CPI size
 };
 
+/*
+ * first_sample_index: Absolute index of the first sample of the frame at the ADC rate,
+ * counted from the start of the acquisition. Sample k of the frame belongs to the ADC
+ * sample first_sample_index + k*sample_index_step, which makes gaps and misalignments
+ * between frames and units directly visible.
+ * noise_source_switch_index: ADC sample index of the last noise source switch, the
+ * samples from this index on belong to noise_source_state. It is estimated from the
+ * arrival time of the blocks and includes their measured delivery jitter, it is not
+ * sample exact: the rebuffer drops a further noise_switch_guard samples ([calibration]).
+ * iq_corr_cpi_index: CPI index of the first frame corrected with the current IQ corrections.
+ * active_ch_mask: Bit m is set when the mth receiver channel is present in the frame, the
+ * active_ant_chs channels of the payload are stored in ascending channel order.
+ * 0 stands for all the channels (frames of earlier firmware versions).
+ *
+ * Per-channel metadata (header version 12): systems with more than IQ_HEADER_CH_CNT
+ * receiver channels describe all their ch_meta_cnt channels in a metadata block of
+ * ch_meta_length bytes that follows the header, the payload starts after it
+ * (iq_header_payload_offset). With W = (ch_meta_cnt+63)/64 the block holds
+ *     uint64_t active_ch_mask[W];      bit m of word m/64: mth channel
+ *     uint64_t adc_overdrive_flags[W];
+ *     uint32_t if_gains[ch_meta_cnt];
+ * padded to a multiple of 64 bytes. The fixed fields keep describing the first 32
+ * channels, but only the block is authoritative when present. Smaller systems do not
+ * write the block (ch_meta_cnt = ch_meta_length = 0), their frames are laid out as before.
+ * Use the iq_header_* accessors below instead of the fixed fields.
+ *
+ * Spectral frames (data_type IQ_DATA_TYPE_SPECTRUM, header version 13): the delay
+ * synchronizer can replace the IQ samples with the windowed FFT of every channel
+ * ([spectrum] section). The CPI of n samples is cut into (n-fft_size)/fft_hop+1
+ * segments, the payload holds active_ant_chs x segments x fft_size complex float32
+ * bins in channel, segment, bin order (natural FFT order, DC first, unnormalized)
+ * and cpi_length is segments x fft_size. fft_window is one of the IQ_FFT_WINDOW_*
+ * codes. The fft fields are zero in time domain frames.
+ */
 struct iq_header_struct {
 	uint32_t sync_word;            //Updates: RTL-DAQ - Static   
 	uint32_t frame_type;           //Updates: RTL-DAQ - Static
@@ -55,8 +112,118 @@ struct iq_header_struct {
 	uint32_t iq_sync_flag;         //Updates: Delay synchronizer
 	uint32_t sync_state;           //Updates: Delay synchronizer
 	uint32_t noise_source_state;   //Updates: RTL-DAQ	
-	uint32_t reserved[192];        //Updates: RTL-DAQ - Static
+	uint32_t sample_index_step;    //Updates: RTL-DAQ -> Decimator
+	uint64_t first_sample_index;   //Updates: RTL-DAQ -> Rebuffer -> Decimator
+	uint64_t noise_source_switch_index; //Updates: RTL-DAQ
+	uint32_t iq_corr_cpi_index;    //Updates: Delay synchronizer
+	uint32_t active_ch_mask;       //Updates: RTL-DAQ
+	uint32_t ch_meta_cnt;          //Updates: RTL-DAQ - Static
+	uint32_t ch_meta_length;       //Updates: RTL-DAQ - Static
+	uint32_t fft_size;             //Updates: Delay synchronizer - Static
+	uint32_t fft_hop;              //Updates: Delay synchronizer - Static
+	uint32_t fft_window;           //Updates: Delay synchronizer - Static
+	uint32_t reserved[180];        //Updates: RTL-DAQ - Static
 	uint32_t header_version;       //Updates: RTL-DAQ - Static   
 };
+
+/* Field layout of the header, exported for the modules that map the header
+ * directly (see IQ_HEADER_DTYPE in iq_header.py) */
+struct iq_header_field_desc {
+	const char* name;
+	size_t offset;
+	size_t size;
+};
+
+/* Set of receiver channels, bit m of word m/64 stands for the mth channel */
+struct iq_ch_mask {
+	uint64_t w[IQ_CH_MASK_WORDS];
+};
+
+static inline void iq_ch_mask_all(struct iq_ch_mask* mask, int ch_no)
+/* Sets the mask to the first ch_no channels */
+{
+	for (int i = 0; i < IQ_CH_MASK_WORDS; i++)
+	{
+		int n = ch_no - 64*i;
+		mask->w[i] = n >= 64 ? UINT64_MAX : n > 0 ? (UINT64_C(1) << n) - 1 : 0;
+	}
+}
+
+static inline int iq_ch_mask_test(const struct iq_ch_mask* mask, int ch)
+{
+	return (mask->w[ch/64] >> (ch%64)) & 1;
+}
+
+static inline void iq_ch_mask_set(struct iq_ch_mask* mask, int ch)
+{
+	mask->w[ch/64] |= UINT64_C(1) << (ch%64);
+}
+
+static inline int iq_ch_mask_cnt(const struct iq_ch_mask* mask)
+{
+	int cnt = 0;
+	for (int i = 0; i < IQ_CH_MASK_WORDS; i++) {cnt += __builtin_popcountll(mask->w[i]);}
+	return cnt;
+}
+
+static inline int iq_ch_mask_equal(const struct iq_ch_mask* a, const struct iq_ch_mask* b)
+{
+	for (int i = 0; i < IQ_CH_MASK_WORDS; i++) {if (a->w[i] != b->w[i]) {return 0;}}
+	return 1;
+}
+
+static inline int iq_ch_mask_within(const struct iq_ch_mask* mask, int ch_no)
+/* Returns 1 when the mask holds none of the channels above the first ch_no */
+{
+	struct iq_ch_mask all;
+	iq_ch_mask_all(&all, ch_no);
+	for (int i = 0; i < IQ_CH_MASK_WORDS; i++) {if (mask->w[i] & ~all.w[i]) {return 0;}}
+	return 1;
+}
+
+static inline int iq_ch_mask_next(const struct iq_ch_mask* mask, int ch)
+/*
+ * Returns the first channel of the mask after ch, pass -1 to get the first
+ * one. Returns IQ_MAX_CH when there are no more channels.
+ */
+{
+	for (ch++; ch < IQ_MAX_CH; ch = (ch/64+1)*64)
+	{
+		uint64_t w = mask->w[ch/64] >> (ch%64);
+		if (w) {return ch + __builtin_ctzll(w);}
+	}
+	return IQ_MAX_CH;
+}
+
+static inline int iq_ch_mask_end(const struct iq_ch_mask* mask)
+/* Returns the highest channel of the mask + 1, 0 for an empty mask */
+{
+	for (int i = IQ_CH_MASK_WORDS-1; i >= 0; i--) {if (mask->w[i]) {return 64*i + 64 - __builtin_clzll(mask->w[i]);}}
+	return 0;
+}
+
 void dump_iq_header(struct iq_header_struct* iq_header);
 int check_sync_word(struct iq_header_struct* iq_header);
+const char* iq_ch_mask_str(const struct iq_ch_mask* mask, char* str, size_t size);
+size_t iq_ch_meta_length(int ch_cnt);
+
+/*
+ * Accessors of the per-channel fields. The metadata block is accessed right after
+ * the header, so the header has to be kept together with its block (e.g. in the
+ * frame buffer). iq_header_check_ch_meta has to pass on received headers before
+ * the block is read, iq_header_init_ch_meta sets up the block of a new header.
+ */
+int iq_header_check_ch_meta(const struct iq_header_struct* iq_header);
+void iq_header_init_ch_meta(struct iq_header_struct* iq_header, int ch_cnt);
+size_t iq_header_payload_offset(const struct iq_header_struct* iq_header);
+void iq_header_get_ch_mask(const struct iq_header_struct* iq_header, struct iq_ch_mask* mask);
+void iq_header_set_ch_mask(struct iq_header_struct* iq_header, const struct iq_ch_mask* mask);
+void iq_header_get_overdrive(const struct iq_header_struct* iq_header, struct iq_ch_mask* flags);
+void iq_header_set_overdrive(struct iq_header_struct* iq_header, const struct iq_ch_mask* flags);
+uint32_t iq_header_if_gain(const struct iq_header_struct* iq_header, int ch);
+void iq_header_set_if_gain(struct iq_header_struct* iq_header, int ch, uint32_t gain);
+
+int iq_header_field_cnt(void);
+const struct iq_header_field_desc* iq_header_field(int index);
+
+#endif
@@ -1,13 +1,75 @@
 from struct import pack,unpack
 import logging
 import sys
+import ctypes
+from os.path import join, dirname, realpath
+import numpy as np
 """
     Desctiption: IQ Frame header definition
     For header field description check the corresponding documentation
-    Total length: 1024 byte
+    Total length: 1024 byte, followed by the per-channel metadata of large arrays
     Project: HeIMDALL DAQ Firmware
     Author: Tamás Pető
 """
+IQ_HEADER_SIZE = 1024 # size in bytes
+IQ_HEADER_CH_CNT = 32 # Receiver channels covered by the fixed per-channel fields
+IQ_MAX_CH = 256       # Receiver channels addressable by the channel masks
+IQ_DATA_TYPE_SPECTRUM = 4 # Per-channel spectra of the CPI (fft_* fields), see iq_header.h
+IQ_FFT_WINDOWS = ["rectangular", "hann", "hamming", "blackman"] # fft_window codes (enum iq_fft_window)
+
+def iq_ch_meta_length(ch_cnt):
+    """
+        Length of the per-channel metadata block of ch_cnt receiver channels (IQ_CH_META_LENGTH)
+
+        The block follows the header of systems with more than 32 channels:
+        active channel mask and ADC overdrive flags as 64 bit words, then the
+        IF gains as uint32, padded to a multiple of 64 bytes.
+    """
+    if ch_cnt <= IQ_HEADER_CH_CNT:
+        return 0
+    return ((ch_cnt+63)//64*16 + ch_cnt*4 + 63) // 64 * 64
+
+def _ch_meta_words(ch_cnt):
+    return (ch_cnt+63)//64
+
+# Mirror of "struct iq_header_struct" (iq_header.h) with natural C alignment
+IQ_HEADER_DTYPE = np.dtype([
+    ("sync_word",            np.uint32),
+    ("frame_type",           np.uint32),
+    ("hardware_id",          "S16"),
+    ("unit_id",              np.uint32),
+    ("active_ant_chs",       np.uint32),
+    ("ioo_type",             np.uint32),
+    ("rf_center_freq",       np.uint64),
+    ("adc_sampling_freq",    np.uint64),
+    ("sampling_freq",        np.uint64),
+    ("cpi_length",           np.uint32),
+    ("time_stamp",           np.uint64),
+    ("daq_block_index",      np.uint32),
+    ("cpi_index",            np.uint32),
+    ("ext_integration_cntr", np.uint64),
+    ("data_type",            np.uint32),
+    ("sample_bit_depth",     np.uint32),
+    ("adc_overdrive_flags",  np.uint32),
+    ("if_gains",             np.uint32, (32,)),
+    ("delay_sync_flag",      np.uint32),
+    ("iq_sync_flag",         np.uint32),
+    ("sync_state",           np.uint32),
+    ("noise_source_state",   np.uint32),
+    ("sample_index_step",    np.uint32),
+    ("first_sample_index",   np.uint64),
+    ("noise_source_switch_index", np.uint64),
+    ("iq_corr_cpi_index",    np.uint32),
+    ("active_ch_mask",       np.uint32),
+    ("ch_meta_cnt",          np.uint32),
+    ("ch_meta_length",       np.uint32),
+    ("fft_size",             np.uint32),
+    ("fft_hop",              np.uint32),
+    ("fft_window",           np.uint32),
+    ("reserved",             np.uint32, (180,)),
+    ("header_version",       np.uint32),
+], align=True)
+
 class IQHeader():
 
     FRAME_TYPE_DATA  = 0
@@ -22,7 +84,7 @@ class IQHeader():
         
         self.logger = logging.getLogger(__name__)
         self.header_size = 1024 # size in bytes
-        self.reserved_bytes = 192        
+        self.reserved_bytes = 180
 
         self.sync_word=self.SYNC_WORD        # uint32_t        
         self.frame_type=0                    # uint32_t 
@@ -40,20 +102,33 @@ class IQHeader():
         self.ext_integration_cntr=0          # uint64_t 
         self.data_type=0                     # uint32_t 
         self.sample_bit_depth=0              # uint32_t 
-        self.adc_overdrive_flags=0           # uint32_t 
-        self.if_gains=[0]*32                 # uint32_t x 32
+        self.adc_overdrive_flags=0           # uint32_t (all the channels when ch_meta_cnt > 0)
+        self.if_gains=[0]*32                 # uint32_t x 32 (x ch_meta_cnt when ch_meta_cnt > 0)
         self.delay_sync_flag=0               # uint32_t
         self.iq_sync_flag=0                  # uint32_t
         self.sync_state=0                    # uint32_t
         self.noise_source_state=0            # uint32_t        
+        self.sample_index_step=1             # uint32_t
+        self.first_sample_index=0            # uint64_t
+        self.noise_source_switch_index=0     # uint64_t
+        self.iq_corr_cpi_index=0             # uint32_t
+        self.active_ch_mask=0                # uint32_t (all the channels when ch_meta_cnt > 0)
+        self.ch_meta_cnt=0                   # uint32_t
+        self.ch_meta_length=0                # uint32_t
+        self.fft_size=0                      # uint32_t
+        self.fft_hop=0                       # uint32_t
+        self.fft_window=0                    # uint32_t
         self.reserved=[0]*self.reserved_bytes# uint32_t x reserverd_bytes
         self.header_version=0                # uint32_t 
 
     def decode_header(self, iq_header_byte_array):
         """
             Unpack,decode and store the content of the iq header
+
+            The per-channel metadata block of large arrays (ch_meta_length bytes
+            after the header) has to be passed to decode_ch_meta afterwards.
         """
-        iq_header_list = unpack("II16sIIIQQQIQIIQIII"+"I"*32+"IIII"+"I"*self.reserved_bytes+"I", iq_header_byte_array)
+        iq_header_list = unpack("II16sIIIQQQIQIIQIII"+"I"*32+"IIII"+"IQQIIII"+"III"+"I"*self.reserved_bytes+"I", iq_header_byte_array[0:IQ_HEADER_SIZE])
         
         self.sync_word            = iq_header_list[0]
         self.frame_type           = iq_header_list[1]
@@ -72,23 +147,97 @@ class IQHeader():
         self.data_type            = iq_header_list[14]
         self.sample_bit_depth     = iq_header_list[15]
         self.adc_overdrive_flags  = iq_header_list[16]
-        self.if_gains             = iq_header_list[17:49]
+        self.if_gains             = list(iq_header_list[17:49])
         self.delay_sync_flag      = iq_header_list[49]
         self.iq_sync_flag         = iq_header_list[50]
         self.sync_state           = iq_header_list[51]  
         self.noise_source_state   = iq_header_list[52]
-        self.header_version       = iq_header_list[52+self.reserved_bytes+1]
+        self.sample_index_step    = iq_header_list[53]
+        self.first_sample_index   = iq_header_list[54]
+        self.noise_source_switch_index = iq_header_list[55]
+        self.iq_corr_cpi_index    = iq_header_list[56]
+        self.active_ch_mask       = iq_header_list[57]
+        self.ch_meta_cnt          = iq_header_list[58]
+        self.ch_meta_length       = iq_header_list[59]
+        self.fft_size             = iq_header_list[60]
+        self.fft_hop              = iq_header_list[61]
+        self.fft_window           = iq_header_list[62]
+        self.header_version       = iq_header_list[62+self.reserved_bytes+1]
+        if len(iq_header_byte_array) >= IQ_HEADER_SIZE+self.ch_meta_length > IQ_HEADER_SIZE:
+            self.decode_ch_meta(iq_header_byte_array[IQ_HEADER_SIZE:IQ_HEADER_SIZE+self.ch_meta_length])
+
+    def check_ch_meta(self):
+        """
+            Check the size fields of the per-channel metadata block (iq_header_check_ch_meta)
+        """
+        if self.ch_meta_cnt == 0 and self.ch_meta_length == 0:
+            return 0
+        if not IQ_HEADER_CH_CNT < self.ch_meta_cnt <= IQ_MAX_CH or self.ch_meta_length != iq_ch_meta_length(self.ch_meta_cnt):
+            return -1
+        return 0
+
+    def init_ch_meta(self, ch_cnt):
+        """
+            Set up the header for ch_cnt receiver channels, the metadata block
+            is written by encode_header when it is needed
+        """
+        self.ch_meta_length = iq_ch_meta_length(ch_cnt)
+        self.ch_meta_cnt = ch_cnt if self.ch_meta_length else 0
+        if len(self.if_gains) < max(IQ_HEADER_CH_CNT, self.ch_meta_cnt):
+            self.if_gains = list(self.if_gains) + [0]*(max(IQ_HEADER_CH_CNT, self.ch_meta_cnt)-len(self.if_gains))
+
+    def decode_ch_meta(self, ch_meta_byte_array):
+        """
+            Decode the per-channel metadata block, the fixed per-channel fields are
+            replaced with the values of all the channels
+        """
+        if self.check_ch_meta() != 0:
+            return -1
+        if self.ch_meta_cnt == 0:
+            return 0
+        words = _ch_meta_words(self.ch_meta_cnt)
+        meta = np.frombuffer(bytes(ch_meta_byte_array[0:self.ch_meta_length]), dtype=np.uint8)
+        masks = meta[0:16*words].view("<u8")
+        self.active_ch_mask = sum(int(w) << 64*i for i, w in enumerate(masks[0:words]))
+        self.adc_overdrive_flags = sum(int(w) << 64*i for i, w in enumerate(masks[words:]))
+        self.if_gains = meta[16*words:16*words+4*self.ch_meta_cnt].view("<u4").tolist()
+        return 0
+
+    def payload_offset(self):
+        """
+            Offset of the payload from the start of the frame
+        """
+        return IQ_HEADER_SIZE + self.ch_meta_length
+
+    def get_ch_mask(self):
+        """
+            Channel mask of the frame, frames without the active_ch_mask field
+            hold the first active_ant_chs channels
+        """
+        return self.active_ch_mask or (1 << self.active_ant_chs)-1
+
+    def get_overdrive_flags(self):
+        return self.adc_overdrive_flags
+
+    def get_if_gains(self):
+        """
+            IF gains of all the receiver channels
+        """
+        return list(self.if_gains[0:max(IQ_HEADER_CH_CNT, self.ch_meta_cnt)])
 
     def encode_header(self):
         """
             Pack the iq header information into a byte array
+
+            The per-channel metadata block is appended when ch_meta_cnt is set,
+            the fixed fields get the values of the first 32 channels.
         """
         iq_header_byte_array=pack("II", self.sync_word, self.frame_type)
         iq_header_byte_array+=self.hardware_id.encode()+bytearray(16-len(self.hardware_id.encode()))
         iq_header_byte_array+=pack("IIIQQQIQIIQIII",
                                 self.unit_id, self.active_ant_chs, self.ioo_type, self.rf_center_freq, self.adc_sampling_freq,
                                 self.sampling_freq, self.cpi_length, self.time_stamp, self.daq_block_index, self.cpi_index, 
-                                self.ext_integration_cntr, self.data_type, self.sample_bit_depth, self.adc_overdrive_flags)
+                                self.ext_integration_cntr, self.data_type, self.sample_bit_depth, self.adc_overdrive_flags & 0xFFFFFFFF)
         for m in range(32):
             iq_header_byte_array+=pack("I", self.if_gains[m])
 
@@ -96,11 +245,22 @@ class IQHeader():
         iq_header_byte_array+=pack("I", self.iq_sync_flag)
         iq_header_byte_array+=pack("I", self.sync_state)
         iq_header_byte_array+=pack("I", self.noise_source_state)
+        iq_header_byte_array+=pack("=IQQII", self.sample_index_step, self.first_sample_index, self.noise_source_switch_index, self.iq_corr_cpi_index, self.active_ch_mask & 0xFFFFFFFF) # Follows a 4 byte aligned field
+        iq_header_byte_array+=pack("II", self.ch_meta_cnt, self.ch_meta_length)
+        iq_header_byte_array+=pack("III", self.fft_size, self.fft_hop, self.fft_window)
 
         for m in range(self.reserved_bytes):
             iq_header_byte_array+=pack("I",0)
 
         iq_header_byte_array+=pack("I", self.header_version)
+
+        if self.ch_meta_cnt:
+            words = _ch_meta_words(self.ch_meta_cnt)
+            meta = bytearray(self.ch_meta_length)
+            meta[0:8*words] = self.active_ch_mask.to_bytes(8*words, "little")
+            meta[8*words:16*words] = self.adc_overdrive_flags.to_bytes(8*words, "little")
+            meta[16*words:16*words+4*self.ch_meta_cnt] = pack("{:d}I".format(self.ch_meta_cnt), *self.if_gains[0:self.ch_meta_cnt])
+            iq_header_byte_array+=meta
         return iq_header_byte_array
 
     def dump_header(self):
@@ -124,13 +284,20 @@ class IQHeader():
         self.logger.info("Extended integration counter {:d}".format(self.ext_integration_cntr))
         self.logger.info("Data type: {:d}".format(self.data_type))
         self.logger.info("Sample bit depth: {:d}".format(self.sample_bit_depth))
+        if self.data_type == IQ_DATA_TYPE_SPECTRUM:
+            self.logger.info("FFT size: {:d}, hop: {:d}, window: {:d}".format(self.fft_size, self.fft_hop, self.fft_window))
         self.logger.info("ADC overdrive flags: {:d}".format(self.adc_overdrive_flags))    
-        for m in range(32):
+        for m in range(max(IQ_HEADER_CH_CNT, self.ch_meta_cnt)):
             self.logger.info("Ch: {:d} IF gain: {:.1f} dB".format(m, self.if_gains[m]/10))
         self.logger.info("Delay sync  flag: {:d}".format(self.delay_sync_flag))
         self.logger.info("IQ sync  flag: {:d}".format(self.iq_sync_flag))
         self.logger.info("Sync state: {:d}".format(self.sync_state))
         self.logger.info("Noise source state: {:d}".format(self.noise_source_state))
+        self.logger.info("First sample index: {:d} (step: {:d})".format(self.first_sample_index, self.sample_index_step))
+        self.logger.info("Noise source switch index: {:d}".format(self.noise_source_switch_index))
+        self.logger.info("IQ corrections applied from CPI: {:d}".format(self.iq_corr_cpi_index))
+        self.logger.info("Active channel mask: 0x{:08x}".format(self.active_ch_mask))
+        self.logger.info("Per-channel metadata: {:d} channels, {:d} bytes".format(self.ch_meta_cnt, self.ch_meta_length))
     
     def check_sync_word(self):
         """
@@ -140,3 +307,131 @@ class IQHeader():
             return -1
         else:
             return 0
+
+class IQHeaderView():
+    """
+        Zero-copy access to the header of an IQ frame buffer (e.g. a shared memory buffer).
+        Fields are read and written in place, nothing is decoded or encoded per frame.
+        Scalar fields read as numpy scalars, if_gains and reserved are views of the buffer.
+        The per-channel fields of large arrays are read from the metadata block
+        following the header with the get_* methods.
+    """
+    def __init__(self, buffer):
+        """
+            :param buffer: uint8 numpy array holding the frame, starting with the header
+        """
+        object.__setattr__(self, "_fields", buffer[0:IQ_HEADER_SIZE].view(IQ_HEADER_DTYPE)[0])
+        object.__setattr__(self, "_buffer", buffer)
+
+    def __getattr__(self, name):
+        try:
+            return self._fields[name]
+        except (KeyError, ValueError):
+            raise AttributeError(name)
+
+    def __setattr__(self, name, value):
+        self._fields[name] = value
+
+    def check_sync_word(self):
+        """
+            Check the sync word of the header
+        """
+        if self._fields["sync_word"] != IQHeader.SYNC_WORD:
+            return -1
+        else:
+            return 0
+
+    def check_ch_meta(self):
+        """
+            Check the size fields of the per-channel metadata block
+        """
+        ch_meta_cnt, ch_meta_length = int(self._fields["ch_meta_cnt"]), int(self._fields["ch_meta_length"])
+        if ch_meta_cnt == 0 and ch_meta_length == 0:
+            return 0
+        if not IQ_HEADER_CH_CNT < ch_meta_cnt <= IQ_MAX_CH or ch_meta_length != iq_ch_meta_length(ch_meta_cnt) or \
+           IQ_HEADER_SIZE+ch_meta_length > self._buffer.size:
+            return -1
+        return 0
+
+    def payload_offset(self):
+        """
+            Offset of the payload from the start of the frame
+        """
+        return IQ_HEADER_SIZE + int(self._fields["ch_meta_length"])
+
+    def _ch_meta_masks(self):
+        words = _ch_meta_words(int(self._fields["ch_meta_cnt"]))
+        return self._buffer[IQ_HEADER_SIZE:IQ_HEADER_SIZE+16*words].view("<u8"), words
+
+    def get_ch_mask(self):
+        """
+            Channel mask of the frame as an integer, frames without the
+            active_ch_mask field hold the first active_ant_chs channels
+        """
+        if self._fields["ch_meta_cnt"]:
+            masks, words = self._ch_meta_masks()
+            return sum(int(w) << 64*i for i, w in enumerate(masks[0:words]))
+        return int(self._fields["active_ch_mask"]) or (1 << int(self._fields["active_ant_chs"]))-1
+
+    def get_overdrive_flags(self):
+        """
+            ADC overdrive flags of all the channels as an integer
+        """
+        if self._fields["ch_meta_cnt"]:
+            masks, words = self._ch_meta_masks()
+            return sum(int(w) << 64*i for i, w in enumerate(masks[words:]))
+        return int(self._fields["adc_overdrive_flags"])
+
+    def get_if_gains(self):
+        """
+            IF gains of all the receiver channels, a view of the buffer
+        """
+        ch_meta_cnt = int(self._fields["ch_meta_cnt"])
+        if ch_meta_cnt:
+            offset = IQ_HEADER_SIZE + 16*_ch_meta_words(ch_meta_cnt)
+            return self._buffer[offset:offset+4*ch_meta_cnt].view("<u4")
+        return self._fields["if_gains"]
+
+def check_iq_header_layout(lib_path=None):
+    """
+        Compares IQ_HEADER_DTYPE with the field layout compiled into the native library
+
+        :param lib_path: Path of libhdaq.so, the one next to this module is used by default
+
+        :return: List of the mismatching fields, empty when the layouts are identical
+    """
+    if lib_path is None:
+        lib_path = join(dirname(realpath(__file__)), "libhdaq.so")
+    lib = ctypes.CDLL(lib_path)
+
+    class IQHeaderFieldDesc(ctypes.Structure):
+        _fields_ = [("name", ctypes.c_char_p), ("offset", ctypes.c_size_t), ("size", ctypes.c_size_t)]
+    lib.iq_header_field_cnt.argtypes = []
+    lib.iq_header_field_cnt.restype = ctypes.c_int
+    lib.iq_header_field.argtypes = [ctypes.c_int]
+    lib.iq_header_field.restype = ctypes.POINTER(IQHeaderFieldDesc)
+    lib.iq_ch_meta_length.argtypes = [ctypes.c_int]
+    lib.iq_ch_meta_length.restype = ctypes.c_size_t
+
+    errors = []
+    if IQ_HEADER_DTYPE.itemsize != IQ_HEADER_SIZE:
+        errors.append("Header size: {:d} != {:d}".format(IQ_HEADER_DTYPE.itemsize, IQ_HEADER_SIZE))
+    c_names = []
+    for i in range(lib.iq_header_field_cnt()):
+        field = lib.iq_header_field(i).contents
+        name = field.name.decode()
+        c_names.append(name)
+        if name not in IQ_HEADER_DTYPE.fields:
+            errors.append("{:s}: missing from IQ_HEADER_DTYPE".format(name))
+            continue
+        dtype, offset = IQ_HEADER_DTYPE.fields[name][0:2]
+        if offset != field.offset or dtype.itemsize != field.size:
+            errors.append("{:s}: offset {:d} size {:d}, native: offset {:d} size {:d}".format(
+                          name, offset, dtype.itemsize, field.offset, field.size))
+    if c_names != list(IQ_HEADER_DTYPE.names):
+        errors.append("Field order differs from the native layout")
+    for ch_cnt in [1, IQ_HEADER_CH_CNT, IQ_HEADER_CH_CNT+1, 64, 65, 100, IQ_MAX_CH]:
+        if iq_ch_meta_length(ch_cnt) != lib.iq_ch_meta_length(ch_cnt):
+            errors.append("Metadata length of {:d} channels: {:d}, native: {:d}".format(
+                          ch_cnt, iq_ch_meta_length(ch_cnt), lib.iq_ch_meta_length(ch_cnt)))
+    return errors
@@ -95,9 +95,10 @@ void log_log(int level, const char *file, int line, const char *fmt, ...) {
   /* Acquire lock */
   lock();
 
-  /* Get current time */
+  /* Get current time, localtime_r does not re-read the time zone on every call */
   time_t t = time(NULL);
-  struct tm *lt = localtime(&t);
+  struct tm tm;
+  struct tm *lt = localtime_r(&t, &tm);
 
   /* Log to stderr */
   if (!L.quiet) {
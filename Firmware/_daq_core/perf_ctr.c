@@ -0,0 +1,359 @@
+/*
+ *
+ * Description :
+ * Hardware performance counters of the processing stages (perf_event_open)
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "log.h"
+#include "perf_ctr.h"
+
+#define PERF_FRAME_LOG_FNAME "_logs/%s_perf.csv"
+
+enum perf_event_index
+{
+    EV_TASK_CLOCK = 0, // Group leader, the software clock is available on every host
+    EV_CYCLES,
+    EV_INSTRUCTIONS,
+    EV_LLC_MISSES,
+    EV_DTLB_MISSES,
+    EV_PAGE_FAULTS,
+    EV_CNT
+};
+
+static const struct
+{
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} events[EV_CNT] = {
+    {"task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}, // Last level cache on x86 and most ARM cores
+    {"dtlb_misses",   PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"page_faults",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static const char* phase_names[PERF_PHASE_CNT] = {"read", "convert", "filter", "write", "signal"};
+
+struct perf_counts
+{
+    uint64_t v[EV_CNT];
+};
+
+struct perf_thread
+{
+    char name[32];
+    int leader_fd;
+    int fd[EV_CNT];
+    int group_pos[EV_CNT]; // Position of the event in the group read, -1: not supported
+    int phase;
+    int started; // The first frame starts with the first phase, not at the opening of the counters
+    struct perf_counts phase_start, frame_start;
+    struct perf_counts frame[PERF_PHASE_CNT];
+    /* Sums of the phases, the last item is the frame total */
+    struct perf_counts interval[PERF_PHASE_CNT+1], total[PERF_PHASE_CNT+1];
+    uint64_t interval_frames, total_frames;
+    struct perf_thread* next;
+};
+
+static struct
+{
+    int enabled;
+    int report_interval;
+    int exclude_kernel;
+    char stage[32];
+    FILE* frame_log;
+    pthread_mutex_t lock; // Frame log and thread list
+    struct perf_thread* threads;
+} perf = {0, 0, 0, "", NULL, PTHREAD_MUTEX_INITIALIZER, NULL};
+
+static __thread struct perf_thread* thr;
+
+static int open_event(int ev, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[ev].type;
+    attr.config = events[ev].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = perf.exclude_kernel;
+    attr.exclude_hv = perf.exclude_kernel;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+static int read_counts(struct perf_thread* t, struct perf_counts* counts)
+/*
+ * Reads the group with a single system call. The counts are scaled up when the
+ * group was multiplexed with other users of the PMU.
+ */
+{
+    uint64_t buf[3+EV_CNT];
+    if (read(t->leader_fd, buf, sizeof(buf)) < (ssize_t) (3*sizeof(uint64_t))) {return -1;}
+    uint64_t enabled = buf[1], running = buf[2];
+    for (int ev = 0; ev < EV_CNT; ev++)
+    {
+        uint64_t value = t->group_pos[ev] >= 0 ? buf[3+t->group_pos[ev]] : 0;
+        if (running && running < enabled) {value = (uint64_t) ((double) value*enabled/running);}
+        counts->v[ev] = value;
+    }
+    return 0;
+}
+
+static void add_counts(struct perf_counts* acc, const struct perf_counts* to, const struct perf_counts* from)
+{
+    for (int ev = 0; ev < EV_CNT; ev++) {acc->v[ev] += to->v[ev] - from->v[ev];}
+}
+
+static int format_counts(char* buf, size_t size, const struct perf_thread* t, const struct perf_counts* sum,
+                         uint64_t frames)
+/*
+ * Per frame averages of the counts
+ */
+{
+    double avg[EV_CNT];
+    for (int ev = 0; ev < EV_CNT; ev++) {avg[ev] = frames ? (double) sum->v[ev]/frames : 0;}
+    int len = snprintf(buf, size, "task clock %.3f ms", avg[EV_TASK_CLOCK]*1e-6);
+    if (t->group_pos[EV_CYCLES] >= 0)
+        {len += snprintf(buf+len, size-len, ", cycles %.3f M", avg[EV_CYCLES]*1e-6);}
+    if (t->group_pos[EV_INSTRUCTIONS] >= 0 && t->group_pos[EV_CYCLES] >= 0 && avg[EV_CYCLES] > 0)
+        {len += snprintf(buf+len, size-len, ", IPC %.2f", avg[EV_INSTRUCTIONS]/avg[EV_CYCLES]);}
+    if (t->group_pos[EV_LLC_MISSES] >= 0)
+    {
+        len += snprintf(buf+len, size-len, ", LLC misses %.1f k", avg[EV_LLC_MISSES]*1e-3);
+        if (t->group_pos[EV_INSTRUCTIONS] >= 0 && avg[EV_INSTRUCTIONS] > 0)
+            {len += snprintf(buf+len, size-len, " (%.2f MPKI)", avg[EV_LLC_MISSES]*1000/avg[EV_INSTRUCTIONS]);}
+    }
+    if (t->group_pos[EV_DTLB_MISSES] >= 0)
+        {len += snprintf(buf+len, size-len, ", dTLB misses %.1f k", avg[EV_DTLB_MISSES]*1e-3);}
+    if (t->group_pos[EV_PAGE_FAULTS] >= 0)
+        {len += snprintf(buf+len, size-len, ", page faults %.1f", avg[EV_PAGE_FAULTS]);}
+    return len;
+}
+
+static void report(const struct perf_thread* t, const struct perf_counts* sums, uint64_t frames, const char* span)
+{
+    char line[512];
+    if (frames == 0) {return;}
+    format_counts(line, sizeof(line), t, &sums[PERF_PHASE_CNT], frames);
+    log_info("Perf [%s/%s] %s %llu frames, per frame: %s", perf.stage, t->name, span, (unsigned long long) frames, line);
+    for (int phase = 0; phase < PERF_PHASE_CNT; phase++)
+    {
+        if (sums[phase].v[EV_TASK_CLOCK] == 0) {continue;}
+        format_counts(line, sizeof(line), t, &sums[phase], frames);
+        log_info("Perf [%s/%s]   %-8s %4.1f%%: %s", perf.stage, t->name, phase_names[phase],
+                 100.0*sums[phase].v[EV_TASK_CLOCK]/(sums[PERF_PHASE_CNT].v[EV_TASK_CLOCK]+1), line);
+    }
+}
+
+static void log_frame(const struct perf_thread* t, const char* phase, const struct perf_counts* counts)
+{
+    fprintf(perf.frame_log, "%s,%llu,%s", t->name, (unsigned long long) t->total_frames, phase);
+    for (int ev = 0; ev < EV_CNT; ev++)
+    {
+        if (t->group_pos[ev] >= 0) {fprintf(perf.frame_log, ",%llu", (unsigned long long) counts->v[ev]);}
+        else {fprintf(perf.frame_log, ",");}
+    }
+    fprintf(perf.frame_log, "\n");
+}
+
+int perf_ctr_init(const char* stage, const struct daq_config* config)
+/*
+ * Opens the counters of the calling thread when they are enabled in the
+ * configuration.
+ *
+ * Return values:
+ * --------------
+ *       0: Counters opened or disabled
+ *      -1: The counters could not be opened, the stage runs without them
+ */
+{
+    if (!config->en_perf_counters) {return 0;}
+    perf.enabled = 1;
+    perf.report_interval = config->perf_report_interval;
+    snprintf(perf.stage, sizeof(perf.stage), "%s", stage);
+    if (config->en_perf_frame_log)
+    {
+        char fname[128];
+        snprintf(fname, sizeof(fname), PERF_FRAME_LOG_FNAME, stage);
+        perf.frame_log = fopen(fname, "w");
+        if (perf.frame_log == NULL) {log_warn("Failed to open the performance counter log: %s (%s)", fname, strerror(errno));}
+        else
+        {
+            fprintf(perf.frame_log, "thread,frame,phase");
+            for (int ev = 0; ev < EV_CNT; ev++) {fprintf(perf.frame_log, ",%s", events[ev].name);}
+            fprintf(perf.frame_log, "\n");
+        }
+    }
+    return perf_ctr_thread_open("main");
+}
+
+int perf_ctr_thread_open(const char* thread_name)
+/*
+ * Opens the counter group of the calling thread
+ */
+{
+    if (!perf.enabled) {return 0;}
+    if (thr != NULL) {return 0;}
+
+    struct perf_thread* t = calloc(1, sizeof(struct perf_thread));
+    if (t == NULL) {return -1;}
+    snprintf(t->name, sizeof(t->name), "%s", thread_name);
+    t->phase = PERF_PHASE_NONE;
+
+    /* Kernel time is counted as well (page faults, pipe reads) when permitted */
+    t->leader_fd = open_event(EV_TASK_CLOCK, -1);
+    if (t->leader_fd < 0 && (errno == EACCES || errno == EPERM) && !perf.exclude_kernel)
+    {
+        perf.exclude_kernel = 1;
+        t->leader_fd = open_event(EV_TASK_CLOCK, -1);
+    }
+    if (t->leader_fd < 0)
+    {
+        log_warn("Failed to open the performance counters: %s, check /proc/sys/kernel/perf_event_paranoid", strerror(errno));
+        free(t);
+        return -1;
+    }
+
+    char available[256] = "", missing[256] = "";
+    int group_size = 0;
+    for (int ev = 0; ev < EV_CNT; ev++)
+    {
+        t->fd[ev] = ev == EV_TASK_CLOCK ? t->leader_fd : open_event(ev, t->leader_fd);
+        t->group_pos[ev] = t->fd[ev] >= 0 ? group_size++ : -1;
+        char* list = t->fd[ev] >= 0 ? available : missing;
+        snprintf(list + strlen(list), sizeof(available) - strlen(list), "%s%s", *list ? " " : "", events[ev].name);
+    }
+    ioctl(t->leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(t->leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    read_counts(t, &t->frame_start);
+    t->phase_start = t->frame_start;
+    log_info("Performance counters of %s/%s: %s%s, n/a: %s", perf.stage, t->name, available,
+             perf.exclude_kernel ? " (user space only)" : "", *missing ? missing : "-");
+
+    pthread_mutex_lock(&perf.lock);
+    t->next = perf.threads;
+    perf.threads = t;
+    pthread_mutex_unlock(&perf.lock);
+    thr = t;
+    return 0;
+}
+
+void perf_ctr_phase(int phase)
+/*
+ * Closes the active phase and starts the next one, PERF_PHASE_NONE stops the
+ * attribution
+ */
+{
+    struct perf_thread* t = thr;
+    if (t == NULL) {return;}
+    struct perf_counts now;
+    if (read_counts(t, &now) != 0) {return;}
+    if (!t->started) {t->frame_start = now; t->started = 1;}
+    if (t->phase != PERF_PHASE_NONE) {add_counts(&t->frame[t->phase], &now, &t->phase_start);}
+    t->phase_start = now;
+    t->phase = phase;
+}
+
+void perf_ctr_frame_end(void)
+/*
+ * Closes the frame, the active phase continues in the next frame
+ */
+{
+    struct perf_thread* t = thr;
+    if (t == NULL) {return;}
+    struct perf_counts now, frame_total = {{0}};
+    if (read_counts(t, &now) != 0) {return;}
+    if (t->phase != PERF_PHASE_NONE) {add_counts(&t->frame[t->phase], &now, &t->phase_start);}
+    t->phase_start = now;
+    add_counts(&frame_total, &now, &t->frame_start);
+    t->frame_start = now;
+
+    struct perf_counts zero = {{0}};
+    for (int phase = 0; phase < PERF_PHASE_CNT; phase++)
+    {
+        add_counts(&t->interval[phase], &t->frame[phase], &zero);
+        add_counts(&t->total[phase], &t->frame[phase], &zero);
+    }
+    add_counts(&t->interval[PERF_PHASE_CNT], &frame_total, &zero);
+    add_counts(&t->total[PERF_PHASE_CNT], &frame_total, &zero);
+
+    if (perf.frame_log != NULL)
+    {
+        pthread_mutex_lock(&perf.lock);
+        log_frame(t, "frame", &frame_total);
+        for (int phase = 0; phase < PERF_PHASE_CNT; phase++)
+        {
+            if (t->frame[phase].v[EV_TASK_CLOCK] != 0) {log_frame(t, phase_names[phase], &t->frame[phase]);}
+        }
+        pthread_mutex_unlock(&perf.lock);
+    }
+    memset(t->frame, 0, sizeof(t->frame));
+    t->interval_frames++;
+    t->total_frames++;
+
+    if (t->interval_frames >= (uint64_t) perf.report_interval)
+    {
+        report(t, t->interval, t->interval_frames, "last");
+        memset(t->interval, 0, sizeof(t->interval));
+        t->interval_frames = 0;
+    }
+}
+
+void perf_ctr_close(void)
+/*
+ * Logs the summary of the whole run for every instrumented thread and closes
+ * the counters. Called at the exit of the stage, when the instrumented threads
+ * have already stopped.
+ */
+{
+    if (!perf.enabled) {return;}
+    pthread_mutex_lock(&perf.lock);
+    for (struct perf_thread* t = perf.threads; t != NULL;)
+    {
+        struct perf_thread* next = t->next;
+        report(t, t->total, t->total_frames, "total");
+        for (int ev = 0; ev < EV_CNT; ev++)
+        {
+            if (t->fd[ev] >= 0) {close(t->fd[ev]);}
+        }
+        free(t);
+        t = next;
+    }
+    perf.threads = NULL;
+    thr = NULL;
+    if (perf.frame_log != NULL) {fclose(perf.frame_log); perf.frame_log = NULL;}
+    perf.enabled = 0;
+    pthread_mutex_unlock(&perf.lock);
+}
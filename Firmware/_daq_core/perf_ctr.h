@@ -0,0 +1,65 @@
+/*
+ *
+ * Description :
+ * Hardware performance counters of the processing stages (perf_event_open)
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PERF_CTR_H
+#define PERF_CTR_H
+
+#include "daq_config.h"
+
+/*
+ * Enabled with the [perf] section of the configuration file. Every
+ * instrumented thread opens its own counter group (task clock, cycles,
+ * instructions, last level cache misses, dTLB misses and page faults), so
+ * only the CPU time of the processing thread is counted, blocking on the
+ * pipes and FIFOs costs nothing. Counters the host does not provide (e.g. the
+ * hardware ones in most VMs) are reported as n/a.
+ *
+ * The processing loop marks the phases of a frame with perf_ctr_phase, the
+ * counts are attributed to the active phase until the next call, and closes
+ * the frame with perf_ctr_frame_end. The per frame averages of every
+ * report_interval frames and of the whole run are logged into the stage log,
+ * with en_frame_log the counts of every frame are written into
+ * _logs/<stage>_perf.csv as well.
+ *
+ * All the calls are no-ops when the counters are disabled.
+ */
+enum perf_phase
+{
+    PERF_PHASE_NONE = -1, // Not attributed to any phase, counted in the frame total only
+    PERF_PHASE_READ = 0,
+    PERF_PHASE_CONVERT,
+    PERF_PHASE_FILTER,
+    PERF_PHASE_WRITE,
+    PERF_PHASE_SIGNAL,
+    PERF_PHASE_CNT
+};
+
+int  perf_ctr_init(const char* stage, const struct daq_config* config);
+int  perf_ctr_thread_open(const char* thread_name);
+void perf_ctr_phase(int phase);
+void perf_ctr_frame_end(void);
+void perf_ctr_close(void);
+
+#endif
@@ -33,55 +33,31 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <unistd.h>
 #include "rtl_daq.h"
 #include "log.h"
-#include "ini.h"
 #include "iq_header.h"
 #include "sh_mem_util.h"
+#include "daq_config.h"
+#include "stage_ctrl.h"
+#include "hdaq_simd.h"
+#include "perf_ctr.h"
+#include "alloc_audit.h"
 
 #define INI_FNAME "daq_chain_config.ini"
 #define FATAL_ERR(l) log_fatal(l); return -1;
-/*
- * This structure stores the configuration parameters, 
- * that are loaded from the ini file
- */ 
-typedef struct
-{
-    int num_ch;
-    int cal_size;
-    int cpi_size;
-    int daq_buffer_size;
-    int decimation_ratio;    
-    int log_level;      
-} configuration;
 
+static inline void write_out(void* dst, const void* src, size_t size, int stream)
 /*
- * Ini configuration parser callback function  
-*/
-static int handler(void* conf_struct, const char* section, const char* name,
-                   const char* value)
+ * Copies a channel into the output frame, large frames bypass the cache
+ */
 {
-    configuration* pconfig = (configuration*) conf_struct;
-
-    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-    if (MATCH("hw", "num_ch"))
-    {pconfig->num_ch = atoi(value);}
-    else if (MATCH("calibration", "corr_size"))
-    {pconfig->cal_size = atoi(value);}
-    else if (MATCH("daq", "daq_buffer_size"))
-    {pconfig->daq_buffer_size = atoi(value);}
-    else if (MATCH("pre_processing", "decimation_ratio")) 
-    {pconfig->decimation_ratio = atoi(value);}
-    else if (MATCH("pre_processing", "cpi_size")) 
-    {pconfig->cpi_size = atoi(value);}
-    else if (MATCH("daq", "log_level"))
-    {pconfig->log_level = atoi(value);}
-    else {return 0;  /* unknown section/name, error */}
-    return 0;
+    if (stream) {hdaq_stream_copy(dst, src, size);}
+    else {memcpy(dst, src, size);}
 }
 
 int main(int argc, char* argv[])
@@ -94,7 +70,7 @@ int main(int argc, char* argv[])
  */
 {    
     log_set_level(LOG_TRACE);
-    configuration config;    
+    struct daq_config config;
         
     int exit_flag=0;
     int ch_num;
@@ -108,35 +84,47 @@ int main(int argc, char* argv[])
     struct circ_buffer_struct* circ_buff_structs;
     int rd_offset=0, wr_offset=0, available=0;
     size_t offset = 0;
+    int stream_out = 0; // Write the frame with streaming stores
+    uint64_t noise_switch_guard; // [sample] Settling and latency margin after the noise source switch index
     // Used for managing the data frames
     uint32_t expected_frame_index=-1;    
+    struct iq_ch_mask frame_ch_mask, last_ch_mask;
+    char mask_str[IQ_MAX_CH/4+3];
+    size_t payload_offset;
     void* frame_ptr;
-    struct iq_header_struct* iq_header = calloc(1, sizeof(struct iq_header_struct));    
+    struct iq_header_struct* iq_header = calloc(1, IQ_HEADER_LENGTH + IQ_CH_META_MAX_LENGTH); // Header and per-channel metadata
     // Used for the shared memory interface
     int active_buff_ind = 0;
     bool drop_mode = true;
 
-    uint32_t adc_overdrive_flags=0; // Used to accumulate the overdrive flags in a CPI
+    struct iq_ch_mask adc_overdrive_flags, frame_overdrive_flags; // Used to accumulate the overdrive flags in a CPI
+    iq_ch_mask_all(&adc_overdrive_flags, 0);
+    iq_ch_mask_all(&last_ch_mask, 0);
     
     /* Set drop mode from the command prompt*/    
     if (argc == 2){drop_mode = atoi(argv[1]);}
 
     /* Set parameters from the config file*/
-    if (ini_parse(INI_FNAME, handler, &config) < 0) {
+    if (load_daq_config(INI_FNAME, &config) != 0) {
         log_fatal("Configuration could not be loaded, exiting ..");
         return -2;
     }   
     in_buffer_size  = config.daq_buffer_size;
     out_buffer_size = config.cpi_size * config.decimation_ratio;
-    cal_out_buffer_size = config.cal_size; 
+    cal_out_buffer_size = config.corr_size; 
     active_out_buffer_size = 0;
     ch_num = config.num_ch;
+    noise_switch_guard = (uint64_t) config.noise_switch_guard;
     log_set_level(config.log_level);          
     log_info("Config succesfully loaded from %s",INI_FNAME);
     log_info("Channel number: %d", ch_num);
     log_info("Input buffer size: %d IQ samples per channel", in_buffer_size);
     log_info("Output buffer size: %d IQ samples per channel", out_buffer_size);
     log_info("Calibration buffer size: %d IQ samples per channel", cal_out_buffer_size);
+    log_info("Noise source switch guard: %"PRIu64" samples", noise_switch_guard);
+    log_info("Streaming store threshold: %zu bytes", hdaq_stream_threshold());
+    perf_ctr_init("rebuffer", &config);
+    alloc_audit_init("rebuffer");
 
     // Determine the neccesary size of the circular buffers
     int buffer_num_data = out_buffer_size / in_buffer_size + 2;
@@ -156,11 +144,11 @@ int main(int argc, char* argv[])
     struct shmem_transfer_struct* output_sm_buff = calloc(1, sizeof(struct shmem_transfer_struct));
     if (out_buffer_size >= cal_out_buffer_size)
     {
-        output_sm_buff->shared_memory_size = out_buffer_size*ch_num*sizeof(uint8_t)*2+IQ_HEADER_LENGTH;
+        output_sm_buff->shared_memory_size = (size_t) out_buffer_size*ch_num*sizeof(uint8_t)*2+IQ_HEADER_LENGTH+IQ_CH_META_LENGTH(ch_num);
     }
     else
     {
-        output_sm_buff->shared_memory_size = cal_out_buffer_size*ch_num*sizeof(uint8_t)*2+IQ_HEADER_LENGTH;
+        output_sm_buff->shared_memory_size = (size_t) cal_out_buffer_size*ch_num*sizeof(uint8_t)*2+IQ_HEADER_LENGTH+IQ_CH_META_LENGTH(ch_num);
     }
     output_sm_buff->io_type = 0; // Output type
     output_sm_buff->drop_mode = drop_mode;
@@ -168,9 +156,13 @@ int main(int argc, char* argv[])
     strcpy(output_sm_buff->shared_memory_names[1], DECIMATOR_IN_SM_NAME_B);
     strcpy(output_sm_buff->fw_ctr_fifo_name, DECIMATOR_IN_FW_FIFO);
     strcpy(output_sm_buff->bw_ctr_fifo_name, DECIMATOR_IN_BW_FIFO);
+    const char* numa_policy = daq_link_numa_policy(&config, DAQ_GRAPH_REBUFFER, &output_sm_buff->numa_producer_cpu,
+                                                   &output_sm_buff->numa_consumer_cpu);
+    if (numa_policy != NULL) {strcpy(output_sm_buff->numa_policy, numa_policy);}
 
     succ = init_out_sm_buffer(output_sm_buff);
     if(succ !=0){FATAL_ERR("Shared memory initialization failed")}
+    stage_notify(STAGE_EV_READY);
 	
     /*
      *
@@ -179,6 +171,7 @@ int main(int argc, char* argv[])
      */
     while(!exit_flag)
     {
+        perf_ctr_phase(PERF_PHASE_READ);
         CHK_DATA_PIPE(stdin);
         /*
          *------------------
@@ -187,9 +180,21 @@ int main(int argc, char* argv[])
         */        
         /* Reading IQ header */
         read_size = fread(iq_header, sizeof(struct iq_header_struct), 1, stdin);                
-        //dump_iq_header(iq_header); // Uncomment to debug IQ header content
         CHK_FR_READ(read_size,1);
         CHK_SYNC_WORD(check_sync_word(iq_header));
+        /* Reading the per-channel metadata of large arrays */
+        if (iq_header_check_ch_meta(iq_header) != 0 || iq_header->ch_meta_length > IQ_CH_META_LENGTH(ch_num))
+        {
+            log_fatal("Invalid per-channel metadata: %u channels, %u bytes", iq_header->ch_meta_cnt, iq_header->ch_meta_length);
+            exit_flag = 1; break;
+        }
+        payload_offset = iq_header_payload_offset(iq_header);
+        if (payload_offset > IQ_HEADER_LENGTH)
+        {
+            read_size = fread((uint8_t*) iq_header + IQ_HEADER_LENGTH, payload_offset - IQ_HEADER_LENGTH, 1, stdin);
+            CHK_FR_READ(read_size,1);
+        }
+        //dump_iq_header(iq_header); // Uncomment to debug IQ header content
         log_trace("<-- Frame received: type: %d, daq ind:[%d]",iq_header->frame_type, iq_header->daq_block_index);
         if (expected_frame_index == -1)
         {expected_frame_index = iq_header->daq_block_index;}
@@ -200,6 +205,24 @@ int main(int argc, char* argv[])
             expected_frame_index = iq_header->daq_block_index;
         }
         expected_frame_index += 1;
+
+        /* The circular buffers are assigned to the payload slots,
+         * the accumulation restarts when the set of channels changes */
+        iq_header_get_ch_mask(iq_header, &frame_ch_mask);
+        if (!iq_ch_mask_within(&frame_ch_mask, ch_num))
+        {
+            log_fatal("Channel mask of the frame: %s exceeds the channel number: %d",
+                      iq_ch_mask_str(&frame_ch_mask, mask_str, sizeof(mask_str)), ch_num);
+            exit_flag = 1; break;
+        }
+        if (!iq_ch_mask_equal(&frame_ch_mask, &last_ch_mask))
+        {
+            log_info("Active channel mask: %s", iq_ch_mask_str(&frame_ch_mask, mask_str, sizeof(mask_str)));
+            wr_offset = 0;
+            rd_offset = 0;
+            available = 0;
+            last_ch_mask = frame_ch_mask;
+        }
         
         /* Reading multichannel IQ data */
         if (iq_header->cpi_length > 0)
@@ -223,12 +246,10 @@ int main(int argc, char* argv[])
         {   
             case FRAME_TYPE_DUMMY:
             {         
-                /* Reset module parameters */
-                for(int m=0;m<ch_num;m++)
-                {                
-                    struct circ_buffer_struct *cbuff_m = &circ_buff_structs[m];
-                    memset(circ_buff_structs[m].iq_circ_buffer, 0, buffer_num * in_buffer_size*2*sizeof(*cbuff_m->iq_circ_buffer));
-                }
+                /* Reset module parameters
+                 * The circular buffers are not cleared, resetting the offsets is enough:
+                 * samples are only forwarded once "available" is refilled by new frames.
+                 */
                 wr_offset = 0;
                 rd_offset = 0;  
                 available = 0;                
@@ -245,7 +266,19 @@ int main(int argc, char* argv[])
                 available += read_size;                
 
                 // Accumulate ADC overdrive flags
-                adc_overdrive_flags |= iq_header->adc_overdrive_flags;
+                iq_header_get_overdrive(iq_header, &frame_overdrive_flags);
+                for (int i = 0; i < IQ_CH_MASK_WORDS; i++) {adc_overdrive_flags.w[i] |= frame_overdrive_flags.w[i];}
+
+                // Drop the buffered samples that precede the last noise source switch
+                uint64_t oldest_index = iq_header->first_sample_index + in_buffer_size - available/2;
+                uint64_t clean_index  = iq_header->noise_source_switch_index + noise_switch_guard;
+                if (iq_header->noise_source_switch_index != 0 && clean_index > oldest_index)
+                {
+                    int skip = (clean_index - oldest_index < available/2) ? (int) (clean_index - oldest_index) : available/2;
+                    wr_offset = (wr_offset + skip*2) % (buffer_num * in_buffer_size*2);
+                    available -= skip*2;
+                    log_debug("Noise source switch, dropped samples: %d", skip);
+                }
             }
             break;
             default:
@@ -257,6 +290,7 @@ int main(int argc, char* argv[])
          *  IQ Frame Writing
          *------------------
         */ 
+        perf_ctr_phase(PERF_PHASE_WRITE);
         if (iq_header->frame_type == FRAME_TYPE_DUMMY)
         {
             /*Acquire buffer from the sink block*/
@@ -271,7 +305,8 @@ int main(int argc, char* argv[])
                     iq_header->cpi_length = 0;
                     
                     /* Place IQ header into the output buffer*/
-                    memcpy(frame_ptr, iq_header,1024);
+                    memcpy(frame_ptr, iq_header, payload_offset);
+                    perf_ctr_phase(PERF_PHASE_SIGNAL);
                     send_ctr_buff_ready(output_sm_buff, active_buff_ind);
                     log_trace("--> Transfering frame: type: %d, daq ind:[%d]",iq_header->frame_type, iq_header->daq_block_index);
 		    break;
@@ -301,15 +336,20 @@ int main(int argc, char* argv[])
                     
                     /* Place IQ header into the output buffer*/
                     iq_header->cpi_length = active_out_buffer_size;
-                    iq_header->adc_overdrive_flags = adc_overdrive_flags;
+                    iq_header_set_overdrive(iq_header, &adc_overdrive_flags);
+
+                    /* The circular buffer holds the last "available" samples of the stream,
+                     * the forwarded ones start at the oldest of them */
+                    iq_header->first_sample_index = iq_header->first_sample_index + in_buffer_size - available/2;
 
                     float timestamp_adjust = (float) (available-active_out_buffer_size*2)/2*1000/iq_header->sampling_freq;                    
                     log_debug("Timestamp adjust: %f ms", timestamp_adjust);
                     iq_header->time_stamp -= (int) round(timestamp_adjust);                    
-                    adc_overdrive_flags = 0;
-                    memcpy(frame_ptr, iq_header,1024);
+                    iq_ch_mask_all(&adc_overdrive_flags, 0);
+                    memcpy(frame_ptr, iq_header, payload_offset);
                     
                     /* Place Multichannel IQ data */
+                    stream_out = hdaq_stream_frame((size_t) active_out_buffer_size*2*iq_header->active_ant_chs);
                     chunk_size = buffer_num * in_buffer_size * 2 - wr_offset; // Available data until the end of the circular buffer                     
                     if (chunk_size >= active_out_buffer_size*2)
                     {
@@ -317,8 +357,8 @@ int main(int argc, char* argv[])
                         {   
                             // Get the circular buffer structure of the mth channel 
                             struct circ_buffer_struct *cbuff_m = &circ_buff_structs[m];
-                            offset = IQ_HEADER_LENGTH/(sizeof(uint8_t)) + m*active_out_buffer_size*2;
-                            memcpy(frame_ptr+offset, cbuff_m->iq_circ_buffer+wr_offset, active_out_buffer_size*2);
+                            offset = payload_offset + (size_t) m*active_out_buffer_size*2;
+                            write_out(frame_ptr+offset, cbuff_m->iq_circ_buffer+wr_offset, active_out_buffer_size*2, stream_out);
                         }
                         wr_offset += active_out_buffer_size*2;
                         wr_offset = wr_offset % (buffer_num * in_buffer_size*2);                    
@@ -330,14 +370,16 @@ int main(int argc, char* argv[])
                         {   
                             // Get the circular buffer structure of the mth channel 
                             struct circ_buffer_struct *cbuff_m = &circ_buff_structs[m];
-                            offset = IQ_HEADER_LENGTH/(sizeof(uint8_t)) + m*active_out_buffer_size*2;
-                            memcpy(frame_ptr+offset, cbuff_m->iq_circ_buffer+wr_offset, chunk_size);
-                            memcpy(frame_ptr+offset+chunk_size, cbuff_m->iq_circ_buffer, chunk_size_2);
+                            offset = payload_offset + (size_t) m*active_out_buffer_size*2;
+                            write_out(frame_ptr+offset, cbuff_m->iq_circ_buffer+wr_offset, chunk_size, stream_out);
+                            write_out(frame_ptr+offset+chunk_size, cbuff_m->iq_circ_buffer, chunk_size_2, stream_out);
                         }
                         wr_offset = chunk_size_2;
                     }   
                     available -= active_out_buffer_size*2;                
+                    perf_ctr_phase(PERF_PHASE_SIGNAL);
                     send_ctr_buff_ready(output_sm_buff, active_buff_ind);                                      
+                    stage_notify(STAGE_EV_FIRST_FRAME);
                     log_trace("--> Transfering frame: type: %d, daq ind:[%d]",iq_header->frame_type, iq_header->daq_block_index);
 		    break;
                 case 3: // Frame drop
@@ -347,8 +389,11 @@ int main(int argc, char* argv[])
                     exit_flag = 1;
             }
         }                
+        perf_ctr_frame_end();
+        alloc_audit_frame_end();
     }    
     error_code_log(exit_flag);
+    perf_ctr_close();
     log_info("Send terminate and wait..");
     send_ctr_terminate(output_sm_buff);
     sleep(3);    
@@ -359,7 +404,7 @@ int main(int argc, char* argv[])
         free((circ_buff_structs + m * sizeof(*circ_buff_structs))->iq_circ_buffer);       
     }
     log_info("Rebuffering block exited");
-    return 0;
+    return alloc_audit_report();
     
 }
 
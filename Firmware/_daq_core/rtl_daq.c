@@ -44,11 +44,15 @@
 #include <sys/time.h>  // Used for latency estimation
 #include <zmq.h>
 
-#include "ini.h"
+#include "daq_config.h"
+#include "stage_ctrl.h"
 #include "log.h"
 #include "rtl-sdr.h"
 #include "rtl_daq.h"
 #include "iq_header.h"
+#include "hdaq_simd.h"
+#include "perf_ctr.h"
+#include "alloc_audit.h"
 
 #ifdef USEPIGPIO
 #include <pigpio.h>
@@ -59,6 +63,7 @@
 #define ASYNC_BUF_NUMBER 12// Number of buffers used by the asynchronous read 
 #define FS_CORRECTION_KEEP_LIMIT 0.008 // Above this ppm offset the tuning is not terminated after 1 cal. frame
 #define INI_FNAME "daq_chain_config.ini"
+#define BUFF_JITTER_DECAY 0.999 // Per block decay of the measured delivery jitter peak
 
 /*
  * ------> DUMMY FRAMES <------
@@ -75,11 +80,20 @@ struct rtl_rec_struct* rtl_receivers;
 pthread_mutex_t buff_ind_mutex;
 pthread_cond_t buff_ind_cond; // This signal is used to notice the main thread that a reader thread is finished
 pthread_t fifo_read_thread;  
+pthread_t* tuner_ctr_threads; // Persistent workers, used to apply the tuning requests on all the channels in parallel
+int* tuner_ctr_running;       // Set for the channels whose worker could be started, the others are tuned serially
+pthread_mutex_t tuner_ctr_mutex;
+pthread_cond_t tuner_ctr_cond;      // Wakes the workers when a new tuning request is issued
+pthread_cond_t tuner_ctr_done_cond; // Notices the main thread that the last worker has finished
+unsigned int tuner_ctr_request = 0; // Incremented for every issued tuning request
+int tuner_ctr_pending = 0;          // Number of workers still applying the current request
+int tuner_ctr_exit = 0;
 static pthread_barrier_t rtl_init_barrier;
 
 int reconfig_trigger=0, exit_flag=0;
 int noise_source_state = 0; // Noise source state is used also to track the calibration frame status!
-int last_noise_source_state = 0;
+int last_noise_source_state = 0; // Applied state, frames are labelled with this one
+uint64_t noise_source_switch_index = 0;
 int gain_change_flag;
 int *new_gains;
 float *new_fs_corrections;
@@ -87,71 +101,25 @@ int fs_correction_flag, fs_reset_cntr;
 uint32_t new_center_freq;
 int center_freq_change_flag;
 int agc_change_flag = 0;
+/* Bit m enables the mth channel, the payload of the frames holds the enabled channels only.
+ * The reader threads test their bit, the words are updated with atomic stores. */
+struct iq_ch_mask ch_mask;
+struct iq_ch_mask new_ch_mask;
+int ch_mask_change_flag = 0;
 static uint32_t ch_no, buffer_size;
 struct timeval frame_time_stamp;
 static int ctr_channel_index;
 
-int gpio_23 = 0;
-int gpio_24 = 0;
-
-/*
- * This structure stores the configuration parameters, 
- * that are loaded from the ini file
- */ 
-typedef struct
-{
-    int num_ch;
-    char* en_bias_tee_str;    
-    int daq_buffer_size;    
-    int sample_rate;
-    int center_freq;
-    int gain;
-    int en_noise_source_ctr;
-    int ctr_channel_serial_no;
-    int log_level;
-    const char* hw_name;
-    int hw_unit_id;
-    int ioo_type;
-} configuration;
-
-/*
- * Ini configuration parser callback function  
-*/
-static int handler(void* conf_struct, const char* section, const char* name,
-                   const char* value)
+static inline uint64_t monotonic_ns(void)
 {
-    configuration* pconfig = (configuration*) conf_struct;
-
-    #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
-    if (MATCH("hw", "num_ch")) 
-        {pconfig->num_ch = atoi(value);}
-    else if (MATCH("hw","name"))
-        {pconfig->hw_name = strdup(value);}
-    else if (MATCH("hw","unit_id"))
-        {pconfig->hw_unit_id = atoi(value);}
-    else if (MATCH("hw", "ioo_type"))
-        {pconfig->ioo_type = atoi(value);}
-    else if (MATCH("hw","en_bias_tee"))
-        {pconfig->en_bias_tee_str = strdup(value);}
-    else if (MATCH("daq", "daq_buffer_size"))
-        {pconfig->daq_buffer_size = atoi(value);} 
-    else if (MATCH("daq", "sample_rate")) 
-        {pconfig->sample_rate = atoi(value);} 
-    else if (MATCH("daq", "center_freq")) 
-        {pconfig->center_freq = atoi(value);} 
-    else if (MATCH("daq", "gain")) 
-        {pconfig->gain = atoi(value);} 
-    else if (MATCH("daq", "en_noise_source_ctr")) 
-        {pconfig->en_noise_source_ctr = atoi(value);}
-    else if (MATCH("daq", "ctr_channel_serial_no"))
-        {pconfig->ctr_channel_serial_no = atoi(value);}
-    else if (MATCH("daq", "log_level")) 
-        {pconfig->log_level = atoi(value);}
-    else 
-        {return 0;}  /* unknown section/name, error */
-    return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
 }
 
+int gpio_23 = 0;
+int gpio_24 = 0;
+
 void * fifo_read_tf(void* arg)
 /*   
  *  Control FIFO read thread function
@@ -185,12 +153,14 @@ void * fifo_read_tf(void* arg)
     // Initialize message structure
     struct hdaq_im_msg_struct* msg;    
     msg = (struct hdaq_im_msg_struct*) malloc(sizeof(struct hdaq_im_msg_struct));
+    char mask_str[IQ_MAX_CH/4+3];
     
     /* Main thread loop*/
     while(!exit_flag){
         
         // Blocks until command is received
-        zmq_recv (responder, msg, 128, zmq_socket_flags);        
+        memset(msg, 0, sizeof(struct hdaq_im_msg_struct)); // Short messages leave the rest of the parameters zero
+        zmq_recv (responder, msg, sizeof(struct hdaq_im_msg_struct), zmq_socket_flags);        
         log_info("IM Request from: %d",msg->source_module_identifier);
         log_info("Command id: %c",msg->command_identifier);
         
@@ -252,6 +222,14 @@ void * fifo_read_tf(void* arg)
             fs_reset_cntr = 0;
             fs_correction_flag=1;
         }
+        /* Active channel mask */
+        else if (msg->command_identifier == 'm')
+        {
+            /* Little endian bitmap, at least 4 byte long */
+            memcpy(new_ch_mask.w, msg->parameters, sizeof(new_ch_mask.w));
+            ch_mask_change_flag = 1;
+            log_info("Signal 'm': Channel mask request: %s", iq_ch_mask_str(&new_ch_mask, mask_str, sizeof(mask_str)));
+        }
         /* Noise source switch requests */
         else if (msg->command_identifier == 'n')
         {
@@ -272,9 +250,13 @@ void * fifo_read_tf(void* arg)
             log_info("Signal 2: FIFO read thread exiting \n");
             exit_flag = 1;           
         }
-        /* Send out dummy frames while the changes takes effect*/
-        en_dummy_frame = 1; 
-        dummy_frame_cntr = 0;
+        /* Send out dummy frames while the changes takes effect.
+         * Noise source switches are marked in the header with sample precision instead */
+        if (msg->command_identifier != 'n')
+        {
+            en_dummy_frame = 1; 
+            dummy_frame_cntr = 0;
+        }
         zmq_send (responder, "ok", 2, 0);
 
         pthread_cond_signal(&buff_ind_cond);
@@ -284,6 +266,84 @@ void * fifo_read_tf(void* arg)
 }
 
 
+void apply_tuning_requests(struct rtl_rec_struct *rtl_rec)
+/*
+ *  Applies the pending center frequency and gain change requests on a single tuner.
+ *  The request flags are not modified meanwhile, as the main thread holds the
+ *  buffer index mutex until all the channels are tuned.
+ *
+ *  Arguments:
+ *  ----------
+ *       *rtl_rec: Descriptor structure of the current rtl_sdr
+ */
+{
+    int ch_ind = rtl_rec - rtl_receivers;
+
+    /* Center frequency tuning request*/
+    if(center_freq_change_flag == 1)
+    {
+        if (rtlsdr_set_center_freq(rtl_rec->dev, new_center_freq) !=0)
+        {
+            log_error("Failed to set center frequency: %s", strerror(errno));
+        }
+        else
+        {
+            rtl_rec->center_freq = rtlsdr_get_center_freq(rtl_rec->dev);
+            log_info("Center frequency changed at ch: %d, frequency: %d",ch_ind,rtl_rec->center_freq);
+        }
+    }
+    /* Gain change request */
+    if(gain_change_flag==1)
+    {
+        if (rtlsdr_set_tuner_gain(rtl_rec->dev, new_gains[ch_ind]) !=0){
+            log_error("Failed to set gain value: %s", strerror(errno));
+        }
+        else{
+            log_info("Gain change at ch: %d, gain %d",ch_ind, new_gains[ch_ind]);
+            rtl_rec->gain = new_gains[ch_ind];
+            rtl_rec->agc = 0;
+        }
+    }
+}
+
+void * tuner_ctr_tf(void* arg)
+/*
+ *  Tuner control thread function
+ *
+ *  Every channel has a persistent worker that sleeps until the main thread issues
+ *  a tuning request, so the I2C transactions of the separate devices overlap instead
+ *  of adding up and no thread has to be created on a retune.
+ *
+ *  Arguments:
+ *  ----------
+ *       *arg: Descriptor structure of the current rtl_sdr
+ *
+ *  Return values:
+ *  --------------
+ *       NULL
+ */
+{
+    struct rtl_rec_struct *rtl_rec = (struct rtl_rec_struct *) arg;
+    unsigned int served_request = 0;
+
+    pthread_mutex_lock(&tuner_ctr_mutex);
+    while (1)
+    {
+        while (served_request == tuner_ctr_request && !tuner_ctr_exit)
+            {pthread_cond_wait(&tuner_ctr_cond, &tuner_ctr_mutex);}
+        if (tuner_ctr_exit) {break;}
+        served_request = tuner_ctr_request;
+        pthread_mutex_unlock(&tuner_ctr_mutex);
+
+        apply_tuning_requests(rtl_rec);
+
+        pthread_mutex_lock(&tuner_ctr_mutex);
+        if (--tuner_ctr_pending == 0) {pthread_cond_signal(&tuner_ctr_done_cond);}
+    }
+    pthread_mutex_unlock(&tuner_ctr_mutex);
+    return NULL;
+}
+
 void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx)
 /*   
  *                RTL-SDR Async read callback function
@@ -306,15 +366,68 @@ void rtlsdrCallback(unsigned char *buf, uint32_t len, void *ctx)
     struct rtl_rec_struct *rtl_rec = (struct rtl_rec_struct *) ctx;// Set the receiver's structure
   
     int wr_buff_ind = rtl_rec->buff_ind % NUM_BUFF; // Calculate current buffer index in the circular buffer 
-    memcpy(rtl_rec->buffer + buffer_size * wr_buff_ind, buf, len);    
-    
+    /* Masked channels keep streaming to stay aligned with the others, only their samples are not stored */
+    int ch = rtl_rec - rtl_receivers;
+    if ((__atomic_load_n(&ch_mask.w[ch/64], __ATOMIC_RELAXED) >> (ch%64)) & 1)
+        memcpy(rtl_rec->buffer + buffer_size * wr_buff_ind, buf, len);    
+
+    /* Delivery jitter: deviation of the arrival interval from the block duration, at most one block */
+    uint64_t now_ns = monotonic_ns();
+    uint64_t jitter_ns = (uint64_t) (rtl_rec->buff_jitter_ns * BUFF_JITTER_DECAY);
+    if (rtl_rec->buff_ind > 0)
+    {
+        int64_t block_ns = (int64_t) ((len/2) * 1e9 / rtl_rec->sample_rate);
+        int64_t deviation = llabs((int64_t) (now_ns - rtl_rec->buff_time_ns) - block_ns);
+        if (deviation > block_ns) {deviation = block_ns;}
+        if ((uint64_t) deviation > jitter_ns) {jitter_ns = deviation;}
+    }
+
     log_debug("Read at device:%d, buff index:%llu, write index:%d",rtl_rec->dev_ind, rtl_rec->buff_ind, wr_buff_ind);
-    rtl_rec->buff_ind++;
+    /* Seqlock write, a single writer per receiver */
+    unsigned int seq = rtl_rec->buff_seq;
+    __atomic_store_n(&rtl_rec->buff_seq, seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&rtl_rec->buff_time_ns, now_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&rtl_rec->buff_jitter_ns, jitter_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&rtl_rec->buff_ind, rtl_rec->buff_ind+1, __ATOMIC_RELAXED);
+    __atomic_store_n(&rtl_rec->buff_seq, seq+2, __ATOMIC_RELEASE);
 
     /* Signal to the main thread that new data is ready */
     pthread_cond_signal(&buff_ind_cond);
 }
 
+uint64_t current_sample_index(struct rtl_rec_struct *rtl_rec)
+/*
+ * Estimates the index of the first sample digitized after the call. This is an
+ * arrival time estimate, not sample exact: the device is filling the block after
+ * the last delivered one, the time elapsed since its delivery gives the position
+ * within it. The blocks arrive with a varying USB delay, the measured delivery
+ * jitter is added, so the estimate errs towards later samples.
+ */
+{
+    unsigned long long ind;
+    uint64_t time_ns, jitter_ns;
+    unsigned int seq;
+    do
+    {
+        seq = __atomic_load_n(&rtl_rec->buff_seq, __ATOMIC_ACQUIRE);
+        ind = __atomic_load_n(&rtl_rec->buff_ind, __ATOMIC_RELAXED);
+        time_ns = __atomic_load_n(&rtl_rec->buff_time_ns, __ATOMIC_RELAXED);
+        jitter_ns = __atomic_load_n(&rtl_rec->buff_jitter_ns, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&rtl_rec->buff_seq, __ATOMIC_RELAXED));
+
+    uint64_t now_ns = monotonic_ns();
+    uint64_t block_size = buffer_size/2;
+    uint64_t index = (uint64_t) ind * block_size;
+    if (now_ns > time_ns)
+    {
+        uint64_t offset = (uint64_t) ((now_ns - time_ns) * 1e-9 * rtl_rec->sample_rate);
+        index += offset < block_size ? offset : block_size;
+    }
+    return index + (uint64_t) (jitter_ns * 1e-9 * rtl_rec->sample_rate);
+}
+
 void *read_thread_entry(void *arg)
 /*
  *                 Tuner read and configuration thread
@@ -425,7 +538,7 @@ return NULL;
 int main( int argc, char** argv )
 {   
     log_set_level(LOG_TRACE);
-    configuration config;
+    struct daq_config config;
 
     #ifdef USEPIGPIO
     // PIGPIO
@@ -442,28 +555,22 @@ int main( int argc, char** argv )
     #endif
 
     /* Set parameters from the config file*/
-    if (ini_parse(INI_FNAME, handler, &config) < 0) 
+    if (load_daq_config(INI_FNAME, &config) != 0)
     {
         log_fatal("Configuration could not be loaded, exiting ..");
         return -1;
     }   
     buffer_size = config.daq_buffer_size*2;
     ch_no = config.num_ch;
+    iq_ch_mask_all(&ch_mask, ch_no);
     
     log_set_level(config.log_level);
-    /* -> Parse bias tree config */
-    int en_bias_tee[ch_no];
-    char * en_bias_ch_i_str = strtok(config.en_bias_tee_str, ",");    
-    int i = 0;    
-    while( en_bias_ch_i_str != NULL ) 
-    {
-      en_bias_tee[i] = atoi(en_bias_ch_i_str);      
-      en_bias_ch_i_str = strtok(NULL, ",");
-      i++;      
-    }    
+    int* en_bias_tee = config.en_bias_tee; // Missing values are left disabled
     log_info("Config succesfully loaded from %s",INI_FNAME);
     log_info("Channel number: %d", ch_no);
     log_info("Number of IQ samples per channel: %d", buffer_size/2);    
+    perf_ctr_init("rtl_daq", &config);
+    alloc_audit_init("rtl_daq");
     log_info("Starting multichannel coherent RTL-SDR receiver");
     if (config.en_noise_source_ctr == 1)
         log_info("Noise source control: enabled");
@@ -482,10 +589,12 @@ int main( int argc, char** argv )
     }
 
     /* Allocation */    
-    struct iq_header_struct* iq_header = calloc(1, sizeof(struct iq_header_struct));
+    struct iq_header_struct* iq_header = calloc(1, IQ_HEADER_LENGTH + IQ_CH_META_LENGTH(ch_no)); // Header and per-channel metadata
     
     new_gains          = calloc(ch_no, sizeof(*new_gains));
     new_fs_corrections = calloc(ch_no, sizeof(*new_fs_corrections));
+    tuner_ctr_threads  = calloc(ch_no, sizeof(*tuner_ctr_threads));
+    tuner_ctr_running  = calloc(ch_no, sizeof(*tuner_ctr_running));
     
     rtl_receivers = malloc(sizeof(struct rtl_rec_struct)*ch_no);    
     for(int i=0; i<ch_no; i++)
@@ -510,6 +619,9 @@ int main( int argc, char** argv )
     {
         struct rtl_rec_struct *rtl_rec = &rtl_receivers[i];
         rtl_rec->buff_ind=0;        
+        rtl_rec->buff_seq=0;
+        rtl_rec->buff_time_ns=0;
+        rtl_rec->buff_jitter_ns=0;
         rtl_rec->gain = config.gain;
         rtl_rec->agc = 0;
         rtl_rec->center_freq = config.center_freq;
@@ -524,9 +636,10 @@ int main( int argc, char** argv )
     }
     /* Fill up the static fields of the IQ header */    
 	iq_header->sync_word = SYNC_WORD;
-    iq_header->header_version = 7;
+    iq_header->header_version = IQ_HEADER_VERSION;
+    iq_header_init_ch_meta(iq_header, ch_no);
 	strcpy(iq_header->hardware_id, config.hw_name);
-	iq_header->unit_id=config.hw_unit_id;
+	iq_header->unit_id=config.unit_id;
 	iq_header->active_ant_chs=ch_no;
 	iq_header->ioo_type=config.ioo_type;
 	iq_header->rf_center_freq= (uint64_t) config.center_freq;
@@ -543,12 +656,16 @@ int main( int argc, char** argv )
 	iq_header->adc_overdrive_flags=0;
 	for(int m=0;m<ch_no;m++)
 	{
-	    iq_header->if_gains[m]=(uint32_t) config.gain;
+	    iq_header_set_if_gain(iq_header, m, (uint32_t) config.gain);
 	}
 	iq_header->delay_sync_flag=0;
 	iq_header->iq_sync_flag=0;
     iq_header->sync_state=0;
 	iq_header->noise_source_state=0;
+	iq_header->sample_index_step=1; // Scaled by the decimator module
+	iq_header->first_sample_index=0; // Absolute ADC sample index of the block
+	iq_header->noise_source_switch_index=0;
+	iq_header_set_ch_mask(iq_header, &ch_mask);
 
     pthread_mutex_init(&buff_ind_mutex, NULL);
     pthread_cond_init(&buff_ind_cond, NULL);     
@@ -581,6 +698,18 @@ int main( int argc, char** argv )
         //rtlsdr_set_gpio(rtl_rec->dev, en_bias_tee[m] , m+1);
     }
 
+    /* Spawn tuner control workers */
+    pthread_mutex_init(&tuner_ctr_mutex, NULL);
+    pthread_cond_init(&tuner_ctr_cond, NULL);
+    pthread_cond_init(&tuner_ctr_done_cond, NULL);
+    for(int i=0; i<ch_no; i++)
+    {
+        if (pthread_create(&tuner_ctr_threads[i], NULL, tuner_ctr_tf, &rtl_receivers[i]) != 0)
+            {log_warn("Failed to start tuner control thread, ch: %d will be tuned serially", i);}
+        else
+            {tuner_ctr_running[i] = 1;}
+    }
+
     pthread_barrier_init(&rtl_init_barrier, NULL, ch_no);
     /* Spawn reader threads */
     for(int i=0; i<ch_no; i++)
@@ -588,10 +717,13 @@ int main( int argc, char** argv )
         pthread_create(&rtl_receivers[i].async_read_thread, NULL, read_thread_entry, &rtl_receivers[i]);
     }
 
+    stage_notify(STAGE_EV_READY);
     unsigned long long read_buff_ind = 0;
     int data_ready = 1;
     int rd_buff_ind = 1;
-    uint8_t overdrive_flags=0;
+    struct iq_ch_mask overdrive_flags;
+    iq_ch_mask_all(&overdrive_flags, 0);
+    char mask_str[IQ_MAX_CH/4+3];
     struct rtl_rec_struct *rtl_rec;
     /*
      *
@@ -604,6 +736,7 @@ int main( int argc, char** argv )
          * All the reader threads should reach the same index before we could send out the data,
          * and we could coninue the acquisition.
         */        
+        perf_ctr_phase(PERF_PHASE_READ);
         pthread_cond_wait(&buff_ind_cond, &buff_ind_mutex); // TODO: Check- should we acquire mutex first?
         data_ready = 1;
         for(int i=0; i<ch_no; i++)
@@ -630,28 +763,30 @@ int main( int argc, char** argv )
              *---------------------
             */
             // Acquire local time in ms (Unix EPOC) and set timestamp field
+            perf_ctr_phase(PERF_PHASE_CONVERT);
             gettimeofday(&frame_time_stamp, NULL);                    
             uint64_t time_stamp_ms = (uint64_t)(frame_time_stamp.tv_sec) * 1000 +
                                      (uint64_t)(frame_time_stamp.tv_usec) / 1000;
             log_debug("Timestamp: %llu", time_stamp_ms);
             iq_header->time_stamp = time_stamp_ms;
             iq_header->daq_block_index = (uint32_t) read_buff_ind;
+            iq_header->first_sample_index = (uint64_t) read_buff_ind * (buffer_size/2);
+            iq_header_set_ch_mask(iq_header, &ch_mask);
+            iq_header->active_ant_chs = iq_ch_mask_cnt(&ch_mask);
             for(int i=0; i<ch_no; i++)
             {
                 rtl_rec = &rtl_receivers[i];                
                 // Set center frequncy value
                 iq_header->rf_center_freq = (uint64_t) rtl_rec->center_freq;                
                 // Set gain value                
-                iq_header->if_gains[i] = (uint32_t) rtl_rec->gain;                
+                iq_header_set_if_gain(iq_header, i, (uint32_t) rtl_rec->gain);
                 // Check overdrive
-                for(int n=0; n<buffer_size; n++)
-                {
-                    if( *(rtl_rec->buffer+buffer_size*rd_buff_ind + n) == 255)
-                        overdrive_flags |= 1<<i;
-                }
+                if (iq_ch_mask_test(&ch_mask, i) && hdaq_u8_max(rtl_rec->buffer+buffer_size*rd_buff_ind, buffer_size) == 255)
+                    iq_ch_mask_set(&overdrive_flags, i);
             }             
-            iq_header->adc_overdrive_flags = (uint32_t) overdrive_flags;
-            iq_header->noise_source_state = (uint32_t) noise_source_state;
+            iq_header_set_overdrive(iq_header, &overdrive_flags);
+            iq_header->noise_source_state = (uint32_t) last_noise_source_state;
+            iq_header->noise_source_switch_index = noise_source_switch_index;
             // Set frame type in the header
             if(en_dummy_frame)
             {
@@ -663,7 +798,7 @@ int main( int argc, char** argv )
             {
                 iq_header->cpi_length= (uint32_t) config.daq_buffer_size;
                 iq_header->data_type=1;
-                if (noise_source_state ==1) // Calibration frame
+                if (last_noise_source_state ==1) // Calibration frame
                 {
                     iq_header->frame_type=FRAME_TYPE_CAL;
                 }
@@ -673,7 +808,8 @@ int main( int argc, char** argv )
                 }
             }
             /* Sending IQ header */
-            fwrite(iq_header, sizeof(struct iq_header_struct), 1, stdout);   
+            perf_ctr_phase(PERF_PHASE_WRITE);
+            fwrite(iq_header, iq_header_payload_offset(iq_header), 1, stdout);   
             
             /*
             *-------------------
@@ -684,18 +820,20 @@ int main( int argc, char** argv )
             /* Sending out the so far acquired data */            
             if(en_dummy_frame == 0) // DATA or CAL frame
             {            
+                rd_buff_ind = read_buff_ind % NUM_BUFF;
                 for(int i=0; i<ch_no; i++)
                 {                
+                    if (!iq_ch_mask_test(&ch_mask, i)) continue;
                     rtl_rec = &rtl_receivers[i];
-                    rd_buff_ind = read_buff_ind % NUM_BUFF;                                              
                     fwrite(rtl_rec->buffer + buffer_size * rd_buff_ind, 1, buffer_size, stdout);                
                 }
             }
-            if(overdrive_flags !=0)
-                log_warn("Overdrive detected, flags: 0x%02X", overdrive_flags);
+            if(iq_ch_mask_cnt(&overdrive_flags) != 0)
+                log_warn("Overdrive detected, flags: %s", iq_ch_mask_str(&overdrive_flags, mask_str, sizeof(mask_str)));
 
             fflush(stdout);
-            overdrive_flags=0;
+            if (iq_header->frame_type != FRAME_TYPE_DUMMY) {stage_notify(STAGE_EV_FIRST_FRAME);}
+            iq_ch_mask_all(&overdrive_flags, 0);
             read_buff_ind ++;
             if (en_dummy_frame)
             {
@@ -710,6 +848,7 @@ int main( int argc, char** argv )
             *-------------------
             */
 
+            perf_ctr_phase(PERF_PHASE_SIGNAL);
             /* We need to reconfigure the tuner, so the async read must be stopped*/
             // This feature is deprecated !!!
             if(reconfig_trigger==1)
@@ -723,41 +862,41 @@ int main( int argc, char** argv )
                 }
                 reconfig_trigger=0;
             }
-            /* Center frequency tuning request*/
-            if(center_freq_change_flag == 1)
+            /* Center frequency tuning and gain change requests */
+            if(center_freq_change_flag == 1 || gain_change_flag == 1)
             {
+                struct timeval tune_start, tune_end;
+                gettimeofday(&tune_start, NULL);
+                pthread_mutex_lock(&tuner_ctr_mutex);
+                tuner_ctr_pending = 0;
+                for( int i=0; i<ch_no; i++) {tuner_ctr_pending += tuner_ctr_running[i];}
+                tuner_ctr_request++;
+                pthread_cond_broadcast(&tuner_ctr_cond);
+                pthread_mutex_unlock(&tuner_ctr_mutex);
                 for( int i=0; i<ch_no; i++)
                 {
-                    rtl_rec = &rtl_receivers[i];         
-                    if (rtlsdr_set_center_freq(rtl_rec->dev, new_center_freq) !=0)
-                    {
-                        log_error("Failed to set center frequency: %s", strerror(errno));
-                    }                    
-                    else
-                    {
-                        rtl_rec->center_freq = rtlsdr_get_center_freq(rtl_rec->dev);
-                        log_info("Center frequency changed at ch: %d, frequency: %d",i,rtl_rec->center_freq);
-                    }
+                    if (!tuner_ctr_running[i]) {apply_tuning_requests(&rtl_receivers[i]);}
                 }
+                pthread_mutex_lock(&tuner_ctr_mutex);
+                while (tuner_ctr_pending > 0) {pthread_cond_wait(&tuner_ctr_done_cond, &tuner_ctr_mutex);}
+                pthread_mutex_unlock(&tuner_ctr_mutex);
+                gettimeofday(&tune_end, NULL);
+                log_info("Tuning completed in %.1f ms", (tune_end.tv_sec - tune_start.tv_sec)*1000.0 +
+                                                        (tune_end.tv_usec - tune_start.tv_usec)/1000.0);
                 center_freq_change_flag=0;
+                gain_change_flag=0;
             }
-            
-            /* Gain change request */
-            if(gain_change_flag==1)
+            /* Active channel mask change request, the dummy frames cover the transition */
+            if (ch_mask_change_flag == 1)
             {
-                for( int i=0; i<ch_no; i++)
+                if (iq_ch_mask_cnt(&new_ch_mask) == 0 || !iq_ch_mask_within(&new_ch_mask, ch_no))
+                    {log_error("Invalid channel mask: %s, channel number: %d", iq_ch_mask_str(&new_ch_mask, mask_str, sizeof(mask_str)), ch_no);}
+                else
                 {
-                    rtl_rec = &rtl_receivers[i];
-                    if (rtlsdr_set_tuner_gain(rtl_rec->dev, new_gains[i]) !=0){
-                        log_error("Failed to set gain value: %s", strerror(errno));
-                    }
-                    else{
-                        log_info("Gain change at ch: %d, gain %d",i, new_gains[i]);
-                        rtl_rec->gain = new_gains[i];
-                        rtl_rec->agc = 0;
-                    }
+                    for (int i = 0; i < IQ_CH_MASK_WORDS; i++) {__atomic_store_n(&ch_mask.w[i], new_ch_mask.w[i], __ATOMIC_RELAXED);}
+                    log_info("Active channel mask: %s, channels: %d", iq_ch_mask_str(&ch_mask, mask_str, sizeof(mask_str)), iq_ch_mask_cnt(&ch_mask));
                 }
-                gain_change_flag=0;
+                ch_mask_change_flag = 0;
             }
             /* Enable AGC request */
             if (agc_change_flag == 1)
@@ -860,7 +999,15 @@ int main( int argc, char** argv )
                 }
                 */
             }
+            if (last_noise_source_state != noise_source_state)
+            {
+                /* The following frames are labelled with the new state, the rebuffer drops their samples preceding the switch */
+                noise_source_switch_index = current_sample_index(&rtl_receivers[ctr_channel_index]);
+                log_debug("Noise source switch at sample: %"PRIu64, noise_source_switch_index);
+            }
             last_noise_source_state = noise_source_state;
+            perf_ctr_frame_end();
+            alloc_audit_frame_end();
         }
     } 
     log_info("Exiting..");  
@@ -884,8 +1031,17 @@ int main( int argc, char** argv )
         fprintf(stderr, "[ INFO ] Device closed with id:%d\n",i);
         */
     }
+    pthread_mutex_lock(&tuner_ctr_mutex);
+    tuner_ctr_exit = 1;
+    pthread_cond_broadcast(&tuner_ctr_cond);
+    pthread_mutex_unlock(&tuner_ctr_mutex);
+    for(int i=0; i<ch_no; i++)
+    {
+        if (tuner_ctr_running[i]) {pthread_join(tuner_ctr_threads[i], NULL);}
+    }
     pthread_mutex_unlock(&buff_ind_mutex);
     pthread_join(fifo_read_thread, NULL);
+    perf_ctr_close();
     log_info("All the resources are free now");
     free(rtl_receivers);
 
@@ -894,6 +1050,6 @@ int main( int argc, char** argv )
     gpioTerminate();
     #endif
 
-    return 0;
+    return alloc_audit_report();
 }
 
@@ -27,7 +27,9 @@
 #include <pthread.h>
 #include <rtl-sdr.h>
 #include <stdint.h>
+#include <time.h>
 #include "log.h"
+#include "iq_header.h"
 
 
 #define ERR_IQFRAME_WRITE     10 
@@ -45,8 +47,6 @@
 #define CHK_CTR_READ(r, e) if(r != e)     {exit_flag = ERR_CTR_THREAD_READ;}
 
 
-#define MAX_IQFRAME_PAYLOAD_SIZE 8388608 // 2^23[sample] per channel
-//Should be greather than the cpi_size in the daq_chain_config.ini
 void error_code_log(int exit_flag)
 /*
  * Dump out error codes
@@ -77,11 +77,12 @@ void error_code_log(int exit_flag)
 }
 
 // HeIMDALL DAQ inter-modul message structure
+// Messages are 128 byte long, the per-channel ones of more than 31 channels are longer
+#define IM_MSG_PARAM_SIZE (IQ_MAX_CH*4)
 struct hdaq_im_msg_struct { 
-    // Total length: 128 byte
     uint8_t source_module_identifier;
     char command_identifier;
-    uint8_t parameters[126];
+    uint8_t parameters[IM_MSG_PARAM_SIZE];
 };
 
 struct rtl_rec_struct {
@@ -89,6 +90,10 @@ struct rtl_rec_struct {
     rtlsdr_dev_t *dev;
     uint8_t *buffer;   
     unsigned long long buff_ind;
+    /* Written by the read callback, current_sample_index reads them as one consistent set */
+    unsigned int buff_seq;     // Sequence counter of the set, odd while it is being updated
+    uint64_t buff_time_ns;     // Arrival time of the last block (CLOCK_MONOTONIC)
+    uint64_t buff_jitter_ns;   // Peak deviation of the block arrival intervals, decaying
     pthread_t async_read_thread;        
     uint32_t center_freq, sample_rate;
 };
@@ -0,0 +1,716 @@
+/*
+ *
+ * Description :
+ * Emulated librtlsdr, virtual RTL-SDR dongles for hardware-free testing of rtl_daq
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The library implements the rtl-sdr.h API (with the KrakenSDR extensions used
+ * by rtl_daq), so it can be linked instead of the real librtlsdr or preloaded
+ * into a dynamically linked rtl_daq.out (LD_PRELOAD / LD_LIBRARY_PATH). It
+ * presents virtual dongles with the serial numbers 1000+i, the asynchronous
+ * reads deliver the blocks at the configured sample rate.
+ *
+ * Every channel receives a common signal with its own delay and phase shift
+ * plus independent receiver noise:
+ *  - With the noise source off, the common signal is an optional CW tone at a
+ *    fixed RF frequency, it moves with the center frequency of the tuner.
+ *  - With the noise source on (bias tee GPIO 0 of any of the devices, as done
+ *    by rtl_daq on the control channel), it is the correlated noise of the
+ *    internal noise source. The switch takes effect at the sample that is
+ *    being digitized when the request arrives.
+ * The levels follow the test data synthesizer: 0 dB is the full scale of the
+ * ADC at the maximum tuner gain (49.6 dB), the tuner gain scales all the
+ * components and the samples are clipped at the full scale.
+ *
+ * The emulation is parametrized with environment variables, the per channel
+ * values are comma separated lists (missing values are zero):
+ *  HDAQ_EMU_DEVICES      : Number of the virtual dongles (default: 5)
+ *  HDAQ_EMU_DELAYS       : Sample delays of the channels
+ *  HDAQ_EMU_PHASES       : Phase shifts of the channels [deg]
+ *  HDAQ_EMU_DRIFTS       : Sample clock offsets of the channels [ppm]. The
+ *                          sampling frequency corrections (fs-correction and
+ *                          frequency correction) are subtracted from them, the
+ *                          remainder accumulates as sample slips.
+ *  HDAQ_EMU_NOISE        : Power of the receiver noise [dB] (default: -20)
+ *  HDAQ_EMU_NOISE_SOURCE : Power of the noise source [dB] (default: -23)
+ *  HDAQ_EMU_SIGNAL       : RF frequency [Hz] and power [dB] of the CW tone,
+ *                          e.g.: 700100000,-10 (default: none)
+ *  HDAQ_EMU_RATE         : Speed relative to real time (default: 1), 0 delivers
+ *                          the blocks as fast as they are consumed
+ *  HDAQ_EMU_TUNE_US      : Duration of the tuning and gain setting calls [us],
+ *                          emulates the I2C transactions (default: 0)
+ *
+ * The signals are periodic with EMU_PERIOD samples: the per channel tables are
+ * computed when the tuning or the gain changes, the blocks are copied out of
+ * them, so the library costs little more than a memcpy per block.
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+#include "rtl-sdr.h"
+
+#define EMU_PERIOD          (1<<18) // Period of the emulated signals [sample]
+#define EMU_DEFAULT_DEVICES 5
+#define EMU_MAX_GPIO        8
+#define EMU_XTAL_FREQ       28800000
+#define EMU_FULL_GAIN       496     // Tuner gain of the 0 dB reference level [tenth dB]
+#define EMU_AGC_LEVEL       0.25    // RMS level kept by the AGC
+#define EMU_DEF_BUF_NUM     15
+#define EMU_DEF_BUF_LEN     (16*32*512)
+#define EMU_SLEEP_SLICE_NS  50000000 // Cancel requests are checked at least this often
+
+/* Gain steps of the R820T tuner [tenth dB] */
+static const int tuner_gains[] = {0, 9, 14, 27, 37, 77, 87, 125, 144, 157, 166, 197, 207, 229, 254,
+                                  280, 297, 328, 338, 364, 372, 386, 402, 421, 434, 439, 445, 480, 496};
+#define TUNER_GAIN_CNT ((int)(sizeof(tuner_gains)/sizeof(tuner_gains[0])))
+
+struct rtlsdr_dev
+{
+    uint32_t index;
+    char serial[16];
+    pthread_mutex_t lock;
+
+    /* Tuner settings */
+    uint32_t center_freq, sample_rate;
+    int gain, manual_gain, freq_corr, testmode;
+    float fs_corr;
+    int gpio[EMU_MAX_GPIO];
+
+    /* Emulated hardware */
+    int delay;
+    float phase, drift;
+    float* noise;      // Receiver noise, complex float, unit power
+    uint8_t* table[2]; // Output samples with the noise source off/on
+    int dirty;         // The tables must be recomputed
+
+    /* Stream state */
+    uint64_t sample_cntr;
+    double slip;       // Accumulated sample slip caused by the clock offset
+    uint8_t test_cntr;
+    struct timespec start; // Time of the start_index-th sample
+    uint64_t start_index;
+    int ns_state, ns_next, ns_gen;
+    uint64_t ns_switch_index;
+    int streaming;     // The stream clock is running
+    volatile int cancel;
+};
+
+/* The noise source feeds all the channels */
+static struct
+{
+    pthread_mutex_t lock;
+    int state, gen;
+    struct timespec switch_time;
+} noise_source = {PTHREAD_MUTEX_INITIALIZER, 0, 0, {0, 0}};
+
+static float* noise_source_samples;
+static pthread_once_t noise_source_once = PTHREAD_ONCE_INIT;
+
+/*
+ * -------------------------
+ *  Emulation parameters
+ * -------------------------
+ */
+static double env_double(const char* name, double def)
+{
+    const char* value = getenv(name);
+    return (value != NULL && *value) ? atof(value) : def;
+}
+
+static double env_list_item(const char* name, uint32_t index)
+/*
+ * Returns the index-th value of a comma separated list, 0 when it is missing
+ */
+{
+    const char* value = getenv(name);
+    if (value == NULL) {return 0;}
+    for (uint32_t i = 0; i < index; i++)
+    {
+        value = strchr(value, ',');
+        if (value == NULL) {return 0;}
+        value++;
+    }
+    return atof(value);
+}
+
+static uint32_t device_count(void)
+{
+    double count = env_double("HDAQ_EMU_DEVICES", EMU_DEFAULT_DEVICES);
+    return count > 0 ? (uint32_t) count : 0;
+}
+
+static inline double db_to_amplitude(double db)
+{
+    return pow(10, db/20);
+}
+
+/*
+ * -------------------------
+ *  Signal generation
+ * -------------------------
+ */
+static uint64_t next_random(uint64_t* state)
+{
+    /* xorshift64* */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void gen_noise(float* samples, size_t n, uint64_t seed)
+/*
+ * Complex white Gaussian noise with unit power (Box-Muller)
+ */
+{
+    uint64_t state = seed ? seed : 1;
+    for (size_t k = 0; k < n; k++)
+    {
+        double u1 = ((next_random(&state) >> 11) + 1.0) * (1.0/9007199254740993.0);
+        double u2 = (next_random(&state) >> 11) * (1.0/9007199254740992.0);
+        double r = sqrt(-log(u1));
+        samples[2*k]   = (float) (r*cos(2*M_PI*u2));
+        samples[2*k+1] = (float) (r*sin(2*M_PI*u2));
+    }
+}
+
+static void init_noise_source(void)
+{
+    noise_source_samples = malloc(EMU_PERIOD*2*sizeof(float));
+    if (noise_source_samples != NULL) {gen_noise(noise_source_samples, EMU_PERIOD, 0x4e6f697365ULL);}
+}
+
+static inline uint8_t quantize(double x)
+{
+    double v = 127.5 + 127.5*x;
+    if (v <= 0) {return 0;}
+    if (v >= 255) {return 255;}
+    return (uint8_t) lrint(v);
+}
+
+static void update_tables(rtlsdr_dev_t* dev)
+/*
+ * Computes the output samples of both noise source states with the current
+ * tuning and gain. The delay is applied when the samples are read out.
+ */
+{
+    double gain_db = (dev->gain - EMU_FULL_GAIN)/10.0;
+    double noise_amp = db_to_amplitude(env_double("HDAQ_EMU_NOISE", -20));
+    double ns_amp = db_to_amplitude(env_double("HDAQ_EMU_NOISE_SOURCE", -23));
+
+    /* The tone is placed on the closest frequency that is periodic in the table */
+    double sig_amp = 0, sig_cycles = 0;
+    const char* signal = getenv("HDAQ_EMU_SIGNAL");
+    if (signal != NULL && strchr(signal, ',') != NULL && dev->sample_rate)
+    {
+        double offset = atof(signal) - (double) dev->center_freq;
+        if (fabs(offset) < dev->sample_rate/2.0)
+        {
+            sig_amp = db_to_amplitude(atof(strchr(signal, ',')+1));
+            sig_cycles = round(offset/dev->sample_rate*EMU_PERIOD);
+        }
+    }
+
+    for (int state = 0; state < 2; state++)
+    {
+        double common_amp = state ? ns_amp : sig_amp;
+        double scale = db_to_amplitude(gain_db);
+        if (!dev->manual_gain) // AGC
+            {scale = EMU_AGC_LEVEL/sqrt(noise_amp*noise_amp + common_amp*common_amp);}
+        double rot_i = common_amp*scale*cos(dev->phase*M_PI/180);
+        double rot_q = common_amp*scale*sin(dev->phase*M_PI/180);
+        double rx_noise_amp = noise_amp*scale;
+
+        uint8_t* table = dev->table[state];
+        for (size_t k = 0; k < EMU_PERIOD; k++)
+        {
+            double c_i = 0, c_q = 0;
+            if (state)
+            {
+                c_i = noise_source_samples[2*k];
+                c_q = noise_source_samples[2*k+1];
+            }
+            else if (sig_amp != 0)
+            {
+                double arg = 2*M_PI*fmod(sig_cycles*k, EMU_PERIOD)/EMU_PERIOD;
+                c_i = cos(arg);
+                c_q = sin(arg);
+            }
+            table[2*k]   = quantize(c_i*rot_i - c_q*rot_q + dev->noise[2*k]*rx_noise_amp);
+            table[2*k+1] = quantize(c_i*rot_q + c_q*rot_i + dev->noise[2*k+1]*rx_noise_amp);
+        }
+    }
+    dev->dirty = 0;
+}
+
+static double elapsed_since(const struct timespec* start, const struct timespec* now)
+{
+    return (now->tv_sec - start->tv_sec) + (now->tv_nsec - start->tv_nsec)*1e-9;
+}
+
+static int wait_block_end(rtlsdr_dev_t* dev, uint64_t end_index)
+/*
+ * Waits until the last sample of the block is digitized. Returns -1 when the
+ * asynchronous read is cancelled in the meantime.
+ */
+{
+    double rate = env_double("HDAQ_EMU_RATE", 1);
+    if (rate <= 0 || dev->sample_rate == 0) {return dev->cancel ? -1 : 0;}
+
+    double end = (end_index - dev->start_index)/(dev->sample_rate*rate);
+    struct timespec deadline = dev->start;
+    deadline.tv_sec += (time_t) end;
+    deadline.tv_nsec += (long) ((end - (time_t) end)*1e9);
+    if (deadline.tv_nsec >= 1000000000) {deadline.tv_sec++; deadline.tv_nsec -= 1000000000;}
+    while (!dev->cancel)
+    {
+        struct timespec now, slice;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double remaining = elapsed_since(&now, &deadline);
+        if (remaining <= 0) {return 0;}
+        slice = deadline;
+        if (remaining > EMU_SLEEP_SLICE_NS*1e-9)
+        {
+            slice = now;
+            slice.tv_nsec += EMU_SLEEP_SLICE_NS;
+            if (slice.tv_nsec >= 1000000000) {slice.tv_sec++; slice.tv_nsec -= 1000000000;}
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slice, NULL);
+    }
+    return -1;
+}
+
+static void copy_samples(rtlsdr_dev_t* dev, uint8_t* buf, uint64_t first, size_t n, int state)
+{
+    int64_t offset = dev->delay + (int64_t) floor(dev->slip);
+    uint64_t index = (uint64_t) (((int64_t) (first % EMU_PERIOD) - offset % EMU_PERIOD + 2*EMU_PERIOD) % EMU_PERIOD);
+    while (n)
+    {
+        size_t chunk = EMU_PERIOD - index < n ? EMU_PERIOD - index : n;
+        memcpy(buf, dev->table[state] + 2*index, 2*chunk);
+        buf += 2*chunk;
+        n -= chunk;
+        index = 0;
+    }
+}
+
+static void fill_block(rtlsdr_dev_t* dev, uint8_t* buf, uint32_t len)
+/*
+ * Produces the next len bytes of the sample stream
+ */
+{
+    size_t n = len/2;
+    uint64_t first = dev->sample_cntr;
+    pthread_mutex_lock(&dev->lock);
+
+    if (dev->testmode)
+    {
+        /* 8 bit counter, as the test mode of the RTL2832U */
+        for (uint32_t i = 0; i < len; i++) {buf[i] = dev->test_cntr++;}
+        dev->sample_cntr += n;
+        pthread_mutex_unlock(&dev->lock);
+        return;
+    }
+    if (dev->dirty) {update_tables(dev);}
+
+    /* Pick up the last noise source switch */
+    pthread_mutex_lock(&noise_source.lock);
+    if (dev->ns_gen != noise_source.gen)
+    {
+        double rate = env_double("HDAQ_EMU_RATE", 1);
+        double at = dev->start_index + elapsed_since(&dev->start, &noise_source.switch_time)*dev->sample_rate*rate;
+        dev->ns_next = noise_source.state;
+        dev->ns_switch_index = (rate > 0 && at > first) ? (uint64_t) at : first;
+        dev->ns_gen = noise_source.gen;
+    }
+    pthread_mutex_unlock(&noise_source.lock);
+
+    size_t head = 0;
+    if (dev->ns_next != dev->ns_state)
+    {
+        head = dev->ns_switch_index > first ? dev->ns_switch_index - first : 0;
+        if (head >= n) {head = n;}
+        else
+        {
+            copy_samples(dev, buf, first, head, dev->ns_state);
+            dev->ns_state = dev->ns_next;
+        }
+    }
+    copy_samples(dev, buf + 2*head, first + head, n - head, dev->ns_state);
+    if (len % 2) {buf[len-1] = 127;}
+
+    /* The clock offset takes effect at the block boundaries */
+    dev->slip += n*(dev->drift - dev->fs_corr - dev->freq_corr)*1e-6;
+    dev->sample_cntr += n;
+    pthread_mutex_unlock(&dev->lock);
+}
+
+static void start_stream_clock(rtlsdr_dev_t* dev)
+/*
+ * The blocks are paced from the current sample on
+ */
+{
+    clock_gettime(CLOCK_MONOTONIC, &dev->start);
+    dev->start_index = dev->sample_cntr;
+    dev->streaming = 1;
+}
+
+static void tuner_latency(void)
+{
+    double tune_us = env_double("HDAQ_EMU_TUNE_US", 0);
+    if (tune_us > 0) {usleep((useconds_t) tune_us);}
+}
+
+/*
+ * -------------------------
+ *  Device enumeration
+ * -------------------------
+ */
+uint32_t rtlsdr_get_device_count(void)
+{
+    return device_count();
+}
+
+const char* rtlsdr_get_device_name(uint32_t index)
+{
+    return index < device_count() ? "Generic RTL2832U OEM" : "";
+}
+
+int rtlsdr_get_device_usb_strings(uint32_t index, char* manufact, char* product, char* serial)
+{
+    if (index >= device_count()) {return -2;}
+    if (manufact) {strcpy(manufact, "Realtek");}
+    if (product) {strcpy(product, "RTL2838UHIDIR");}
+    if (serial) {sprintf(serial, "%u", 1000+index);}
+    return 0;
+}
+
+int rtlsdr_get_index_by_serial(const char* serial)
+{
+    if (serial == NULL) {return -1;}
+    uint32_t count = device_count();
+    if (count == 0) {return -2;}
+    char dev_serial[16];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sprintf(dev_serial, "%u", 1000+i);
+        if (strcmp(serial, dev_serial) == 0) {return (int) i;}
+    }
+    return -3;
+}
+
+int rtlsdr_open(rtlsdr_dev_t** out_dev, uint32_t index)
+{
+    if (out_dev == NULL || index >= device_count()) {return -1;}
+    pthread_once(&noise_source_once, init_noise_source);
+    rtlsdr_dev_t* dev = calloc(1, sizeof(rtlsdr_dev_t));
+    if (dev == NULL || noise_source_samples == NULL) {free(dev); return -ENOMEM;}
+
+    dev->noise = malloc(EMU_PERIOD*2*sizeof(float));
+    dev->table[0] = malloc(EMU_PERIOD*2);
+    dev->table[1] = malloc(EMU_PERIOD*2);
+    if (dev->noise == NULL || dev->table[0] == NULL || dev->table[1] == NULL)
+    {
+        free(dev->noise); free(dev->table[0]); free(dev->table[1]); free(dev);
+        return -ENOMEM;
+    }
+    dev->index = index;
+    sprintf(dev->serial, "%u", 1000+index);
+    pthread_mutex_init(&dev->lock, NULL);
+    dev->center_freq = 100000000;
+    dev->sample_rate = 2048000;
+    dev->delay = (int) env_list_item("HDAQ_EMU_DELAYS", index);
+    dev->phase = (float) env_list_item("HDAQ_EMU_PHASES", index);
+    dev->drift = (float) env_list_item("HDAQ_EMU_DRIFTS", index);
+    gen_noise(dev->noise, EMU_PERIOD, 0x9E3779B97F4A7C15ULL*(index+1));
+    dev->dirty = 1;
+    log_info("Emulated RTL-SDR opened, serial: %s, delay: %d, phase: %.1f deg, drift: %.3f ppm",
+             dev->serial, dev->delay, dev->phase, dev->drift);
+    *out_dev = dev;
+    return 0;
+}
+
+int rtlsdr_close(rtlsdr_dev_t* dev)
+{
+    if (dev == NULL) {return -1;}
+    pthread_mutex_destroy(&dev->lock);
+    free(dev->noise);
+    free(dev->table[0]);
+    free(dev->table[1]);
+    free(dev);
+    return 0;
+}
+
+int rtlsdr_get_usb_strings(rtlsdr_dev_t* dev, char* manufact, char* product, char* serial)
+{
+    if (dev == NULL) {return -1;}
+    return rtlsdr_get_device_usb_strings(dev->index, manufact, product, serial);
+}
+
+/*
+ * -------------------------
+ *  Tuner configuration
+ * -------------------------
+ */
+int rtlsdr_set_xtal_freq(rtlsdr_dev_t* dev, uint32_t rtl_freq, uint32_t tuner_freq)
+{
+    (void) rtl_freq; (void) tuner_freq;
+    return dev == NULL ? -1 : 0;
+}
+
+int rtlsdr_get_xtal_freq(rtlsdr_dev_t* dev, uint32_t* rtl_freq, uint32_t* tuner_freq)
+{
+    if (dev == NULL) {return -1;}
+    if (rtl_freq) {*rtl_freq = EMU_XTAL_FREQ;}
+    if (tuner_freq) {*tuner_freq = EMU_XTAL_FREQ;}
+    return 0;
+}
+
+int rtlsdr_set_center_freq(rtlsdr_dev_t* dev, uint32_t freq)
+{
+    if (dev == NULL) {return -1;}
+    tuner_latency();
+    pthread_mutex_lock(&dev->lock);
+    dev->center_freq = freq;
+    dev->dirty = 1;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+uint32_t rtlsdr_get_center_freq(rtlsdr_dev_t* dev)
+{
+    return dev == NULL ? 0 : dev->center_freq;
+}
+
+int rtlsdr_set_freq_correction(rtlsdr_dev_t* dev, int ppm)
+{
+    if (dev == NULL) {return -1;}
+    if (dev->freq_corr == ppm) {return -2;}
+    dev->freq_corr = ppm;
+    return 0;
+}
+
+int rtlsdr_get_freq_correction(rtlsdr_dev_t* dev)
+{
+    return dev == NULL ? 0 : dev->freq_corr;
+}
+
+int rtlsdr_set_sample_freq_correction_f(rtlsdr_dev_t* dev, float ppm)
+{
+    if (dev == NULL) {return -1;}
+    pthread_mutex_lock(&dev->lock);
+    dev->fs_corr = ppm;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+enum rtlsdr_tuner rtlsdr_get_tuner_type(rtlsdr_dev_t* dev)
+{
+    return dev == NULL ? RTLSDR_TUNER_UNKNOWN : RTLSDR_TUNER_R820T;
+}
+
+int rtlsdr_get_tuner_gains(rtlsdr_dev_t* dev, int* gains)
+{
+    if (dev == NULL) {return -1;}
+    if (gains != NULL) {memcpy(gains, tuner_gains, sizeof(tuner_gains));}
+    return TUNER_GAIN_CNT;
+}
+
+int rtlsdr_set_tuner_gain(rtlsdr_dev_t* dev, int gain)
+/*
+ * The closest gain step is applied, as by the R820T driver
+ */
+{
+    if (dev == NULL) {return -1;}
+    int best = 0;
+    for (int i = 1; i < TUNER_GAIN_CNT; i++)
+    {
+        if (abs(tuner_gains[i] - gain) < abs(tuner_gains[best] - gain)) {best = i;}
+    }
+    tuner_latency();
+    pthread_mutex_lock(&dev->lock);
+    dev->gain = tuner_gains[best];
+    dev->dirty = 1;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+int rtlsdr_get_tuner_gain(rtlsdr_dev_t* dev)
+{
+    return dev == NULL ? 0 : dev->gain;
+}
+
+int rtlsdr_set_tuner_gain_mode(rtlsdr_dev_t* dev, int manual)
+{
+    if (dev == NULL) {return -1;}
+    pthread_mutex_lock(&dev->lock);
+    dev->manual_gain = manual;
+    dev->dirty = 1;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+int rtlsdr_set_sample_rate(rtlsdr_dev_t* dev, uint32_t samp_rate)
+/*
+ * Accepts the same ranges and rounds the rate the same way as the RTL2832U
+ * resampler configuration of librtlsdr
+ */
+{
+    if (dev == NULL) {return -1;}
+    if (samp_rate <= 225000 || samp_rate > 3200000 || (samp_rate > 300000 && samp_rate <= 900000))
+        {return -EINVAL;}
+    uint32_t rsamp_ratio = (uint32_t) ((EMU_XTAL_FREQ * 4194304.0) / samp_rate);
+    rsamp_ratio &= 0x0ffffffc;
+    uint32_t real_rsamp_ratio = rsamp_ratio | ((rsamp_ratio & 0x08000000) << 1);
+    pthread_mutex_lock(&dev->lock);
+    dev->sample_rate = (uint32_t) ((EMU_XTAL_FREQ * 4194304.0) / real_rsamp_ratio);
+    dev->dirty = 1;
+    dev->streaming = 0;
+    pthread_mutex_unlock(&dev->lock);
+    return 0;
+}
+
+uint32_t rtlsdr_get_sample_rate(rtlsdr_dev_t* dev)
+{
+    return dev == NULL ? 0 : dev->sample_rate;
+}
+
+int rtlsdr_set_testmode(rtlsdr_dev_t* dev, int on)
+{
+    if (dev == NULL) {return -1;}
+    dev->testmode = on;
+    return 0;
+}
+
+int rtlsdr_set_agc_mode(rtlsdr_dev_t* dev, int on)
+{
+    (void) on;
+    return dev == NULL ? -1 : 0;
+}
+
+int rtlsdr_set_dithering(rtlsdr_dev_t* dev, int dither)
+{
+    (void) dither;
+    return dev == NULL ? -1 : 0;
+}
+
+int rtlsdr_set_gpio(rtlsdr_dev_t* dev, int value, int gpio)
+{
+    if (dev == NULL || gpio < 0 || gpio >= EMU_MAX_GPIO) {return -1;}
+    dev->gpio[gpio] = value ? 1 : 0;
+    return 0;
+}
+
+int rtlsdr_set_bias_tee_gpio(rtlsdr_dev_t* dev, int gpio, int on)
+/*
+ * GPIO 0 switches the noise source, the other ones power the antenna inputs
+ */
+{
+    if (rtlsdr_set_gpio(dev, on, gpio) != 0) {return -1;}
+    if (gpio == 0)
+    {
+        pthread_mutex_lock(&noise_source.lock);
+        if (noise_source.state != dev->gpio[0])
+        {
+            noise_source.state = dev->gpio[0];
+            noise_source.gen++;
+            clock_gettime(CLOCK_MONOTONIC, &noise_source.switch_time);
+        }
+        pthread_mutex_unlock(&noise_source.lock);
+    }
+    else
+    {
+        log_debug("Emulated RTL-SDR serial: %s, bias tee %d: %s", dev->serial, gpio, on ? "on" : "off");
+    }
+    return 0;
+}
+
+int rtlsdr_set_bias_tee(rtlsdr_dev_t* dev, int on)
+{
+    return rtlsdr_set_bias_tee_gpio(dev, 0, on);
+}
+
+/*
+ * -------------------------
+ *  Streaming
+ * -------------------------
+ */
+int rtlsdr_reset_buffer(rtlsdr_dev_t* dev)
+{
+    return dev == NULL ? -1 : 0;
+}
+
+int rtlsdr_read_sync(rtlsdr_dev_t* dev, void* buf, int len, int* n_read)
+{
+    if (dev == NULL || buf == NULL || len < 0) {return -1;}
+    dev->cancel = 0;
+    if (!dev->streaming) {start_stream_clock(dev);}
+    if (wait_block_end(dev, dev->sample_cntr + len/2) != 0) {return -1;}
+    fill_block(dev, buf, (uint32_t) len);
+    if (n_read) {*n_read = len;}
+    return 0;
+}
+
+int rtlsdr_read_async(rtlsdr_dev_t* dev, rtlsdr_read_async_cb_t cb, void* ctx, uint32_t buf_num, uint32_t buf_len)
+/*
+ * Delivers the blocks from the calling thread until rtlsdr_cancel_async is called.
+ * The samples continue where the previous read stopped, the stream clock is
+ * restarted, so no catch-up burst follows a pause.
+ */
+{
+    if (dev == NULL || cb == NULL) {return -1;}
+    if (buf_num == 0) {buf_num = EMU_DEF_BUF_NUM;}
+    if (buf_len == 0 || buf_len % 512) {buf_len = EMU_DEF_BUF_LEN;}
+
+    uint8_t* buffers = malloc((size_t) buf_num*buf_len);
+    if (buffers == NULL) {return -ENOMEM;}
+    dev->cancel = 0;
+    start_stream_clock(dev);
+    for (uint32_t i = 0; wait_block_end(dev, dev->sample_cntr + buf_len/2) == 0; i = (i+1) % buf_num)
+    {
+        uint8_t* buf = buffers + (size_t) i*buf_len;
+        fill_block(dev, buf, buf_len);
+        cb(buf, buf_len, ctx);
+    }
+    free(buffers);
+    return 0;
+}
+
+int rtlsdr_wait_async(rtlsdr_dev_t* dev, rtlsdr_read_async_cb_t cb, void* ctx)
+{
+    return rtlsdr_read_async(dev, cb, ctx, 0, 0);
+}
+
+int rtlsdr_cancel_async(rtlsdr_dev_t* dev)
+{
+    if (dev == NULL) {return -1;}
+    dev->cancel = 1;
+    return 0;
+}
@@ -24,6 +24,7 @@
  *
  */
 #include <fcntl.h> 
+#include <fcntl.h> 
 #include <sys/shm.h> 
 #include <sys/stat.h> 
 #include <sys/mman.h>
@@ -31,7 +32,13 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <stdint.h>
+#include <string.h>
+#include <signal.h>
 #include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
 #include "sh_mem_util.h"
 #include "log.h"
 
@@ -45,7 +52,22 @@ unsigned char char_a_buff_ready[1]={A_BUFF_READY};
 unsigned char char_b_buff_ready[1]={B_BUFF_READY}; 
 unsigned char char_terminate[1]={TERMINATE}; 
 
-uint8_t signal;
+static uint8_t ctr_signal;
+
+static void producer_disconnected(struct shmem_transfer_struct* sm_buff)
+/*
+ * The consumer has exited, frames are dropped until it re-attaches
+ */
+{
+    if (!sm_buff->connected) {return;}
+    log_warn("Consumer of %s disconnected, dropping frames until it re-attaches", sm_buff->fw_ctr_fifo_name);
+    sm_buff->connected = false;
+    fclose(sm_buff->fw_ctr_fifo);
+    fclose(sm_buff->bw_ctr_fifo);
+    sm_buff->fw_ctr_fifo = NULL;
+    sm_buff->bw_ctr_fifo = NULL;
+    if (sm_buff->state != NULL) {sm_buff->state->consumer_pid = 0;}
+}
 
 void send_ctr_init_ready(struct shmem_transfer_struct* sm_buff)
 {       
@@ -54,45 +76,160 @@ void send_ctr_init_ready(struct shmem_transfer_struct* sm_buff)
 }
 void send_ctr_terminate(struct shmem_transfer_struct* sm_buff)
 {
+    if (!sm_buff->connected) {return;}
     fwrite(char_terminate,1,1,sm_buff->fw_ctr_fifo);
 	fflush(sm_buff->fw_ctr_fifo);
 }
 void send_ctr_buff_ready(struct shmem_transfer_struct* sm_buff, int active_buff_index)
 {
+    if (!sm_buff->connected) {return;}
     sm_buff->buffer_free[active_buff_index] = false;    
     if      (active_buff_index == 0){fwrite(char_a_buff_ready,1,1,sm_buff->fw_ctr_fifo);}
     else if (active_buff_index == 1){fwrite(char_b_buff_ready,1,1,sm_buff->fw_ctr_fifo);}
-    fflush(sm_buff->fw_ctr_fifo); 
+    if (fflush(sm_buff->fw_ctr_fifo) != 0 && errno == EPIPE) {producer_disconnected(sm_buff);}
 
 }
 void send_ctr_buff_free(struct shmem_transfer_struct* sm_buff, int active_buff_index)
 {  
     if      (active_buff_index == 0){fwrite(char_a_buff_ready,1,1,sm_buff->bw_ctr_fifo);}
     else if (active_buff_index == 1){fwrite(char_b_buff_ready,1,1,sm_buff->bw_ctr_fifo);}
-    fflush(sm_buff->bw_ctr_fifo); 
+    fflush(sm_buff->bw_ctr_fifo); // EPIPE is detected on the forward FIFO
+    clearerr(sm_buff->bw_ctr_fifo);
 }
 
 int wait_ctr_init_ready(struct shmem_transfer_struct* sm_buff)
 {    
-    int read_size=fread(&signal, sizeof(signal), 1, sm_buff->fw_ctr_fifo);        
+    int read_size=fread(&ctr_signal, sizeof(ctr_signal), 1, sm_buff->fw_ctr_fifo);        
     CHK_READ(read_size, 1 ,-1)    
-    if(signal == INIT_READY) {return 0;}
+    if(ctr_signal == INIT_READY) {return 0;}
     else {return -2;}
 }
+
+static int open_link_state(struct shmem_transfer_struct* sm_buff)
+/*
+ * Opens (or creates) the <name>_S link state segment.
+ * The name is derived from the name of the A buffer: "decimator_in_A" -> "decimator_in_S"
+ */
+{
+    char name[512];
+    strcpy(name, sm_buff->shared_memory_names[0]);
+    name[strlen(name)-1] = 'S';
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fd < 0) {return -1;}
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < sizeof(struct shmem_link_state) &&
+        ftruncate(fd, sizeof(struct shmem_link_state)) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+    void* ptr = mmap(0, sizeof(struct shmem_link_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {return -1;}
+    sm_buff->state = (struct shmem_link_state*) ptr;
+    if (sm_buff->state->magic != SHMEM_LINK_MAGIC)
+    {
+        memset(sm_buff->state, 0, sizeof(struct shmem_link_state));
+        sm_buff->state->magic = SHMEM_LINK_MAGIC;
+    }
+    return 0;
+}
+
+static int connect_out_fifos(struct shmem_transfer_struct* sm_buff, int fw_fd)
+/*
+ * Completes the producer side handshake on an already opened forward FIFO.
+ * On failure the FIFOs opened here, including fw_fd, are closed, so the attempt can be retried.
+ */
+{
+    /* Open forward control FIFO*/
+    sm_buff->fw_ctr_fifo = fdopen(fw_fd, "w");
+    if (sm_buff->fw_ctr_fifo == NULL)
+    {
+        close(fw_fd);
+        return -4;
+    }
+    setvbuf(sm_buff->fw_ctr_fifo, sm_buff->fw_ctr_fifo_buf, _IOFBF, CTR_FIFO_BUF_SIZE);
+
+    /* Open backward control FIFO*/
+    sm_buff->bw_ctr_fifo= fopen(sm_buff->bw_ctr_fifo_name, "r");
+    if (sm_buff->bw_ctr_fifo == NULL)
+    {
+        fclose(sm_buff->fw_ctr_fifo); // Closes fw_fd as well
+        sm_buff->fw_ctr_fifo = NULL;
+        return -5;
+    }
+    setvbuf(sm_buff->bw_ctr_fifo, sm_buff->bw_ctr_fifo_buf, _IOFBF, CTR_FIFO_BUF_SIZE);
+    if (sm_buff->drop_mode)
+    {
+        int ret= fcntl(fileno(sm_buff->bw_ctr_fifo), F_SETFL, fcntl(fileno(sm_buff->bw_ctr_fifo), F_GETFL) |  O_NONBLOCK);                               
+        if (ret != 0)
+        {
+            fclose(sm_buff->fw_ctr_fifo);
+            fclose(sm_buff->bw_ctr_fifo);
+            sm_buff->fw_ctr_fifo = NULL;
+            sm_buff->bw_ctr_fifo = NULL;
+            return -4;
+        }
+    }
+
+    sm_buff->buffer_free[0] = true;
+    sm_buff->buffer_free[1] = true;
+    sm_buff->connected = true;
+    if (sm_buff->state != NULL)
+    {
+        sm_buff->generation = ++sm_buff->state->generation;
+        sm_buff->state->producer_pid = getpid();
+    }
+    send_ctr_init_ready(sm_buff);
+    return 0;
+}
+
+static int try_reconnect_out(struct shmem_transfer_struct* sm_buff)
+/*
+ * Non-blocking attempt to re-attach a restarted consumer.
+ * Opening the forward FIFO for writing only succeeds when a reader is present.
+ */
+{
+    int fw_fd = open(sm_buff->fw_ctr_fifo_name, O_WRONLY | O_NONBLOCK);
+    if (fw_fd < 0) {return -1;} // ENXIO: No consumer yet
+    fcntl(fw_fd, F_SETFL, fcntl(fw_fd, F_GETFL) & ~O_NONBLOCK);
+    if (connect_out_fifos(sm_buff, fw_fd) != 0)
+    {
+        log_error("Failed to re-attach consumer of %s", sm_buff->fw_ctr_fifo_name);
+        return -1;
+    }
+    log_info("Consumer of %s re-attached, link generation: %u, dropped frames: %d",
+             sm_buff->fw_ctr_fifo_name, sm_buff->generation, sm_buff->dropped_frame_cntr);
+    return 0;
+}
+
 int wait_buff_free(struct shmem_transfer_struct* sm_buff)
 {
+    if (!sm_buff->connected && try_reconnect_out(sm_buff) != 0)
+    {
+        sm_buff->dropped_frame_cntr +=1;
+        return 3;
+    }
     if (sm_buff->buffer_free[0] == true)
         return 0;
     else if (sm_buff->buffer_free[1] == true)
         return 1;    
     else
     { 
-        int read_size=fread(&signal, sizeof(signal), 1, sm_buff->bw_ctr_fifo);
+        int read_size=fread(&ctr_signal, sizeof(ctr_signal), 1, sm_buff->bw_ctr_fifo);
         switch (read_size) 
         { 
-            case 0:  // PIPE empty and errono set EAGAIN
-                if (errno == EAGAIN) 
+            case 0:
+                if (feof(sm_buff->bw_ctr_fifo)) // Pipe closed, the consumer has exited
+                {
+                    producer_disconnected(sm_buff);
+                    sm_buff->dropped_frame_cntr +=1;
+                    return 3;
+                }
+                else if (errno == EAGAIN) // PIPE empty and errono set EAGAIN
                 { 
+                    clearerr(sm_buff->bw_ctr_fifo);
                 	sm_buff->dropped_frame_cntr +=1;
                     if (INGORE_FRAME_DROP_WARNINGS==0)
                         log_warn("Dropping frame.. Total: [%d]",sm_buff->dropped_frame_cntr);
@@ -104,24 +241,20 @@ int wait_buff_free(struct shmem_transfer_struct* sm_buff)
                     return -1;
                 }
                 break;     
-            case EOF:  // EOF, Pipe closed
-                log_error("Unhandled bw fifo close");
-                return -1;
-                break;                    
             case 1:
-                if(signal == A_BUFF_READY)
+                if(ctr_signal == A_BUFF_READY)
                 {
                     sm_buff->buffer_free[0] = true;
                     return 0;
                 }
-                else if(signal == B_BUFF_READY)
+                else if(ctr_signal == B_BUFF_READY)
                 {
                     sm_buff->buffer_free[1] = true;
                     return 1;
                 }
                 else
                 {
-                    log_error("Unidentified control signal: %d", signal);
+                    log_error("Unidentified control signal: %d", ctr_signal);
                     return -1;
                 }        
             break;
@@ -129,12 +262,78 @@ int wait_buff_free(struct shmem_transfer_struct* sm_buff)
     }
     return -2;
 }
+
+static int map_in_buffers(struct shmem_transfer_struct* sm_buff)
+{
+    /* Create the shared memory object */
+    sm_buff->shm_fd[0] = shm_open(sm_buff->shared_memory_names[0], O_RDWR, 0666); 
+    CHK_ZERO(sm_buff->shm_fd[0], -4)
+    sm_buff->shm_fd[1] = shm_open(sm_buff->shared_memory_names[1], O_RDWR, 0666);     
+    CHK_ZERO(sm_buff->shm_fd[1], -4)    
+  
+    /* Memory map the shared memory object */    
+    sm_buff->shm_ptr[0] = mmap(0, sm_buff->shared_memory_size, PROT_READ, MAP_SHARED, sm_buff->shm_fd[0], 0); 
+    CHK_ZERO(sm_buff->shm_ptr[0], -5)
+    sm_buff->shm_ptr[1] = mmap(0, sm_buff->shared_memory_size, PROT_READ, MAP_SHARED, sm_buff->shm_fd[1], 0); 
+    CHK_ZERO(sm_buff->shm_ptr[1], -5)
+    return 0;
+}
+
+static int connect_in_fifos(struct shmem_transfer_struct* sm_buff)
+{
+    /* Open forward control FIFO*/
+    sm_buff->fw_ctr_fifo = fopen(sm_buff->fw_ctr_fifo_name, "r");
+    CHK_ZERO(sm_buff->fw_ctr_fifo, -1)
+    setvbuf(sm_buff->fw_ctr_fifo, sm_buff->fw_ctr_fifo_buf, _IOFBF, CTR_FIFO_BUF_SIZE);
+
+    /* Open backward control FIFO*/
+    sm_buff->bw_ctr_fifo= fopen(sm_buff->bw_ctr_fifo_name, "w");
+    CHK_ZERO(sm_buff->bw_ctr_fifo, -2)
+    setvbuf(sm_buff->bw_ctr_fifo, sm_buff->bw_ctr_fifo_buf, _IOFBF, CTR_FIFO_BUF_SIZE);
+
+    /* Check init ready success on the generator side*/
+    int ret = wait_ctr_init_ready(sm_buff);
+    CHK_SUCC(ret, -3)
+    return 0;
+}
+
+static int reconnect_in(struct shmem_transfer_struct* sm_buff)
+/*
+ * The producer has exited. Waits for its restarted instance, then remaps
+ * the buffers, as the producer may have recreated them.
+ */
+{
+    log_warn("Producer of %s disconnected, waiting for it to re-attach", sm_buff->fw_ctr_fifo_name);
+    fclose(sm_buff->fw_ctr_fifo);
+    fclose(sm_buff->bw_ctr_fifo);
+    munmap(sm_buff->shm_ptr[0], sm_buff->shared_memory_size);
+    munmap(sm_buff->shm_ptr[1], sm_buff->shared_memory_size);
+    close(sm_buff->shm_fd[0]);
+    close(sm_buff->shm_fd[1]);
+
+    int ret = connect_in_fifos(sm_buff);
+    CHK_SUCC(ret, ret)
+    ret = map_in_buffers(sm_buff);
+    CHK_SUCC(ret, ret)
+    if (sm_buff->state != NULL)
+    {
+        sm_buff->generation = sm_buff->state->generation;
+        sm_buff->state->consumer_pid = getpid();
+    }
+    log_info("Producer of %s re-attached, link generation: %u", sm_buff->fw_ctr_fifo_name, sm_buff->generation);
+    return 0;
+}
+
 int wait_buff_ready(struct shmem_transfer_struct* sm_buff)
 {
     uint8_t signal;      
-    CHK_DATA_PIPE(sm_buff->fw_ctr_fifo, -1);
-    int read_size=fread(&signal, sizeof(signal), 1, sm_buff->fw_ctr_fifo);        
-    CHK_READ(read_size, 1 ,-1)          
+    while (1)
+    {
+        int read_size=fread(&signal, sizeof(signal), 1, sm_buff->fw_ctr_fifo);        
+        if (read_size == 1) {break;}
+        CHK_ZERO(feof(sm_buff->fw_ctr_fifo), -1)
+        CHK_SUCC(reconnect_in(sm_buff), -1)
+    }
     if(signal == A_BUFF_READY){return 0;}
     else if(signal == B_BUFF_READY){return 1;}
     else if (signal == TERMINATE){return TERMINATE;}
@@ -142,9 +341,172 @@ int wait_buff_ready(struct shmem_transfer_struct* sm_buff)
     return -2;
 }
 
+/*
+ *-------------------------------------
+ *       NUMA placement
+ *-------------------------------------
+ * The memory policy system calls are used directly (same values as in numaif.h),
+ * so the stages do not depend on libnuma
+ */
+#define NUMA_MPOL_BIND       2
+#define NUMA_MPOL_INTERLEAVE 3
+#define NUMA_MPOL_MF_MOVE    (1<<1)
+#define NUMA_QUERY_BATCH     1024 // Pages queried at once
+
+static int cpu_numa_node(int cpu)
+/*
+ * Returns the node of the CPU, -1 when it is unknown
+ */
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* dir = opendir(path);
+    if (dir == NULL) {return -1;}
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {break;}
+    closedir(dir);
+    return node;
+}
+
+static uint64_t memory_nodes(void)
+/*
+ * Returns the mask of the nodes with memory, e.g.: "0-1,3" -> 0b1011
+ */
+{
+    uint64_t mask = 0;
+    int first, last;
+    char sep;
+    FILE* fd = fopen("/sys/devices/system/node/has_memory", "r");
+    if (fd == NULL) {return 1;} // Kernel without NUMA support
+    while (fscanf(fd, "%d", &first) == 1)
+    {
+        last = first;
+        if (fscanf(fd, "%c", &sep) == 1 && sep == '-')
+        {
+            if (fscanf(fd, "%d", &last) != 1) {break;}
+            if (fscanf(fd, "%c", &sep) != 1) {sep = '\n';}
+        }
+        for (int node = first; node <= last && node < SHMEM_NUMA_MAX_NODES; node++)
+            mask |= 1ull << node;
+        if (sep != ',') {break;}
+    }
+    fclose(fd);
+    return mask ? mask : 1;
+}
+
+static void log_numa_placement(void* ptr, size_t size, const char* name, const char* policy)
+/*
+ * Logs the distribution of the pages over the nodes
+ */
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t page_cnt = (size + page_size - 1) / page_size;
+    size_t node_pages[SHMEM_NUMA_MAX_NODES] = {0};
+    size_t unknown_pages = 0;
+    void* pages[NUMA_QUERY_BATCH];
+    int status[NUMA_QUERY_BATCH];
+    for (size_t p = 0; p < page_cnt; p += NUMA_QUERY_BATCH)
+    {
+        size_t cnt = page_cnt - p < NUMA_QUERY_BATCH ? page_cnt - p : NUMA_QUERY_BATCH;
+        for (size_t i = 0; i < cnt; i++)
+            pages[i] = (uint8_t*) ptr + (p + i) * page_size;
+        if (syscall(SYS_move_pages, 0, cnt, pages, NULL, status, 0) != 0)
+        {
+            log_warn("%s: NUMA policy: %s, page placement can not be queried: %s", name, policy, strerror(errno));
+            return;
+        }
+        for (size_t i = 0; i < cnt; i++)
+        {
+            if (status[i] >= 0 && status[i] < SHMEM_NUMA_MAX_NODES) {node_pages[status[i]]++;}
+            else {unknown_pages++;}
+        }
+    }
+    char report[256] = "";
+    size_t len = 0;
+    for (int node = 0; node < SHMEM_NUMA_MAX_NODES && len < sizeof(report); node++)
+        if (node_pages[node])
+            {len += snprintf(report + len, sizeof(report) - len, " node%d: %.1f%%", node, 100.0 * node_pages[node] / page_cnt);}
+    if (unknown_pages && len < sizeof(report))
+        {snprintf(report + len, sizeof(report) - len, " not present: %.1f%%", 100.0 * unknown_pages / page_cnt);}
+    log_info("%s: NUMA policy: %s, pages:%s", name, policy, report);
+}
+
+int shmem_numa_place(void* ptr, size_t size, const char* name, const char* policy, int producer_cpu, int consumer_cpu)
+/*
+ * Applies the NUMA policy (see sh_mem_util.h) to a shared memory buffer, then
+ * pre-faults and logs its placement. The buffer content is preserved. First
+ * touch buffers (also on fallback) are left alone, their pages are committed
+ * when the producer writes them.
+ *
+ * Return values:
+ * --------------
+ *       0: Policy applied
+ *      -1: Unknown policy
+ *      -2: The policy could not be applied, the buffer is placed by first touch
+ */
+{
+    int ret = 0;
+    int mode = 0;
+    uint64_t nodes = 0;
+    if (policy == NULL || policy[0] == '\0' || strcmp(policy, "first_touch") == 0) {return 0;}
+
+    if (strcmp(policy, "consumer") == 0)
+    {
+        int node = consumer_cpu >= 0 ? cpu_numa_node(consumer_cpu) : -1;
+        if (node >= 0 && node < SHMEM_NUMA_MAX_NODES) {mode = NUMA_MPOL_BIND; nodes = 1ull << node;}
+    }
+    else if (strcmp(policy, "interleave") == 0)
+    {
+        mode = NUMA_MPOL_INTERLEAVE;
+        nodes = memory_nodes();
+    }
+    else if (strcmp(policy, "pinning") == 0)
+    {
+        int cpus[2] = {producer_cpu, consumer_cpu};
+        for (int i = 0; i < 2; i++)
+        {
+            int node = cpus[i] >= 0 ? cpu_numa_node(cpus[i]) : -1;
+            if (node >= 0 && node < SHMEM_NUMA_MAX_NODES) {nodes |= 1ull << node;}
+        }
+        if (nodes) {mode = (nodes & (nodes-1)) ? NUMA_MPOL_INTERLEAVE : NUMA_MPOL_BIND;}
+    }
+    else
+    {
+        log_error("%s: Unknown NUMA policy: %s", name, policy);
+        return -1;
+    }
+
+    if (mode == 0)
+    {
+        log_warn("%s: NUMA policy %s requires pinned stages, the pages are placed by first touch", name, policy);
+        return -2;
+    }
+    unsigned long node_mask = (unsigned long) nodes;
+    if (syscall(SYS_mbind, ptr, size, mode, &node_mask, sizeof(node_mask)*8+1, NUMA_MPOL_MF_MOVE) != 0)
+    {
+        log_warn("%s: NUMA policy %s could not be applied: %s", name, policy, strerror(errno));
+        ret = -2;
+    }
+
+    /* Pre-fault the pages, they are allocated according to the policy */
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page_size)
+    {
+        volatile uint8_t* p = (volatile uint8_t*) ptr + offset;
+        *p = *p;
+    }
+    log_numa_placement(ptr, size, name, policy);
+    return ret;
+}
+
 int init_out_sm_buffer(struct shmem_transfer_struct* sm_buff) 
 {
-    /* Create the shared memory object */
+    /* A consumer may exit at any time, it is handled on the FIFO level */
+    sigaction(SIGPIPE, &(struct sigaction){.sa_handler = SIG_IGN}, NULL);
+
+    /* Create the shared memory object, an already existing one is reused */
     sm_buff->shm_fd[0] = shm_open(sm_buff->shared_memory_names[0], O_CREAT | O_RDWR, 0666); 
     CHK_ZERO(sm_buff->shm_fd[0], -1)
     sm_buff->shm_fd[1] = shm_open(sm_buff->shared_memory_names[1], O_CREAT | O_RDWR, 0666);     
@@ -162,55 +524,34 @@ int init_out_sm_buffer(struct shmem_transfer_struct* sm_buff)
     sm_buff->shm_ptr[1] = mmap(0, sm_buff->shared_memory_size, PROT_WRITE, MAP_SHARED, sm_buff->shm_fd[1], 0); 
     CHK_ZERO(sm_buff->shm_ptr[1], -3)
 
-    /* Open forward control FIFO*/
-    sm_buff->fw_ctr_fifo = fopen(sm_buff->fw_ctr_fifo_name, "w");
-    CHK_ZERO(sm_buff->fw_ctr_fifo, -4);
-
-    /* Open backward control FIFO*/
-    sm_buff->bw_ctr_fifo= fopen(sm_buff->bw_ctr_fifo_name, "r");
-    if (sm_buff->drop_mode)
+    for (int i = 0; i < 2; i++)
     {
-         int ret= fcntl(fileno(sm_buff->bw_ctr_fifo), F_SETFL, fcntl(fileno(sm_buff->bw_ctr_fifo), F_GETFL) |  O_NONBLOCK);                               
-        CHK_SUCC(ret, -4);
+        shmem_numa_place(sm_buff->shm_ptr[i], sm_buff->shared_memory_size, sm_buff->shared_memory_names[i],
+                         sm_buff->numa_policy, sm_buff->numa_producer_cpu, sm_buff->numa_consumer_cpu);
     }
-    
-    CHK_ZERO(sm_buff->bw_ctr_fifo, -5);
 
-    sm_buff->buffer_free[0] = true;
-    sm_buff->buffer_free[1] = true;
-    
+    if (open_link_state(sm_buff) != 0) {log_warn("Link state segment is not available, hot restart disabled");}
     sm_buff->dropped_frame_cntr = 0;
-    
-    send_ctr_init_ready(sm_buff);
 
-    return 0;
+    /* Open forward control FIFO, blocks until the consumer is started*/
+    int fw_fd = open(sm_buff->fw_ctr_fifo_name, O_WRONLY);
+    if (fw_fd < 0) {return -4;}
+    return connect_out_fifos(sm_buff, fw_fd);
 }
 int init_in_sm_buffer(struct shmem_transfer_struct* sm_buff) 
 {
-    /* Open forward control FIFO*/
-    sm_buff->fw_ctr_fifo = fopen(sm_buff->fw_ctr_fifo_name, "r");
-    CHK_ZERO(sm_buff->fw_ctr_fifo, -1)
+    sigaction(SIGPIPE, &(struct sigaction){.sa_handler = SIG_IGN}, NULL);
 
-    /* Open backward control FIFO*/
-    sm_buff->bw_ctr_fifo= fopen(sm_buff->bw_ctr_fifo_name, "w");
-    CHK_ZERO(sm_buff->bw_ctr_fifo, -2)
+    int ret = connect_in_fifos(sm_buff);
+    CHK_SUCC(ret, ret)
+    ret = map_in_buffers(sm_buff);
+    CHK_SUCC(ret, ret)
 
-    /* Check init ready success on the generator side*/
-    int ret = wait_ctr_init_ready(sm_buff);
-    CHK_SUCC(ret, -3)
-
-    /* Create the shared memory object */
-    sm_buff->shm_fd[0] = shm_open(sm_buff->shared_memory_names[0], O_RDWR, 0666); 
-    CHK_ZERO(sm_buff->shm_fd[0], -4)
-    sm_buff->shm_fd[1] = shm_open(sm_buff->shared_memory_names[1], O_RDWR, 0666);     
-    CHK_ZERO(sm_buff->shm_fd[1], -4)    
-  
-    /* Memory map the shared memory object */    
-    sm_buff->shm_ptr[0] = mmap(0, sm_buff->shared_memory_size, PROT_READ, MAP_SHARED, sm_buff->shm_fd[0], 0); 
-    CHK_ZERO(sm_buff->shm_ptr[0], -5)
-    sm_buff->shm_ptr[1] = mmap(0, sm_buff->shared_memory_size, PROT_READ, MAP_SHARED, sm_buff->shm_fd[1], 0); 
-    CHK_ZERO(sm_buff->shm_ptr[1], -5)
-    
+    if (open_link_state(sm_buff) == 0)
+    {
+        sm_buff->generation = sm_buff->state->generation;
+        sm_buff->state->consumer_pid = getpid();
+    }
     sm_buff->dropped_frame_cntr = 0;
     
     return 0;
@@ -223,6 +564,11 @@ int destory_sm_buffer(struct shmem_transfer_struct* sm_buff)
     CHK_SUCC(ret, -1)
     ret = munmap(sm_buff->shm_ptr[1], sm_buff->shared_memory_size);
     CHK_SUCC(ret, -1)
+    if (sm_buff->state != NULL)
+    {
+        munmap(sm_buff->state, sizeof(struct shmem_link_state));
+        sm_buff->state = NULL;
+    }
     
     if( sm_buff->io_type == 0)
     {
@@ -234,10 +580,188 @@ int destory_sm_buffer(struct shmem_transfer_struct* sm_buff)
     }
 
     /* Close forward control FIFO*/
-    fclose(sm_buff->fw_ctr_fifo);
+    if (sm_buff->fw_ctr_fifo != NULL) {fclose(sm_buff->fw_ctr_fifo);}
 
     /* Close backward control FIFO*/
-    fclose(sm_buff->bw_ctr_fifo);
+    if (sm_buff->bw_ctr_fifo != NULL) {fclose(sm_buff->bw_ctr_fifo);}
 
     return 0;
 }
+
+/*
+ *-------------------------------------
+ *    Snapshot link (latest frame)
+ *-------------------------------------
+ */
+size_t shmem_snapshot_struct_size(void)
+{
+    return sizeof(struct shmem_snapshot_struct);
+}
+
+static int map_snapshot(struct shmem_snapshot_struct* sn, int fd, size_t map_size, int prot)
+{
+    void* ptr = mmap(0, map_size, prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {return -3;}
+    sn->map_size = map_size;
+    sn->header = (struct shmem_snapshot_header*) ptr;
+    sn->slot = (uint8_t*) ptr + SHMEM_SNAPSHOT_HEADER_SIZE;
+    return 0;
+}
+
+int init_snapshot_writer(struct shmem_snapshot_struct* sn, const char* name, size_t size)
+/*
+ * Creates the snapshot segment with a frame slot of the given size. An already
+ * existing segment is reused when it is large enough, the consumers that have
+ * mapped it keep on working after a restart of the producer.
+ */
+{
+    memset(sn, 0, sizeof(struct shmem_snapshot_struct));
+    strncpy(sn->shared_memory_name, name, sizeof(sn->shared_memory_name)-1);
+    sn->io_type = 0;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fd < 0) {return -1;}
+    struct stat st;
+    size_t map_size = SHMEM_SNAPSHOT_HEADER_SIZE + size;
+    if (fstat(fd, &st) != 0 || ((size_t) st.st_size < map_size && ftruncate(fd, map_size) != 0))
+    {
+        close(fd);
+        return -2;
+    }
+    if ((size_t) st.st_size > map_size) {map_size = st.st_size;}
+    int ret = map_snapshot(sn, fd, map_size, PROT_READ | PROT_WRITE);
+    CHK_SUCC(ret, ret)
+
+    sn->size = map_size - SHMEM_SNAPSHOT_HEADER_SIZE;
+    struct shmem_snapshot_header* h = sn->header;
+    if (h->magic != SHMEM_SNAPSHOT_MAGIC)
+    {
+        memset(h, 0, sizeof(struct shmem_snapshot_header));
+        h->magic = SHMEM_SNAPSHOT_MAGIC;
+    }
+    if (h->sequence & 1) // A previous producer died while writing, its frame is incomplete
+    {
+        h->frame_cntr = 0;
+        __atomic_store_n(&h->sequence, h->sequence + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&h->size, sn->size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int init_snapshot_reader(struct shmem_snapshot_struct* sn, const char* name)
+{
+    memset(sn, 0, sizeof(struct shmem_snapshot_struct));
+    strncpy(sn->shared_memory_name, name, sizeof(sn->shared_memory_name)-1);
+    sn->io_type = 1;
+
+    int fd = shm_open(name, O_RDONLY, 0666);
+    if (fd < 0) {return -1;}
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size <= SHMEM_SNAPSHOT_HEADER_SIZE)
+    {
+        close(fd);
+        return -2;
+    }
+    int ret = map_snapshot(sn, fd, st.st_size, PROT_READ);
+    CHK_SUCC(ret, ret)
+    if (sn->header->magic != SHMEM_SNAPSHOT_MAGIC)
+    {
+        munmap(sn->header, sn->map_size);
+        return -4;
+    }
+    sn->size = sn->map_size - SHMEM_SNAPSHOT_HEADER_SIZE;
+    return 0;
+}
+
+int destroy_snapshot_buffer(struct shmem_snapshot_struct* sn)
+{
+    if (sn->header == NULL) {return 0;}
+    int ret = munmap(sn->header, sn->map_size);
+    CHK_SUCC(ret, -1)
+    sn->header = NULL;
+    sn->slot = NULL;
+    /* The segment is left in place, the consumers may still map it */
+    return 0;
+}
+
+size_t snapshot_capacity(struct shmem_snapshot_struct* sn)
+{
+    return sn->size;
+}
+
+void* snapshot_slot(struct shmem_snapshot_struct* sn)
+{
+    return sn->slot;
+}
+
+void* snapshot_write_begin(struct shmem_snapshot_struct* sn)
+/*
+ * Opens the frame slot for writing, the frame can be assembled in place. Must
+ * be followed by snapshot_write_commit.
+ */
+{
+    struct shmem_snapshot_header* h = sn->header;
+    __atomic_store_n(&h->sequence, h->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // The odd sequence is visible before any write to the slot
+    return sn->slot;
+}
+
+void snapshot_write_commit(struct shmem_snapshot_struct* sn, size_t length)
+{
+    struct shmem_snapshot_header* h = sn->header;
+    __atomic_store_n(&h->length, length, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->frame_cntr, h->frame_cntr + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sequence, h->sequence + 1, __ATOMIC_RELEASE);
+}
+
+int snapshot_publish(struct shmem_snapshot_struct* sn, const void* frame, size_t length)
+/*
+ * Publishes a copy of the frame as the latest snapshot
+ *
+ * Returns 0 on success, -1 when the frame does not fit into the slot
+ */
+{
+    if (length > sn->size) {return -1;}
+    memcpy(snapshot_write_begin(sn), frame, length);
+    snapshot_write_commit(sn, length);
+    return 0;
+}
+
+long snapshot_read(struct shmem_snapshot_struct* sn, void* buffer, size_t buffer_size, uint64_t* frame_cntr)
+/*
+ * Copies the latest frame into the buffer without ever blocking the producer
+ *
+ * Returns the length of the frame, 0 when no frame has been published yet,
+ * -1 when the frame does not fit into the buffer and -2 when no consistent copy
+ * could be taken because the producer kept on overwriting the slot.
+ */
+{
+    struct shmem_snapshot_header* h = sn->header;
+    for (int i = 0; i < SNAPSHOT_READ_RETRIES; i++)
+    {
+        uint32_t seq = __atomic_load_n(&h->sequence, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            sched_yield();
+            continue;
+        }
+        uint64_t length = __atomic_load_n(&h->length, __ATOMIC_RELAXED);
+        uint64_t cntr = __atomic_load_n(&h->frame_cntr, __ATOMIC_RELAXED);
+        long ret;
+        if (cntr == 0) {ret = 0;}
+        else if (length > buffer_size || length > sn->size) {ret = -1;}
+        else
+        {
+            memcpy(buffer, sn->slot, length);
+            ret = (long) length;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // The copy completes before the sequence is checked again
+        if (__atomic_load_n(&h->sequence, __ATOMIC_RELAXED) == seq)
+        {
+            if (frame_cntr != NULL) {*frame_cntr = cntr;}
+            return ret;
+        }
+    }
+    return -2;
+}
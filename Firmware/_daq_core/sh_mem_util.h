@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #define ERR_FCNTL -20
 
@@ -30,18 +31,43 @@
 #define DELAY_SYNC_IQ_FW_FIFO "_data_control/fw_delay_sync_iq"
 #define DELAY_SYNC_IQ_BW_FIFO "_data_control/bw_delay_sync_iq"
 
+#define DELAY_SYNC_IQ_SNAPSHOT_NAME "delay_sync_iq_L"
+
+#define DELAY_SYNC_HWC_FW_FIFO "_data_control/fw_delay_sync_hwc"
+#define DELAY_SYNC_HWC_BW_FIFO "_data_control/bw_delay_sync_hwc"
+
 //const unsigned char fw_cmd_init_ready[1] = 0x0A;
 #define INIT_READY    10
 #define A_BUFF_READY   1
 #define B_BUFF_READY   2
 #define TERMINATE    255
 
+/*
+*-------------------------------------
+*       Link state (hot restart)
+*-------------------------------------
+* Every link has a third, small shared memory segment (<name>_S) next to the
+* A and B buffers. It outlives the processes on both sides, so a restarted
+* stage can re-attach to a running peer. The producer increments the
+* generation counter on every (re)connection.
+*/
+#define SHMEM_LINK_MAGIC 0x4b4c4448 // "HDLK"
+
+struct shmem_link_state {
+    uint32_t magic;
+    uint32_t generation;
+    int32_t producer_pid;
+    int32_t consumer_pid;
+};
+
 /*
 *-------------------------------------
 *       Shared memory transfer
 *-------------------------------------
 */
 
+#define CTR_FIFO_BUF_SIZE 64
+
 struct shmem_transfer_struct {    
     char shared_memory_names[2][512];
     char fw_ctr_fifo_name[512];
@@ -55,6 +81,69 @@ struct shmem_transfer_struct {
     FILE* bw_ctr_fifo;
     void* shm_ptr[2];
     int shm_fd[2];
+    bool connected; // Producer side: false while the consumer is being restarted
+    uint32_t generation;
+    struct shmem_link_state* state;
+    /* NUMA placement of the buffers, set by the producer before the initialization */
+    char numa_policy[64]; // Empty: first touch
+    int numa_producer_cpu;
+    int numa_consumer_cpu;
+    /* Buffers of the control FIFO streams, otherwise stdio allocates them at the first transfer */
+    char fw_ctr_fifo_buf[CTR_FIFO_BUF_SIZE];
+    char bw_ctr_fifo_buf[CTR_FIFO_BUF_SIZE];
+};
+
+/*
+*-------------------------------------
+*       NUMA placement
+*-------------------------------------
+* The producer creates the buffers of a link, so by default their pages are
+* allocated on its own node when it first writes them. A consumer on an other
+* node of a multi-socket host then reads every sample from remote memory. The
+* placement policy of a link can be:
+*   first_touch: The default kernel policy
+*   consumer:    Bound to the node of the CPU the consumer is pinned to
+*   interleave:  Interleaved over all the nodes with memory
+*   pinning:     Bound to the node of the pinned producer and consumer, the two
+*                nodes are interleaved when they differ
+* The producer applies the policy, pre-faults the buffers and logs the observed
+* placement of their pages. Policies that need an unpinned stage fall back to
+* first touch. First touch buffers are not pre-faulted, only the pages of the
+* written frames are committed.
+*/
+#define SHMEM_NUMA_MAX_NODES 64
+
+/*
+*-------------------------------------
+*    Snapshot link (latest frame)
+*-------------------------------------
+* Single producer, any number of consumers, no control FIFOs. The producer
+* overwrites the frame slot of the <name>_L segment with every frame and the
+* consumers copy the latest frame whenever they like. The slot is protected by
+* a sequence lock: the sequence number is odd while the producer writes the
+* slot and a consumer retries its copy when the number has changed meanwhile.
+* The producer never waits for the consumers, so monitoring clients (GUIs,
+* dashboards) can not back-pressure the chain or cause frame drops on it.
+*/
+#define SHMEM_SNAPSHOT_MAGIC 0x4e534448 // "HDSN"
+#define SHMEM_SNAPSHOT_HEADER_SIZE 64   // The frame slot starts on a new cache line
+#define SNAPSHOT_READ_RETRIES 1000
+
+struct shmem_snapshot_header {
+    uint32_t magic;
+    uint32_t sequence;   // Odd while the producer writes the slot
+    uint64_t size;       // Capacity of the frame slot [byte]
+    uint64_t length;     // Length of the latest frame [byte]
+    uint64_t frame_cntr; // Number of published frames, 0: no frame yet
+};
+
+struct shmem_snapshot_struct {
+    char shared_memory_name[512];
+    size_t size; // Capacity of the frame slot [byte]
+    size_t map_size;
+    bool io_type; // 0-Output, 1-Input
+    struct shmem_snapshot_header* header;
+    uint8_t* slot;
 };
 
 /*
@@ -63,6 +152,8 @@ struct shmem_transfer_struct {
 *-------------------------------------
 */
 
+int shmem_numa_place(void* ptr, size_t size, const char* name, const char* policy, int producer_cpu, int consumer_cpu);
+
 int init_out_sm_buffer(struct shmem_transfer_struct*);
 int init_in_sm_buffer(struct shmem_transfer_struct*);
 
@@ -77,6 +168,17 @@ int wait_buff_free(struct shmem_transfer_struct*);
 int wait_buff_ready(struct shmem_transfer_struct*);
 int wait_ctr_init_read(struct shmem_transfer_struct*);
 
+int init_snapshot_writer(struct shmem_snapshot_struct*, const char* name, size_t size);
+int init_snapshot_reader(struct shmem_snapshot_struct*, const char* name);
+int destroy_snapshot_buffer(struct shmem_snapshot_struct*);
+void* snapshot_write_begin(struct shmem_snapshot_struct*);
+void snapshot_write_commit(struct shmem_snapshot_struct*, size_t length);
+int snapshot_publish(struct shmem_snapshot_struct*, const void* frame, size_t length);
+long snapshot_read(struct shmem_snapshot_struct*, void* buffer, size_t buffer_size, uint64_t* frame_cntr);
+size_t snapshot_capacity(struct shmem_snapshot_struct*);
+void* snapshot_slot(struct shmem_snapshot_struct*);
+size_t shmem_snapshot_struct_size(void);
+
 
 
 
@@ -19,20 +19,74 @@
    along with this program.  If not, see <https://www.gnu.org/licenses/>.
 """
 import logging
-from struct import pack, unpack
-from multiprocessing import shared_memory
+from struct import pack, unpack, pack_into, unpack_from, calcsize
+from multiprocessing import shared_memory, resource_tracker
 import numpy as np
 import os
+import ctypes
+from os.path import join, dirname, realpath
 
 A_BUFF_READY =   1
 B_BUFF_READY =   2
 INIT_READY   =  10
 TERMINATE    = 255
+
+# Link state segment, see "struct shmem_link_state" in sh_mem_util.h
+SHMEM_LINK_MAGIC = 0x4b4c4448
+SHMEM_LINK_STATE_FMT = '=IIii' # magic, generation, producer_pid, consumer_pid
+
+def _attach_shmem(name, create=False, size=0):
+    """
+        Opens a shared memory segment without handing it over to the resource tracker.
+        The tracker would unlink the segment when this process exits, which breaks
+        the re-attachment of the restarted stage.
+    """
+    memory = shared_memory.SharedMemory(name=name, create=create, size=size)
+    try:
+        resource_tracker.unregister(memory._name, "shared_memory")
+    except Exception:
+        pass
+    return memory
+
+class _LinkState():
+    """
+        Python side view of the <name>_S link state segment
+    """
+    def __init__(self, shmem_name):
+        size = calcsize(SHMEM_LINK_STATE_FMT)
+        try:
+            self.memory = _attach_shmem(shmem_name+'_S')
+        except FileNotFoundError:
+            try:
+                self.memory = _attach_shmem(shmem_name+'_S', create=True, size=size)
+            except FileExistsError:
+                self.memory = _attach_shmem(shmem_name+'_S')
+        if unpack_from('=I', self.memory.buf, 0)[0] != SHMEM_LINK_MAGIC:
+            pack_into(SHMEM_LINK_STATE_FMT, self.memory.buf, 0, SHMEM_LINK_MAGIC, 0, 0, 0)
+
+    @property
+    def generation(self):
+        return unpack_from('=I', self.memory.buf, 4)[0]
+
+    def new_generation(self):
+        generation = (self.generation + 1) & 0xFFFFFFFF
+        pack_into('=Ii', self.memory.buf, 4, generation, os.getpid())
+        return generation
+
+    def set_consumer_pid(self, pid):
+        pack_into('=i', self.memory.buf, 12, pid)
+
+    def close(self):
+        self.memory.close()
 class outShmemIface():
    
 
-    def __init__(self, shmem_name, shmem_size, drop_mode = False):
-        
+    def __init__(self, shmem_name, shmem_size, drop_mode = False, numa = None):
+        """
+            :param numa: NUMA placement of the buffers (see sh_mem_util.h), tuple of
+                         the policy name and the pinned CPUs of the producer and the
+                         consumer, e.g.: ("consumer", 2, 6). None: first touch
+        """
         self.init_ok = True        
         self.logger = logging.getLogger(__name__)
         self.ignore_frame_drop_warning = True
@@ -45,63 +99,105 @@ class outShmemIface():
         self.memories = []
         self.buffers = []
         
-        # Try to remove shared memories if already exist
-        try:
-            shmem_A = shared_memory.SharedMemory(name=shmem_name+'_A',create=False, size=shmem_size)
-            shmem_A.close()
-            #shmem_A.unlink()
-        except FileNotFoundError as err:
-            self.logger.warning("Shared memory not exist")
-        try:
-            shmem_B = shared_memory.SharedMemory(name=shmem_name+'_B',create=False, size=shmem_size)
-            shmem_B.close()
-            #shmem_B.unlink()
-        except FileNotFoundError as err:
-            self.logger.warning("Shared memory not exist")
-        
-        # Create the shared memories
-        self.memories.append(shared_memory.SharedMemory(name=shmem_name+'_A',create=True, size=shmem_size))
-        self.memories.append(shared_memory.SharedMemory(name=shmem_name+'_B',create=True, size=shmem_size))
+        self.connected = False
+        self.generation = 0
+        self.fw_ctr_fifo = None
+        self.bw_ctr_fifo = None
+
+        # Reuse the shared memories if they already exist, a restarted consumer may still map them
+        for suffix in ['_A', '_B']:
+            try:
+                memory = _attach_shmem(shmem_name+suffix)
+                if memory.size < shmem_size:
+                    memory.close()
+                    memory.unlink()
+                    memory = _attach_shmem(shmem_name+suffix, create=True, size=shmem_size)
+            except FileNotFoundError:
+                memory = _attach_shmem(shmem_name+suffix, create=True, size=shmem_size)
+            self.memories.append(memory)
         self.buffers.append(np.ndarray((shmem_size,), dtype=np.uint8, buffer=self.memories[0].buf))
-        self.buffers.append(np.ndarray((shmem_size,), dtype=np.uint8, buffer=self.memories[1].buf))                
-        
-        # Opening control FIFOs
-        if self.drop_mode:
-            bw_fifo_flags = os.O_RDONLY | os.O_NONBLOCK
-        else:
-            bw_fifo_flags = os.O_RDONLY
-        try:            
-            self.fw_ctr_fifo = os.open('_data_control/'+'fw_'+shmem_name, os.O_WRONLY)             
-            self.bw_ctr_fifo = os.open('_data_control/'+'bw_'+shmem_name, bw_fifo_flags)            
+        self.buffers.append(np.ndarray((shmem_size,), dtype=np.uint8, buffer=self.memories[1].buf))
+        if numa is not None:
+            policy, producer_cpu, consumer_cpu = numa
+            for suffix, buffer in zip(['_A', '_B'], self.buffers):
+                _get_shmem_lib().shmem_numa_place(buffer.ctypes.data, buffer.nbytes, (shmem_name+suffix).encode(),
+                                                  policy.encode(), producer_cpu, consumer_cpu)
+        self.state = _LinkState(shmem_name)
+
+        # Opening control FIFOs, blocks until the consumer is started
+        try:
+            fw_ctr_fifo = os.open('_data_control/'+'fw_'+shmem_name, os.O_WRONLY)
+            self._connect(fw_ctr_fifo)
         except OSError as err:
             self.logger.critical("OS error: {0}".format(err))
             self.logger.critical("Failed to open control fifos")
-            self.bw_ctr_fifo = None
-            self.fw_ctr_fifo = None
             self.init_ok = False
-        
-        # Send init ready signal        
-        if self.init_ok:            
-            os.write(self.fw_ctr_fifo, pack('B',INIT_READY))                        
-        
+
+    def _connect(self, fw_ctr_fifo):
+        """
+            Completes the handshake with the consumer on the opened forward FIFO
+        """
+        self.fw_ctr_fifo = fw_ctr_fifo
+        self.bw_ctr_fifo = os.open('_data_control/'+'bw_'+self.shmem_name, os.O_RDONLY)
+        if self.drop_mode:
+            os.set_blocking(self.bw_ctr_fifo, False)
+        self.buffer_free = [True, True]
+        self.connected = True
+        self.generation = self.state.new_generation()
+        os.write(self.fw_ctr_fifo, pack('B',INIT_READY))
+
+    def _disconnected(self):
+        """
+            The consumer has exited, frames are dropped until it re-attaches
+        """
+        self.logger.warning("Consumer of {0} disconnected, dropping frames until it re-attaches".format(self.shmem_name))
+        self.connected = False
+        os.close(self.fw_ctr_fifo)
+        os.close(self.bw_ctr_fifo)
+        self.fw_ctr_fifo = None
+        self.bw_ctr_fifo = None
+        self.state.set_consumer_pid(0)
+
+    def _try_reconnect(self):
+        try:
+            fw_ctr_fifo = os.open('_data_control/'+'fw_'+self.shmem_name, os.O_WRONLY | os.O_NONBLOCK)
+        except OSError: # ENXIO: No consumer yet
+            return False
+        os.set_blocking(fw_ctr_fifo, True)
+        self._connect(fw_ctr_fifo)
+        self.logger.info("Consumer of {0} re-attached, link generation: {1:d}, dropped frames: {2:d}".format(
+                         self.shmem_name, self.generation, self.dropped_frame_cntr))
+        return True
+
     def send_ctr_buff_ready(self, active_buffer_index):
-        # Send buffer ready signal on the forward FIFO
-        if active_buffer_index == 0:            
-            os.write(self.fw_ctr_fifo, pack('B',A_BUFF_READY))
-        elif active_buffer_index == 1:            
-            os.write(self.fw_ctr_fifo, pack('B',B_BUFF_READY))
-        
+        if not self.connected:
+            return
         # Deassert buffer free flag
         self.buffer_free[active_buffer_index] = False
+
+        # Send buffer ready signal on the forward FIFO
+        try:
+            if active_buffer_index == 0:
+                os.write(self.fw_ctr_fifo, pack('B',A_BUFF_READY))
+            elif active_buffer_index == 1:
+                os.write(self.fw_ctr_fifo, pack('B',B_BUFF_READY))
+        except BrokenPipeError:
+            self._disconnected()
     
     def send_ctr_terminate(self):
-        os.write(self.fw_ctr_fifo, pack('B',TERMINATE))
-        self.logger.info("Terminate signal sent")
+        if not self.connected:
+            return
+        try:
+            os.write(self.fw_ctr_fifo, pack('B',TERMINATE))
+            self.logger.info("Terminate signal sent")
+        except BrokenPipeError:
+            self._disconnected()
         
     def destory_sm_buffer(self):
         for memory in self.memories:
             memory.close()
             #memory.unlink()
+        self.state.close()
         
         if self.fw_ctr_fifo is not None:            
             os.close(self.fw_ctr_fifo)
@@ -110,6 +206,9 @@ class outShmemIface():
             os.close(self.bw_ctr_fifo)          
         
     def wait_buff_free(self):
+        if not self.connected and not self._try_reconnect():
+            self.dropped_frame_cntr +=1
+            return 3
         if self.buffer_free[0]:
             return 0
         elif self.buffer_free[1]:
@@ -117,6 +216,10 @@ class outShmemIface():
         else:       
             try:
                 buffer = os.read(self.bw_ctr_fifo, 1)
+                if not buffer: # Pipe closed, the consumer has exited
+                    self._disconnected()
+                    self.dropped_frame_cntr +=1
+                    return 3
                 signal = unpack('B', buffer )[0]
 
                 if signal  == A_BUFF_READY:
@@ -145,38 +248,66 @@ class inShmemIface():
         self.memories = []
         self.buffers = []        
 
+        self.state = None
+        self.generation = 0
+
         try:            
-            self.fw_ctr_fifo = os.open('_data_control/'+'fw_'+shmem_name, os.O_RDONLY)
-            self.bw_ctr_fifo = os.open('_data_control/'+'bw_'+shmem_name, os.O_WRONLY)                         
+            self._connect()
         except OSError as err:
             self.logger.critical("OS error: {0}".format(err))
             self.logger.critical("Failed to open control fifos")
             self.bw_ctr_fifo = None
             self.fw_ctr_fifo = None
             self.init_ok = False
-        
-        if self.fw_ctr_fifo is not None:
-            if unpack('B', os.read(self.fw_ctr_fifo, 1))[0] == INIT_READY:
-                self.memories.append(shared_memory.SharedMemory(name=shmem_name+'_A'))
-                self.memories.append(shared_memory.SharedMemory(name=shmem_name+'_B'))
-                self.buffers.append(np.ndarray((self.memories[0].size,), 
-                                                dtype=np.uint8, 
-                                                buffer=self.memories[0].buf))
-                self.buffers.append(np.ndarray((self.memories[1].size,), 
-                                                dtype=np.uint8, 
-                                                buffer=self.memories[1].buf))
-            else:
-                self.init_ok = False
+
+    def _connect(self):
+        """
+            Opens the control FIFOs, waits for the init ready signal of the producer
+            and maps the shared memories
+        """
+        self.fw_ctr_fifo = os.open('_data_control/'+'fw_'+self.shmem_name, os.O_RDONLY)
+        self.bw_ctr_fifo = os.open('_data_control/'+'bw_'+self.shmem_name, os.O_WRONLY)
+        if unpack('B', os.read(self.fw_ctr_fifo, 1))[0] != INIT_READY:
+            self.init_ok = False
+            return
+        self.memories = [_attach_shmem(self.shmem_name+'_A'), _attach_shmem(self.shmem_name+'_B')]
+        self.buffers = [np.ndarray((memory.size,), dtype=np.uint8, buffer=memory.buf) for memory in self.memories]
+        if self.state is None:
+            self.state = _LinkState(self.shmem_name)
+        self.generation = self.state.generation
+        self.state.set_consumer_pid(os.getpid())
+
+    def _reconnect(self):
+        """
+            The producer has exited. Waits for its restarted instance, then remaps
+            the buffers, as the producer may have recreated them.
+        """
+        self.logger.warning("Producer of {0} disconnected, waiting for it to re-attach".format(self.shmem_name))
+        os.close(self.fw_ctr_fifo)
+        os.close(self.bw_ctr_fifo)
+        self.buffers = []
+        for memory in self.memories:
+            try:
+                memory.close()
+            except BufferError: # Views of the previous frame are still alive, the mapping is released with them
+                pass
+        self._connect()
+        self.logger.info("Producer of {0} re-attached, link generation: {1:d}".format(self.shmem_name, self.generation))
 
     def send_ctr_buff_ready(self, active_buffer_index):                
-        if active_buffer_index == 0:            
-            os.write(self.bw_ctr_fifo, pack('B',A_BUFF_READY))
-        elif active_buffer_index == 1:            
-            os.write(self.bw_ctr_fifo, pack('B',B_BUFF_READY))
+        try:
+            if active_buffer_index == 0:
+                os.write(self.bw_ctr_fifo, pack('B',A_BUFF_READY))
+            elif active_buffer_index == 1:
+                os.write(self.bw_ctr_fifo, pack('B',B_BUFF_READY))
+        except BrokenPipeError: # Detected on the forward FIFO
+            pass
                 
     def destory_sm_buffer(self):
         for memory in self.memories:
             memory.close()
+        if self.state is not None:
+            self.state.close()
         
         if self.fw_ctr_fifo is not None:            
             os.close(self.fw_ctr_fifo)
@@ -185,7 +316,11 @@ class inShmemIface():
             os.close(self.bw_ctr_fifo)         
         
     def wait_buff_free(self):
-        signal = unpack('B', os.read(self.fw_ctr_fifo, 1))[0]
+        buffer = os.read(self.fw_ctr_fifo, 1)
+        while not buffer:
+            self._reconnect()
+            buffer = os.read(self.fw_ctr_fifo, 1)
+        signal = unpack('B', buffer)[0]
         if signal == A_BUFF_READY:                    
             return 0
         elif signal == B_BUFF_READY:                                 
@@ -193,3 +328,119 @@ class inShmemIface():
         elif signal == TERMINATE:
             return TERMINATE
         return -1
+
+def _load_shmem_library(lib_path=None):
+    """
+        The snapshot link and the NUMA placement are implemented in sh_mem_util.c,
+        the sequence lock needs the memory barriers and the placement the memory
+        policy system calls that are not available from Python
+    """
+    if lib_path is None:
+        lib_path = join(dirname(realpath(__file__)), "libhdaq.so")
+    lib = ctypes.CDLL(lib_path)
+    lib.init_snapshot_writer.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+    lib.init_snapshot_writer.restype = ctypes.c_int
+    lib.init_snapshot_reader.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.init_snapshot_reader.restype = ctypes.c_int
+    lib.destroy_snapshot_buffer.argtypes = [ctypes.c_void_p]
+    lib.destroy_snapshot_buffer.restype = ctypes.c_int
+    lib.snapshot_write_begin.argtypes = [ctypes.c_void_p]
+    lib.snapshot_write_begin.restype = ctypes.c_void_p
+    lib.snapshot_write_commit.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.snapshot_write_commit.restype = None
+    lib.snapshot_read.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_uint64)]
+    lib.snapshot_read.restype = ctypes.c_long
+    lib.snapshot_capacity.argtypes = [ctypes.c_void_p]
+    lib.snapshot_capacity.restype = ctypes.c_size_t
+    lib.snapshot_slot.argtypes = [ctypes.c_void_p]
+    lib.snapshot_slot.restype = ctypes.c_void_p
+    lib.shmem_numa_place.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_char_p,
+                                      ctypes.c_int, ctypes.c_int]
+    lib.shmem_numa_place.restype = ctypes.c_int
+    lib.shmem_snapshot_struct_size.argtypes = []
+    lib.shmem_snapshot_struct_size.restype = ctypes.c_size_t
+    return lib
+
+_shmem_lib = None
+def _get_shmem_lib():
+    global _shmem_lib
+    if _shmem_lib is None:
+        _shmem_lib = _load_shmem_library()
+    return _shmem_lib
+
+class outSnapshotIface():
+    """
+        Producer side of a snapshot link (see "Snapshot link" in sh_mem_util.h).
+        Every published frame overwrites the previous one, publishing never blocks.
+    """
+    def __init__(self, shmem_name, shmem_size):
+        self.init_ok = True
+        self.logger = logging.getLogger(__name__)
+        self.shmem_name = shmem_name
+        self.lib = _get_shmem_lib()
+        self.link = ctypes.create_string_buffer(self.lib.shmem_snapshot_struct_size())
+        if self.lib.init_snapshot_writer(self.link, (shmem_name+'_L').encode(), shmem_size) != 0:
+            self.logger.critical("Failed to create the snapshot link {0}".format(shmem_name))
+            self.init_ok = False
+            return
+        self.size = self.lib.snapshot_capacity(self.link)
+        self.slot = np.ctypeslib.as_array((ctypes.c_uint8*self.size).from_address(self.lib.snapshot_slot(self.link)))
+
+    def publish(self, *parts):
+        """
+            Publishes the concatenation of the given arrays as the latest frame
+
+            :param parts: C-contiguous numpy arrays (e.g. header and payload), None entries are skipped
+            :return: False when the frame does not fit into the slot
+        """
+        parts = [part.reshape(-1).view(np.uint8) for part in parts if part is not None]
+        length = sum(part.size for part in parts)
+        if length > self.size:
+            return False
+        self.lib.snapshot_write_begin(self.link)
+        offset = 0
+        for part in parts:
+            self.slot[offset:offset+part.size] = part
+            offset += part.size
+        self.lib.snapshot_write_commit(self.link, length)
+        return True
+
+    def destory_sm_buffer(self):
+        if self.init_ok:
+            self.slot = None
+            self.lib.destroy_snapshot_buffer(self.link)
+
+class inSnapshotIface():
+    """
+        Consumer side of a snapshot link, the latest frame can be read at any time
+    """
+    def __init__(self, shmem_name):
+        self.init_ok = True
+        self.logger = logging.getLogger(__name__)
+        self.shmem_name = shmem_name
+        self.lib = _get_shmem_lib()
+        self.link = ctypes.create_string_buffer(self.lib.shmem_snapshot_struct_size())
+        if self.lib.init_snapshot_reader(self.link, (shmem_name+'_L').encode()) != 0:
+            self.logger.error("Snapshot link {0} is not available".format(shmem_name))
+            self.init_ok = False
+            return
+        self.buffer = np.empty(self.lib.snapshot_capacity(self.link), dtype=np.uint8)
+        self.frame_cntr = ctypes.c_uint64(0)
+
+    def read(self):
+        """
+            Takes a consistent copy of the latest frame
+
+            :return: Tuple of the frame counter and the frame bytes (a view of the
+                     internal buffer, valid until the next read), None when no
+                     frame has been published yet or no consistent copy could be taken
+        """
+        length = self.lib.snapshot_read(self.link, self.buffer.ctypes.data, self.buffer.size,
+                                        ctypes.byref(self.frame_cntr))
+        if length <= 0:
+            return None
+        return self.frame_cntr.value, self.buffer[:length]
+
+    def destory_sm_buffer(self):
+        if self.init_ok:
+            self.lib.destroy_snapshot_buffer(self.link)
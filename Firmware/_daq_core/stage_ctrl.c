@@ -0,0 +1,62 @@
+/*
+ *
+ * Description :
+ * Stage status reporting towards the DAQ chain launcher
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include "stage_ctrl.h"
+
+static int status_fd = -2; // -2: not yet initialized, -1: no launcher
+static unsigned int sent_events = 0;
+
+static int event_bit(char event)
+{
+    switch (event)
+    {
+        case STAGE_EV_READY:       return 1;
+        case STAGE_EV_FIRST_FRAME: return 2;
+        case STAGE_EV_FIRST_SYNC:  return 4;
+        default:                   return 0;
+    }
+}
+
+void stage_notify(char event)
+/*
+ * Reports a milestone to the launcher. Every event is sent only once,
+ * so the function can be called from the processing loops.
+ */
+{
+    int bit = event_bit(event);
+    if (sent_events & bit) {return;}
+    sent_events |= bit;
+
+    if (status_fd == -2)
+    {
+        const char* fd_str = getenv(STAGE_STATUS_FD_ENV);
+        status_fd = fd_str ? atoi(fd_str) : -1;
+        if (status_fd <= 2) {status_fd = -1;}
+    }
+    if (status_fd < 0) {return;}
+    if (write(status_fd, &event, 1) != 1) {status_fd = -1;}
+}
@@ -0,0 +1,43 @@
+/*
+ *
+ * Description :
+ * Stage status reporting towards the DAQ chain launcher
+ *
+ * Project : HeIMDALL DAQ Firmware
+ * License : GNU GPL V3
+ * Author  : Tamas Peto
+ *
+ * Copyright (C) 2018-2022  Tamás Pető
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef STAGE_CTRL_H
+#define STAGE_CTRL_H
+
+/*
+ * The launcher passes the write end of a status pipe to every stage in the
+ * HDAQ_STATUS_FD environment variable. Stages report their milestones as
+ * single characters on this pipe. When the stage is started without the
+ * launcher (e.g. from the start scripts) the reports are silently dropped.
+ */
+#define STAGE_STATUS_FD_ENV "HDAQ_STATUS_FD"
+
+#define STAGE_EV_READY       'R' // Stage initialized, links are open
+#define STAGE_EV_FIRST_FRAME 'F' // First valid (non-dummy) frame forwarded
+#define STAGE_EV_FIRST_SYNC  'S' // First delay and IQ synchronized frame forwarded
+
+void stage_notify(char event);
+
+#endif
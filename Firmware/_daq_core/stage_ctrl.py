@@ -0,0 +1,56 @@
+"""
+    HeIMDALL DAQ Firmware
+    Stage status reporting towards the DAQ chain launcher (see stage_ctrl.h)
+
+    Author: Tamás Pető
+    License: GNU GPL V3
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+"""
+import os
+
+STAGE_STATUS_FD_ENV  = "HDAQ_STATUS_FD"
+
+STAGE_EV_READY       = b'R' # Stage initialized, links are open
+STAGE_EV_FIRST_FRAME = b'F' # First valid (non-dummy) frame forwarded
+STAGE_EV_FIRST_SYNC  = b'S' # First delay and IQ synchronized frame forwarded
+
+_status_fd = None
+_sent_events = set()
+
+def stage_notify(event):
+    """
+        Reports a milestone to the launcher. Every event is sent only once,
+        reports are dropped when the stage was not started by the launcher.
+
+        :param event: One of the STAGE_EV_* constants
+    """
+    global _status_fd
+    if event in _sent_events:
+        return
+    _sent_events.add(event)
+
+    if _status_fd is None:
+        try:
+            _status_fd = int(os.environ.get(STAGE_STATUS_FD_ENV, "-1"))
+        except ValueError:
+            _status_fd = -1
+        if _status_fd <= 2:
+            _status_fd = -1
+    if _status_fd < 0:
+        return
+    try:
+        os.write(_status_fd, event)
+    except OSError:
+        _status_fd = -1
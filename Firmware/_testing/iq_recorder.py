@@ -170,7 +170,7 @@ class IQRecorder():
                     self.logger.info("IQ Frame received and dropped, CPI index: {:d}".format(self.iq_header.cpi_index))
                 
                 # Check overdrive
-                if self.iq_header.adc_overdrive_flags != 0:
+                if self.iq_header.get_overdrive_flags() != 0:
                     self.logger.warning("Overdrive detected!")
 
             except:
@@ -203,8 +203,9 @@ class IQRecorder():
         self.iq_header.decode_header(iq_header_bytes)
         self.logger.debug("IQ header received and decoded")
         
-        # Calculate total bytes to receive from the iq header data        
-        total_bytes_to_receive = int((self.iq_header.cpi_length * self.iq_header.active_ant_chs * (2*self.iq_header.sample_bit_depth))/8)
+        # Calculate total bytes to receive from the iq header data, the per-channel metadata of large arrays precedes the payload
+        meta_length = self.iq_header.ch_meta_length
+        total_bytes_to_receive = meta_length + int((self.iq_header.cpi_length * self.iq_header.active_ant_chs * (2*self.iq_header.sample_bit_depth))/8)
         receiver_buffer_size = 2**18
         
         self.logger.debug("Total bytes to receive: {:d}".format(total_bytes_to_receive))
@@ -223,6 +224,8 @@ class IQRecorder():
             total_received_bytes += recv_bytes_count
         
         self.logger.debug("Succesfully received")
+        if meta_length:
+            self.iq_header.decode_ch_meta(iq_data_bytes[0:meta_length])
         
         # Dump IQ header        
         #self.iq_header.dump_header()
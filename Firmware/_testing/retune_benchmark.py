@@ -0,0 +1,182 @@
+"""
+	Description :
+	Retune latency benchmark
+
+	Measures the time from a FREQ command issued on the control interface of the
+	Hardware Controller (port 5001) to the first delay and IQ synchronized DATA
+	frame on the new center frequency, received through the IQ server (port 5000).
+	The DAQ chain has to be running with the "eth" output data interface, the
+	synthetic data source (daq_synthetic_start.sh) is sufficient.
+
+	Usage:
+	    python3 _testing/retune_benchmark.py [retune count] [frequency 1 [MHz]] [frequency 2 [MHz]]
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import os
+import sys
+import time
+import socket
+import logging
+from struct import pack, unpack
+
+currentPath = os.path.dirname(os.path.realpath(__file__))
+rootPath = os.path.dirname(currentPath)
+sys.path.insert(0, os.path.join(rootPath, "_daq_core"))
+from iq_header import IQHeader
+from iq_eth_sink import IQRecorder
+
+HWC_PORT = 5001
+SYNC_TIMEOUT = 60 # [s]
+
+class RetuneBenchmark():
+    def __init__(self):
+        self.logger = logging.getLogger(__name__)
+        self.iq_rec = IQRecorder()
+        self.ctr_socket = None
+
+    def connect(self):
+        """
+            Opens the IQ data and the control interface connections, completion
+            events are enabled on the control interface
+        """
+        self.iq_rec.connect_eth()
+        if not self.iq_rec.receiver_connection_status:
+            return -1
+        self.ctr_socket = socket.create_connection(("127.0.0.1", HWC_PORT))
+        self.ctr_socket.sendall("EVNT".encode()+pack('B', 1)+bytearray(123))
+        self._recv_ctr_msg()
+        return 0
+
+    def close(self):
+        if self.ctr_socket is not None:
+            self.ctr_socket.sendall("EXIT".encode()+bytearray(124))
+            self.ctr_socket.close()
+        self.iq_rec.close_eth()
+
+    def _recv_ctr_msg(self):
+        msg_bytes = bytearray()
+        while len(msg_bytes) < 128:
+            msg_bytes += self.ctr_socket.recv(128-len(msg_bytes))
+        return msg_bytes
+
+    def _poll_events(self, cmd_id, events):
+        """
+            Collects the completion event of the given command without blocking
+        """
+        self.ctr_socket.setblocking(False)
+        try:
+            while True:
+                msg_bytes = self._recv_ctr_msg()
+                if msg_bytes[0:4].decode() == "EVNT" and unpack('I', msg_bytes[4:8])[0] == cmd_id:
+                    events.append((time.perf_counter(), unpack('I', msg_bytes[12:16])[0]))
+        except BlockingIOError:
+            pass
+        finally:
+            self.ctr_socket.setblocking(True)
+
+    def _download_frame(self):
+        self.iq_rec.socket_inst.sendall(str.encode("IQDownload"))
+        self.iq_rec.receive_iq_frame()
+        return self.iq_rec.iq_header
+
+    def _is_synced_data(self, iq_header, rf_freq):
+        return iq_header.frame_type == IQHeader.FRAME_TYPE_DATA and \
+               iq_header.delay_sync_flag == 1 and iq_header.iq_sync_flag == 1 and \
+               (rf_freq is None or iq_header.rf_center_freq == rf_freq)
+
+    def wait_sync(self, rf_freq=None, cmd_id=None, events=None):
+        """
+            Downloads frames until the first synchronized DATA frame on the given frequency
+
+            :return: Tuple of the arrival times of the first frame on the new frequency
+                     and of the first synchronized one, None on timeout
+        """
+        t_start = time.perf_counter()
+        t_visible = None
+        while time.perf_counter() - t_start < SYNC_TIMEOUT:
+            iq_header = self._download_frame()
+            t_frame = time.perf_counter()
+            if cmd_id is not None:
+                self._poll_events(cmd_id, events)
+            if t_visible is None and iq_header.frame_type != IQHeader.FRAME_TYPE_DUMMY and \
+               (rf_freq is None or iq_header.rf_center_freq == rf_freq):
+                t_visible = t_frame
+            if self._is_synced_data(iq_header, rf_freq):
+                return t_visible, t_frame
+        return None
+
+    def retune(self, rf_freq):
+        """
+            Issues a FREQ command and measures the latencies of the retune
+
+            :return: Dictionary of the measured latencies [ms], None on timeout
+        """
+        events = []
+        t_cmd = time.perf_counter()
+        self.ctr_socket.sendall("FREQ".encode()+pack('Q', rf_freq)+bytearray(116))
+        ack = self._recv_ctr_msg()
+        while ack[0:4].decode() != "FNSD": # Late event of a previous command
+            ack = self._recv_ctr_msg()
+        t_ack = time.perf_counter()
+        cmd_id = unpack('I', ack[4:8])[0]
+        times = self.wait_sync(rf_freq, cmd_id, events)
+        if times is None:
+            return None
+        result = {"ack"    : (t_ack-t_cmd)*1000,
+                  "visible": (times[0]-t_cmd)*1000,
+                  "synced" : (times[1]-t_cmd)*1000}
+        result["event"] = (events[0][0]-t_cmd)*1000 if len(events) else float('nan')
+        return result
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.WARNING)
+    retune_count = int(sys.argv[1]) if len(sys.argv) > 1 else 10
+    rf_freqs = [int(float(sys.argv[2])*10**6) if len(sys.argv) > 2 else 416000000,
+                int(float(sys.argv[3])*10**6) if len(sys.argv) > 3 else 433000000]
+
+    benchmark = RetuneBenchmark()
+    if benchmark.connect() != 0:
+        print("Failed to connect to the DAQ chain")
+        sys.exit(-1)
+    print("Waiting for the initial synchronization..")
+    if benchmark.wait_sync() is None:
+        print("The DAQ chain has not synchronized in {:d} s".format(SYNC_TIMEOUT))
+        benchmark.close()
+        sys.exit(-1)
+
+    print("{:>6s}{:>12s}{:>10s}{:>12s}{:>12s}{:>12s}".format("run", "freq [MHz]", "ack", "event", "1st frame", "synced"))
+    results = []
+    for r in range(retune_count):
+        rf_freq = rf_freqs[r%2]
+        result = benchmark.retune(rf_freq)
+        if result is None:
+            print("{:6d}{:12.3f}  timeout".format(r, rf_freq/10**6))
+            continue
+        results.append(result)
+        print("{:6d}{:12.3f}{:10.1f}{:12.1f}{:12.1f}{:12.1f}".format(r, rf_freq/10**6, result["ack"],
+              result["event"], result["visible"], result["synced"]))
+    benchmark.close()
+
+    if len(results):
+        synced = sorted([result["synced"] for result in results])
+        print("Command to first synchronized DATA frame [ms]: min {:.1f}, median {:.1f}, max {:.1f}".format(
+              synced[0], synced[len(synced)//2], synced[-1]))
@@ -32,6 +32,7 @@ from struct import pack, unpack
 from configparser import ConfigParser
 import logging
 from threading import Thread
+import zmq
 
 
 # Import IQ header module
@@ -48,26 +49,25 @@ class FIFO_rd_thread(Thread):
     """
     Description:
     ------------
-    This thread function handles the external requests using an external FIFO file.
+    This thread function handles the external requests on the same ZMQ socket (port 1130)
+    as the rtl_daq module, so the synthetic chain can be controlled by the other modules.
     Upon receipt of a command, this thread infroms the main thread on the requested operation.
     
-    The valid (1 byte) commands are the followings:
-         r: Tuner reconfiguration
-         n: Turning on the noise source
-         f: Tunrning off the noise source
+    The inter-module messages are 128 byte long, the first byte is the source module identifier,
+    the second one is the command identifier (see inter_module_messages.py):
+         n: Noise source control
          g: Gain reconfiguration
          c: Center frequency change request
-         2: Gentle system halt request
+         a, s, r: Accepted, but not simulated
     """
     def __init__(self, ch_no):
-        Thread.__init__(self)
+        Thread.__init__(self, daemon=True)
         self.M = ch_no
         self.logger=logging.getLogger(__name__)
-        self.ctr_fifo_descriptor = open("_data_control/rec_control_fifo", 'rb')
-        if self.ctr_fifo_descriptor is not None:
-            self.logger.debug("Control FIFO succesfully opened, waiting for ctr messages")
-        else:
-            self.logger.error("Failed to open control FIFO")
+        context = zmq.Context()
+        self.ctr_socket = context.socket(zmq.REP)
+        self.ctr_socket.bind("tcp://*:1130")
+        self.logger.debug("Control socket succesfully opened, waiting for ctr messages")
         
         # TODO: Do not store internal system parameters here
         self.gains = [0]*self.M
@@ -77,32 +77,27 @@ class FIFO_rd_thread(Thread):
         
     def run(self):
         while(True):
-            cmd = self.ctr_fifo_descriptor.read(1)
-            self.logger.debug("Command character received: "+cmd.decode())
+            msg = self.ctr_socket.recv()
+            cmd = chr(msg[1])
+            self.logger.debug("Command character received: "+cmd)
             
-            if cmd.decode() == 'c':                
-                self.logger.info("Ctr FIFO: Center frequency control message")
-                center_freq_byte = self.ctr_fifo_descriptor.read(4)
-                self.rf_center_freq = unpack("I", center_freq_byte)[0]                                                
+            if cmd == 'c':                
+                self.logger.info("Ctr: Center frequency control message")
+                self.rf_center_freq = unpack("I", msg[2:6])[0]                                                
                 self.logger.debug("Center frequency: {:.2f} MHz".format(self.rf_center_freq/10**6))
 
-
-            if cmd.decode() == 'g':                
-                self.logger.info("Ctr FIFO: Gain control message")
-                gain_bytes = self.ctr_fifo_descriptor.read(self.M*4)
-                self.gains = unpack("I"*self.M, gain_bytes)                                
+            elif cmd == 'g':                
+                self.logger.info("Ctr: Gain control message")
+                self.gains = unpack("I"*self.M, msg[2:2+self.M*4])                                
                 for m in range(self.M):
                     self.logger.debug("Channel: {:d}, Gain:{:d} /10 dB".format(m, self.gains[m]))
                 
-            elif cmd.decode() == 'n':
-                self.logger.info("Ctr FIFO: Enabling noise source")
-                self.noise_source_state = 1
-
-            elif cmd.decode() == 'f':
-                self.logger.info("Ctr FIFO: Disabling noise source")
-                self.noise_source_state = 0
+            elif cmd == 'n':
+                self.noise_source_state = msg[2]
+                self.logger.info("Ctr: Noise source state: {:d}".format(self.noise_source_state))
             
             self.en_dummy_frame = 1
+            self.ctr_socket.send(b"ok")
 
 
 ####################################
@@ -216,7 +211,7 @@ no_dummy_frames = 5
 iq_header = IQHeader()
 
 iq_header.sync_word            = IQHeader.SYNC_WORD
-iq_header.header_version       = 7
+iq_header.header_version       = 11
 iq_header.frame_type           = 0 # 0 - Normal data frame, 3 - calibration frame
 iq_header.hardware_id          = "K"+str(M)
 iq_header.unit_id              = 0              
@@ -238,7 +233,10 @@ iq_header.if_gains             = [0]*32
 #iq_header.iq_sync_flag        = 0  
 #iq_header.sync_state          = 0
 iq_header.noise_source_state   = 0   
-#iq_header.reserved=[0]*192       
+iq_header.sample_index_step    = 1
+iq_header.first_sample_index   = 0
+iq_header.noise_source_switch_index = 0
+#iq_header.reserved=[0]*185       
 
 logger.info("Decimation ratio: {:d}".format(R))
 logger.debug("IQ header size: {:d}".format(len(iq_header.encode_header())))
@@ -265,6 +263,7 @@ try:
         logger.info("Writing block: {:d}".format(b))
         iq_header.adc_overdrive_flags = 0
         iq_header.daq_block_index = b
+        iq_header.first_sample_index = b*N_daq
         iq_header.time_stamp = int(time.time_ns()/10**6)
         # Generate signal of interest
         
@@ -446,6 +445,8 @@ try:
                 iq_header.frame_type = IQHeader.FRAME_TYPE_DUMMY
                 if m==0 :logging.info("Frame type: Dummy")  
             else:
+                if FIFO_rd_thread_inst0.noise_source_state != iq_header.noise_source_state:
+                    iq_header.noise_source_switch_index = b*N_daq # Synthetic switches are block aligned
                 if FIFO_rd_thread_inst0.noise_source_state == 1: # Calibration Frame
                     iq_header.noise_source_state   = 1
                     iq_header.frame_type           = IQHeader.FRAME_TYPE_CAL
@@ -460,7 +461,9 @@ try:
             # Update gain status in the header        
             iq_header.if_gains[m] = FIFO_rd_thread_inst0.gains[m]                  
             # Update center frequency field in the header
-            iq_header.rf_center_freq = int(FIFO_rd_thread_inst0.rf_center_freq+sig_freq)            
+            iq_header.rf_center_freq = int(FIFO_rd_thread_inst0.rf_center_freq)
+            if sig_type == "swept-cw":
+                iq_header.rf_center_freq += int(sig_freq)
             
             if (raw_sig_m.real == 1).any():
                 iq_header.adc_overdrive_flags |= 1<<m
@@ -479,7 +482,7 @@ try:
             
             signal[0::2] = raw_sig_m.real
             signal[1::2] = raw_sig_m.imag      
-            byte_array= pack('B'*block_size, *signal)
+            byte_array= signal.tobytes()
             #logger.debug("Data block size: {:d} bytes".format(len(byte_array)))
             #iq_header.encode_header()
             #logger.debug("Header size: {:d}".format(len(iq_header.encode_header())))
@@ -0,0 +1,128 @@
+"""
+	Description :
+	Unit test for the allocation audit of the processing stages
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import os
+import shutil
+import tempfile
+import threading
+import subprocess
+from configparser import ConfigParser
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+config_files_path = join(dirname(root_path), "config_files")
+rebuffer      = join(daq_core_path, "rebuffer.out")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from iq_header import IQHeader, IQHeaderView
+from shmemIface import inShmemIface, TERMINATE
+
+M        = 2
+N_DAQ    = 4096
+CPI_SIZE = 4*N_DAQ
+CAL_SIZE = 2*N_DAQ
+
+def iq_frame(index, frame_type, rng):
+    iq_header = IQHeader()
+    iq_header.sync_word          = IQHeader.SYNC_WORD
+    iq_header.frame_type         = frame_type
+    iq_header.active_ant_chs     = M
+    iq_header.adc_sampling_freq  = 2400000
+    iq_header.sampling_freq      = 2400000
+    iq_header.cpi_length         = N_DAQ
+    iq_header.daq_block_index    = index
+    iq_header.sample_bit_depth   = 8
+    iq_header.sample_index_step  = 1
+    iq_header.first_sample_index = index*N_DAQ
+    return iq_header.encode_header() + rng.integers(0, 256, 2*M*N_DAQ, dtype=np.uint8).tobytes()
+
+class TesterAllocAudit(unittest.TestCase):
+
+    def setUp(self):
+        self.cwd = os.getcwd()
+        self.tmp_dir = tempfile.mkdtemp()
+        os.chdir(self.tmp_dir)
+        os.mkdir("_data_control")
+        os.mkfifo(join("_data_control", "fw_decimator_in"))
+        os.mkfifo(join("_data_control", "bw_decimator_in"))
+
+        parser = ConfigParser()
+        parser.read(join(config_files_path, "kraken_default", "daq_chain_config.ini"))
+        parser["hw"]["num_ch"] = str(M)
+        parser["hw"]["en_bias_tee"] = ",".join(["0"]*M)
+        parser["daq"]["log_level"] = "2"
+        parser["daq"]["daq_buffer_size"] = str(N_DAQ)
+        parser["pre_processing"]["cpi_size"] = str(CPI_SIZE)
+        parser["calibration"]["corr_size"] = str(CAL_SIZE)
+        with open("daq_chain_config.ini", "w") as fd:
+            parser.write(fd)
+
+    def tearDown(self):
+        os.chdir(self.cwd)
+        shutil.rmtree(self.tmp_dir)
+
+    def _consume(self, frame_types):
+        link = inShmemIface("decimator_in")
+        self.assertTrue(link.init_ok)
+        while True:
+            index = link.wait_buff_free()
+            if index == TERMINATE or index < 0:
+                break
+            frame_types.append(int(IQHeaderView(link.buffers[index]).frame_type))
+            link.send_ctr_buff_ready(index)
+        link.destory_sm_buffer()
+
+    def test_rebuffer_steady_state(self):
+        """
+            After the warm-up frames the rebuffer forwards the data and the
+            calibration frames without any heap allocation
+        """
+        rng = np.random.default_rng(0)
+        env = dict(os.environ, HDAQ_ALLOC_AUDIT="4")
+        with open("rebuffer.log", "w") as log:
+            proc = subprocess.Popen([rebuffer], stdin=subprocess.PIPE, stderr=log, env=env)
+            frame_types = []
+            consumer = threading.Thread(target=self._consume, args=(frame_types,))
+            consumer.start()
+            types = [IQHeader.FRAME_TYPE_DATA]*40 + [IQHeader.FRAME_TYPE_CAL]*20 + [IQHeader.FRAME_TYPE_DATA]*20
+            for index, frame_type in enumerate(types):
+                proc.stdin.write(iq_frame(index, frame_type, rng))
+            proc.stdin.close()
+            ret = proc.wait(timeout=30)
+            consumer.join(timeout=10)
+        with open("rebuffer.log") as log:
+            log_text = log.read()
+        self.assertEqual(ret, 0, log_text)
+        self.assertIn("no allocation in the steady state", log_text)
+        self.assertEqual(frame_types.count(IQHeader.FRAME_TYPE_DATA), 60*N_DAQ//CPI_SIZE)
+        self.assertEqual(frame_types.count(IQHeader.FRAME_TYPE_CAL), 20*N_DAQ//CAL_SIZE)
+
+if __name__ == '__main__':
+    unittest.main()
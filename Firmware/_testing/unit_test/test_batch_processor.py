@@ -0,0 +1,192 @@
+"""
+	Description :
+	Unit test for the offline batch processor (daq_batch.out)
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import tempfile
+import subprocess
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+batch         = join(daq_core_path, "daq_batch.out")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from iq_header import IQHeader
+
+M     = 4
+N_DAQ = 2048
+DEC   = 4
+
+def write_capture(fname, frame_types, rng, ch_mask=0):
+    """
+        Writes a raw cu8 capture and returns the raw payloads of the frames
+    """
+    ch_no = bin(ch_mask).count("1") if ch_mask else M
+    payloads = []
+    with open(fname, "wb") as fd:
+        for index, frame_type in enumerate(frame_types):
+            iq_header = IQHeader()
+            iq_header.sync_word         = IQHeader.SYNC_WORD
+            iq_header.frame_type        = frame_type
+            iq_header.active_ant_chs    = ch_no
+            iq_header.active_ch_mask    = ch_mask
+            iq_header.adc_sampling_freq = 2400000
+            iq_header.sampling_freq     = 2400000
+            iq_header.cpi_length        = 0 if frame_type == IQHeader.FRAME_TYPE_DUMMY else N_DAQ
+            iq_header.daq_block_index   = index
+            iq_header.sample_bit_depth  = 8
+            iq_header.sample_index_step = 1
+            iq_header.first_sample_index = index*N_DAQ
+            payload = rng.integers(0, 256, (ch_no, 2*iq_header.cpi_length), dtype=np.uint8)
+            fd.write(iq_header.encode_header())
+            fd.write(payload.tobytes())
+            payloads.append(payload)
+    return payloads
+
+def read_capture(fname):
+    """
+        Reads a processed (cf32) capture
+    """
+    frames = []
+    with open(fname, "rb") as fd:
+        while True:
+            header_bytes = fd.read(1024)
+            if len(header_bytes) < 1024:
+                break
+            iq_header = IQHeader()
+            iq_header.decode_header(header_bytes)
+            size = iq_header.cpi_length*iq_header.active_ant_chs*8
+            samples = np.frombuffer(fd.read(size), dtype=np.complex64).reshape(iq_header.active_ant_chs, -1)
+            frames.append((iq_header, samples))
+    return frames
+
+def cu8_to_cf32(payload):
+    return ((payload.astype(np.float32)-np.float32(127.5))*(np.float32(1)/np.float32(127.5))).view(np.complex64)
+
+class TesterBatchProcessor(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp_dir = tempfile.TemporaryDirectory()
+        self.rng = np.random.default_rng(0)
+        self.capture = join(self.tmp_dir.name, "capture.iqf")
+        self.frame_types = [IQHeader.FRAME_TYPE_DATA]*5 + [IQHeader.FRAME_TYPE_CAL]*2 + \
+                           [IQHeader.FRAME_TYPE_DUMMY] + [IQHeader.FRAME_TYPE_DATA]*30
+        self.payloads = write_capture(self.capture, self.frame_types, self.rng)
+        self.coeffs = np.hanning(31).astype(np.float32)
+        self.coeffs /= np.sum(self.coeffs)
+        self.fir_fname = join(self.tmp_dir.name, "fir_coeffs.txt")
+        np.savetxt(self.fir_fname, self.coeffs)
+
+    def tearDown(self):
+        self.tmp_dir.cleanup()
+
+    def _run(self, *args):
+        out_dir = tempfile.mkdtemp(dir=self.tmp_dir.name)
+        ret = subprocess.run([batch, "-c", join(root_path, "daq_chain_config.ini"), "-d", str(DEC),
+                              "-f", self.fir_fname, "-o", out_dir]+list(args)+[self.capture],
+                             capture_output=True, text=True)
+        self.assertEqual(ret.returncode, 0, ret.stderr)
+        return read_capture(join(out_dir, "capture_dec{:d}.iqf".format(DEC)))
+
+    def test_decimation(self):
+        """
+            The data frames are filtered as one continuous stream over the
+            calibration frames, which are only converted
+        """
+        frames = self._run("-j", "1")
+        self.assertEqual(len(frames), len(self.frame_types))
+
+        data = np.concatenate([cu8_to_cf32(p) for p, t in zip(self.payloads, self.frame_types)
+                               if t == IQHeader.FRAME_TYPE_DATA], axis=1)
+        ref = np.array([np.convolve(data[m, :], self.coeffs)[DEC-1:data.shape[1]:DEC] for m in range(M)])
+        out = np.concatenate([s for h, s in frames if h.frame_type == IQHeader.FRAME_TYPE_DATA], axis=1)
+        np.testing.assert_allclose(out, ref, atol=1e-5)
+
+        for index, (iq_header, samples) in enumerate(frames):
+            self.assertEqual(iq_header.cpi_index, index)
+            self.assertEqual(iq_header.sample_bit_depth, 32)
+            if iq_header.frame_type == IQHeader.FRAME_TYPE_DATA:
+                self.assertEqual(iq_header.cpi_length, N_DAQ//DEC)
+                self.assertEqual(iq_header.sampling_freq, 2400000//DEC)
+                self.assertEqual(iq_header.first_sample_index, index*N_DAQ+DEC-1)
+                self.assertEqual(iq_header.sample_index_step, DEC)
+            elif iq_header.frame_type == IQHeader.FRAME_TYPE_CAL:
+                np.testing.assert_array_equal(samples, cu8_to_cf32(self.payloads[index]))
+
+    def test_parallel_processing(self):
+        """
+            The output must not depend on the number of worker threads
+        """
+        single = self._run("-j", "1")
+        parallel = self._run("-j", "4")
+        for (h1, s1), (h2, s2) in zip(single, parallel):
+            self.assertEqual(h1.encode_header(), h2.encode_header())
+            np.testing.assert_array_equal(s1, s2)
+
+    def test_frame_range(self):
+        frames = self._run("-s", "20", "-n", "5")
+        full = self._run()
+        self.assertEqual(len(frames), 5)
+        for (h1, s1), (h2, s2) in zip(frames, full[20:25]):
+            self.assertEqual(h1.daq_block_index, h2.daq_block_index)
+            np.testing.assert_array_equal(s1, s2)
+
+    def test_iq_correction(self):
+        corrections = np.exp(1j*np.deg2rad([0, 30, -60, 90])).astype(np.complex64)*np.float32(2)
+        corr_fname = join(self.tmp_dir.name, "corrections.txt")
+        np.savetxt(corr_fname, np.column_stack((corrections.real, corrections.imag)))
+        corrected = self._run("-q", corr_fname)
+        raw = self._run()
+        for (h, s), (h_raw, s_raw) in zip(corrected, raw):
+            if s_raw.size == 0:
+                continue
+            ref = (s_raw-np.mean(s_raw, axis=1, keepdims=True))*corrections[:s_raw.shape[0], None]
+            np.testing.assert_allclose(s, ref, atol=1e-5)
+
+    def test_channel_mask(self):
+        """
+            The IQ corrections of a masked capture belong to the receiver channels
+            of the payload slots
+        """
+        ch_mask = 0b1011
+        self.payloads = write_capture(self.capture, self.frame_types, self.rng, ch_mask)
+        corrections = np.exp(1j*np.deg2rad([0, 30, -60, 90])).astype(np.complex64)
+        corr_fname = join(self.tmp_dir.name, "corrections.txt")
+        np.savetxt(corr_fname, np.column_stack((corrections.real, corrections.imag)))
+        corrected = self._run("-q", corr_fname, "-j", "4")
+        raw = self._run("-j", "1")
+        for (h, s), (h_raw, s_raw) in zip(corrected, raw):
+            self.assertEqual(h.active_ch_mask, ch_mask)
+            self.assertEqual(s.shape[0], 3)
+            if s_raw.size == 0:
+                continue
+            ref = (s_raw-np.mean(s_raw, axis=1, keepdims=True))*corrections[[0, 1, 3], None]
+            np.testing.assert_allclose(s, ref, atol=1e-5)
+
+if __name__ == '__main__':
+    unittest.main()
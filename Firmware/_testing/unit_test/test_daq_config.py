@@ -0,0 +1,219 @@
+"""
+	Description :
+	Unit test for the shared configuration loader and validator
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import os
+import tempfile
+import subprocess
+
+current_path      = dirname(realpath(__file__))
+root_path         = dirname(dirname(current_path))
+daq_core_path     = join(root_path, "_daq_core")
+config_files_path = join(dirname(root_path), "config_files")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from daq_config import load_daq_config, check_daq_config, check_config_file, graph_stages, graph_input_link, \
+                       link_numa_policy, iq_frame_length
+
+class TesterDaqConfig(unittest.TestCase):
+
+    def setUp(self):
+        with open(join(config_files_path, "kraken_default", "daq_chain_config.ini")) as f:
+            self.reference_ini = f.read()
+        self.tmp_files = []
+
+    def tearDown(self):
+        for fname in self.tmp_files:
+            os.remove(fname)
+
+    def _write_ini(self, replacements):
+        """
+            Writes a modified copy of the reference configuration
+
+            :param replacements: list of (original line, new line) tuples
+        """
+        ini = self.reference_ini
+        for old, new in replacements:
+            self.assertIn(old, ini)
+            ini = ini.replace(old, new)
+        fd, fname = tempfile.mkstemp(suffix=".ini")
+        with os.fdopen(fd, "w") as f:
+            f.write(ini)
+        self.tmp_files.append(fname)
+        return fname
+
+    def test_shipped_configs(self):
+        """
+            All the configuration files shipped with the firmware must pass the check
+        """
+        for config_dir in os.listdir(config_files_path):
+            fname = join(config_files_path, config_dir, "daq_chain_config.ini")
+            with self.subTest(config=config_dir):
+                self.assertEqual(check_config_file(fname), [])
+
+    def test_typed_fields(self):
+        config, ret = load_daq_config(join(config_files_path, "kerberos_default", "daq_chain_config.ini"))
+        self.assertEqual(ret, 0)
+        self.assertEqual(config.num_ch, 4)
+        self.assertEqual(config.config_name, b"kerberos_default")
+        self.assertEqual(config.get_list("en_bias_tee"), [0, 0, 0, 0])
+        self.assertEqual(len(config.get_list("iq_adjust_amplitude")), 4)
+
+    def test_invalid_field(self):
+        fname = self._write_ini([("cpi_size = 1048576", "cpi_size = 1M")])
+        config, ret = load_daq_config(fname)
+        self.assertEqual(ret, -2)
+        self.assertIn(b"pre_processing.cpi_size", config.invalid_fields)
+        self.assertNotEqual(check_daq_config(config), [])
+
+    def test_cross_field_constraints(self):
+        fname = self._write_ini([("daq_buffer_size = 262144", "daq_buffer_size = 262143"),
+                                 ("decimation_ratio = 1",     "decimation_ratio = 4"),
+                                 ("cpi_size = 1048576",       "cpi_size = 32768"),
+                                 ("en_bias_tee = 0,0,0,0,0",  "en_bias_tee = 0,0,0")])
+        errors = check_config_file(fname)
+        self.assertEqual(len(errors), 4, errors)  # buffer size, tap size, CPI duration, bias tee list
+
+    def test_cal_track_modes(self):
+        fname = self._write_ini([("cal_track_mode = 2", "cal_track_mode = 3")])
+        self.assertEqual(check_config_file(fname), [])
+        fname = self._write_ini([("cal_track_mode = 2", "cal_track_mode = 4")])
+        self.assertEqual(len(check_config_file(fname)), 1)
+
+    def test_stage_graph_bypass(self):
+        """
+            Without decimation the decimator is bypassed and the delay synchronizer
+            reads the rebuffer output directly
+        """
+        config, _ = load_daq_config(join(config_files_path, "kraken_default", "daq_chain_config.ini"))
+        self.assertEqual(graph_stages(config), ["rtl_daq", "rebuffer", "delay_sync"])
+        self.assertEqual(graph_input_link(config, "delay_sync"), "decimator_in")
+        self.assertIsNone(graph_input_link(config, "decimator"))
+
+        config, _ = load_daq_config(self._write_ini([("en_bypass = 1", "en_bypass = 0")]))
+        self.assertEqual(graph_stages(config), ["rtl_daq", "rebuffer", "decimator", "delay_sync"])
+        self.assertEqual(graph_input_link(config, "decimator"), "decimator_in")
+        self.assertEqual(graph_input_link(config, "delay_sync"), "decimator_out")
+
+        config, _ = load_daq_config(self._write_ini([("decimation_ratio = 1", "decimation_ratio = 4"),
+                                                     ("fir_tap_size = 1", "fir_tap_size = 64")]))
+        self.assertEqual(check_daq_config(config), [])
+        self.assertEqual(graph_input_link(config, "delay_sync"), "decimator_out")
+
+    def test_stage_graph_constraints(self):
+        chain = "chain = rtl_daq > rebuffer > decimator > delay_sync"
+        fname = self._write_ini([(chain, "chain = rtl_daq > rebuffer > delay_sync")])
+        self.assertEqual(check_config_file(fname), [])
+        fname = self._write_ini([(chain, "chain = rtl_daq > rebuffer > delay_sync"),
+                                 ("decimation_ratio = 1", "decimation_ratio = 4"),
+                                 ("fir_tap_size = 1", "fir_tap_size = 64")])
+        self.assertEqual(len(check_config_file(fname)), 1)  # Decimator is required
+        for invalid in ["rtl_daq > decimator > rebuffer > delay_sync", "rtl_daq > rebuffer > squelch > delay_sync",
+                        "rtl_daq > rebuffer > decimator", "rtl_daq >> rebuffer > delay_sync"]:
+            with self.subTest(chain=invalid):
+                fname = self._write_ini([(chain, "chain = "+invalid)])
+                config, _ = load_daq_config(fname)
+                self.assertEqual(len(check_daq_config(config)), 1)
+                self.assertEqual(graph_stages(config), [])
+
+    def test_numa_placement(self):
+        """
+            The links are placed by the producer by default, the CPUs of the
+            producer and the consumer come from the stage pinning
+        """
+        config, _ = load_daq_config(join(config_files_path, "kraken_default", "daq_chain_config.ini"))
+        self.assertEqual(link_numa_policy(config, "rebuffer"), ("first_touch", -1, -1))
+        self.assertIsNone(link_numa_policy(config, "decimator"))
+
+        en_bypass = "en_bypass = 1"
+        numa = "\n[launcher]\ncpu_rebuffer = 2\ncpu_decimator = 3\ncpu_delay_sync = 8\n" \
+               "\n[numa]\ndecimator_in = consumer\ndecimator_out = pinning\ndelay_sync_iq = interleave\n"
+        fname = self._write_ini([(en_bypass, en_bypass+numa)])
+        config, ret = load_daq_config(fname)
+        self.assertEqual(ret, 0)
+        self.assertEqual(check_daq_config(config), [])
+        self.assertEqual(link_numa_policy(config, "rebuffer"), ("consumer", 2, 8)) # Read by delay_sync
+        self.assertEqual(link_numa_policy(config, "delay_sync"), ("interleave", 8, -1))
+
+        config, _ = load_daq_config(self._write_ini([(en_bypass, "en_bypass = 0"+numa)]))
+        self.assertEqual(link_numa_policy(config, "rebuffer"), ("consumer", 2, 3))
+        self.assertEqual(link_numa_policy(config, "decimator"), ("pinning", 3, 8))
+
+        fname = self._write_ini([(en_bypass, en_bypass+"\n[numa]\ndecimator_in = remote\n")])
+        self.assertEqual(len(check_config_file(fname)), 1)
+
+    def test_perf_counters(self):
+        config, _ = load_daq_config(join(config_files_path, "kraken_default", "daq_chain_config.ini"))
+        self.assertEqual((config.en_perf_counters, config.perf_report_interval, config.en_perf_frame_log), (0, 100, 0))
+
+        en_bypass = "en_bypass = 1"
+        fname = self._write_ini([(en_bypass, en_bypass+"\n[perf]\nen_counters = 1\nreport_interval = 20\nen_frame_log = 1\n")])
+        config, ret = load_daq_config(fname)
+        self.assertEqual(ret, 0)
+        self.assertEqual(check_daq_config(config), [])
+        self.assertEqual((config.en_perf_counters, config.perf_report_interval, config.en_perf_frame_log), (1, 20, 1))
+
+        fname = self._write_ini([(en_bypass, en_bypass+"\n[perf]\nen_counters = 2\nreport_interval = 0\n")])
+        self.assertEqual(len(check_config_file(fname)), 2)
+
+    def test_spectrum_output(self):
+        """
+            With overlapping segments the spectral frames are longer than the CPI,
+            the delay_sync_iq link is sized for them
+        """
+        config, _ = load_daq_config(join(config_files_path, "kraken_default", "daq_chain_config.ini"))
+        self.assertEqual(config.en_spectrum, 0)
+        self.assertEqual(iq_frame_length(config), 1048576)
+
+        en_bypass = "en_bypass = 1"
+        fname = self._write_ini([(en_bypass, en_bypass+"\n[spectrum]\nen_spectrum = 1\nfft_size = 4096\noverlap = 1024\nwindow = blackman\n")])
+        config, ret = load_daq_config(fname)
+        self.assertEqual(ret, 0)
+        self.assertEqual(check_daq_config(config), [])
+        self.assertEqual(config.spectrum_window, b"blackman")
+        self.assertEqual(iq_frame_length(config), ((1048576-4096)//3072+1)*4096)
+
+        fname = self._write_ini([(en_bypass, en_bypass+"\n[spectrum]\nen_spectrum = 1\nfft_size = 131072\noverlap = 131072\nwindow = kaiser\n")])
+        self.assertEqual(len(check_config_file(fname)), 3) # FFT size over the correlation size, overlap, window
+
+    def test_missing_file(self):
+        _, ret = load_daq_config(join(current_path, "not_existing.ini"))
+        self.assertEqual(ret, -1)
+
+    def test_cli_checker(self):
+        ret = subprocess.run([join(daq_core_path, "daq_config_check.out"),
+                              join(config_files_path, "kraken_default", "daq_chain_config.ini")],
+                             capture_output=True, text=True)
+        self.assertEqual(ret.returncode, 0)
+        self.assertEqual(ret.stderr, "")
+        ret = subprocess.run([join(daq_core_path, "daq_config_check.out"), "-g",
+                              join(config_files_path, "kraken_default", "daq_chain_config.ini")],
+                             capture_output=True, text=True)
+        self.assertEqual(ret.stdout, "rtl_daq rebuffer delay_sync\n")
+
+if __name__ == '__main__':
+    unittest.main()
@@ -24,9 +24,11 @@
 """
 import unittest
 from os.path import join, dirname, realpath
+import os
 import sys
 import subprocess
 import logging
+import threading
 import numpy as np
 from struct import pack
 import time
@@ -45,6 +47,68 @@ sys.path.insert(0, daq_core_path)
 sys.path.insert(0, unit_test_path)
 from iq_header import IQHeader
 from capture_shmem_stream import IQFrameRecorder
+from daq_config import load_daq_config, graph_input_link
+from delay_sync import delaySynchronizer, CalibrationWorker
+
+# Input link of the delay synchronizer in the active stage graph (the decimator may be bypassed)
+in_link = graph_input_link(load_daq_config(join(root_path, "daq_chain_config.ini"))[0], "delay_sync")
+# The raw rebuffer output holds 8 bit samples, the decimator output complex float32 ones
+in_data_type = "CINT8" if in_link == "decimator_in" else "CF32"
+
+class FrameSource:
+    """
+        Replaces the input link of the delay synchronizer, hands over the prepared frames one by one.
+        The next frame is only given when the calibration worker has finished, so the results are
+        applied on the same frames as in a chain that is not loaded.
+    """
+    def __init__(self, frames, cal_worker):
+        self.frames = frames
+        self.cal_worker = cal_worker
+        self.buffers = [None, None]
+        self.frame_index = 0
+
+    def wait_buff_free(self):
+        while self.cal_worker.busy and self.cal_worker.results.empty():
+            time.sleep(0.001)
+        if self.frame_index == len(self.frames):
+            return -1 # Stops the processing loop
+        buffer_index = self.frame_index % 2
+        self.buffers[buffer_index] = self.frames[self.frame_index]
+        self.frame_index += 1
+        return buffer_index
+
+    def send_ctr_buff_ready(self, buffer_index):
+        pass
+
+class FrameSink:
+    """
+        Replaces an output link of the delay synchronizer, keeps the headers of the sent frames
+    """
+    def __init__(self, size):
+        self.buffers = [np.zeros(size, dtype=np.uint8), np.zeros(size, dtype=np.uint8)]
+        self.dropped_frame_cntr = 0
+        self.headers = []
+
+    def wait_buff_free(self):
+        return len(self.headers) % 2
+
+    def send_ctr_buff_ready(self, buffer_index):
+        iq_header = IQHeader()
+        iq_header.decode_header(self.buffers[buffer_index][0:1024].tobytes())
+        self.headers.append(iq_header)
+
+class TuneSocket:
+    """
+        Replaces the control socket of the rtl_daq module
+    """
+    def __init__(self):
+        self.messages = []
+
+    def send(self, msg):
+        self.messages.append(msg)
+
+    def recv(self):
+        return b"ok"
 
 class TesterDelaySyncModule(unittest.TestCase):
 
@@ -55,9 +119,9 @@ class TesterDelaySyncModule(unittest.TestCase):
         logging.info("--> Starting Delay synchronizer unit test <--")
         try:
             # Close control FIFOs
-            proc = subprocess.Popen(["rm",join(data_control_path,"fw_decimator_out")], stderr=subprocess.DEVNULL)
+            proc = subprocess.Popen(["rm",join(data_control_path,"fw_"+in_link)], stderr=subprocess.DEVNULL)
             proc.wait()
-            proc = subprocess.Popen(["rm",join(data_control_path,"bw_decimator_out")], stderr=subprocess.DEVNULL)
+            proc = subprocess.Popen(["rm",join(data_control_path,"bw_"+in_link)], stderr=subprocess.DEVNULL)
             proc.wait()
 
             proc = subprocess.Popen(["rm",join(data_control_path,"fw_delay_sync_iq")], stderr=subprocess.DEVNULL)
@@ -80,9 +144,9 @@ class TesterDelaySyncModule(unittest.TestCase):
         self.fd_log_delay_sync_err = open(join(log_path,"delay_sync.log"), "w")
 
         # Set-up control FIFOs   
-        proc = subprocess.Popen(["mkfifo",join(data_control_path,"fw_decimator_out")])
+        proc = subprocess.Popen(["mkfifo",join(data_control_path,"fw_"+in_link)])
         proc.wait()
-        proc = subprocess.Popen(["mkfifo",join(data_control_path,"bw_decimator_out")])
+        proc = subprocess.Popen(["mkfifo",join(data_control_path,"bw_"+in_link)])
         proc.wait()
 
         proc = subprocess.Popen(["mkfifo",join(data_control_path,"fw_delay_sync_iq")])
@@ -101,9 +165,9 @@ class TesterDelaySyncModule(unittest.TestCase):
         self.fd_log_delay_sync_err.close()
         
         # Close control FIFOs
-        proc = subprocess.Popen(["rm",join(data_control_path,"fw_decimator_out")], stderr=subprocess.DEVNULL)
+        proc = subprocess.Popen(["rm",join(data_control_path,"fw_"+in_link)], stderr=subprocess.DEVNULL)
         proc.wait()
-        proc = subprocess.Popen(["rm",join(data_control_path,"bw_decimator_out")], stderr=subprocess.DEVNULL)
+        proc = subprocess.Popen(["rm",join(data_control_path,"bw_"+in_link)], stderr=subprocess.DEVNULL)
         proc.wait()
 
         proc = subprocess.Popen(["rm",join(data_control_path,"fw_delay_sync_iq")], stderr=subprocess.DEVNULL)
@@ -140,6 +204,194 @@ class TesterDelaySyncModule(unittest.TestCase):
         
         # -> Assert <-
         self.assertTrue(data_throughput_ratio > 1.5)
+
+    def test_case_6_101(self):
+        logging.info("-> Starting Test Case [101] : Calibration worker job ordering")
+
+        # -> Assume <-
+        release = threading.Event()
+        jobs = []
+        def compute(state, frame_type, iq_samples, channel_list, std_ch_ind):
+            jobs.append((state, channel_list, std_ch_ind))
+            release.wait()
+            return state
+        worker = CalibrationWorker(compute)
+        worker.start()
+        iq_samples = np.ones((3, 16), dtype=np.complex64)
+
+        # -> Action & Assert <-
+        # The result is returned once, tagged with the submitted frame
+        worker.submit("STATE_IQ_CAL", IQHeader.FRAME_TYPE_CAL, 7, 100, iq_samples, [1, 2], 0)
+        self.assertTrue(worker.busy)
+        self.assertIsNone(worker.poll())
+        release.set()
+        result = self._wait_cal_result(worker)
+        self.assertEqual(result, ("STATE_IQ_CAL", IQHeader.FRAME_TYPE_CAL, 7, 100, "STATE_IQ_CAL"))
+        self.assertFalse(worker.busy)
+        self.assertIsNone(worker.poll())
+
+        # Results follow the submission order
+        worker.submit("STATE_TRACK", IQHeader.FRAME_TYPE_DATA, 8, 100, iq_samples, [0, 2], 1)
+        self.assertEqual(self._wait_cal_result(worker)[2], 8)
+        self.assertEqual(jobs, [("STATE_IQ_CAL", [1, 2], 0), ("STATE_TRACK", [0, 2], 1)])
+
+        # Drain waits for the running job and drops its result
+        release.clear()
+        worker.submit("STATE_TRACK", IQHeader.FRAME_TYPE_DATA, 9, 100, iq_samples, [1, 2], 0)
+        drain = threading.Thread(target=worker.drain)
+        drain.start()
+        drain.join(0.2)
+        self.assertTrue(drain.is_alive())
+        release.set()
+        drain.join(5)
+        self.assertFalse(drain.is_alive())
+        self.assertFalse(worker.busy)
+        self.assertIsNone(worker.poll())
+        worker.stop()
+
+    def test_case_6_102(self):
+        logging.info("-> Starting Test Case [102] : Channel mask change drains the calibration worker")
+
+        # -> Assume <-
+        delay_sync = self._new_delay_synchronizer()
+        release = threading.Event()
+        jobs = []
+        def compute(state, frame_type, iq_samples, channel_list, std_ch_ind):
+            jobs.append((channel_list, std_ch_ind))
+            release.wait()
+            return None
+        delay_sync.cal_worker = CalibrationWorker(compute)
+        delay_sync.cal_worker.start()
+        M = delay_sync.M
+        delay_sync.current_state = "STATE_SAMPLE_CAL"
+        delay_sync._submit_cal(np.ones((M, delay_sync.N_proc), dtype=np.complex64))
+
+        # -> Action <- Drop the standard channel while the job is running
+        new_mask = delay_sync.ch_mask & ~1
+        mask_change = threading.Thread(target=delay_sync._set_channel_mask, args=(new_mask,))
+        mask_change.start()
+        mask_change.join(0.2)
+        blocked = mask_change.is_alive()
+        release.set()
+        mask_change.join(5)
+
+        # -> Assert <-
+        self.assertTrue(blocked)
+        self.assertFalse(delay_sync.cal_worker.busy)
+        self.assertIsNone(delay_sync.cal_worker.poll())
+        # The job worked on the channel layout it was submitted with
+        self.assertEqual(jobs, [(list(range(1, M)), 0)])
+        self.assertEqual(delay_sync.channel_list, list(range(1, M-1)))
+        delay_sync.cal_worker.stop()
+
+    def test_case_6_103(self):
+        logging.info("-> Starting Test Case [103] : Sample delays are applied with the worker result")
+
+        # -> Assume <-
+        delays = [0, 0, 5, 0, -3]
+        delay_sync = self._new_delay_synchronizer()
+        M = delay_sync.M
+        delays = delays[0:M]
+        rng = np.random.default_rng(103)
+        frames = [self._make_frame(IQHeader.FRAME_TYPE_CAL, self._cal_samples(rng, M, delays), k) for k in range(3)]
+
+        # -> Action <-
+        hwc_sink = self._run_frames(delay_sync, frames)
+
+        # -> Assert <-
+        self.assertEqual([h.sync_state for h in hwc_sink.headers], [1, 2, 3])
+        self.assertEqual(list(delay_sync.delays), [-d for d in delays])
+        self.assertEqual(len(delay_sync.rtl_daq_socket.messages), 1)
+
+    def test_case_6_104(self):
+        logging.info("-> Starting Test Case [104] : Blind tracking requests calibration on drift")
+
+        # -> Assume <- Phase of channel 2 drifts 0.5 deg per data frame
+        delay_sync = self._new_delay_synchronizer()
+        delay_sync.cal_track_mode = 3
+        drifts = np.zeros(delay_sync.M)
+        drifts[2] = 0.5
+
+        # -> Action <-
+        sync_states = [h.sync_state for h in self._run_track_test(delay_sync, 104, drifts)]
+
+        # -> Assert <- The burst is requested once the drift exceeds the phase tolerance
+        self.assertEqual(sync_states[0:2], [6, 6])
+        self.assertIn(7, sync_states)
+        first_request = sync_states.index(7)
+        self.assertGreater(first_request*drifts[2], delay_sync.phase_diff_tolerance)
+        self.assertTrue(all(state == 7 for state in sync_states[first_request:]))
+
+    def test_case_6_105(self):
+        logging.info("-> Starting Test Case [105] : Blind tracking on a stable array")
+
+        # -> Assume <-
+        delay_sync = self._new_delay_synchronizer()
+        delay_sync.cal_track_mode = 3
+
+        # -> Action <-
+        sync_states = [h.sync_state for h in self._run_track_test(delay_sync, 105, np.zeros(delay_sync.M))]
+
+        # -> Assert <-
+        self.assertEqual(sync_states, [6]*len(sync_states))
+
+    def test_case_6_106(self):
+        logging.info("-> Starting Test Case [106] : Coherence monitor on a phase jump")
+
+        # -> Assume <- 30 deg phase jump on channel 3 at the 8th tracked frame
+        delay_sync = self._new_delay_synchronizer()
+        jump_phases = np.zeros(delay_sync.M)
+        jump_phases[3] = 30
+
+        # -> Action <-
+        headers = self._run_track_test(delay_sync, 106, np.zeros(delay_sync.M), jump_frame=8, jump_phases=jump_phases)
+
+        # -> Assert <-
+        self.assertFalse(self.check_sync_loss(headers, 8, delay_sync.max_sync_fails))
+
+    def test_case_6_107(self):
+        logging.info("-> Starting Test Case [107] : Coherence monitor on a delay jump")
+
+        # -> Assume <- Channel 1 slips one sample at the 8th tracked frame
+        delay_sync = self._new_delay_synchronizer()
+        jump_delays = [0]*delay_sync.M
+        jump_delays[1] = 1
+
+        # -> Action <-
+        headers = self._run_track_test(delay_sync, 107, np.zeros(delay_sync.M), jump_frame=8, jump_delays=jump_delays)
+
+        # -> Assert <-
+        self.assertFalse(self.check_sync_loss(headers, 8, delay_sync.max_sync_fails))
+
+    def test_case_6_108(self):
+        logging.info("-> Starting Test Case [108] : Coherence monitor on coherent frames")
+
+        # -> Assume <-
+        delay_sync = self._new_delay_synchronizer()
+
+        # -> Action <-
+        headers = self._run_track_test(delay_sync, 108, np.zeros(delay_sync.M), data_frames=24)
+
+        # -> Assert <-
+        self.assertTrue(all(h.sync_state == 6 and h.delay_sync_flag and h.iq_sync_flag for h in headers))
+        self.assertEqual(delay_sync.sync_failed_cntr_total, 0)
+
+    def test_case_6_109(self):
+        logging.info("-> Starting Test Case [109] : CPI indexes with bypassed decimator")
+
+        # -> Assume <- Raw 8 bit frames of the rebuffer, the first one is a dummy frame
+        delay_sync = self._new_delay_synchronizer()
+        M = delay_sync.M
+        raw_samples = np.full((M, 2*self.N_INPROC), 127, dtype=np.uint8)
+        frames = [self._make_frame(IQHeader.FRAME_TYPE_DUMMY, raw_samples[:, 0:0], 0)]
+        frames += [self._make_frame(IQHeader.FRAME_TYPE_DATA, raw_samples, k) for k in range(1, 4)]
+
+        # -> Action <-
+        hwc_sink = self._run_frames(delay_sync, frames)
+
+        # -> Assert <- Numbered from 0 like the decimator output
+        self.assertEqual([h.cpi_index for h in hwc_sink.headers], [0, 1, 2, 3])
+        self.assertTrue(all(h.sample_bit_depth == 32 and h.data_type == 3 for h in hwc_sink.headers))
         
     #############################################
     #              TEST RUN WRAPPERS            #  
@@ -151,8 +403,8 @@ class TesterDelaySyncModule(unittest.TestCase):
         test_iq_frame_bytes = subprocess.Popen(["python3",join(unit_test_path,"gen_std_frame.py"),
                                                 "-t", str(IQHeader.FRAME_TYPE_DATA),
                                                 "-b", str(frame_count),
-                                                "-d", "CF32",
-                                                "-m", "decimator_out"], 
+                                                "-d", in_data_type,
+                                                "-m", in_link], 
                                                stdout=subprocess.DEVNULL, 
                                                stderr=self.fd_log_gen_err)
         # Start delay sync module        
@@ -194,10 +446,133 @@ class TesterDelaySyncModule(unittest.TestCase):
         
         return data_throughput_ratio
 
+    # Reduced frame sizes of the in-process tests
+    N_INPROC = 2**12
+
+    def _new_delay_synchronizer(self):
+        """
+            Creates a delay synchronizer with the chain configuration and reduced frame sizes,
+            the links are replaced by the _run_frames function
+        """
+        cwd = os.getcwd()
+        os.chdir(root_path)
+        try:
+            delay_sync = delaySynchronizer()
+        finally:
+            os.chdir(cwd)
+        delay_sync.N = self.N_INPROC
+        delay_sync.N_proc = self.N_INPROC
+        delay_sync.rtl_daq_socket = TuneSocket()
+        return delay_sync
+
+    def _make_frame(self, frame_type, iq_samples, daq_block_index):
+        """
+            Assembles an input frame of the delay synchronizer. Complex samples give a decimator
+            output frame (complex float32), interleaved uint8 I/Q samples give a raw rebuffer frame.
+        """
+        iq_header = IQHeader()
+        iq_header.frame_type       = frame_type
+        iq_header.active_ant_chs   = iq_samples.shape[0]
+        iq_header.rf_center_freq   = 100000000
+        iq_header.adc_sampling_freq= 2400000
+        iq_header.sampling_freq    = 2400000
+        iq_header.daq_block_index  = daq_block_index
+        if iq_samples.dtype == np.uint8:
+            iq_header.cpi_length       = iq_samples.shape[1]//2
+            iq_header.sample_bit_depth = 8
+            payload = iq_samples.tobytes()
+        else:
+            iq_header.cpi_length       = iq_samples.shape[1]
+            iq_header.cpi_index        = daq_block_index
+            iq_header.data_type        = 3
+            iq_header.sample_bit_depth = 32
+            payload = iq_samples.astype(np.complex64).tobytes()
+        return np.frombuffer(iq_header.encode_header() + payload, dtype=np.uint8).copy()
+
+    def _cal_samples(self, rng, M, delays, phases=None):
+        """
+            Noise source signal delayed by the given number of samples and phase shifted on the channels
+        """
+        N = self.N_INPROC
+        sig = (rng.standard_normal(N+64) + 1j*rng.standard_normal(N+64))/np.sqrt(2)
+        phases = np.zeros(M) if phases is None else np.deg2rad(phases)
+        iq_samples = np.zeros((M, N), dtype=np.complex64)
+        for m in range(M):
+            iq_samples[m,:] = sig[32-delays[m]:32-delays[m]+N] * np.exp(1j*phases[m])
+            iq_samples[m,:] += 0.01*(rng.standard_normal(N) + 1j*rng.standard_normal(N))
+        return iq_samples
+
+    def _run_track_test(self, delay_sync, seed, drifts, data_frames=16, jump_frame=None, jump_phases=None, jump_delays=None):
+        """
+            Calibrates the synchronizer on noise source frames, then feeds data frames of a single
+            dominant source. The phases of the channels drift by "drifts" [deg] per data frame,
+            from the "jump_frame"th tracked frame on the channels are shifted by "jump_phases" [deg]
+            and delayed by "jump_delays" [sample].
+            Returns the headers sent with the tracked data frames.
+        """
+        M = delay_sync.M
+        N = self.N_INPROC
+        rng = np.random.default_rng(seed)
+        phases = rng.uniform(-180, 180, M) # Channel phase errors
+        response = np.exp(1j*rng.uniform(-np.pi, np.pi, M)) # Array response of the source
+        frames = [self._make_frame(IQHeader.FRAME_TYPE_CAL, self._cal_samples(rng, M, [0]*M, phases), k) for k in range(8)]
+        for b in range(data_frames):
+            sig = (rng.standard_normal(N+64) + 1j*rng.standard_normal(N+64))/np.sqrt(2)
+            channel_phases = phases + drifts*b
+            delays = [0]*M
+            if jump_frame is not None and b >= jump_frame+1: # +1: The first data frame is not tracked
+                channel_phases = channel_phases + (jump_phases if jump_phases is not None else 0)
+                delays = jump_delays if jump_delays is not None else delays
+            iq_samples = np.array([sig[32-delays[m]:32-delays[m]+N] for m in range(M)])
+            iq_samples *= (response*np.exp(1j*np.deg2rad(channel_phases)))[:, None]
+            iq_samples += 0.01*(rng.standard_normal((M, N)) + 1j*rng.standard_normal((M, N)))
+            frames.append(self._make_frame(IQHeader.FRAME_TYPE_DATA, iq_samples, len(frames)))
+
+        hwc_sink = self._run_frames(delay_sync, frames)
+        self.assertEqual(len(hwc_sink.headers), len(frames))
+        # The first data frame closes the calibration (STATE_TRACK_LOCK)
+        return [h for h in hwc_sink.headers if h.frame_type == IQHeader.FRAME_TYPE_DATA][1:]
+
+    def _run_frames(self, delay_sync, frames):
+        """
+            Runs the processing loop of the delay synchronizer on the given frames,
+            returns the sink holding the headers sent toward the HW controller
+        """
+        size = 1024 + self.N_INPROC*delay_sync.M*8
+        delay_sync.in_shmem_iface = FrameSource(frames, delay_sync.cal_worker)
+        delay_sync.out_shmem_iface_iq = FrameSink(size)
+        delay_sync.out_shmem_iface_hwc = FrameSink(size)
+        delay_sync.out_snapshot_iface_iq = None
+        delay_sync.start()
+        return delay_sync.out_shmem_iface_hwc
+
+    def _wait_cal_result(self, worker, timeout=5):
+        t_end = time.time() + timeout
+        result = worker.poll()
+        while result is None and time.time() < t_end:
+            time.sleep(0.001)
+            result = worker.poll()
+        return result
+
     #############################################
     #         RESULT CHECKER FUNCTIONS          #  
     #############################################
     
+    def check_sync_loss(self, headers, jump_frame, max_frames):
+        """
+            Checks that the sync flags are set until the jump and cleared
+            within max_frames frames after it
+        """
+        sync = [h.delay_sync_flag == 1 and h.iq_sync_flag == 1 for h in headers]
+        if not all(sync[0:jump_frame]):
+            logging.error("False sync loss before the jump, frame: {:d}".format(sync.index(False)))
+            return -1
+        if all(sync[jump_frame:jump_frame+max_frames]):
+            logging.error("Sync loss is not detected in {:d} frames".format(max_frames))
+            return -2
+        logging.info("Sync loss detected after {:d} frames".format(sync[jump_frame:].index(False)))
+        return 0
+
     def check_frame(self, file_name, frame_count, frame_type):
         iq_header = IQHeader()
         blocks = 0
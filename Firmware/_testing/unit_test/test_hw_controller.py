@@ -0,0 +1,189 @@
+"""
+	Description :
+	Unit test for the control interface of the hardware controller module
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import os
+import socket
+import threading
+import queue
+import time
+from struct import pack, unpack
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from iq_header import IQHeader
+from hw_controller import HWC, CMD_STATUS_DONE, CMD_STATUS_FAILED
+
+class FrameSource:
+    """
+        Replaces the input link of the hardware controller, frames are handed over one by one
+    """
+    def __init__(self):
+        self.frames = queue.Queue()
+        self.processed = queue.Queue()
+        self.buffers = [None, None]
+        self.frame_cntr = 0
+
+    def wait_buff_free(self):
+        frame = self.frames.get()
+        if frame is None:
+            return -1 # Stops the processing loop
+        buffer_index = self.frame_cntr % 2
+        self.buffers[buffer_index] = frame
+        self.frame_cntr += 1
+        return buffer_index
+
+    def send_ctr_buff_ready(self, buffer_index):
+        self.processed.put(buffer_index)
+
+    def feed(self, cpi_index, rf_center_freq):
+        iq_header = IQHeader()
+        iq_header.frame_type     = IQHeader.FRAME_TYPE_DATA
+        iq_header.rf_center_freq = rf_center_freq
+        iq_header.cpi_index      = cpi_index
+        self.frames.put(np.frombuffer(iq_header.encode_header(), dtype=np.uint8).copy())
+        self.processed.get(timeout=5)
+
+class RtlDaqSocket:
+    """
+        Replaces the control socket of the rtl_daq module
+    """
+    def __init__(self):
+        self.messages = []
+
+    def send(self, msg):
+        self.messages.append(msg)
+
+    def recv(self):
+        return b"ok"
+
+class TesterHWController(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cwd = os.getcwd()
+        os.chdir(root_path)
+        try:
+            cls.hwc = HWC() # Starts the control interface server
+        finally:
+            os.chdir(cwd)
+        cls.hwc.rtl_daq_socket = RtlDaqSocket()
+        cls.hwc.cmd_socket = RtlDaqSocket()
+        cls.hwc.in_shmem_iface = FrameSource()
+        cls.hwc.cmd_worker = threading.Thread(target=cls.hwc._command_worker, daemon=True)
+        cls.hwc.cmd_worker.start()
+        cls.main_loop = threading.Thread(target=cls.hwc.start, daemon=True)
+        cls.main_loop.start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.hwc.in_shmem_iface.frames.put(None)
+        cls.main_loop.join(5)
+
+    def setUp(self):
+        t_end = time.time() + 5
+        while True:
+            try:
+                self.client = socket.create_connection(("localhost", self.hwc.ctr_iface_server.ctr_iface_port_no))
+                break
+            except ConnectionRefusedError:
+                if time.time() > t_end: raise
+                time.sleep(0.05)
+        self.client.settimeout(5)
+
+    def tearDown(self):
+        self.client.sendall(b"EXIT" + bytearray(self.hwc.ctr_iface_server.ctr_frame_length-4))
+        self.client.close()
+
+    def _send_cmd(self, command, payload=b""):
+        msg = command.encode() + payload
+        self.client.sendall(msg + bytearray(self.hwc.ctr_iface_server.ctr_frame_length-len(msg)))
+
+    def _recv_msg(self):
+        msg = bytearray()
+        while len(msg) < 128:
+            chunk = self.client.recv(128-len(msg))
+            self.assertTrue(chunk)
+            msg += chunk
+        return bytes(msg)
+
+    def _wait_worker(self):
+        t_end = time.time() + 5
+        while not self.hwc.pending_cmds and time.time() < t_end:
+            time.sleep(0.01)
+
+    def test_freq_completion_event(self):
+        freq = 433000000
+        source = self.hwc.in_shmem_iface
+        source.feed(10, 100000000)
+
+        self._send_cmd("EVNT", b"\x01")
+        self.assertEqual(self._recv_msg()[0:8], b"FNSD" + pack('I', 0))
+
+        # -> The command is acknowledged first with its ID
+        forwarded = len(self.hwc.cmd_socket.messages)
+        self._send_cmd("FREQ", pack('Q', freq))
+        reply = self._recv_msg()
+        self.assertEqual(reply[0:4], b"FNSD")
+        cmd_id = unpack('I', reply[4:8])[0]
+        self.assertGreater(cmd_id, 0)
+
+        # -> The completion is reported on the first frame carrying the new frequency
+        self._wait_worker()
+        source.feed(11, 100000000)
+        source.feed(12, freq)
+        event = self._recv_msg()
+        self.assertEqual(event[0:4], b"EVNT")
+        self.assertEqual(unpack('I', event[4:8])[0], cmd_id)
+        self.assertEqual(event[8:12], b"FREQ")
+        self.assertEqual(unpack('II', event[12:20]), (CMD_STATUS_DONE, 12))
+        self.assertEqual(len(self.hwc.cmd_socket.messages), forwarded+1) # Forwarded to rtl_daq by the worker
+
+    def test_failed_command_event(self):
+        source = self.hwc.in_shmem_iface
+        source.feed(20, 100000000)
+
+        self._send_cmd("EVNT", b"\x01")
+        self._recv_msg()
+
+        # -> The standard channel can not be disabled, the failure carries the CPI index of the last processed frame
+        self._send_cmd("CHMK", pack('I', 0))
+        reply = self._recv_msg()
+        self.assertEqual(reply[0:4], b"FNSD")
+        cmd_id = unpack('I', reply[4:8])[0]
+        event = self._recv_msg()
+        self.assertEqual(event[0:4], b"EVNT")
+        self.assertEqual(unpack('I', event[4:8])[0], cmd_id)
+        self.assertEqual(event[8:12], b"CHMK")
+        self.assertEqual(unpack('II', event[12:20]), (CMD_STATUS_FAILED, 20))
+
+if __name__ == '__main__':
+    unittest.main()
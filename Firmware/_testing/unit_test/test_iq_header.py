@@ -0,0 +1,173 @@
+"""
+	Description :
+	Unit test for the IQ header definitions
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import ctypes
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from iq_header import IQHeader, IQHeaderView, IQ_HEADER_DTYPE, IQ_HEADER_SIZE, check_iq_header_layout, iq_ch_meta_length
+
+class TesterIQHeader(unittest.TestCase):
+
+    def setUp(self):
+        self.iq_header = IQHeader()
+        self.iq_header.frame_type = IQHeader.FRAME_TYPE_CAL
+        self.iq_header.hardware_id = "KrakenSDR"
+        self.iq_header.active_ant_chs = 5
+        self.iq_header.rf_center_freq = 433000000
+        self.iq_header.sampling_freq = 2400000
+        self.iq_header.cpi_length = 2**20
+        self.iq_header.time_stamp = 1650000000000
+        self.iq_header.cpi_index = 12345
+        self.iq_header.ext_integration_cntr = 2**40+1
+        self.iq_header.if_gains = [m*10 for m in range(32)]
+        self.iq_header.noise_source_state = 1
+        self.iq_header.sample_index_step = 8
+        self.iq_header.first_sample_index = 2**33+7
+        self.iq_header.noise_source_switch_index = 2**33+1
+        self.iq_header.iq_corr_cpi_index = 12300
+        self.iq_header.active_ch_mask = 0b1011
+        self.iq_header.header_version = 13
+        self.iq_header.fft_size = 1024
+        self.iq_header.fft_hop = 768
+
+    def test_native_layout(self):
+        self.assertEqual(IQ_HEADER_DTYPE.itemsize, IQ_HEADER_SIZE)
+        self.assertEqual(check_iq_header_layout(), [])
+
+    def test_view_read(self):
+        """
+            Fields read through the view must match the encoded values
+        """
+        buffer = np.frombuffer(self.iq_header.encode_header(), dtype=np.uint8).copy()
+        view = IQHeaderView(buffer)
+        self.assertEqual(view.check_sync_word(), 0)
+        self.assertEqual(view.frame_type, IQHeader.FRAME_TYPE_CAL)
+        self.assertEqual(view.hardware_id.decode(), "KrakenSDR")
+        self.assertEqual(view.rf_center_freq, 433000000)
+        self.assertEqual(view.cpi_length, 2**20)
+        self.assertEqual(view.time_stamp, 1650000000000)
+        self.assertEqual(view.cpi_index, 12345)
+        self.assertEqual(view.ext_integration_cntr, 2**40+1)
+        self.assertEqual(list(view.if_gains), self.iq_header.if_gains)
+        self.assertEqual(view.noise_source_state, 1)
+        self.assertEqual(view.sample_index_step, 8)
+        self.assertEqual(view.first_sample_index, 2**33+7)
+        self.assertEqual(view.noise_source_switch_index, 2**33+1)
+        self.assertEqual(view.iq_corr_cpi_index, 12300)
+        self.assertEqual(view.active_ch_mask, 0b1011)
+        self.assertEqual((view.fft_size, view.fft_hop), (1024, 768))
+        self.assertEqual(view.header_version, 13)
+        self.assertEqual(view.payload_offset(), IQ_HEADER_SIZE)
+        self.assertEqual(view.get_ch_mask(), 0b1011)
+
+    def test_view_write(self):
+        """
+            Fields written through the view must modify the underlying buffer
+        """
+        buffer = np.zeros(IQ_HEADER_SIZE+64, dtype=np.uint8)
+        buffer[0:IQ_HEADER_SIZE] = np.frombuffer(self.iq_header.encode_header(), dtype=np.uint8)
+        view = IQHeaderView(buffer)
+        view.delay_sync_flag = 1
+        view.iq_sync_flag = 1
+        view.sync_state = 6
+        view.if_gains[4] = 496
+
+        decoded = IQHeader()
+        decoded.decode_header(buffer[0:IQ_HEADER_SIZE].tobytes())
+        self.assertEqual(decoded.delay_sync_flag, 1)
+        self.assertEqual(decoded.iq_sync_flag, 1)
+        self.assertEqual(decoded.sync_state, 6)
+        self.assertEqual(decoded.if_gains[4], 496)
+        self.assertEqual(decoded.cpi_index, 12345)
+        self.assertFalse(buffer[IQ_HEADER_SIZE:].any())
+
+    def test_ch_meta(self):
+        """
+            Headers of more than 32 channels carry the per-channel fields of all the
+            channels in the metadata block, read back by Python and by the native accessors
+        """
+        ch_cnt = 100
+        ch_mask = (1<<ch_cnt)-1 & ~(1<<3 | 1<<70)
+        self.iq_header.active_ant_chs = ch_cnt-2
+        self.iq_header.init_ch_meta(ch_cnt)
+        self.iq_header.active_ch_mask = ch_mask
+        self.iq_header.adc_overdrive_flags = 1<<1 | 1<<99
+        self.iq_header.if_gains = [m*3 for m in range(ch_cnt)]
+        self.assertEqual(self.iq_header.ch_meta_length, iq_ch_meta_length(ch_cnt))
+        self.assertEqual(self.iq_header.ch_meta_length % 64, 0)
+
+        frame = np.frombuffer(self.iq_header.encode_header(), dtype=np.uint8).copy()
+        self.assertEqual(frame.size, IQ_HEADER_SIZE+iq_ch_meta_length(ch_cnt))
+        view = IQHeaderView(frame)
+        self.assertEqual(view.check_ch_meta(), 0)
+        self.assertEqual(view.payload_offset(), frame.size)
+        self.assertEqual(view.active_ch_mask, ch_mask & 0xFFFFFFFF) # Fixed fields hold the first 32 channels
+        self.assertEqual(view.get_ch_mask(), ch_mask)
+        self.assertEqual(view.get_overdrive_flags(), 1<<1 | 1<<99)
+        self.assertEqual(view.get_if_gains().tolist(), self.iq_header.if_gains)
+
+        decoded = IQHeader()
+        decoded.decode_header(frame[0:IQ_HEADER_SIZE].tobytes())
+        self.assertEqual(decoded.get_ch_mask(), ch_mask & 0xFFFFFFFF)
+        self.assertEqual(decoded.decode_ch_meta(frame[IQ_HEADER_SIZE:].tobytes()), 0)
+        self.assertEqual(decoded.get_ch_mask(), ch_mask)
+        self.assertEqual(decoded.get_if_gains(), self.iq_header.if_gains)
+        self.assertEqual(decoded.encode_header(), frame.tobytes())
+
+        lib = ctypes.CDLL(join(daq_core_path, "libhdaq.so"))
+        class IQChMask(ctypes.Structure):
+            _fields_ = [("w", ctypes.c_uint64*4)]
+        lib.iq_header_check_ch_meta.argtypes = [ctypes.c_void_p]
+        lib.iq_header_payload_offset.argtypes = [ctypes.c_void_p]
+        lib.iq_header_payload_offset.restype = ctypes.c_size_t
+        lib.iq_header_get_ch_mask.argtypes = [ctypes.c_void_p, ctypes.POINTER(IQChMask)]
+        lib.iq_header_if_gain.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        lib.iq_header_if_gain.restype = ctypes.c_uint32
+        hdr = frame.ctypes.data
+        self.assertEqual(lib.iq_header_check_ch_meta(hdr), 0)
+        self.assertEqual(lib.iq_header_payload_offset(hdr), frame.size)
+        mask = IQChMask()
+        lib.iq_header_get_ch_mask(hdr, ctypes.byref(mask))
+        self.assertEqual(sum(w << 64*i for i, w in enumerate(mask.w)), ch_mask)
+        self.assertEqual([lib.iq_header_if_gain(hdr, m) for m in range(ch_cnt)], self.iq_header.if_gains)
+
+        view.ch_meta_length = 64 # Inconsistent with the channel count
+        self.assertEqual(view.check_ch_meta(), -1)
+        self.assertEqual(lib.iq_header_check_ch_meta(hdr), -1)
+
+    def test_sync_word(self):
+        buffer = np.zeros(IQ_HEADER_SIZE, dtype=np.uint8)
+        self.assertEqual(IQHeaderView(buffer).check_sync_word(), -1)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -79,6 +79,7 @@ class TesterRebufferModule(unittest.TestCase):
                 
         # Save default config file parameters
         self.N, self. R, self.N_daq, self.N_cal = self._read_config_file()
+        self.guard = self._read_noise_switch_guard()
         
     def tearDown(self):
         # Close log files
@@ -97,6 +98,7 @@ class TesterRebufferModule(unittest.TestCase):
         
         # Write back default config file parameters
         self._write_config_file(self.N, self.R, self.N_daq, self.N_cal)
+        self._write_noise_switch_guard(self.guard)
 
     #############################################
     #               TEST FUNCTIONS              #  
@@ -237,6 +239,48 @@ class TesterRebufferModule(unittest.TestCase):
         self._run_ramp_test(frame_count, frame_type, sample_size=N_daq)
         # -> Assert <-
         self.assertFalse(self.check_ramp(join(unit_test_path,'rebuffer_test_0.dat'), output_frame_count))
+    def test_case_2_13(self):
+        logging.info("-> Starting Test Case [2_13] :")
+        # -> Assume <- Switch index in the middle of a block
+        N_daq = 256
+        guard = 100
+        self._write_config_file(N=512, R=1, N_daq=N_daq, N_cal=512)
+        self._write_noise_switch_guard(guard)
+        switch_frame = 5
+        switch_index = self.NS_FIRST_INDEX + switch_frame*N_daq + 100
+        # -> Action <-
+        self._run_noise_switch_test(16, N_daq, switch_frame, switch_index)
+        # -> Assert <-
+        self.assertFalse(self.check_noise_switch(join(unit_test_path,'rebuffer_test_0.dat'),
+                                                 16, N_daq, 512, guard, switch_frame, switch_index))
+    def test_case_2_14(self):
+        logging.info("-> Starting Test Case [2_14] :")
+        # -> Assume <- Switch index on a block edge
+        N_daq = 256
+        guard = 100
+        self._write_config_file(N=512, R=1, N_daq=N_daq, N_cal=512)
+        self._write_noise_switch_guard(guard)
+        switch_frame = 6
+        switch_index = self.NS_FIRST_INDEX + switch_frame*N_daq
+        # -> Action <-
+        self._run_noise_switch_test(16, N_daq, switch_frame, switch_index)
+        # -> Assert <-
+        self.assertFalse(self.check_noise_switch(join(unit_test_path,'rebuffer_test_0.dat'),
+                                                 16, N_daq, 512, guard, switch_frame, switch_index))
+    def test_case_2_15(self):
+        logging.info("-> Starting Test Case [2_15] :")
+        # -> Assume <- Whole blocks fall inside the guard interval
+        N_daq = 256
+        guard = 600
+        self._write_config_file(N=512, R=1, N_daq=N_daq, N_cal=512)
+        self._write_noise_switch_guard(guard)
+        switch_frame = 5
+        switch_index = self.NS_FIRST_INDEX + switch_frame*N_daq + 100
+        # -> Action <-
+        self._run_noise_switch_test(16, N_daq, switch_frame, switch_index)
+        # -> Assert <-
+        self.assertFalse(self.check_noise_switch(join(unit_test_path,'rebuffer_test_0.dat'),
+                                                 16, N_daq, 512, guard, switch_frame, switch_index))
 
     #############################################
     #              TEST RUN WRAPPERS            #  
@@ -292,6 +336,55 @@ class TesterRebufferModule(unittest.TestCase):
 
         rebuffer_module.communicate(gen_out)
         recorder.join()        
+
+    # Stream index of the first generated sample in the noise source switch tests
+    NS_FIRST_INDEX = 4096
+
+    def _gen_index_frames(self, frame_count, N_daq, switch_frame, switch_index, M=4):
+        """
+            Generates data frames whose samples carry their own stream index:
+            I = index & 0xFF, Q = (index >> 8) + 32*m. The frames starting from
+            "switch_frame" report the "switch_index" noise source switch.
+        """
+        iq_header = IQHeader()
+        iq_header.frame_type        = IQHeader.FRAME_TYPE_DATA
+        iq_header.active_ant_chs    = M
+        iq_header.cpi_length        = N_daq
+        iq_header.sample_bit_depth  = 8
+        iq_header.sampling_freq     = 2400000
+        iq_header.sample_index_step = 1
+        frames = bytearray()
+        for b in range(frame_count):
+            first_index = self.NS_FIRST_INDEX + b*N_daq
+            iq_header.daq_block_index    = b
+            iq_header.first_sample_index = first_index
+            iq_header.noise_source_switch_index = switch_index if b >= switch_frame else 0
+            index = np.arange(first_index, first_index+N_daq, dtype=np.uint32)
+            iq_data = np.zeros((M, N_daq*2), dtype=np.uint8)
+            for m in range(M):
+                iq_data[m,0::2] = index & 0xFF
+                iq_data[m,1::2] = (index >> 8) + 32*m
+            frames += iq_header.encode_header()
+            frames += iq_data.tobytes()
+        return bytes(frames)
+
+    def _run_noise_switch_test(self, frame_count, N_daq, switch_frame, switch_index):
+        # Build up and start test chain
+        gen_out = self._gen_index_frames(frame_count, N_daq, switch_frame, switch_index)
+        rebuffer_module = subprocess.Popen([join(daq_core_path,"rebuffer.out"), "0"], # 0-Drop mode disabled
+                                           stdin=subprocess.PIPE,
+                                           stdout=subprocess.DEVNULL,
+                                           stderr=self.fd_log_rebuffer_err)
+        recorder = IQFrameRecorder("decimator_in",
+                                   join(unit_test_path,'rebuffer_test_0.dat'),
+                                   "1")
+        if recorder.in_shmem_iface.init_ok:
+            recorder.start()
+        else:
+            self.assertTrue(0)
+
+        rebuffer_module.communicate(gen_out)
+        recorder.join()
     #############################################
     #         RESULT CHECKER FUNCTIONS          #  
     #############################################
@@ -392,6 +485,55 @@ class TesterRebufferModule(unittest.TestCase):
         logging.info("Ramp test check {:d} frames".format(block_index-1))
         return 0
 
+    def check_noise_switch(self, file_name, frame_count, N_daq, N, guard, switch_frame, switch_index):
+        """
+            Replays the accumulation of the rebuffer: the buffered samples older than
+            switch_index + guard are dropped, and every output frame starts at the
+            oldest buffered sample.
+        """
+        buffered = []
+        expected = []
+        for b in range(frame_count):
+            first_index = self.NS_FIRST_INDEX + b*N_daq
+            buffered += range(first_index, first_index+N_daq)
+            if b >= switch_frame:
+                buffered = [index for index in buffered if index >= switch_index + guard]
+            if len(buffered) >= N:
+                expected.append(buffered[:N])
+                buffered = buffered[N:]
+
+        iq_header = IQHeader()
+        received = []
+        with open(file_name, "rb") as file_descr:
+            while True:
+                iq_header_bytes = file_descr.read(1024)
+                if len(iq_header_bytes) == 0: break
+                iq_header.decode_header(iq_header_bytes)
+                iq_data_bytes = file_descr.read(iq_header.cpi_length*iq_header.active_ant_chs*2)
+                iq_data = np.frombuffer(iq_data_bytes, dtype=np.uint8).reshape(iq_header.active_ant_chs, iq_header.cpi_length*2)
+                index = iq_data[0,0::2].astype(np.uint64) + (iq_data[0,1::2].astype(np.uint64) << 8)
+                for m in range(1, iq_header.active_ant_chs):
+                    if (iq_data[m,0::2] != iq_data[0,0::2]).any() or (iq_data[m,1::2] != iq_data[0,1::2]+32*m).any():
+                        logging.error("Channel {:d} is not aligned to the reference channel".format(m))
+                        return -1
+                if iq_header.first_sample_index != index[0]:
+                    logging.error("First sample index mismatch [Header/Payload]: {:d}/{:d}"\
+                        .format(iq_header.first_sample_index, int(index[0])))
+                    return -2
+                if ((switch_index <= index) & (index < switch_index + guard)).any():
+                    logging.error("Samples inside the guard interval have been forwarded")
+                    return -3
+                received.append(list(index))
+
+        if received != expected:
+            logging.error("Forwarded samples mismatch, expected frames: {:d}, received frames: {:d}"\
+                .format(len(expected), len(received)))
+            for frame_exp, frame_rec in zip(expected, received):
+                logging.error("First index [Expected/Received]: {:d}/{:d}".format(frame_exp[0], int(frame_rec[0])))
+            return -4
+        logging.info("Noise switch test check {:d} frames".format(len(received)))
+        return 0
+
     #############################################
     #            AUXILIARY FUNCTIONS            #  
     #############################################
@@ -424,6 +566,27 @@ class TesterRebufferModule(unittest.TestCase):
         parser['pre_processing']['decimation_ratio'] = str(R)       
         parser['daq']['daq_buffer_size'] = str(N_daq)
         parser['calibration']['corr_size'] = str(N_cal)
+        with open(config_filename, 'w') as configfile:
+            parser.write(configfile)
+        return 0
+
+    def _read_noise_switch_guard(self):
+        parser = ConfigParser()
+        parser.read([config_filename])
+        return parser.get('calibration', 'noise_switch_guard', fallback=None)
+
+    def _write_noise_switch_guard(self, guard):
+        """
+            Sets the noise source switch guard, None removes the parameter (module default)
+        """
+        parser = ConfigParser()
+        found = parser.read([config_filename])
+        if not found:
+            return -1
+        if guard is None:
+            parser.remove_option('calibration', 'noise_switch_guard')
+        else:
+            parser['calibration']['noise_switch_guard'] = str(guard)
         with open(config_filename, 'w') as configfile:
             parser.write(configfile)
         return 0
\ No newline at end of file
@@ -0,0 +1,201 @@
+"""
+	Description :
+	Unit test for the emulated librtlsdr (virtual RTL-SDR dongles)
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import os
+import time
+import ctypes
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+
+FS = 2400000
+CALLBACK = ctypes.CFUNCTYPE(None, ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint32, ctypes.c_void_p)
+EMU_ENV = ["HDAQ_EMU_DEVICES", "HDAQ_EMU_DELAYS", "HDAQ_EMU_PHASES", "HDAQ_EMU_DRIFTS", "HDAQ_EMU_SIGNAL",
+           "HDAQ_EMU_RATE"]
+
+lib = ctypes.CDLL(join(daq_core_path, "emu", "librtlsdr.so.0"))
+for name in ["rtlsdr_close", "rtlsdr_cancel_async", "rtlsdr_get_tuner_gain"]:
+    getattr(lib, name).argtypes = [ctypes.c_void_p]
+lib.rtlsdr_set_sample_freq_correction_f.argtypes = [ctypes.c_void_p, ctypes.c_float]
+lib.rtlsdr_set_center_freq.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+lib.rtlsdr_set_tuner_gain.argtypes = [ctypes.c_void_p, ctypes.c_int]
+lib.rtlsdr_set_tuner_gain_mode.argtypes = [ctypes.c_void_p, ctypes.c_int]
+lib.rtlsdr_set_sample_rate.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+lib.rtlsdr_get_sample_rate.argtypes = [ctypes.c_void_p]
+lib.rtlsdr_get_sample_rate.restype = ctypes.c_uint32
+lib.rtlsdr_set_bias_tee_gpio.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+lib.rtlsdr_read_sync.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(ctypes.c_int)]
+lib.rtlsdr_read_async.argtypes = [ctypes.c_void_p, CALLBACK, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32]
+
+def open_device(index, gain=496):
+    dev = ctypes.c_void_p()
+    assert lib.rtlsdr_open(ctypes.byref(dev), index) == 0
+    lib.rtlsdr_set_tuner_gain_mode(dev, 1)
+    lib.rtlsdr_set_tuner_gain(dev, gain)
+    lib.rtlsdr_set_center_freq(dev, 700000000)
+    lib.rtlsdr_set_sample_rate(dev, FS)
+    return dev
+
+def read(dev, n):
+    """
+        Reads n complex samples
+    """
+    buf = np.empty(2*n, dtype=np.uint8)
+    n_read = ctypes.c_int()
+    assert lib.rtlsdr_read_sync(dev, buf.ctypes.data, 2*n, ctypes.byref(n_read)) == 0
+    assert n_read.value == 2*n
+    return ((buf.astype(np.float32)-127.5)/127.5).view(np.complex64)
+
+def delay_and_phase(x, ref):
+    """
+        Delay [sample] and phase [deg] of x relative to ref
+    """
+    xcorr = np.fft.ifft(np.fft.fft(x)*np.conj(np.fft.fft(ref)))
+    lag = int(np.argmax(np.abs(xcorr)))
+    if lag > len(x)//2:
+        lag -= len(x)
+    return lag, np.rad2deg(np.angle(xcorr[lag]))
+
+class TesterRtlsdrEmu(unittest.TestCase):
+
+    def setUp(self):
+        os.environ["HDAQ_EMU_RATE"] = "0"
+        self.devs = []
+
+    def tearDown(self):
+        for dev in self.devs:
+            lib.rtlsdr_close(dev)
+        for name in EMU_ENV:
+            os.environ.pop(name, None)
+
+    def _open(self, ch_no, gain=496):
+        self.devs = [open_device(i, gain) for i in range(ch_no)]
+        return self.devs
+
+    def _noise_source(self, state):
+        dev = ctypes.c_void_p()
+        lib.rtlsdr_open(ctypes.byref(dev), 0)
+        lib.rtlsdr_set_bias_tee_gpio(dev, 0, state)
+        lib.rtlsdr_close(dev)
+
+    def test_enumeration(self):
+        os.environ["HDAQ_EMU_DEVICES"] = "32"
+        self.assertEqual(lib.rtlsdr_get_device_count(), 32)
+        self.assertEqual(lib.rtlsdr_get_index_by_serial(b"1000"), 0)
+        self.assertEqual(lib.rtlsdr_get_index_by_serial(b"1031"), 31)
+        self.assertEqual(lib.rtlsdr_get_index_by_serial(b"1032"), -3)
+        serial = ctypes.create_string_buffer(256)
+        self.assertEqual(lib.rtlsdr_get_device_usb_strings(7, None, None, serial), 0)
+        self.assertEqual(serial.value, b"1007")
+        dev = ctypes.c_void_p()
+        self.assertNotEqual(lib.rtlsdr_open(ctypes.byref(dev), 32), 0)
+
+    def test_tuner_settings(self):
+        dev, = self._open(1)
+        self.assertEqual(lib.rtlsdr_get_sample_rate(dev), FS)
+        self.assertNotEqual(lib.rtlsdr_set_sample_rate(dev, 500000), 0)
+        self.assertEqual(lib.rtlsdr_get_sample_rate(dev), FS)
+        lib.rtlsdr_set_tuner_gain(dev, 100)
+        self.assertEqual(lib.rtlsdr_get_tuner_gain(dev), 87) # Closest R820T gain step
+
+    def test_delay_and_phase(self):
+        """
+            The channels see the noise source with their configured delay and phase
+        """
+        os.environ["HDAQ_EMU_DELAYS"] = "0,10,0,-30"
+        os.environ["HDAQ_EMU_PHASES"] = "0,30,-60,90"
+        devs = self._open(4)
+        self._noise_source(1)
+        samples = [read(dev, 2**16) for dev in devs]
+        self._noise_source(0)
+        for m, (delay, phase) in enumerate([(0, 0), (10, 30), (0, -60), (-30, 90)]):
+            lag, phase_diff = delay_and_phase(samples[m], samples[0])
+            self.assertEqual(lag, delay)
+            self.assertAlmostEqual(phase_diff, phase, delta=2)
+
+        # Without the noise source the channels are uncorrelated
+        samples = [read(dev, 2**16) for dev in devs]
+        rho = np.abs(np.vdot(samples[1], samples[0]))/np.linalg.norm(samples[0])/np.linalg.norm(samples[1])
+        self.assertLess(rho, 0.05)
+
+    def test_drift_correction(self):
+        """
+            The clock offset slips the samples, the sampling frequency
+            correction stops the drift
+        """
+        os.environ["HDAQ_EMU_DRIFTS"] = "0,100"
+        devs = self._open(2)
+        self._noise_source(1)
+        for _ in range(10): # 10^5 samples, 10 samples of slip
+            [read(dev, 10000) for dev in devs]
+        lag, _ = delay_and_phase(read(devs[1], 2**14), read(devs[0], 2**14))
+        self.assertEqual(lag, 10)
+
+        lib.rtlsdr_set_sample_freq_correction_f(devs[1], 100)
+        for _ in range(10):
+            [read(dev, 10000) for dev in devs]
+        lag, _ = delay_and_phase(read(devs[1], 2**14), read(devs[0], 2**14))
+        self._noise_source(0)
+        self.assertEqual(lag, 11) # 116384 samples were read before the correction
+
+    def test_tuning(self):
+        """
+            The CW tone stays on its RF frequency when the tuner is retuned
+        """
+        os.environ["HDAQ_EMU_SIGNAL"] = "700100000,-10"
+        dev, = self._open(1)
+        for center_freq, offset in [(700000000, 100000), (700300000, -200000)]:
+            lib.rtlsdr_set_center_freq(dev, center_freq)
+            read(dev, 2**14) # Settling
+            spectrum = np.abs(np.fft.fftshift(np.fft.fft(read(dev, 2**14))))
+            freq = np.fft.fftshift(np.fft.fftfreq(2**14, 1/FS))[np.argmax(spectrum)]
+            self.assertAlmostEqual(freq, offset, delta=FS/2**14)
+
+    def test_async_rate(self):
+        """
+            The asynchronous read delivers the blocks at the sample rate
+        """
+        os.environ["HDAQ_EMU_RATE"] = "1"
+        dev, = self._open(1)
+        block_size = 2*2**15
+        blocks = []
+        def callback(buf, length, ctx):
+            blocks.append(length)
+            if len(blocks) == 20:
+                lib.rtlsdr_cancel_async(dev)
+        cb = CALLBACK(callback)
+        t_start = time.monotonic()
+        self.assertEqual(lib.rtlsdr_read_async(dev, cb, None, 4, block_size), 0)
+        elapsed = time.monotonic() - t_start
+        self.assertEqual(blocks, [block_size]*20)
+        expected = 20*block_size/2/FS
+        self.assertGreater(elapsed, expected*0.95)
+        self.assertLess(elapsed, expected*1.5)
+
+if __name__ == '__main__':
+    unittest.main()
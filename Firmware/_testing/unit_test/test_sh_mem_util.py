@@ -0,0 +1,134 @@
+"""
+	Description :
+	Unit test for the shared memory links, re-attachment of a restarted consumer
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath, exists
+import sys
+import os
+import subprocess
+import time
+import numpy as np
+from configparser import ConfigParser
+
+current_path      = dirname(realpath(__file__))
+root_path         = dirname(dirname(current_path))
+daq_core_path     = join(root_path, "_daq_core")
+data_control_path = join(root_path, "_data_control")
+unit_test_path    = join(root_path, "_testing", "unit_test")
+
+config_filename = join(root_path, 'daq_chain_config.ini')
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from iq_header import IQHeader
+
+M         = 4
+N_DAQ     = 1024
+FRAME_CNT = 120
+
+def _frame(daq_block_index):
+    iq_header = IQHeader()
+    iq_header.frame_type       = IQHeader.FRAME_TYPE_DATA
+    iq_header.active_ant_chs   = M
+    iq_header.cpi_length       = N_DAQ
+    iq_header.sample_bit_depth = 8
+    iq_header.sampling_freq    = 2400000
+    iq_header.daq_block_index  = daq_block_index
+    return iq_header.encode_header() + np.full(M*N_DAQ*2, daq_block_index % 256, dtype=np.uint8).tobytes()
+
+class TesterShmemLink(unittest.TestCase):
+    """
+        The rebuffer is the producer of the decimator_in link, the consumer is the frame recorder
+    """
+    def setUp(self):
+        # Small frames, one output frame per input frame
+        with open(config_filename) as config_file:
+            self.config_text = config_file.read()
+        parser = ConfigParser()
+        parser.read_string(self.config_text)
+        parser['pre_processing']['cpi_size'] = str(N_DAQ)
+        parser['pre_processing']['decimation_ratio'] = str(1)
+        parser['daq']['daq_buffer_size'] = str(N_DAQ)
+        with open(config_filename, 'w') as config_file:
+            parser.write(config_file)
+
+        for fifo in ["fw_decimator_in", "bw_decimator_in"]:
+            if exists(join(data_control_path, fifo)):
+                os.remove(join(data_control_path, fifo))
+            os.mkfifo(join(data_control_path, fifo))
+        self.out_files = [join(unit_test_path, "reattach_test_{:d}.dat".format(k)) for k in range(2)]
+
+    def tearDown(self):
+        with open(config_filename, 'w') as config_file:
+            config_file.write(self.config_text)
+        for fname in [join(data_control_path, "fw_decimator_in"), join(data_control_path, "bw_decimator_in")] + self.out_files:
+            if exists(fname):
+                os.remove(fname)
+
+    def _start_consumer(self, k):
+        return subprocess.Popen(["python3", join(unit_test_path, "capture_shmem_stream.py"), "decimator_in", self.out_files[k], "1"],
+                                cwd=root_path, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    def _read_indexes(self, fname):
+        iq_header = IQHeader()
+        indexes = []
+        with open(fname, "rb") as file_descr:
+            while True:
+                iq_header_bytes = file_descr.read(1024)
+                if len(iq_header_bytes) < 1024: break
+                iq_header.decode_header(iq_header_bytes)
+                if len(file_descr.read(iq_header.cpi_length*iq_header.active_ant_chs*2)) == 0: break
+                indexes.append(iq_header.daq_block_index)
+        return indexes
+
+    def test_consumer_restart(self):
+        rebuffer = subprocess.Popen([join(daq_core_path, "rebuffer.out"), "0"], cwd=root_path,
+                                    stdin=subprocess.PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        consumer = self._start_consumer(0)
+        for b in range(FRAME_CNT):
+            if b == 40: # Consumer crash, the producer keeps running
+                consumer.kill()
+                consumer.wait()
+            elif b == 60:
+                consumer = self._start_consumer(1)
+            rebuffer.stdin.write(_frame(b))
+            rebuffer.stdin.flush()
+            time.sleep(0.02)
+        rebuffer.stdin.close()
+        rebuffer.wait(timeout=30)
+        consumer.wait(timeout=30)
+
+        # The killed consumer may have lost its last buffered frames
+        first = self._read_indexes(self.out_files[0])
+        second = self._read_indexes(self.out_files[1])
+        self.assertGreater(len(first), 0)
+        self.assertLess(max(first), 40)
+        # The restarted consumer gets every frame from the re-attachment to the end of the stream
+        self.assertGreater(len(second), 0)
+        self.assertGreaterEqual(second[0], 60)
+        self.assertEqual(second, list(range(second[0], FRAME_CNT)))
+        self.assertEqual(rebuffer.returncode, 0)
+
+if __name__ == '__main__':
+    unittest.main()
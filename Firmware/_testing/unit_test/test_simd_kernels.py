@@ -0,0 +1,140 @@
+"""
+	Description :
+	Unit test for the SIMD kernel variants, runs the equivalence check of hdaq_simd_check.out
+	and checks the Python binding of the kernels against numpy references
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import os
+import subprocess
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+checker       = join(daq_core_path, "hdaq_simd_check.out")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+import hdaq_kernels
+
+class TesterSimdKernels(unittest.TestCase):
+
+    def _run_checker(self, env=None):
+        return subprocess.run([checker], capture_output=True, text=True, env=env)
+
+    def test_variants_match_reference(self):
+        """
+            Every variant supported by the host must reproduce the scalar reference
+        """
+        ret = self._run_checker()
+        self.assertEqual(ret.returncode, 0, ret.stderr)
+        self.assertNotIn("FAILED", ret.stdout)
+
+    def test_forced_variant(self):
+        env = dict(os.environ, HDAQ_SIMD="scalar")
+        ret = self._run_checker(env)
+        self.assertEqual(ret.returncode, 0, ret.stderr)
+        self.assertIn("Default SIMD kernel variant: scalar", ret.stdout)
+
+class TesterKernelBinding(unittest.TestCase):
+
+    def setUp(self):
+        self.rng = np.random.default_rng(0)
+
+    def _cnoise(self, *shape):
+        return (self.rng.standard_normal(shape)+1j*self.rng.standard_normal(shape)).astype(np.complex64)
+
+    def test_cu8_conversion(self):
+        raw = self.rng.integers(0, 256, (4, 2*1000), dtype=np.uint8)
+        iq = hdaq_kernels.cu8_to_cf32(raw)
+        # Same single precision operations as the kernel: (x-127.5)*(1/127.5)
+        raw_f = (raw.astype(np.float32)-np.float32(127.5))*(np.float32(1)/np.float32(127.5))
+        ref = raw_f.view(np.complex64)
+        self.assertEqual(iq.shape, (4, 1000))
+        np.testing.assert_array_equal(iq, ref)
+        self.assertEqual(hdaq_kernels.u8_max(raw), raw.max())
+
+    def test_reductions(self):
+        x = self._cnoise(4096)
+        y = self._cnoise(4096)
+        self.assertAlmostEqual(hdaq_kernels.power(x), np.sum(np.abs(x)**2), delta=1e-3)
+        self.assertAlmostEqual(hdaq_kernels.mean(x), np.mean(x), delta=1e-6)
+        self.assertAlmostEqual(hdaq_kernels.dotc(x, y), np.vdot(y, x), delta=1e-3)
+
+    def test_correct_iq_in_place(self):
+        """
+            The output of the delay synchronizer is written directly into the
+            output buffer, the binding must not copy
+        """
+        x = self._cnoise(4, 1024) + np.complex64(0.3-0.1j)
+        corrections = np.exp(1j*np.arange(4)).astype(np.complex64)
+        ref = (x-np.mean(x, axis=1, keepdims=True))*corrections[:, None]
+        out = np.zeros_like(x)
+        ret = hdaq_kernels.correct_iq(x, out, corrections)
+        self.assertIs(ret, out)
+        np.testing.assert_allclose(out, ref, atol=1e-5)
+        hdaq_kernels.correct_iq(x, x, corrections)
+        np.testing.assert_allclose(x, ref, atol=1e-5)
+
+    def test_xcorr(self):
+        x = self._cnoise(512)
+        y = np.roll(x, 5)
+        corr = hdaq_kernels.xcorr(y, x, 8)
+        ref = np.correlate(y, x, mode="full")[511-8:511+9]
+        np.testing.assert_allclose(corr, ref, atol=1e-3)
+        self.assertEqual(np.argmax(np.abs(corr))-8, 5)
+
+    def test_covariance(self):
+        x = self._cnoise(5, 2048)
+        R = hdaq_kernels.covariance(x)
+        np.testing.assert_allclose(R, x @ x.conj().T / 2048, atol=1e-5)
+        np.testing.assert_array_equal(R, R.conj().T)
+
+    def test_fir_decimator(self):
+        """
+            Frame by frame processing must give the same output as filtering the
+            whole stream at once, the decimator keeps the last sample of each
+            decimation period
+        """
+        coeffs = np.hanning(33).astype(np.float32)
+        coeffs /= np.sum(coeffs)
+        dec = 4
+        x = self._cnoise(2, 4*1024)
+        decimator = hdaq_kernels.FIRDecimator(coeffs, dec, 2)
+        out = np.concatenate([decimator.process(np.ascontiguousarray(x[:, f*1024:(f+1)*1024])) for f in range(4)], axis=1)
+        ref = np.array([np.convolve(x[m, :], coeffs)[dec-1:x.shape[1]:dec] for m in range(2)])
+        np.testing.assert_allclose(out, ref, atol=1e-5)
+
+    def test_rejects_copies(self):
+        x = self._cnoise(4, 1024)
+        with self.assertRaises(ValueError):
+            hdaq_kernels.power(x.astype(np.complex128))
+        with self.assertRaises(ValueError):
+            hdaq_kernels.covariance(x[:, ::2])
+        with self.assertRaises(ValueError):
+            hdaq_kernels.scale(x, 1, out=np.zeros((4, 512), dtype=np.complex64))
+
+if __name__ == '__main__':
+    unittest.main()
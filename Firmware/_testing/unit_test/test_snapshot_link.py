@@ -0,0 +1,122 @@
+"""
+	Description :
+	Unit test for the latest frame snapshot link (sequence lock protected shared memory slot)
+
+	Project : HeIMDALL DAQ Firmware
+	License : GNU GPL V3
+	Author  : Tamas Peto
+
+	Copyright (C) 2018-2022  Tamás Pető
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""
+import unittest
+from os.path import join, dirname, realpath
+import sys
+import os
+import time
+import multiprocessing
+from multiprocessing import shared_memory
+import numpy as np
+
+current_path  = dirname(realpath(__file__))
+root_path     = dirname(dirname(current_path))
+daq_core_path = join(root_path, "_daq_core")
+
+# Import HeIMDALL modules
+sys.path.insert(0, daq_core_path)
+from shmemIface import outSnapshotIface, inSnapshotIface
+
+SLOT_SIZE = 2**20
+
+def _fill(cntr):
+    """
+        Every byte of a frame carries the frame counter, the length varies from frame to frame
+    """
+    return np.full(SLOT_SIZE//2 + (cntr*4099) % (SLOT_SIZE//2), cntr % 251, dtype=np.uint8)
+
+def _writer(name, duration):
+    writer = outSnapshotIface(name, SLOT_SIZE)
+    cntr = 0
+    t_end = time.time()+duration
+    while time.time() < t_end:
+        cntr += 1
+        writer.publish(_fill(cntr))
+    writer.destory_sm_buffer()
+
+class TesterSnapshotLink(unittest.TestCase):
+
+    def setUp(self):
+        self.name = "hdaq_test_snapshot_{:d}".format(os.getpid())
+
+    def tearDown(self):
+        try:
+            memory = shared_memory.SharedMemory(name=self.name+'_L')
+            memory.close()
+            memory.unlink()
+        except FileNotFoundError:
+            pass
+
+    def test_latest_frame(self):
+        writer = outSnapshotIface(self.name, SLOT_SIZE)
+        self.assertTrue(writer.init_ok)
+        reader = inSnapshotIface(self.name)
+        self.assertTrue(reader.init_ok)
+        self.assertIsNone(reader.read()) # Nothing published yet
+
+        header = np.arange(1024, dtype=np.uint32).astype(np.uint8)
+        payload = np.arange(100, dtype=np.complex64).reshape(4, 25)
+        for _ in range(3):
+            self.assertTrue(writer.publish(header, payload))
+        cntr, frame = reader.read()
+        self.assertEqual(cntr, 3)
+        self.assertEqual(frame.size, 1024+payload.nbytes)
+        np.testing.assert_array_equal(frame[:1024], header)
+        np.testing.assert_array_equal(frame[1024:].view(np.complex64).reshape(4, 25), payload)
+
+        self.assertFalse(writer.publish(np.zeros(SLOT_SIZE+1, dtype=np.uint8)))
+        self.assertEqual(reader.read()[0], 3)
+        reader.destory_sm_buffer()
+        writer.destory_sm_buffer()
+
+    def test_missing_link(self):
+        self.assertFalse(inSnapshotIface(self.name).init_ok)
+
+    def test_concurrent_reads_are_consistent(self):
+        """
+            The reader must never see a partially overwritten frame, while the
+            writer publishes continuously in an other process
+        """
+        outSnapshotIface(self.name, SLOT_SIZE).destory_sm_buffer()
+        reader = inSnapshotIface(self.name)
+        writer = multiprocessing.Process(target=_writer, args=(self.name, 2))
+        writer.start()
+        reads = 0
+        last_cntr = 0
+        while writer.is_alive():
+            snapshot = reader.read()
+            if snapshot is None:
+                continue
+            cntr, frame = snapshot
+            np.testing.assert_array_equal(frame, _fill(cntr))
+            self.assertGreaterEqual(cntr, last_cntr)
+            last_cntr = cntr
+            reads += 1
+        writer.join()
+        reader.destory_sm_buffer()
+        self.assertGreater(reads, 10)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -7,20 +7,21 @@
 #   Authors: Tamas Peto, Carl Laufer
 
 # Check config file
-#res=$(python3 ini_checker.py 2>&1) #comment out ini checker for now since it is very slow
-echo -e "\e[33mConfig file check bypassed [ WARNING ]\e[39m"
-#if test -z "$res" 
-#then
-#      echo -e "\e[92mConfig file check [ OK ]\e[39m"
-#else
-#      echo -e "\e[91mConfig file check [ FAIL ]\e[39m"
-#      echo $res
-#      exit
-#fi
+res=$(./_daq_core/daq_config_check.out daq_chain_config.ini 2>&1)
+if test -z "$res" 
+then
+      echo -e "\e[92mConfig file check [ OK ]\e[39m"
+else
+      echo -e "\e[91mConfig file check [ FAIL ]\e[39m"
+      echo "$res"
+      exit
+fi
 
 sudo sysctl -w kernel.sched_rt_runtime_us=-1
 
 # Read config ini file
+# Active stages of the processing graph, the bypassed stages are not started
+graph_stages=" $(./_daq_core/daq_config_check.out -g daq_chain_config.ini) "
 out_data_iface_type=$(awk -F'=' '/out_data_iface_type/ {gsub (" ", "", $0); print $2}' daq_chain_config.ini)
 
 # (re) create control FIFOs
@@ -39,8 +40,10 @@ rm _data_control/bw_delay_sync_hwc 2> /dev/null
 mkfifo _data_control/fw_decimator_in
 mkfifo _data_control/bw_decimator_in
 
-mkfifo _data_control/fw_decimator_out
-mkfifo _data_control/bw_decimator_out
+if [[ $graph_stages == *" decimator "* ]]; then
+    mkfifo _data_control/fw_decimator_out
+    mkfifo _data_control/bw_decimator_out
+fi
 
 mkfifo _data_control/fw_delay_sync_iq
 mkfifo _data_control/bw_delay_sync_iq
@@ -90,12 +93,14 @@ while true; do
 done
 
 # Generating FIR filter coefficients
-python3 fir_filter_designer.py
-out=$?
-if test $out -ne 0
-    then
-        echo -e "\e[91mDAQ chain not started!\e[39m"
-        exit
+if [[ $graph_stages == *" decimator "* ]]; then
+    python3 fir_filter_designer.py
+    out=$?
+    if test $out -ne 0
+        then
+            echo -e "\e[91mDAQ chain not started!\e[39m"
+            exit
+    fi
 fi
 
 # Start main program chain -Thread 0 Normal (non squelch mode)
@@ -104,7 +109,11 @@ chrt -f 99 _daq_core/rtl_daq.out 2> _logs/rtl_daq.log | \
 chrt -f 99 _daq_core/rebuffer.out 0 2> _logs/rebuffer.log &
 
 # Decimator - Thread 1
-chrt -f 99 _daq_core/decimate.out 2> _logs/decimator.log &
+if [[ $graph_stages == *" decimator "* ]]; then
+    chrt -f 99 _daq_core/decimate.out 2> _logs/decimator.log &
+else
+    echo "Decimator bypassed"
+fi
 
 # Delay synchronizer - Thread 2
 chrt -f 99 python3 _daq_core/delay_sync.py 2> _logs/delay_sync.log &
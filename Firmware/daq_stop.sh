@@ -3,6 +3,7 @@ echo "Shut down DAQ chain .."
 #sudo kill -64 $(ps aux | grep 'rtl' | awk '{print $2}')
 #sudo killall -s 9 rtl*
 
+sudo pkill -64 daq_launcher # Stop the supervisor first, so that it does not restart the stages
 sudo pkill -64 rtl_daq.out
 sudo kill -64 $(ps ax | grep "[p]ython3 _testing/test_data_synthesizer.py" | awk '{print $1}') 2> /dev/null
 sudo pkill -64 sync.out
@@ -7,17 +7,19 @@
 #   Authors: Tamas Peto, Carl Laufer
 
 # Check config file
-res=$(python3 ini_checker.py no_hw 2>&1)
+res=$(./_daq_core/daq_config_check.out daq_chain_config.ini 2>&1)
 if test -z "$res" 
 then
       echo -e "\e[92mConfig file check [OK]\e[39m"
 else
       echo -e "\e[91mConfig file check [FAIL]\e[39m"
-      echo $res
+      echo "$res"
       exit
 fi
 
 # Read config ini file
+# Active stages of the processing graph, the bypassed stages are not started
+graph_stages=" $(./_daq_core/daq_config_check.out -g daq_chain_config.ini) "
 out_data_iface_type=$(awk -F "=" '/out_data_iface_type/ {print $2}' daq_chain_config.ini)
 
 # (re) create control FIFOs
@@ -36,8 +38,10 @@ rm _data_control/bw_delay_sync_hwc 2> /dev/null
 mkfifo _data_control/fw_decimator_in
 mkfifo _data_control/bw_decimator_in
 
-mkfifo _data_control/fw_decimator_out
-mkfifo _data_control/bw_decimator_out
+if [[ $graph_stages == *" decimator "* ]]; then
+    mkfifo _data_control/fw_decimator_out
+    mkfifo _data_control/bw_decimator_out
+fi
 
 mkfifo _data_control/fw_delay_sync_iq
 mkfifo _data_control/bw_delay_sync_iq
@@ -55,12 +59,14 @@ rm _logs/*.log 2> /dev/null
 #sudo cpufreq-set -d 1.8GHz
 
 # Generating FIR filter coefficients
-python3 fir_filter_designer.py
-out=$?
-if test $out -ne 0
-    then
-        echo -e "\e[91mDAQ chain not started!\e[39m"
-        exit
+if [[ $graph_stages == *" decimator "* ]]; then
+    python3 fir_filter_designer.py
+    out=$?
+    if test $out -ne 0
+        then
+            echo -e "\e[91mDAQ chain not started!\e[39m"
+            exit
+    fi
 fi
 # Start main program chain -Thread 0 Normal (non squelch mode)
 echo "Starting DAQ Subsystem with synthetic data source"
@@ -68,7 +74,11 @@ python3 _testing/test_data_synthesizer.py 2>_logs/synthetic.log | \
 _daq_core/rebuffer.out 0 2> _logs/rebuffer.log &
 
 # Decimator - Thread 1
-chrt -f 99 _daq_core/decimate.out 2> _logs/decimator.log &
+if [[ $graph_stages == *" decimator "* ]]; then
+    chrt -f 99 _daq_core/decimate.out 2> _logs/decimator.log &
+else
+    echo "Decimator bypassed"
+fi
 
 # Delay synchronizer - Thread 2
 python3 _daq_core/delay_sync.py 2> _logs/delay_sync.log &
@@ -280,10 +280,10 @@ def check_ini(parameters, en_hw_check=True):
             error_list.append("Track lock interventation enable field must be 0 or 1. Currently it is: '{0}' ".format(cal_params['require_track_lock_intervention']))
 
     if not chk_int(cal_params['cal_track_mode']):
-        error_list.append("Calibration track mode should be one of the followings: 0/1/2. Currently it is: '{0}' ".format(cal_params['cal_track_mode']))
+        error_list.append("Calibration track mode should be one of the followings: 0/1/2/3. Currently it is: '{0}' ".format(cal_params['cal_track_mode']))
     else:
-        if not int(cal_params['cal_track_mode']) in [0,1,2]:
-            error_list.append("Calibration track mode should be one of the followings: 0/1/2. Currently it is: '{0}' ".format(cal_params['cal_track_mode']))
+        if not int(cal_params['cal_track_mode']) in [0,1,2,3]:
+            error_list.append("Calibration track mode should be one of the followings: 0/1/2/3. Currently it is: '{0}' ".format(cal_params['cal_track_mode']))
 
     if not chk_int(cal_params['cal_frame_interval']):
         error_list.append("Calibration frame interval must be a positive integer. Currently it is: '{0}' ".format(cal_params['cal_frame_interval']))
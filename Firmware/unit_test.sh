@@ -5,6 +5,27 @@ echo "Internal warnings are ignored"
 rm _testing/test_logs/*.log 2> /dev/NULL
 rm _testing/test_logs/*.html 2> /dev/NULL
 
+# Start unit test for the configuration loader
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_daq_config.py
+
+# Start unit test for the IQ header definitions
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_iq_header.py
+
+# Start unit test for the SIMD kernel variants
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_simd_kernels.py
+
+# Start unit test for the snapshot link
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_snapshot_link.py
+
+# Start unit test for the emulated librtlsdr
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_rtlsdr_emu.py
+
+# Start unit test for the offline batch processor
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_batch_processor.py
+
+# Start unit test for the allocation audit of the processing stages
+sudo python3 -W ignore -m unittest -v _testing/unit_test/test_alloc_audit.py
+
 # Start unit test for the rebuffer module
 #sudo python3 -W ignore -m unittest -v _testing/unit_test/test_rebuffer.py
 